@@ -0,0 +1,75 @@
+#!/usr/bin/env bash
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Library Public License as published by
+# the Free Software Foundation; either version 2, or (at your option)
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Library Public License for more details.
+#
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7147" # git grep '\<7147\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+    CEPH_ARGS+="--osd_op_run_to_completion=true --osd_async_read=true "
+    CEPH_ARGS+="--ms_async_op_threads=1 "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function get_op_inline() {
+    CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.0) perf dump | \
+        jq '.osd.op_inline'
+}
+
+# A read whose object context or onode would have to be loaded from
+# the store is queued; once both are cached the next read runs inline
+function TEST_inline_read_needs_cache() {
+    local dir=$1
+    local poolname=test
+
+    run_mon $dir a --osd_pool_default_size=1 || return 1
+    run_mgr $dir x || return 1
+    run_osd_bluestore $dir 0 || return 1
+    create_pool $poolname 1 1
+    wait_for_clean || return 1
+
+    echo FOO > $dir/FOO
+    rados -p $poolname put obj $dir/FOO || return 1
+
+    # start with empty caches
+    kill_daemons $dir TERM osd.0 || return 1
+    activate_osd $dir 0 || return 1
+    wait_for_clean || return 1
+
+    local before=$(get_op_inline)
+    rados -p $poolname get obj $dir/BAR || return 1
+    diff $dir/FOO $dir/BAR || return 1
+    test "$(get_op_inline)" = "$before" || return 1
+
+    rados -p $poolname get obj $dir/BAR || return 1
+    diff $dir/FOO $dir/BAR || return 1
+    test "$(get_op_inline)" -gt "$before" || return 1
+}
+
+main osd-inline-read "$@"
+
+# Local Variables:
+# compile-command: "cd ../../../build ; make -j4 && \
+#    ../qa/run-standalone.sh osd-inline-read.sh"
+# End:
@@ -106,6 +106,71 @@ function TEST_scrub_test() {
     teardown $dir || return 1
 }
 
+function get_scrub_read_bytes() {
+    local osd=$1
+    CEPH_ARGS='' ceph --admin-daemon $(get_asok_path osd.$osd) perf dump | \
+        jq '.osd.scrub_read_bytes'
+}
+
+# Deep scrub with read-ahead must read every byte exactly once, also
+# when client writes keep the pg busy while it runs
+function TEST_deep_scrub_read_bytes() {
+    local dir=$1
+    local poolname=test
+    local stride=65536
+
+    TESTDATA="testdata.$$"
+
+    setup $dir || return 1
+    run_mon $dir a --osd_pool_default_size=1 || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 --osd_deep_scrub_stride=$stride \
+        --osd_deep_scrub_read_ahead=4 || return 1
+
+    # Create a pool with a single pg
+    create_pool $poolname 1 1
+    wait_for_clean || return 1
+    poolid=$(ceph osd dump | grep "^pool.*[']${poolname}[']" | awk '{ print $2 }')
+    local pgid="${poolid}.0"
+
+    # below one stride, exactly four strides, and with a short last stride
+    local total=0
+    for size in 1032 $(expr 4 \* $stride) 1000000
+    do
+        dd if=/dev/urandom of=$TESTDATA bs=$size count=1
+        for i in $(seq 1 5)
+        do
+            rados -p $poolname put obj${size}.${i} $TESTDATA || return 1
+            total=$(expr $total + $size)
+        done
+    done
+    rm -f $TESTDATA
+
+    local before=$(get_scrub_read_bytes 0)
+    pg_deep_scrub "$pgid" || return 1
+    local after=$(get_scrub_read_bytes 0)
+    test "$(expr $after - $before)" = "$total" || return 1
+
+    # writes to other objects while the scrub runs
+    dd if=/dev/urandom of=$TESTDATA bs=1032 count=1
+    (
+        for i in $(seq 1 200)
+        do
+            rados -p $poolname put new${i} $TESTDATA || exit 1
+        done
+    ) &
+    local writer=$!
+    before=$(get_scrub_read_bytes 0)
+    pg_deep_scrub "$pgid" || return 1
+    after=$(get_scrub_read_bytes 0)
+    wait $writer || return 1
+    rm -f $TESTDATA
+    test "$(expr $after - $before)" -ge "$total" || return 1
+    ceph pg dump pgs | grep ^${pgid} | grep -vq -- +inconsistent || return 1
+
+    teardown $dir || return 1
+}
+
 main osd-scrub-test "$@"
 
 # Local Variables:
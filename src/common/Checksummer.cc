@@ -0,0 +1,258 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <string.h>
+
+#include "include/types.h"
+#include "include/crc32c.h"
+#include "common/Checksummer.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#include "arch/probe.h"
+#include "arch/intel.h"
+#define HAVE_CRC32C_LANES 1
+#endif
+
+namespace {
+
+/// a crc32c block that is contiguous in memory, waiting for a lane
+struct crc_block_t {
+  const unsigned char *data;
+  size_t len;
+  size_t item;     ///< index in the batch
+  size_t pos;      ///< offset in csum'd space
+};
+
+#ifdef HAVE_CRC32C_LANES
+static const unsigned CRC_LANES = 4;
+
+/*
+ * crc32 has a latency of 3 cycles but a throughput of 1 per cycle, so a
+ * single block keeps the unit a third busy.  Hashing several independent
+ * blocks in lock step fills the pipeline without the pclmul recombination
+ * the single-buffer path needs.
+ */
+__attribute__((target("sse4.2")))
+static void crc32c_lanes(const crc_block_t *b, uint32_t *out)
+{
+  const unsigned char *d0 = b[0].data, *d1 = b[1].data;
+  const unsigned char *d2 = b[2].data, *d3 = b[3].data;
+  size_t len = b[0].len;
+  uint64_t c0 = 0xffffffff, c1 = 0xffffffff, c2 = 0xffffffff, c3 = 0xffffffff;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w0, w1, w2, w3;
+    memcpy(&w0, d0 + i, 8);
+    memcpy(&w1, d1 + i, 8);
+    memcpy(&w2, d2 + i, 8);
+    memcpy(&w3, d3 + i, 8);
+    c0 = _mm_crc32_u64(c0, w0);
+    c1 = _mm_crc32_u64(c1, w1);
+    c2 = _mm_crc32_u64(c2, w2);
+    c3 = _mm_crc32_u64(c3, w3);
+  }
+  uint32_t r0 = c0, r1 = c1, r2 = c2, r3 = c3;
+  for (; i < len; ++i) {
+    r0 = _mm_crc32_u8(r0, d0[i]);
+    r1 = _mm_crc32_u8(r1, d1[i]);
+    r2 = _mm_crc32_u8(r2, d2[i]);
+    r3 = _mm_crc32_u8(r3, d3[i]);
+  }
+  out[0] = r0;
+  out[1] = r1;
+  out[2] = r2;
+  out[3] = r3;
+}
+#endif
+
+uint64_t expected_csum(const Checksummer::verify_item_t& it, size_t pos)
+{
+  size_t idx = pos / it.csum_block_size;
+  const char *p = it.csum_data->c_str();
+  switch (it.csum_type) {
+  case Checksummer::CSUM_XXHASH32:
+    return reinterpret_cast<const Checksummer::xxhash32::value_t*>(p)[idx];
+  case Checksummer::CSUM_XXHASH64:
+    return reinterpret_cast<const Checksummer::xxhash64::value_t*>(p)[idx];
+  case Checksummer::CSUM_CRC32C:
+    return reinterpret_cast<const Checksummer::crc32c::value_t*>(p)[idx];
+  case Checksummer::CSUM_CRC32C_16:
+    return reinterpret_cast<const Checksummer::crc32c_16::value_t*>(p)[idx];
+  case Checksummer::CSUM_CRC32C_8:
+    return reinterpret_cast<const Checksummer::crc32c_8::value_t*>(p)[idx];
+  }
+  return 0;
+}
+
+/// reduce a full crc32c to what this item stores
+uint64_t truncate_crc(int csum_type, uint32_t crc)
+{
+  switch (csum_type) {
+  case Checksummer::CSUM_CRC32C_16:
+    return crc & 0xffff;
+  case Checksummer::CSUM_CRC32C_8:
+    return crc & 0xff;
+  }
+  return crc;
+}
+
+/// record a result; blocks may complete out of order, so keep the lowest
+void check(Checksummer::verify_item_t& it, size_t pos, uint64_t v, int *bad)
+{
+  if (expected_csum(it, pos) == v) {
+    return;
+  }
+  if (it.bad_off < 0) {
+    ++*bad;
+  } else if ((size_t)it.bad_off < pos) {
+    return;
+  }
+  it.bad_off = pos;
+  it.bad_csum = v;
+}
+
+class crc_lanes_t {
+  std::vector<Checksummer::verify_item_t>& items;
+  int *bad;
+  crc_block_t pending[4];
+  unsigned num_pending = 0;
+  bool use_lanes;
+
+public:
+  crc_lanes_t(std::vector<Checksummer::verify_item_t>& i, int *b)
+    : items(i), bad(b), use_lanes(Checksummer::have_batch_crc32c()) {}
+
+  void flush() {
+    uint32_t crc[4];
+#ifdef HAVE_CRC32C_LANES
+    if (num_pending == CRC_LANES) {
+      crc32c_lanes(pending, crc);
+    } else
+#endif
+    for (unsigned i = 0; i < num_pending; ++i) {
+      crc[i] = ceph_crc32c(-1, pending[i].data, pending[i].len);
+    }
+    for (unsigned i = 0; i < num_pending; ++i) {
+      auto& it = items[pending[i].item];
+      check(it, pending[i].pos, truncate_crc(it.csum_type, crc[i]), bad);
+    }
+    num_pending = 0;
+  }
+
+  void add(const crc_block_t& b) {
+    if (!use_lanes) {
+      auto& it = items[b.item];
+      check(it, b.pos,
+	    truncate_crc(it.csum_type, ceph_crc32c(-1, b.data, b.len)), bad);
+      return;
+    }
+    if (num_pending && pending[0].len != b.len) {
+      flush();
+    }
+    pending[num_pending++] = b;
+#ifdef HAVE_CRC32C_LANES
+    if (num_pending == CRC_LANES) {
+      flush();
+    }
+#endif
+  }
+};
+
+/// hash a block that spans buffers; data/l is the piece we already have
+uint64_t calc_split(int csum_type, size_t len, const char *data, size_t l,
+		    bufferlist::const_iterator& p)
+{
+  switch (csum_type) {
+  case Checksummer::CSUM_XXHASH32:
+    {
+      XXH32_state_t *s = XXH32_createState();
+      XXH32_reset(s, -1);
+      XXH32_update(s, data, l);
+      for (len -= l; len > 0; len -= l) {
+	l = p.get_ptr_and_advance(len, &data);
+	XXH32_update(s, data, l);
+      }
+      uint64_t v = XXH32_digest(s);
+      XXH32_freeState(s);
+      return v;
+    }
+  case Checksummer::CSUM_XXHASH64:
+    {
+      XXH64_state_t *s = XXH64_createState();
+      XXH64_reset(s, -1);
+      XXH64_update(s, data, l);
+      for (len -= l; len > 0; len -= l) {
+	l = p.get_ptr_and_advance(len, &data);
+	XXH64_update(s, data, l);
+      }
+      uint64_t v = XXH64_digest(s);
+      XXH64_freeState(s);
+      return v;
+    }
+  default:
+    {
+      uint32_t crc = ceph_crc32c(-1, (const unsigned char*)data, l);
+      return truncate_crc(csum_type, p.crc32c(len - l, crc));
+    }
+  }
+}
+
+} // anonymous namespace
+
+bool Checksummer::have_batch_crc32c()
+{
+#ifdef HAVE_CRC32C_LANES
+  if (!ceph_arch_probed) {
+    ceph_arch_probe();
+  }
+  return ceph_arch_intel_sse42;
+#else
+  return false;
+#endif
+}
+
+int Checksummer::verify_batch(std::vector<verify_item_t>& items)
+{
+  int bad = 0;
+  crc_lanes_t lanes(items, &bad);
+  for (size_t i = 0; i < items.size(); ++i) {
+    auto& it = items[i];
+    it.bad_off = -1;
+    it.bad_csum = 0;
+    switch (it.csum_type) {
+    case CSUM_NONE:
+      continue;
+    case CSUM_XXHASH32:
+    case CSUM_XXHASH64:
+    case CSUM_CRC32C:
+    case CSUM_CRC32C_16:
+    case CSUM_CRC32C_8:
+      break;
+    default:
+      return -EOPNOTSUPP;
+    }
+    bool is_crc = it.csum_type >= CSUM_CRC32C;
+    size_t bs = it.csum_block_size;
+    size_t length = it.bl->length();
+    assert(length % bs == 0);
+    assert(it.csum_data->length() >= (it.offset + length) / bs *
+	   get_csum_value_size(it.csum_type));
+    bufferlist::const_iterator p = it.bl->begin();
+    for (size_t pos = it.offset; pos < it.offset + length; pos += bs) {
+      const char *data;
+      size_t l = p.get_ptr_and_advance(bs, &data);
+      if (l < bs) {
+	check(it, pos, calc_split(it.csum_type, bs, data, l, p), &bad);
+      } else if (is_crc) {
+	lanes.add(crc_block_t{(const unsigned char*)data, bs, i, pos});
+      } else if (it.csum_type == CSUM_XXHASH32) {
+	check(it, pos, XXH32(data, bs, -1), &bad);
+      } else {
+	check(it, pos, XXH64(data, bs, -1), &bad);
+      }
+    }
+  }
+  lanes.flush();
+  return bad;
+}
@@ -4,6 +4,8 @@
 #ifndef CEPH_OS_BLUESTORE_CHECKSUMMER
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
+#include <vector>
+
 #include "xxHash/xxhash.h"
 
 class Checksummer {
@@ -265,6 +267,40 @@ public:
     Alg::fini(&state);
     return -1;  // no errors
   }
+
+  /// one region to check as part of a verify_batch()
+  struct verify_item_t {
+    int csum_type = CSUM_NONE;
+    size_t csum_block_size = 0;
+    size_t offset = 0;                   ///< offset of bl in csum'd space
+    const bufferlist *bl = nullptr;      ///< length is a csum_block_size multiple
+    const bufferptr *csum_data = nullptr;
+
+    int bad_off = -1;      ///< [out] offset of first bad block, or -1
+    uint64_t bad_csum = 0; ///< [out] value calculated for that block
+
+    verify_item_t() {}
+    verify_item_t(int t, size_t bs, size_t o, const bufferlist *b,
+		  const bufferptr *c)
+      : csum_type(t), csum_block_size(bs), offset(o), bl(b), csum_data(c) {}
+  };
+
+  /**
+   * verify_batch - check many regions in one pass
+   *
+   * Produces the same bad_off/bad_csum as verify<Alg>() would for each
+   * item, but walks every block of every item up front so that
+   * independent blocks can be hashed together: crc32c blocks of equal
+   * size are fed to the crc unit in interleaved lanes (when the cpu
+   * supports it), and contiguous xxhash blocks skip the streaming state.
+   *
+   * @returns number of items with a bad block, or -EOPNOTSUPP if an item
+   * has an unknown csum_type
+   */
+  static int verify_batch(std::vector<verify_item_t>& items);
+
+  /// true if verify_batch() has a multi-lane crc32c implementation here
+  static bool have_batch_crc32c();
 };
 
 #endif
@@ -19,6 +19,18 @@
 // default to debug_mode off
 bool mempool::debug_mode = false;
 
+static std::mutex& numa_dumpers_lock()
+{
+  static std::mutex lock;
+  return lock;
+}
+
+static std::map<std::string, mempool::numa_dumper_t>& numa_dumpers()
+{
+  static std::map<std::string, mempool::numa_dumper_t> dumpers;
+  return dumpers;
+}
+
 // --------------------------------------------------------------
 
 mempool::pool_t& mempool::get_pool(mempool::pool_index_t ix)
@@ -53,9 +65,33 @@ void mempool::dump(ceph::Formatter *f)
   }
   f->close_section();
   f->dump_object("total", total);
+  {
+    std::lock_guard<std::mutex> l(numa_dumpers_lock());
+    if (!numa_dumpers().empty()) {
+      f->open_object_section("by_numa_node");
+      for (auto& p : numa_dumpers()) {
+	f->open_object_section(p.first.c_str());
+	p.second(f);
+	f->close_section();
+      }
+      f->close_section();
+    }
+  }
   f->close_section();
 }
 
+void mempool::register_numa_dumper(const std::string& name, numa_dumper_t fn)
+{
+  std::lock_guard<std::mutex> l(numa_dumpers_lock());
+  numa_dumpers()[name] = fn;
+}
+
+void mempool::unregister_numa_dumper(const std::string& name)
+{
+  std::lock_guard<std::mutex> l(numa_dumpers_lock());
+  numa_dumpers().erase(name);
+}
+
 void mempool::set_debug_mode(bool d)
 {
   debug_mode = d;
@@ -0,0 +1,107 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "acconfig.h"
+#include "numa.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <fstream>
+
+#include "include/stringify.h"
+
+std::vector<int> get_online_numa_nodes()
+{
+  std::vector<int> ret;
+#ifdef HAVE_SCHED
+  std::ifstream f("/sys/devices/system/node/online");
+  std::string line;
+  if (!f || !std::getline(f, line)) {
+    return ret;
+  }
+  cpu_set_t nodes;
+  size_t size;
+  if (parse_cpu_set_list(line.c_str(), &size, &nodes) < 0) {
+    return ret;
+  }
+  for (int i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET_S(i, size, &nodes)) {
+      ret.push_back(i);
+    }
+  }
+#endif
+  return ret;
+}
+
+int get_numa_node_count()
+{
+  int n = get_online_numa_nodes().size();
+  return n > 0 ? n : 1;
+}
+
+#ifdef HAVE_SCHED
+int parse_cpu_set_list(const char *s, size_t *cpu_set_size,
+		       cpu_set_t *cpu_set)
+{
+  *cpu_set_size = sizeof(*cpu_set);
+  CPU_ZERO_S(*cpu_set_size, cpu_set);
+  while (*s) {
+    char *end;
+    long a = strtol(s, &end, 10);
+    if (end == s || a < 0 || a >= CPU_SETSIZE) {
+      return -EINVAL;
+    }
+    long b = a;
+    s = end;
+    if (*s == '-') {
+      ++s;
+      b = strtol(s, &end, 10);
+      if (end == s || b < a || b >= CPU_SETSIZE) {
+	return -EINVAL;
+      }
+      s = end;
+    }
+    for (long i = a; i <= b; ++i) {
+      CPU_SET_S(i, *cpu_set_size, cpu_set);
+    }
+    if (*s == ',') {
+      ++s;
+    } else if (*s == '\n') {
+      break;
+    } else if (*s) {
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+int get_numa_node_cpu_set(int node, size_t *cpu_set_size,
+			  cpu_set_t *cpu_set)
+{
+  std::ifstream f("/sys/devices/system/node/node" + stringify(node) +
+		  "/cpulist");
+  std::string line;
+  if (!f || !std::getline(f, line)) {
+    return -ENOENT;
+  }
+  return parse_cpu_set_list(line.c_str(), cpu_set_size, cpu_set);
+}
+#endif
+
+int set_current_thread_numa_node(int node)
+{
+#ifdef HAVE_SCHED
+  cpu_set_t cpu_set;
+  size_t size;
+  int r = get_numa_node_cpu_set(node, &size, &cpu_set);
+  if (r < 0) {
+    return r;
+  }
+  if (sched_setaffinity(0, size, &cpu_set) < 0) {
+    return -errno;
+  }
+  return 0;
+#else
+  return -EOPNOTSUPP;
+#endif
+}
@@ -0,0 +1,48 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include "acconfig.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_SCHED
+#include <sched.h>
+#endif
+
+// Minimal NUMA topology helpers built on sysfs and sched_setaffinity, so
+// we do not need to link against libnuma.
+
+/// ids of the online NUMA nodes in ascending order (may be sparse,
+/// e.g. {0, 2}); empty if unknown
+std::vector<int> get_online_numa_nodes();
+
+/// number of online NUMA nodes (1 if unknown)
+int get_numa_node_count();
+
+#ifdef HAVE_SCHED
+/// parse a cpu list like "0-3,8,10-11"
+int parse_cpu_set_list(const char *s, size_t *cpu_set_size,
+		       cpu_set_t *cpu_set);
+
+/// cpus that belong to the given node
+int get_numa_node_cpu_set(int node, size_t *cpu_set_size,
+			  cpu_set_t *cpu_set);
+#endif
+
+/// bind the calling thread to the cpus of the given node
+int set_current_thread_numa_node(int node);
+
+/// spread num_shards shards over the given nodes in contiguous blocks;
+/// returns the node id for shard, or -1 if there is nothing to spread
+inline int get_numa_node_for_shard(unsigned shard, unsigned num_shards,
+				   const std::vector<int>& nodes)
+{
+  if (nodes.size() <= 1 || num_shards == 0) {
+    return -1;
+  }
+  return nodes[(uint64_t)shard * nodes.size() / num_shards];
+}
@@ -2373,6 +2373,22 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_STARTUP)
     .set_description(""),
 
+    Option("osd_numa_shard_affinity", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Bind op shards and their object store cache shards to NUMA nodes")
+    .set_long_description("Op shards are spread over the online NUMA nodes in contiguous blocks, and each op worker thread is bound to the CPUs of its shard's node.  The object store cache shard serving the same placement groups is assigned to the same node, so that onodes and buffers are allocated from and accessed by node-local memory.")
+    .add_see_also("osd_op_num_shards"),
+
+    Option("osd_op_run_to_completion", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Run client reads on the messenger thread that received them")
+    .set_long_description("Each async messenger worker owns a fixed set of op shards.  A plain client read for one of its shards whose placement group has nothing queued, waiting or running is processed by the messenger thread itself instead of being handed to an op shard thread.  Only reads that do not wait for the device (see osd_async_read), of objects whose object context and store metadata are already cached, are run this way; writes and everything else, and ops that cannot run immediately, take the op queue as usual.")
+    .add_see_also("ms_async_op_threads")
+    .add_see_also("osd_async_read")
+    .add_see_also("osd_op_num_shards"),
+
     Option("osd_skip_data_digest", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description(""),
@@ -2856,6 +2872,12 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("osd_async_read", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Let replicated pool reads wait for the device without holding an op thread")
+    .set_long_description("Client reads that miss the object store cache park the op and release the op thread until the data arrives, as erasure coded pools always do.  Only takes effect with an object store that implements asynchronous reads (bluestore)."),
+
     Option("osd_recover_clone_overlap_limit", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_description(""),
@@ -3101,6 +3123,18 @@ std::vector<Option> get_global_options() {
     .set_default(0)
     .set_description("Duration to inject a delay during scrubbing"),
 
+    Option("osd_scrub_client_latency_target", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("Client op latency (seconds) scrub tries not to push the OSD past")
+    .set_long_description("When the recent average latency of client ops on this OSD exceeds this target, the delay between scrub chunks grows in proportion to the overrun, up to osd_scrub_sleep_max.  0 disables the adjustment and scrub always sleeps osd_scrub_sleep.")
+    .add_see_also("osd_scrub_sleep")
+    .add_see_also("osd_scrub_sleep_max"),
+
+    Option("osd_scrub_sleep_max", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(1.0)
+    .set_description("Longest delay between scrub chunks while client ops are over osd_scrub_client_latency_target")
+    .add_see_also("osd_scrub_client_latency_target"),
+
     Option("osd_scrub_auto_repair", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description("Automatically repair damaged objects detected during scrub"),
@@ -3128,6 +3162,12 @@ std::vector<Option> get_global_options() {
     .set_default(512_K)
     .set_description("Number of bytes to read from an object at a time during deep scrub"),
 
+    Option("osd_deep_scrub_read_ahead", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_description("Number of osd_deep_scrub_stride reads deep scrub keeps in flight per object")
+    .set_long_description("Deep scrub queues the strides after the one it is hashing so that the device reads them while the digest is computed.  1 reads one stride at a time.")
+    .add_see_also("osd_deep_scrub_stride"),
+
     Option("osd_deep_scrub_keys", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(1024)
     .set_description("Number of keys to read from an object at a time during deep scrub"),
@@ -3379,6 +3419,13 @@ std::vector<Option> get_global_options() {
     .set_default(64)
     .set_description(""),
 
+    Option("osd_object_info_cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8192)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Number of decoded object infos (and snapsets) cached per OSD")
+    .set_long_description("Objects that fall out of a PG's object context cache keep their decoded object_info_t and SnapSet in a per-shard cache, so the next op on them does not have to read and decode the xattrs again.  0 disables the cache.")
+    .add_see_also("osd_pg_object_context_cache_count"),
+
     Option("osd_tracing", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
     .set_description(""),
@@ -3487,6 +3534,12 @@ std::vector<Option> get_global_options() {
     .set_default("lru")
     .set_description(""),
 
+    Option("rocksdb_range_readahead", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(256_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Readahead for bounded range scans")
+    .set_long_description("Bulk range scans (e.g., listing omap values) read ahead up to this much, or up to the number of bytes the caller asked for if that is less.  0 disables readahead."),
+
     Option("rocksdb_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4_K)
     .set_description(""),
@@ -3728,6 +3781,25 @@ std::vector<Option> get_global_options() {
     .set_default(16)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Enable io_uring backend for kernel block devices")
+    .set_long_description("Submit and reap KernelDevice I/O through io_uring instead of libaio.  Falls back to libaio if ceph was built without liburing or the running kernel does not support it.")
+    .add_see_also("bdev_ioring_hipri")
+    .add_see_also("bdev_ioring_sqthread_poll"),
+
+    Option("bdev_ioring_hipri", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Enable io_uring completion polling (IORING_SETUP_IOPOLL) for non-rotational devices")
+    .set_long_description("Requires the device driver to be configured with polled queues (e.g. nvme.poll_queues).")
+    .add_see_also("bdev_ioring"),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Enable io_uring submission queue polling (IORING_SETUP_SQPOLL)")
+    .set_long_description("A kernel thread polls the submission queue so that submitting I/O does not require a system call.  Costs a busy kernel thread per device.")
+    .add_see_also("bdev_ioring"),
+
     Option("bdev_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4_K)
     .set_description(""),
@@ -3927,6 +3999,13 @@ std::vector<Option> get_global_options() {
     .set_description("Default checksum algorithm to use")
     .set_long_description("crc32c, xxhash32, and xxhash64 are available.  The _16 and _8 variants use only a subset of the bits for more compact (but less reliable) checksumming."),
 
+    Option("bluestore_csum_batch_verify", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Verify all checksums of a read in one batch")
+    .set_long_description("Collect every blob region of a read and verify their checksums together once the data is in memory.  Independent crc32c blocks are then hashed in parallel lanes where the CPU supports SSE4.2.  When disabled, each region is verified on its own as it is decoded.")
+    .add_see_also("bluestore_csum_type"),
+
     Option("bluestore_min_alloc_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(0)
     .set_flag(Option::FLAG_CREATE)
@@ -4040,6 +4119,39 @@ std::vector<Option> get_global_options() {
     .set_description("Compression ratio required to store compressed data")
     .set_long_description("If we compress data and get less than this we discard the result and store the original uncompressed data."),
 
+    Option("bluestore_compression_sample_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(4_K)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Bytes at the start of a blob sampled to predict whether it will compress")
+    .set_long_description("Blobs whose sample looks random (see bluestore_compression_sample_max_entropy) are stored uncompressed without running the compressor, unless bluestore_compression_mode is force.  0 disables sampling.")
+    .add_see_also("bluestore_compression_sample_max_entropy"),
+
+    Option("bluestore_compression_sample_max_entropy", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.95)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Skip compressing blobs whose sampled byte entropy exceeds this fraction of 8 bits per byte")
+    .add_see_also("bluestore_compression_sample_size"),
+
+    Option("bluestore_compression_history_misses", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Stop compressing an object or collection after this many writes in a row failed to compress")
+    .set_long_description("Only every this many'th write is then compressed, to notice when the data becomes compressible again.  Ignored when bluestore_compression_mode is force.  0 disables the history."),
+
+    Option("bluestore_compression_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Number of threads compressing blobs of large writes in parallel")
+    .set_long_description("With 0, blobs are compressed one after another by the thread doing the write.  Otherwise the blobs of a write are spread over these threads and the writing thread.")
+    .add_see_also("bluestore_compression_queue_max_bytes"),
+
+    Option("bluestore_compression_queue_max_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_M)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Max uncompressed bytes queued for the compression threads")
+    .set_long_description("Blobs that do not fit are compressed by the writing thread itself.")
+    .add_see_also("bluestore_compression_threads"),
+
     Option("bluestore_extent_map_shard_max_size", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(1200)
     .set_description("Max size (bytes) for a single extent map shard before splitting"),
@@ -4060,6 +4172,13 @@ std::vector<Option> get_global_options() {
     .set_default(256)
     .set_description("Preallocated buffer for inline shards"),
 
+    Option("bluestore_onode_format", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min_max(1, 2)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Format used when writing onodes")
+    .set_long_description("1 is the legacy fully encoded format.  2 is the flat format, which can be read in place so that stat and xattr operations do not decode the extent map.  Mounting with 2 raises min_compat_ondisk_format, so older releases refuse to mount the store until it is converted back with 'ceph-bluestore-tool convert-onode-format --onode-format 1'."),
+
     Option("bluestore_cache_trim_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
     .set_default(.05)
     .set_description("How frequently we trim the bluestore cache"),
@@ -4120,6 +4239,83 @@ std::vector<Option> get_global_options() {
     .add_see_also("bluestore_cache_autotune")
     .set_description("The number of seconds to wait between rebalances when cache autotune is enabled."),
 
+    Option("bluestore_onode_l2cache_path", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Path to a file on a fast local device used as a second level onode cache")
+    .set_long_description("When set, encoded onodes and extent map shards are also kept in this mmap'd file so that they survive OSD restarts and eviction from the in-memory cache.  The file is discarded if the OSD did not shut down cleanly."),
+
+    Option("bluestore_onode_l2cache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_G)
+    .set_flag(Option::FLAG_STARTUP)
+    .add_see_also("bluestore_onode_l2cache_path")
+    .set_description("Size of the second level onode cache file"),
+
+    Option("bluestore_onode_l2cache_slot_size", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(4_K)
+    .set_flag(Option::FLAG_STARTUP)
+    .add_see_also("bluestore_onode_l2cache_path")
+    .set_description("Size of each slot in the second level onode cache; larger onodes or shards are not cached"),
+
+    Option("bluestore_tier_fast_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_STARTUP)
+    .add_see_also("bluestore_bluefs_min_free")
+    .set_description("Amount of spare block.db capacity to use as a fast data tier")
+    .set_long_description("When non-zero and the OSD has a separate block.db device, up to this many bytes of its free space are taken from bluefs at mount and used to hold small writes and frequently read objects.  Cold data is migrated back to the main device in the background.  The space is reserved once and remembered across restarts."),
+
+    Option("bluestore_tier_small_write_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(16_K)
+    .add_see_also("bluestore_tier_fast_size")
+    .set_description("New allocations up to this size are placed on the fast tier"),
+
+    Option("bluestore_tier_max_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.9)
+    .set_min_max(0.0, 1.0)
+    .add_see_also("bluestore_tier_fast_size")
+    .set_description("Stop placing new data on the fast tier above this utilization"),
+
+    Option("bluestore_tier_demote_ratio", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.75)
+    .set_min_max(0.0, 1.0)
+    .add_see_also("bluestore_tier_fast_size")
+    .set_description("Demote cold objects from the fast tier while its utilization is above this ratio"),
+
+    Option("bluestore_tier_min_read_recency_for_promote", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .add_see_also("bluestore_tier_hit_set_count")
+    .set_description("Number of recent hit sets an object must appear in to be promoted to the fast tier"),
+
+    Option("bluestore_tier_promote_max_object_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1_M)
+    .add_see_also("bluestore_tier_fast_size")
+    .set_description("Do not promote objects larger than this to the fast tier"),
+
+    Option("bluestore_tier_hit_set_period", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(60)
+    .add_see_also("bluestore_tier_hit_set_count")
+    .set_description("Seconds covered by each read hit set used to find hot objects"),
+
+    Option("bluestore_tier_hit_set_count", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .add_see_also("bluestore_tier_hit_set_period")
+    .set_description("Number of past read hit sets to keep per collection"),
+
+    Option("bluestore_tier_hit_set_target_size", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(1000)
+    .add_see_also("bluestore_tier_hit_set_period")
+    .set_description("Expected number of distinct objects read per collection per hit set period"),
+
+    Option("bluestore_tier_agent_interval", Option::TYPE_FLOAT, Option::LEVEL_DEV)
+    .set_default(1)
+    .add_see_also("bluestore_tier_fast_size")
+    .set_description("Seconds between background demotion passes"),
+
+    Option("bluestore_tier_demote_max_objects", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(64)
+    .add_see_also("bluestore_tier_demote_ratio")
+    .set_description("Maximum number of objects to examine per demotion pass"),
+
     Option("bluestore_kvbackend", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("rocksdb")
     .set_flag(Option::FLAG_CREATE)
@@ -4127,8 +4323,42 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_allocator", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("bitmap")
-    .set_enum_allowed({"bitmap", "stupid"})
-    .set_description("Allocator policy"),
+    .set_enum_allowed({"bitmap", "stupid", "avl"})
+    .set_description("Allocator policy")
+    .set_long_description("bitmap scans a bitmap of the device; stupid keeps free extents in power-of-two bins; avl keeps them in trees by offset and by size, and uses best fit for large allocations to limit fragmentation."),
+
+    Option("bluestore_allocator_cache_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(16_M)
+    .set_description("Free space kept in per-thread caches in front of the allocator")
+    .set_long_description("Small allocations and releases are served from per-shard stocks of free extents, refilled from and drained to the allocator in batches, so that op threads do not all serialize on the allocator lock.  This is the total across all shards.  0 disables the cache.  Takes effect on mount.")
+    .add_see_also("bluestore_allocator_cache_shards")
+    .add_see_also("bluestore_allocator_cache_max_alloc"),
+
+    Option("bluestore_allocator_cache_shards", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(8)
+    .set_description("Number of allocator cache shards threads are spread over")
+    .add_see_also("bluestore_allocator_cache_size"),
+
+    Option("bluestore_allocator_cache_max_alloc", Option::TYPE_SIZE, Option::LEVEL_DEV)
+    .set_default(64_K)
+    .set_description("Largest allocation served from the allocator cache")
+    .add_see_also("bluestore_allocator_cache_size"),
+
+    Option("bluestore_allocator_snapshot", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_description("Save the allocator free map on clean umount and load it on mount")
+    .set_long_description("On mount the allocator is normally rebuilt by walking the whole freelist in the key/value store, which can take tens of seconds on large HDDs.  With this enabled, a clean umount writes the free extents to a bluefs file, guarded by a sequence number in the superblock, and the next mount loads them from there instead.  The snapshot is discarded as soon as it has been read, so after a crash or any other open the full rebuild is used."),
+
+    Option("bluestore_avl_alloc_bf_threshold", Option::TYPE_SIZE, Option::LEVEL_DEV)
+    .set_default(128_K)
+    .set_description("Allocations at least this large are placed best fit by the avl allocator")
+    .set_long_description("Smaller allocations are placed first fit near the hint, which keeps related data together.")
+    .add_see_also("bluestore_avl_alloc_bf_free_pct"),
+
+    Option("bluestore_avl_alloc_bf_free_pct", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(4)
+    .set_description("Below this percentage of free space the avl allocator places everything best fit")
+    .add_see_also("bluestore_avl_alloc_bf_threshold"),
 
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
@@ -4152,11 +4382,15 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_rocksdb_cf", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(false)
-    .set_description("Enable use of rocksdb column families for bluestore metadata"),
+    .set_description("Enable use of rocksdb column families for bluestore metadata")
+    .set_long_description("Only takes effect at mkfs; use 'ceph-bluestore-tool reshard' to change the layout of an existing OSD.")
+    .add_see_also("bluestore_rocksdb_cfs"),
 
     Option("bluestore_rocksdb_cfs", Option::TYPE_STR, Option::LEVEL_DEV)
-    .set_default("M= P= L=")
-    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options"),
+    .set_default("O(4,0-13)=block_cache_ratio=0.25 M(4,0-8) P L S T C X B b D d")
+    .set_description("List of whitespace-separate key/value pairs where key is CF name and value is CF options")
+    .set_long_description("Each key is a key prefix, optionally followed by (shards[,l-h]) to spread the prefix over that many column families by a hash of key bytes l to h; O and M hash the object and the onode id so that all keys of one object stay in one shard.  Values are ';' separated rocksdb column family options (e.g. compaction_style), plus block_cache_ratio (share of the kv cache dedicated to this CF) and bloom_bits_per_key (0 disables the bloom filter).  Prefixes not listed stay in the default column family.  The layout of an existing db is recorded on disk and wins over this setting; only the options are applied.")
+    .add_see_also("bluestore_rocksdb_cf"),
 
     Option("bluestore_fsck_on_mount", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
@@ -4227,6 +4461,20 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media"),
 
+    Option("bluestore_deferred_coalesce", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Flush deferred writes of all sequencers together")
+    .set_long_description("When enabled, the pending deferred writes of every sequencer are merged into a single flush.  Overlapping writes keep only the newest data, and adjacent writes are joined into one IO.  The IOs are issued in elevator order, starting from where the previous flush left off.  When disabled, each sequencer submits its own batch, as before.")
+    .add_see_also("bluestore_deferred_flush_queue_depth"),
+
+    Option("bluestore_deferred_flush_queue_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Max deferred write IOs in flight before new flushes are held back")
+    .set_long_description("While this many coalesced deferred IOs are outstanding, further pending batches are held back, and keep merging, until a flush completes.  This keeps the device queue full of long, sorted runs instead of many small writes.  0 means no limit.  Has no effect while deferred writes are being drained.")
+    .add_see_also("bluestore_deferred_coalesce"),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -4302,6 +4550,14 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("bluestore_kv_sync_pipelines", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(1)
+    .set_min(1)
+    .set_flag(Option::FLAG_STARTUP)
+    .set_description("Number of independent kv sync/finalize pipelines")
+    .set_long_description("Each collection's transactions are committed by one pipeline (chosen by hashing the collection), so ordering within a collection is preserved while collections hashed to different pipelines commit to the key/value store in parallel.  Collection create/remove/split are kv submitted before queue_transactions returns when more than one pipeline is configured.")
+    .add_see_also("bluestore_shard_finishers"),
+
     Option("bluestore_debug_random_read_err", Option::TYPE_FLOAT, Option::LEVEL_DEV)
     .set_default(0)
     .set_description(""),
@@ -4953,6 +5209,19 @@ std::vector<Option> get_rgw_options() {
     .set_default(false)
     .set_description("true if LTTng-UST tracepoints should be enabled"),
 
+    Option("rgw_compression_sample_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(4_K)
+    .set_description("Bytes of an object's first part sampled to predict whether it will compress")
+    .set_long_description(
+        "If the sample looks random (see rgw_compression_sample_max_entropy), the object "
+        "is stored uncompressed without running the compressor. 0 disables sampling.")
+    .add_see_also("rgw_compression_sample_max_entropy"),
+
+    Option("rgw_compression_sample_max_entropy", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.95)
+    .set_description("Skip compressing objects whose sampled byte entropy exceeds this fraction of 8 bits per byte")
+    .add_see_also("rgw_compression_sample_size"),
+
     Option("rgw_max_chunk_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
     .set_default(4_M)
     .set_description("Set RGW max chunk size")
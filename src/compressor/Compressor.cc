@@ -12,6 +12,7 @@
  *
  */
 
+#include <cmath>
 #include <random>
 #include <sstream>
 #include <iterator>
@@ -100,3 +101,32 @@ CompressorRef Compressor::create(CephContext *cct, int alg)
   std::string type_name = get_comp_alg_name(alg);
   return create(cct, type_name);
 }
+
+double Compressor::estimate_entropy(const ceph::bufferlist &in,
+				    size_t sample_len)
+{
+  uint32_t hist[256] = {0};
+  size_t n = 0;
+  for (auto& p : in.buffers()) {
+    if (n >= sample_len) {
+      break;
+    }
+    const unsigned char *c = (const unsigned char *)p.c_str();
+    size_t l = std::min<size_t>(p.length(), sample_len - n);
+    for (size_t i = 0; i < l; ++i) {
+      ++hist[c[i]];
+    }
+    n += l;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  double e = 0;
+  for (auto h : hist) {
+    if (h) {
+      double f = (double)h / n;
+      e -= f * std::log2(f);
+    }
+  }
+  return e / 8;
+}
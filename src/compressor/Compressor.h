@@ -97,6 +97,15 @@ public:
   static CompressorRef create(CephContext *cct, const std::string &type);
   static CompressorRef create(CephContext *cct, int alg);
 
+  /**
+   * Estimate how compressible in is from the byte histogram of its first
+   * sample_len bytes.
+   *
+   * @return order-0 entropy as a fraction of 8 bits per byte: close to 1
+   *         for random or already compressed data, 0 for an empty sample
+   */
+  static double estimate_entropy(const ceph::bufferlist &in, size_t sample_len);
+
 protected:
   CompressionAlgorithm alg;
   std::string type;
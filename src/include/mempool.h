@@ -24,6 +24,8 @@
 #include <mutex>
 #include <atomic>
 #include <typeinfo>
+#include <functional>
+#include <string>
 #include <boost/container/flat_set.hpp>
 #include <boost/container/flat_map.hpp>
 
@@ -275,6 +277,13 @@ public:
 
 void dump(ceph::Formatter *f);
 
+// Components that place their caches on specific NUMA nodes (e.g.,
+// BlueStore cache shards) can register a callback here to report their
+// per-node usage under "by_numa_node" in dump().
+typedef std::function<void(ceph::Formatter*)> numa_dumper_t;
+void register_numa_dumper(const std::string& name, numa_dumper_t fn);
+void unregister_numa_dumper(const std::string& name);
+
 
 // STL allocator for use with containers.  All actual state
 // is stored in the static pool_allocator_base_t, which saves us from
@@ -435,6 +444,13 @@ public:
     using unordered_map =						\
       std::unordered_map<k,v,h,eq,pool_allocator<std::pair<const k,v>>>;\
                                                                         \
+    template<typename k, typename v,					\
+	     typename h=std::hash<k>,					\
+	     typename eq = std::equal_to<k>>				\
+    using unordered_multimap =						\
+      std::unordered_multimap<k,v,h,eq,					\
+			      pool_allocator<std::pair<const k,v>>>;	\
+                                                                        \
     inline size_t allocated_bytes() {					\
       return mempool::get_pool(id).allocated_bytes();			\
     }									\
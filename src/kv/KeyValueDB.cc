@@ -2,6 +2,8 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "KeyValueDB.h"
+#include "include/str_list.h"
+#include "common/strtol.h"
 #ifdef WITH_LEVELDB
 #include "LevelDBStore.h"
 #endif
@@ -65,3 +67,97 @@ int KeyValueDB::test_init(const string& type, const string& dir)
   }
   return -EINVAL;
 }
+
+int KeyValueDB::parse_column_families(const string& spec,
+				      vector<ColumnFamily> *cfs,
+				      std::ostream *err)
+{
+  list<string> items;
+  get_str_list(spec, " \t\n", items);
+  for (auto& item : items) {
+    string name = item;
+    string option;
+    size_t eq = item.find('=');
+    if (eq != string::npos) {
+      name = item.substr(0, eq);
+      option = item.substr(eq + 1);
+    }
+    uint32_t shard_cnt = 1;
+    uint32_t hash_l = 0;
+    uint32_t hash_h = UINT32_MAX;
+    size_t lp = name.find('(');
+    if (lp != string::npos) {
+      if (name.back() != ')') {
+	if (err)
+	  *err << "missing ')' in '" << item << "'";
+	return -EINVAL;
+      }
+      string shards = name.substr(lp + 1, name.size() - lp - 2);
+      name.resize(lp);
+      string range;
+      size_t comma = shards.find(',');
+      if (comma != string::npos) {
+	range = shards.substr(comma + 1);
+	shards.resize(comma);
+      }
+      string e;
+      shard_cnt = strict_strtol(shards.c_str(), 10, &e);
+      if (!e.empty() || shard_cnt < 1 || shard_cnt > 1024) {
+	if (err)
+	  *err << "bad shard count in '" << item << "'";
+	return -EINVAL;
+      }
+      if (!range.empty()) {
+	size_t dash = range.find('-');
+	if (dash == string::npos) {
+	  if (err)
+	    *err << "bad hash range in '" << item << "'";
+	  return -EINVAL;
+	}
+	hash_l = strict_strtol(range.substr(0, dash).c_str(), 10, &e);
+	if (e.empty() && dash + 1 < range.size()) {
+	  hash_h = strict_strtol(range.substr(dash + 1).c_str(), 10, &e);
+	}
+	if (!e.empty() || hash_l >= hash_h) {
+	  if (err)
+	    *err << "bad hash range in '" << item << "'";
+	  return -EINVAL;
+	}
+      }
+    }
+    if (name.empty() || name.find('-') != string::npos) {
+      if (err)
+	*err << "bad column family name in '" << item << "'";
+      return -EINVAL;
+    }
+    for (auto& i : *cfs) {
+      if (i.name == name) {
+	if (err)
+	  *err << "duplicate column family '" << name << "'";
+	return -EINVAL;
+      }
+    }
+    cfs->push_back(ColumnFamily(name, option, shard_cnt, hash_l, hash_h));
+  }
+  return 0;
+}
+
+string KeyValueDB::dump_column_families(const vector<ColumnFamily>& cfs)
+{
+  std::ostringstream out;
+  for (auto& i : cfs) {
+    if (out.tellp() > 0)
+      out << ' ';
+    out << i.name;
+    if (i.shard_cnt > 1 || i.hash_l > 0 || i.hash_h != UINT32_MAX) {
+      out << '(' << i.shard_cnt;
+      if (i.hash_l > 0 || i.hash_h != UINT32_MAX) {
+	out << ',' << i.hash_l << '-';
+	if (i.hash_h != UINT32_MAX)
+	  out << i.hash_h;
+      }
+      out << ')';
+    }
+  }
+  return out.str();
+}
@@ -31,10 +31,42 @@ public:
   struct ColumnFamily {
     string name;      //< name of this individual column family
     string option;    //< configure option string for this CF
+    uint32_t shard_cnt = 1;       //< number of hash shards for this prefix
+    uint32_t hash_l = 0;          //< first key byte fed to the shard hash
+    uint32_t hash_h = UINT32_MAX; //< past last key byte fed to the hash
     ColumnFamily(const string &name, const string &option)
       : name(name), option(option) {}
+    ColumnFamily(const string &name, const string &option,
+		 uint32_t shard_cnt, uint32_t hash_l, uint32_t hash_h)
+      : name(name), option(option),
+	shard_cnt(shard_cnt), hash_l(hash_l), hash_h(hash_h) {}
+
+    /// name of the underlying column family holding shard idx
+    string get_shard_name(uint32_t idx) const {
+      if (shard_cnt == 1)
+	return name;
+      return name + "-" + std::to_string(idx);
+    }
+    bool same_layout(const ColumnFamily& o) const {
+      return name == o.name && shard_cnt == o.shard_cnt &&
+	hash_l == o.hash_l && hash_h == o.hash_h;
+    }
   };
 
+  /**
+   * parse a whitespace separated column family layout
+   *
+   * Each entry is name[(shards[,l-h])][=options].  A prefix with more
+   * than one shard is spread over column families name-0..name-(shards-1);
+   * keys are routed by hashing bytes [l, h) of the key (the whole key by
+   * default).
+   */
+  static int parse_column_families(const string& spec,
+				   vector<ColumnFamily> *cfs,
+				   std::ostream *err = nullptr);
+  /// inverse of parse_column_families, without the options
+  static string dump_column_families(const vector<ColumnFamily>& cfs);
+
   class TransactionImpl {
   public:
     /// Set Keys
@@ -166,6 +198,12 @@ public:
   /// Try to repair K/V database. leveldb and rocksdb require that database must be not opened.
   virtual int repair(std::ostream &out) { return 0; }
 
+  /// Move every key to the column family layout new_cfs.  Offline only.
+  virtual int reshard(const vector<ColumnFamily>& new_cfs,
+		      std::ostream &out) {
+    return -EOPNOTSUPP;
+  }
+
   virtual Transaction get_transaction() = 0;
   virtual int submit_transaction(Transaction) = 0;
   virtual int submit_transaction_sync(Transaction t) {
@@ -273,6 +311,7 @@ private:
   int64_t cache_bytes[PriorityCache::Priority::LAST+1] = { 0 };
   double cache_ratio = 0;
 
+protected:
   // This class filters a WholeSpaceIterator by a prefix.
   class PrefixIteratorImpl : public IteratorImpl {
     const std::string prefix;
@@ -345,6 +384,49 @@ public:
       get_wholespace_iterator());
   }
 
+  /// Scan a bounded key range in one call
+  ///
+  /// Appends encode(key) + encode(value) to out for each pair in order,
+  /// with the first skip bytes of every key dropped, and returns how many
+  /// pairs that was.  Stops after max_keys pairs, or as soon as out has
+  /// grown by max_bytes, and sets *more if the range holds further keys.
+  /// The result decodes like a map<string,bufferlist> without the count.
+  virtual int get_range(
+    const std::string &prefix, ///< [in] Prefix/CF to scan
+    const std::string &start,  ///< [in] first key (or key to start after)
+    bool after,                ///< [in] true to skip start itself
+    const std::string &end,    ///< [in] stop before this key; "" for none
+    size_t skip,               ///< [in] leading key bytes not to return
+    size_t max_keys,           ///< [in] max pairs to return
+    size_t max_bytes,          ///< [in] max bytes to return (soft)
+    bufferlist *out,           ///< [out] encoded pairs
+    bool *more) {              ///< [out] true if stopped short of end
+    Iterator it = get_iterator(prefix);
+    if (after) {
+      it->upper_bound(start);
+    } else {
+      it->lower_bound(start);
+    }
+    int num = 0;
+    unsigned len = out->length();
+    *more = false;
+    for (; it->valid(); it->next(false)) {
+      std::string k = it->key();
+      if (!end.empty() && k >= end) {
+	break;
+      }
+      if ((size_t)num >= max_keys || out->length() - len >= max_bytes) {
+	*more = true;
+	break;
+      }
+      assert(k.size() >= skip);
+      encode(k.substr(skip), *out);
+      encode(it->value(), *out);
+      ++num;
+    }
+    return num;
+  }
+
   void add_column_family(const std::string& cf_name, void *handle) {
     cf_handles.insert(std::make_pair(cf_name, handle));
   }
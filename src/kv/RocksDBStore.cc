@@ -25,6 +25,7 @@ using std::string;
 #include "include/str_list.h"
 #include "include/stringify.h"
 #include "include/str_map.h"
+#include "include/ceph_hash.h"
 #include "KeyValueDB.h"
 #include "RocksDBStore.h"
 
@@ -35,6 +36,11 @@ using std::string;
 #undef dout_prefix
 #define dout_prefix *_dout << "rocksdb: "
 
+// column family layout of the db, and the one a reshard is moving it to
+static const string SHARDING_DEF_FILE("sharding_def");
+static const string RESHARDING_FILE("sharding_in_progress");
+static const unsigned RESHARD_BATCH_KEYS = 10000;
+
 static bufferlist to_bufferlist(rocksdb::Slice in) {
   bufferlist bl;
   bl.append(bufferptr(in.data(), in.size()));
@@ -74,7 +80,7 @@ public:
     for (auto& p : store.merge_ops) {
       names[p.first] = p.second->name();
     }
-    for (auto& p : store.cf_handles) {
+    for (auto& p : store.cf_shards) {
       names.erase(p.first);
     }
     for (auto& p : names) {
@@ -310,6 +316,195 @@ int RocksDBStore::install_cf_mergeop(
   return 0;
 }
 
+int RocksDBStore::prepare_cf_options(
+  const string& prefix,
+  const string& options,
+  const rocksdb::Options& base,
+  rocksdb::ColumnFamilyOptions *cf_opt)
+{
+  // copy default CF settings, block cache, merge operators as
+  // the base for new CF
+  *cf_opt = rocksdb::ColumnFamilyOptions(base);
+
+  // pick out the keys we handle ourselves and pass everything else on to
+  // rocksdb.  items are ';' separated, but nested table options may carry
+  // their own ';' inside {}.
+  string rocksdb_opts;
+  double cache_ratio = 0;
+  int64_t bloom_bits = -1;
+  int depth = 0;
+  size_t start = 0;
+  for (size_t i = 0; i <= options.size(); ++i) {
+    if (i < options.size()) {
+      if (options[i] == '{') {
+	++depth;
+      } else if (options[i] == '}') {
+	--depth;
+      }
+      if (options[i] != ';' || depth > 0) {
+	continue;
+      }
+    }
+    string item = options.substr(start, i - start);
+    start = i + 1;
+    size_t eq = item.find('=');
+    string key = item.substr(0, eq);
+    string val = eq == string::npos ? string() : item.substr(eq + 1);
+    string err;
+    if (key == "block_cache_ratio") {
+      cache_ratio = strict_strtod(val.c_str(), &err);
+      if (!err.empty() || cache_ratio < 0 || cache_ratio >= 1.0) {
+	derr << __func__ << " bad block_cache_ratio '" << val << "' for CF '"
+	     << prefix << "'" << dendl;
+	return -EINVAL;
+      }
+    } else if (key == "bloom_bits_per_key") {
+      bloom_bits = strict_strtoll(val.c_str(), 10, &err);
+      if (!err.empty() || bloom_bits < 0) {
+	derr << __func__ << " bad bloom_bits_per_key '" << val << "' for CF '"
+	     << prefix << "'" << dendl;
+	return -EINVAL;
+      }
+    } else if (!item.empty()) {
+      if (!rocksdb_opts.empty()) {
+	rocksdb_opts += ';';
+      }
+      rocksdb_opts += item;
+    }
+  }
+
+  // user input options will override the base options
+  rocksdb::Status status = rocksdb::GetColumnFamilyOptionsFromString(
+    *cf_opt, rocksdb_opts, cf_opt);
+  if (!status.ok()) {
+    derr << __func__ << " invalid db column family options for CF '"
+	 << prefix << "': " << options << dendl;
+    return -EINVAL;
+  }
+
+  if ((cache_ratio > 0 && !bbt_opts.no_block_cache) || bloom_bits >= 0) {
+    rocksdb::BlockBasedTableOptions cf_bbt_opts(bbt_opts);
+    if (cache_ratio > 0 && !bbt_opts.no_block_cache) {
+      // all shards of a prefix share one cache
+      cf_cache_t& c = cf_caches[prefix];
+      if (!c.cache) {
+	if (cf_cache_ratio + cache_ratio >= 1.0) {
+	  derr << __func__ << " block_cache_ratio of CF '" << prefix
+	       << "' leaves nothing for the default cache" << dendl;
+	  cf_caches.erase(prefix);
+	  return -EINVAL;
+	}
+	uint64_t size = block_cache_size * cache_ratio;
+	if (g_conf->rocksdb_cache_type == "clock") {
+	  c.cache = rocksdb::NewClockCache(size,
+					   g_conf->rocksdb_cache_shard_bits);
+	} else {
+	  c.cache = rocksdb::NewLRUCache(size,
+					 g_conf->rocksdb_cache_shard_bits);
+	}
+	c.ratio = cache_ratio;
+	cf_cache_ratio += cache_ratio;
+      }
+      cf_bbt_opts.block_cache = c.cache;
+    }
+    if (bloom_bits == 0) {
+      cf_bbt_opts.filter_policy.reset();
+    } else if (bloom_bits > 0) {
+      cf_bbt_opts.filter_policy.reset(
+	rocksdb::NewBloomFilterPolicy(bloom_bits));
+    }
+    cf_opt->table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(cf_bbt_opts));
+  }
+  dout(10) << __func__ << " CF '" << prefix << "' cache ratio " << cache_ratio
+	   << " bloom bits " << bloom_bits << " options '" << rocksdb_opts
+	   << "'" << dendl;
+
+  install_cf_mergeop(prefix, cf_opt);
+  return 0;
+}
+
+void RocksDBStore::apply_cache_ratios(uint64_t total)
+{
+  if (bbt_opts.no_block_cache) {
+    return;
+  }
+  bbt_opts.block_cache->SetCapacity(total * (1.0 - cf_cache_ratio));
+  for (auto& p : cf_caches) {
+    p.second.cache->SetCapacity(total * p.second.ratio);
+  }
+}
+
+rocksdb::Env *RocksDBStore::get_env()
+{
+  return env ? env : rocksdb::Env::Default();
+}
+
+int RocksDBStore::read_sharding(const string& fn, string *spec)
+{
+  string fpath = path + "/" + fn;
+  rocksdb::Status status = get_env()->FileExists(fpath);
+  if (status.IsNotFound()) {
+    return -ENOENT;
+  }
+  status = rocksdb::ReadFileToString(get_env(), fpath, spec);
+  if (!status.ok()) {
+    derr << __func__ << " failed to read " << fpath << ": "
+	 << status.ToString() << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+int RocksDBStore::write_sharding(const string& fn, const string& spec)
+{
+  string fpath = path + "/" + fn;
+  rocksdb::Status status = rocksdb::WriteStringToFile(get_env(), spec, fpath,
+						      true);
+  if (!status.ok()) {
+    derr << __func__ << " failed to write " << fpath << ": "
+	 << status.ToString() << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+int RocksDBStore::update_shard_map(
+  const vector<ColumnFamily>& cfs,
+  std::unordered_map<string, prefix_shards> *shards)
+{
+  shards->clear();
+  for (auto& p : cfs) {
+    prefix_shards& ps = (*shards)[p.name];
+    ps.hash_l = p.hash_l;
+    ps.hash_h = p.hash_h;
+    for (uint32_t i = 0; i < p.shard_cnt; ++i) {
+      string name = p.get_shard_name(i);
+      auto h = cf_handles.find(name);
+      if (h == cf_handles.end()) {
+	derr << __func__ << " column family '" << name << "' of prefix '"
+	     << p.name << "' does not exist" << dendl;
+	return -ENOENT;
+      }
+      ps.handles.push_back(static_cast<rocksdb::ColumnFamilyHandle*>(h->second));
+    }
+  }
+  return 0;
+}
+
+rocksdb::ColumnFamilyHandle *RocksDBStore::get_shard_handle(
+  const prefix_shards& shards,
+  const char *key, size_t keylen)
+{
+  if (shards.handles.size() == 1) {
+    return shards.handles.front();
+  }
+  size_t l = std::min<size_t>(shards.hash_l, keylen);
+  size_t h = std::min<size_t>(shards.hash_h, keylen);
+  uint32_t hash = ceph_str_hash_rjenkins(key + l, h - l);
+  return shards.handles[hash % shards.handles.size()];
+}
+
 int RocksDBStore::create_and_open(ostream &out,
 				  const vector<ColumnFamily>& cfs)
 {
@@ -387,7 +582,7 @@ int RocksDBStore::load_rocksdb_options(bool create_if_missing, rocksdb::Options&
     cache_size = g_conf->rocksdb_cache_size;
   }
   uint64_t row_cache_size = cache_size * g_conf->rocksdb_cache_row_ratio;
-  uint64_t block_cache_size = cache_size - row_cache_size;
+  block_cache_size = cache_size - row_cache_size;
 
   if (g_conf->rocksdb_cache_type == "lru") {
     bbt_opts.block_cache = rocksdb::NewLRUCache(
@@ -461,6 +656,9 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
     dout(1) << __func__ << " load rocksdb options failed" << dendl;
     return r;
   }
+  cf_caches.clear();
+  cf_cache_ratio = 0;
+  sharding.clear();
   rocksdb::Status status;
   if (create_if_missing) {
     status = rocksdb::DB::Open(opt, path, &db);
@@ -471,31 +669,43 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
     // create and open column families
     if (cfs) {
       for (auto& p : *cfs) {
-	// copy default CF settings, block cache, merge operators as
-	// the base for new CF
-	rocksdb::ColumnFamilyOptions cf_opt(opt);
-	// user input options will override the base options
-	status = rocksdb::GetColumnFamilyOptionsFromString(
-	  cf_opt, p.option, &cf_opt);
-	if (!status.ok()) {
-	  derr << __func__ << " invalid db column family option string for CF: "
-	       << p.name << dendl;
-	  return -EINVAL;
-	}
-	install_cf_mergeop(p.name, &cf_opt);
-	rocksdb::ColumnFamilyHandle *cf;
-	status = db->CreateColumnFamily(cf_opt, p.name, &cf);
-	if (!status.ok()) {
-	  derr << __func__ << " Failed to create rocksdb column family: "
-	       << p.name << dendl;
-	  return -EINVAL;
+	for (uint32_t i = 0; i < p.shard_cnt; ++i) {
+	  rocksdb::ColumnFamilyOptions cf_opt;
+	  r = prepare_cf_options(p.name, p.option, opt, &cf_opt);
+	  if (r < 0) {
+	    return r;
+	  }
+	  string name = p.get_shard_name(i);
+	  rocksdb::ColumnFamilyHandle *cf;
+	  status = db->CreateColumnFamily(cf_opt, name, &cf);
+	  if (!status.ok()) {
+	    derr << __func__ << " Failed to create rocksdb column family: "
+		 << name << dendl;
+	    return -EINVAL;
+	  }
+	  // store the new CF handle
+	  add_column_family(name, static_cast<void*>(cf));
 	}
-	// store the new CF handle
-	add_column_family(p.name, static_cast<void*>(cf));
+      }
+      sharding = *cfs;
+      r = update_shard_map(sharding, &cf_shards);
+      if (r < 0) {
+	return r;
+      }
+      r = write_sharding(SHARDING_DEF_FILE, dump_column_families(sharding));
+      if (r < 0) {
+	return r;
       }
     }
     default_cf = db->DefaultColumnFamily();
   } else {
+    string target;
+    if (read_sharding(RESHARDING_FILE, &target) == 0 &&
+	!kv_options.count("resharding")) {
+      derr << __func__ << " found interrupted resharding to '" << target
+	   << "'; rerun ceph-bluestore-tool reshard to complete it" << dendl;
+      return -EBUSY;
+    }
     std::vector<string> existing_cfs;
     status = rocksdb::DB::ListColumnFamilies(
       rocksdb::DBOptions(opt),
@@ -511,36 +721,57 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
       }
       default_cf = db->DefaultColumnFamily();
     } else {
-      // we cannot change column families for a created database.  so, map
-      // what options we are given to whatever cf's already exist.
-      std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
-      for (auto& n : existing_cfs) {
-	// copy default CF settings, block cache, merge operators as
-	// the base for new CF
-	rocksdb::ColumnFamilyOptions cf_opt(opt);
-	bool found = false;
+      // we cannot change column families for a created database; the
+      // layout on disk wins, and we only take the per-CF options from
+      // what we are given.
+      string spec;
+      if (read_sharding(SHARDING_DEF_FILE, &spec) == 0) {
+	std::ostringstream perr;
+	r = parse_column_families(spec, &sharding, &perr);
+	if (r < 0) {
+	  derr << __func__ << " bad column family layout '" << spec << "': "
+	       << perr.str() << dendl;
+	  return r;
+	}
+      } else {
+	// created before layouts were recorded: one CF per prefix
+	for (auto& n : existing_cfs) {
+	  if (n != rocksdb::kDefaultColumnFamilyName) {
+	    sharding.push_back(ColumnFamily(n, ""));
+	  }
+	}
+      }
+      std::map<string, const ColumnFamily*> cf_layout;
+      for (auto& p : sharding) {
 	if (cfs) {
 	  for (auto& i : *cfs) {
-	    if (i.name == n) {
-	      found = true;
-	      status = rocksdb::GetColumnFamilyOptionsFromString(
-		cf_opt, i.option, &cf_opt);
-	      if (!status.ok()) {
-		derr << __func__ << " invalid db column family options for CF '"
-		     << i.name << "': " << i.option << dendl;
-		return -EINVAL;
-	      }
+	    if (i.name == p.name) {
+	      p.option = i.option;
 	    }
 	  }
 	}
+	for (uint32_t i = 0; i < p.shard_cnt; ++i) {
+	  cf_layout[p.get_shard_name(i)] = &p;
+	}
+      }
+      std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+      for (auto& n : existing_cfs) {
+	rocksdb::ColumnFamilyOptions cf_opt(opt);
 	if (n != rocksdb::kDefaultColumnFamilyName) {
-	  install_cf_mergeop(n, &cf_opt);
+	  auto p = cf_layout.find(n);
+	  if (p != cf_layout.end()) {
+	    r = prepare_cf_options(p->second->name, p->second->option, opt,
+				   &cf_opt);
+	  } else {
+	    dout(1) << __func__ << " column family '" << n
+		    << "' exists but not expected" << dendl;
+	    r = prepare_cf_options(n, string(), opt, &cf_opt);
+	  }
+	  if (r < 0) {
+	    return r;
+	  }
 	}
 	column_families.push_back(rocksdb::ColumnFamilyDescriptor(n, cf_opt));
-	if (!found && n != rocksdb::kDefaultColumnFamilyName) {
-	  dout(1) << __func__ << " column family '" << n
-		  << "' exists but not expected" << dendl;
-	}
       }
       std::vector<rocksdb::ColumnFamilyHandle*> handles;
       status = rocksdb::DB::Open(rocksdb::DBOptions(opt),
@@ -557,8 +788,30 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
 	  add_column_family(existing_cfs[i], static_cast<void*>(handles[i]));
 	}
       }
+      r = update_shard_map(sharding, &cf_shards);
+      if (r < 0) {
+	return r;
+      }
+      if (cfs && !cfs->empty()) {
+	bool same = cfs->size() == sharding.size();
+	for (auto& i : *cfs) {
+	  bool found = false;
+	  for (auto& p : sharding) {
+	    found = found || p.same_layout(i);
+	  }
+	  same = same && found;
+	}
+	if (!same) {
+	  dout(1) << __func__ << " column family layout '"
+		  << dump_column_families(sharding)
+		  << "' differs from the configured '"
+		  << dump_column_families(*cfs)
+		  << "'; use ceph-bluestore-tool reshard to change it" << dendl;
+	}
+      }
     }
   }
+  apply_cache_ratios(block_cache_size);
   assert(default_cf != nullptr);
   
   PerfCountersBuilder plb(g_ceph_context, "rocksdb", l_rocksdb_first, l_rocksdb_last);
@@ -566,6 +819,11 @@ int RocksDBStore::do_open(ostream &out, bool create_if_missing,
   plb.add_u64_counter(l_rocksdb_txns, "submit_transaction", "Submit transactions");
   plb.add_u64_counter(l_rocksdb_txns_sync, "submit_transaction_sync", "Submit transactions sync");
   plb.add_time_avg(l_rocksdb_get_latency, "get_latency", "Get latency");
+  plb.add_u64_counter(l_rocksdb_get_range, "get_range", "Range scans");
+  plb.add_u64_counter(l_rocksdb_get_range_keys, "get_range_keys",
+		      "Keys returned by range scans");
+  plb.add_time_avg(l_rocksdb_get_range_latency, "get_range_latency",
+		   "Range scan latency");
   plb.add_time_avg(l_rocksdb_submit_latency, "submit_latency", "Submit Latency");
   plb.add_time_avg(l_rocksdb_submit_sync_latency, "submit_sync_latency", "Submit Sync Latency");
   plb.add_u64_counter(l_rocksdb_compact, "compact", "Compactions");
@@ -833,7 +1091,7 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const string &k,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     put_bat(bat, cf, k, to_set_bl);
   } else {
@@ -847,21 +1105,21 @@ void RocksDBStore::RocksDBTransactionImpl::set(
   const char *k, size_t keylen,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k, keylen);
   if (cf) {
     string key(k, keylen);  // fixme?
     put_bat(bat, cf, key, to_set_bl);
   } else {
     string key;
     combine_strings(prefix, k, keylen, &key);
-    put_bat(bat, cf, key, to_set_bl);
+    put_bat(bat, db->default_cf, key, to_set_bl);
   }
 }
 
 void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const string &k)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k));
   } else {
@@ -873,7 +1131,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 					         const char *k,
 						 size_t keylen)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k, keylen);
   if (cf) {
     bat.Delete(cf, rocksdb::Slice(k, keylen));
   } else {
@@ -886,7 +1144,7 @@ void RocksDBStore::RocksDBTransactionImpl::rmkey(const string &prefix,
 void RocksDBStore::RocksDBTransactionImpl::rm_single_key(const string &prefix,
 					                 const string &k)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     bat.SingleDelete(cf, k);
   } else {
@@ -896,17 +1154,21 @@ void RocksDBStore::RocksDBTransactionImpl::rm_single_key(const string &prefix,
 
 void RocksDBStore::RocksDBTransactionImpl::rmkeys_by_prefix(const string &prefix)
 {
-  auto cf = db->get_cf_handle(prefix);
-  if (cf) {
+  auto shards = db->get_cf_handles(prefix);
+  if (shards) {
     if (db->enable_rmrange) {
       string endprefix("\xff\xff\xff\xff");  // FIXME: this is cheating...
-      bat.DeleteRange(cf, string(), endprefix);
+      for (auto cf : shards->handles) {
+	bat.DeleteRange(cf, string(), endprefix);
+      }
     } else {
       auto it = db->get_iterator(prefix);
       for (it->seek_to_first();
 	   it->valid();
 	   it->next()) {
-	bat.Delete(cf, rocksdb::Slice(it->key()));
+	string k = it->key();
+	bat.Delete(get_shard_handle(*shards, k.data(), k.size()),
+		   rocksdb::Slice(k));
       }
     }
   } else {
@@ -931,18 +1193,22 @@ void RocksDBStore::RocksDBTransactionImpl::rm_range_keys(const string &prefix,
                                                          const string &start,
                                                          const string &end)
 {
-  auto cf = db->get_cf_handle(prefix);
-  if (cf) {
+  auto shards = db->get_cf_handles(prefix);
+  if (shards) {
     if (db->enable_rmrange) {
-      bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
+      for (auto cf : shards->handles) {
+	bat.DeleteRange(cf, rocksdb::Slice(start), rocksdb::Slice(end));
+      }
     } else {
       auto it = db->get_iterator(prefix);
       it->lower_bound(start);
       while (it->valid()) {
-	if (it->key() >= end) {
+	string k = it->key();
+	if (k >= end) {
 	  break;
 	}
-	bat.Delete(cf, rocksdb::Slice(it->key()));
+	bat.Delete(get_shard_handle(*shards, k.data(), k.size()),
+		   rocksdb::Slice(k));
 	it->next();
       }
     }
@@ -972,7 +1238,7 @@ void RocksDBStore::RocksDBTransactionImpl::merge(
   const string &k,
   const bufferlist &to_set_bl)
 {
-  auto cf = db->get_cf_handle(prefix);
+  auto cf = db->get_cf_handle(prefix, k);
   if (cf) {
     // bufferlist::c_str() is non-constant, so we can't call c_str()
     if (to_set_bl.is_contiguous() && to_set_bl.length() > 0) {
@@ -1013,33 +1279,34 @@ int RocksDBStore::get(
     std::map<string, bufferlist> *out)
 {
   utime_t start = ceph_clock_now();
-  auto cf = get_cf_handle(prefix);
-  if (cf) {
+  // one MultiGet lets rocksdb share the memtable and block lookups
+  auto shards = get_cf_handles(prefix);
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs;
+  std::vector<rocksdb::Slice> slices;
+  std::vector<string> combined;  // keys in the default cf carry the prefix
+  cfs.reserve(keys.size());
+  slices.reserve(keys.size());
+  if (shards) {
     for (auto& key : keys) {
-      std::string value;
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    cf,
-			    rocksdb::Slice(key),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value);
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(cct, status.ToString());
-      }
+      cfs.push_back(get_shard_handle(*shards, key.data(), key.size()));
+      slices.emplace_back(key);
     }
   } else {
+    combined.reserve(keys.size());
     for (auto& key : keys) {
-      std::string value;
-      string k = combine_strings(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    default_cf,
-			    rocksdb::Slice(k),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value);
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(cct, status.ToString());
-      }
+      combined.push_back(combine_strings(prefix, key));
+      cfs.push_back(default_cf);
+      slices.emplace_back(combined.back());
+    }
+  }
+  std::vector<std::string> values;
+  auto statuses = db->MultiGet(rocksdb::ReadOptions(), cfs, slices, &values);
+  auto key = keys.begin();
+  for (size_t i = 0; i < statuses.size(); ++i, ++key) {
+    if (statuses[i].ok()) {
+      (*out)[*key].append(values[i]);
+    } else if (statuses[i].IsIOError()) {
+      ceph_abort_msg(cct, statuses[i].ToString());
     }
   }
   utime_t lat = ceph_clock_now() - start;
@@ -1058,7 +1325,7 @@ int RocksDBStore::get(
   int r = 0;
   string value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix);
+  auto cf = get_cf_handle(prefix, key);
   if (cf) {
     s = db->Get(rocksdb::ReadOptions(),
 		cf,
@@ -1095,7 +1362,7 @@ int RocksDBStore::get(
   int r = 0;
   string value;
   rocksdb::Status s;
-  auto cf = get_cf_handle(prefix);
+  auto cf = get_cf_handle(prefix, key, keylen);
   if (cf) {
     s = db->Get(rocksdb::ReadOptions(),
 		cf,
@@ -1122,6 +1389,112 @@ int RocksDBStore::get(
   return r;
 }
 
+int RocksDBStore::get_range(
+  const string &prefix,
+  const string &start,
+  bool after,
+  const string &end,
+  size_t skip,
+  size_t max_keys,
+  size_t max_bytes,
+  bufferlist *out,
+  bool *more)
+{
+  auto shards = get_cf_handles(prefix);
+  if (shards && shards->handles.size() > 1 &&
+      (start.size() < shards->hash_h || end.size() < shards->hash_h ||
+       start.compare(0, shards->hash_h, end, 0, shards->hash_h) != 0)) {
+    // the range may span shards; only the merging iterator can keep the
+    // keys in order
+    return KeyValueDB::get_range(prefix, start, after, end, skip,
+				 max_keys, max_bytes, out, more);
+  }
+  utime_t t0 = ceph_clock_now();
+
+  // keys in the default column family carry "prefix\0"
+  rocksdb::ColumnFamilyHandle *cf = default_cf;
+  string lower, upper;
+  if (shards) {
+    // every key in the range shares the hashed bytes of its bounds (the
+    // onode id for omap), so they all live in start's shard
+    cf = get_shard_handle(*shards, start.data(), start.size());
+    lower = start;
+    upper = end;
+  } else {
+    lower = combine_strings(prefix, start);
+    if (end.empty()) {
+      upper = prefix;
+      upper.push_back(1);
+    } else {
+      upper = combine_strings(prefix, end);
+    }
+    skip += prefix.size() + 1;
+  }
+
+  // let rocksdb stop at the end of the range rather than us, and read
+  // ahead when we expect to go through a lot of it
+  rocksdb::ReadOptions opts;
+  rocksdb::Slice upper_slice(upper);
+  if (!upper.empty()) {
+    opts.iterate_upper_bound = &upper_slice;
+  }
+  opts.readahead_size = std::min<uint64_t>(
+    max_bytes, cct->_conf->get_val<uint64_t>("rocksdb_range_readahead"));
+  std::unique_ptr<rocksdb::Iterator> it(db->NewIterator(opts, cf));
+  it->Seek(lower);
+  if (after && it->Valid() && it->key() == rocksdb::Slice(lower)) {
+    it->Next();
+  }
+
+  // copy everything into a few large buffers, not one per key
+  const size_t chunk = std::max<size_t>(
+    4096, std::min<size_t>(max_bytes, 1 << 20));
+  bufferptr arena;
+  size_t used = 0;
+  size_t total = 0;
+  auto put = [&](const char *p, size_t l) {
+    ceph_le32 len;
+    len = l;
+    size_t need = sizeof(len) + l;
+    if (arena.length() - used < need) {
+      if (used) {
+	out->append(arena, 0, used);
+      }
+      arena = buffer::create(std::max(chunk, need));
+      used = 0;
+    }
+    memcpy(arena.c_str() + used, &len, sizeof(len));
+    memcpy(arena.c_str() + used + sizeof(len), p, l);
+    used += need;
+    total += need;
+  };
+
+  int num = 0;
+  *more = false;
+  for (; it->Valid(); it->Next()) {
+    if ((size_t)num >= max_keys || total >= max_bytes) {
+      *more = true;
+      break;
+    }
+    rocksdb::Slice k = it->key();
+    rocksdb::Slice v = it->value();
+    assert(k.size() >= skip);
+    put(k.data() + skip, k.size() - skip);
+    put(v.data(), v.size());
+    ++num;
+  }
+  if (used) {
+    out->append(arena, 0, used);
+  }
+  if (!it->status().ok()) {
+    ceph_abort_msg(cct, it->status().ToString());
+  }
+  logger->inc(l_rocksdb_get_range);
+  logger->inc(l_rocksdb_get_range_keys, num);
+  logger->tinc(l_rocksdb_get_range_latency, ceph_clock_now() - t0);
+  return num;
+}
+
 int RocksDBStore::split_key(rocksdb::Slice in, string *prefix, string *key)
 {
   size_t prefix_len = 0;
@@ -1155,6 +1528,18 @@ void RocksDBStore::compact()
   }
 }
 
+void RocksDBStore::compact_prefix(const string& prefix)
+{
+  auto shards = get_cf_handles(prefix);
+  if (!shards) {
+    compact_range(prefix, past_prefix(prefix));
+    return;
+  }
+  rocksdb::CompactRangeOptions options;
+  for (auto cf : shards->handles) {
+    db->CompactRange(options, cf, nullptr, nullptr);
+  }
+}
 
 void RocksDBStore::compact_thread_entry()
 {
@@ -1238,14 +1623,23 @@ void RocksDBStore::compact_range(const string& start, const string& end)
 
 int64_t RocksDBStore::request_cache_bytes(PriorityCache::Priority pri, uint64_t chunk_bytes) const
 {
-  auto cache = bbt_opts.block_cache;
   int64_t assigned = get_cache_bytes(pri);
 
+  // dedicated column family caches are carved out of our share, so their
+  // usage counts against it as well
+  std::vector<rocksdb::Cache*> caches = { bbt_opts.block_cache.get() };
+  for (auto& p : cf_caches) {
+    caches.push_back(p.second.cache.get());
+  }
+
   switch (pri) {
   // PRI0 is for rocksdb's high priority items (indexes/filters)
   case PriorityCache::Priority::PRI0:
     {
-      int64_t usage = cache->GetHighPriPoolUsage();
+      int64_t usage = 0;
+      for (auto cache : caches) {
+	usage += cache->GetHighPriPoolUsage();
+      }
 
       // RocksDB sometimes flushes the high pri cache when the low priority
       // cache exceeds the soft cap, so in that case use a "watermark" for 
@@ -1260,7 +1654,10 @@ int64_t RocksDBStore::request_cache_bytes(PriorityCache::Priority pri, uint64_t
   // All other cache items are currently shoved into the LAST priority. 
   case PriorityCache::Priority::LAST:
     { 
-      uint64_t usage = cache->GetUsage() - cache->GetHighPriPoolUsage();
+      uint64_t usage = 0;
+      for (auto cache : caches) {
+	usage += cache->GetUsage() - cache->GetHighPriPoolUsage();
+      }
       dout(10) << __func__ << " low pri pool usage: " << usage << dendl;
       int64_t request = PriorityCache::get_chunk(usage, chunk_bytes);
       return (request > assigned) ? request - assigned : 0;
@@ -1273,7 +1670,11 @@ int64_t RocksDBStore::request_cache_bytes(PriorityCache::Priority pri, uint64_t
 
 int64_t RocksDBStore::get_cache_usage() const
 {
-  return static_cast<int64_t>(bbt_opts.block_cache->GetUsage());
+  int64_t usage = bbt_opts.block_cache->GetUsage();
+  for (auto& p : cf_caches) {
+    usage += p.second.cache->GetUsage();
+  }
+  return usage;
 }
 
 int64_t RocksDBStore::commit_cache_size()
@@ -1282,14 +1683,17 @@ int64_t RocksDBStore::commit_cache_size()
   int64_t total_bytes = get_cache_bytes();
 
   double ratio = (double) high_pri_bytes / total_bytes;
-  size_t old_bytes = bbt_opts.block_cache->GetCapacity();
+  size_t old_bytes = get_cache_capacity();
   dout(10) << __func__ << " old: " << old_bytes
            << ", new: " << total_bytes << dendl;
-  bbt_opts.block_cache->SetCapacity((size_t) total_bytes);
+  apply_cache_ratios(total_bytes);
   set_cache_high_pri_pool_ratio(ratio);
 
   // After setting the cache sizes, updated the high pri watermark. 
   int64_t high_pri_pool_usage = bbt_opts.block_cache->GetHighPriPoolUsage();
+  for (auto& p : cf_caches) {
+    high_pri_pool_usage += p.second.cache->GetHighPriPoolUsage();
+  }
   if (high_pri_watermark < high_pri_pool_usage) {
     high_pri_watermark = high_pri_pool_usage;
   } else {
@@ -1308,11 +1712,18 @@ int RocksDBStore::set_cache_high_pri_pool_ratio(double ratio)
           << bbt_opts.block_cache->GetHighPriPoolRatio() << " new ratio: "
           << ratio << dendl;
   bbt_opts.block_cache->SetHighPriPoolRatio(ratio);
+  for (auto& p : cf_caches) {
+    p.second.cache->SetHighPriPoolRatio(ratio);
+  }
   return 0;
 }
 
 int64_t RocksDBStore::get_cache_capacity() {
-  return bbt_opts.block_cache->GetCapacity();
+  int64_t capacity = bbt_opts.block_cache->GetCapacity();
+  for (auto& p : cf_caches) {
+    capacity += p.second.cache->GetCapacity();
+  }
+  return capacity;
 }
 
 RocksDBStore::RocksDBWholeSpaceIteratorImpl::~RocksDBWholeSpaceIteratorImpl()
@@ -1444,10 +1855,268 @@ string RocksDBStore::past_prefix(const string &prefix)
   return limit;
 }
 
+//
+// Merges the iterators of several column families into one ordered key
+// space.  Keys of the default column family carry their prefix; keys of
+// the others belong to the prefix they were added with.  Comparing
+// (prefix, key) pairs gives the same order as the combined keys, since
+// the separator sorts before any prefix byte.
+//
+class RocksDBStore::ShardMergeIteratorImpl
+  : public KeyValueDB::WholeSpaceIteratorImpl
+{
+  struct source_t {
+    string prefix;          ///< empty for the default column family
+    rocksdb::Iterator *it;
+    bool off = false;       ///< placed outside of the range we seeked to
+    source_t(const string& p, rocksdb::Iterator *i) : prefix(p), it(i) {}
+    bool valid() const {
+      return !off && it->Valid();
+    }
+  };
+  rocksdb::DB *db;
+  const rocksdb::Snapshot *snapshot;
+  vector<source_t> srcs;
+  int cur = -1;
+  bool forward = true;
+
+  void split(const source_t& s, rocksdb::Slice *p, rocksdb::Slice *k) {
+    rocksdb::Slice key = s.it->key();
+    if (!s.prefix.empty()) {
+      *p = rocksdb::Slice(s.prefix);
+      *k = key;
+      return;
+    }
+    const char *sep = static_cast<const char*>(
+      memchr(key.data(), 0, key.size()));
+    if (!sep) {
+      *p = key;
+      *k = rocksdb::Slice();
+      return;
+    }
+    size_t plen = sep - key.data();
+    *p = rocksdb::Slice(key.data(), plen);
+    *k = rocksdb::Slice(sep + 1, key.size() - plen - 1);
+  }
+  int cmp(const source_t& a, const source_t& b) {
+    rocksdb::Slice ap, ak, bp, bk;
+    split(a, &ap, &ak);
+    split(b, &bp, &bk);
+    int c = ap.compare(bp);
+    return c ? c : ak.compare(bk);
+  }
+  void pick() {
+    cur = -1;
+    for (unsigned i = 0; i < srcs.size(); ++i) {
+      if (!srcs[i].valid()) {
+	continue;
+      }
+      if (cur < 0 ||
+	  (forward ? cmp(srcs[i], srcs[cur]) < 0 :
+	             cmp(srcs[i], srcs[cur]) > 0)) {
+	cur = i;
+      }
+    }
+  }
+  /// place every source at its first key >= prefix/key
+  void seek_ge(const string& prefix, const string& key) {
+    for (auto& s : srcs) {
+      s.off = false;
+      if (s.prefix.empty()) {
+	s.it->Seek(combine_strings(prefix, key));
+	continue;
+      }
+      int c = s.prefix.compare(prefix);
+      if (c < 0) {
+	s.off = true;
+      } else if (c == 0) {
+	s.it->Seek(key);
+      } else {
+	s.it->SeekToFirst();
+      }
+    }
+    forward = true;
+    pick();
+  }
+  /// place every source at its last key < prefix/key
+  void seek_lt(const string& prefix, const string& key) {
+    for (auto& s : srcs) {
+      s.off = false;
+      int c = s.prefix.empty() ? 0 : s.prefix.compare(prefix);
+      if (c < 0) {
+	s.it->SeekToLast();
+      } else if (c == 0) {
+	s.it->Seek(s.prefix.empty() ? combine_strings(prefix, key) : key);
+	if (s.it->Valid()) {
+	  s.it->Prev();
+	} else {
+	  s.it->SeekToLast();
+	}
+      } else {
+	s.off = true;
+      }
+    }
+    forward = false;
+    pick();
+  }
+
+public:
+  explicit ShardMergeIteratorImpl(rocksdb::DB *db)
+    : db(db), snapshot(db->GetSnapshot()) {}
+  ~ShardMergeIteratorImpl() override {
+    for (auto& s : srcs) {
+      delete s.it;
+    }
+    db->ReleaseSnapshot(snapshot);
+  }
+
+  void add_source(const string& prefix, rocksdb::ColumnFamilyHandle *cf) {
+    rocksdb::ReadOptions options;
+    options.snapshot = snapshot;
+    srcs.emplace_back(prefix, db->NewIterator(options, cf));
+  }
+
+  int seek_to_first() override {
+    for (auto& s : srcs) {
+      s.off = false;
+      s.it->SeekToFirst();
+    }
+    forward = true;
+    pick();
+    return status();
+  }
+  int seek_to_first(const string &prefix) override {
+    seek_ge(prefix, string());
+    return status();
+  }
+  int seek_to_last() override {
+    for (auto& s : srcs) {
+      s.off = false;
+      s.it->SeekToLast();
+    }
+    forward = false;
+    pick();
+    return status();
+  }
+  int seek_to_last(const string &prefix) override {
+    string limit = past_prefix(prefix);
+    for (auto& s : srcs) {
+      s.off = false;
+      if (s.prefix.empty()) {
+	s.it->Seek(limit);
+	if (s.it->Valid()) {
+	  s.it->Prev();
+	} else {
+	  s.it->SeekToLast();
+	}
+      } else if (s.prefix.compare(prefix) <= 0) {
+	s.it->SeekToLast();
+      } else {
+	s.off = true;
+      }
+    }
+    forward = false;
+    pick();
+    return status();
+  }
+  int upper_bound(const string &prefix, const string &after) override {
+    lower_bound(prefix, after);
+    if (valid()) {
+      pair<string,string> key = raw_key();
+      if (key.first == prefix && key.second == after)
+	next();
+    }
+    return status();
+  }
+  int lower_bound(const string &prefix, const string &to) override {
+    seek_ge(prefix, to);
+    return status();
+  }
+  bool valid() override {
+    return cur >= 0;
+  }
+  int next() override {
+    if (!valid()) {
+      return status();
+    }
+    if (!forward) {
+      // bring the other sources past the current key first
+      pair<string,string> key = raw_key();
+      seek_ge(key.first, key.second);
+    }
+    srcs[cur].it->Next();
+    pick();
+    return status();
+  }
+  int prev() override {
+    if (!valid()) {
+      return status();
+    }
+    if (forward) {
+      pair<string,string> key = raw_key();
+      seek_lt(key.first, key.second);
+    } else {
+      srcs[cur].it->Prev();
+      pick();
+    }
+    return status();
+  }
+  string key() override {
+    rocksdb::Slice p, k;
+    split(srcs[cur], &p, &k);
+    return k.ToString();
+  }
+  pair<string,string> raw_key() override {
+    rocksdb::Slice p, k;
+    split(srcs[cur], &p, &k);
+    return make_pair(p.ToString(), k.ToString());
+  }
+  bool raw_key_is_prefixed(const string &prefix) override {
+    rocksdb::Slice p, k;
+    split(srcs[cur], &p, &k);
+    return p.compare(rocksdb::Slice(prefix)) == 0;
+  }
+  bufferlist value() override {
+    return to_bufferlist(srcs[cur].it->value());
+  }
+  bufferptr value_as_ptr() override {
+    rocksdb::Slice val = srcs[cur].it->value();
+    return bufferptr(val.data(), val.size());
+  }
+  int status() override {
+    for (auto& s : srcs) {
+      if (!s.it->status().ok()) {
+	return -1;
+      }
+    }
+    return 0;
+  }
+  size_t key_size() override {
+    size_t size = srcs[cur].it->key().size();
+    if (!srcs[cur].prefix.empty()) {
+      size += srcs[cur].prefix.size() + 1;
+    }
+    return size;
+  }
+  size_t value_size() override {
+    return srcs[cur].it->value().size();
+  }
+};
+
 RocksDBStore::WholeSpaceIterator RocksDBStore::get_wholespace_iterator()
 {
-  return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
-    db->NewIterator(rocksdb::ReadOptions(), default_cf));
+  if (cf_shards.empty()) {
+    return std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+      db->NewIterator(rocksdb::ReadOptions(), default_cf));
+  }
+  auto it = std::make_shared<ShardMergeIteratorImpl>(db);
+  it->add_source(string(), default_cf);
+  for (auto& p : cf_shards) {
+    for (auto cf : p.second.handles) {
+      it->add_source(p.first, cf);
+    }
+  }
+  return it;
 }
 
 class CFIteratorImpl : public KeyValueDB::IteratorImpl {
@@ -1517,13 +2186,185 @@ public:
 
 KeyValueDB::Iterator RocksDBStore::get_iterator(const std::string& prefix)
 {
-  rocksdb::ColumnFamilyHandle *cf_handle =
-    static_cast<rocksdb::ColumnFamilyHandle*>(get_cf_handle(prefix));
-  if (cf_handle) {
+  auto shards = get_cf_handles(prefix);
+  if (!shards) {
+    // the whole space iterator would merge in every column family
+    return std::make_shared<PrefixIteratorImpl>(
+      prefix,
+      std::make_shared<RocksDBWholeSpaceIteratorImpl>(
+	db->NewIterator(rocksdb::ReadOptions(), default_cf)));
+  }
+  if (shards->handles.size() == 1) {
     return std::make_shared<CFIteratorImpl>(
       prefix,
-      db->NewIterator(rocksdb::ReadOptions(), cf_handle));
-  } else {
-    return KeyValueDB::get_iterator(prefix);
+      db->NewIterator(rocksdb::ReadOptions(), shards->handles.front()));
+  }
+  auto it = std::make_shared<ShardMergeIteratorImpl>(db);
+  for (auto cf : shards->handles) {
+    it->add_source(prefix, cf);
+  }
+  return std::make_shared<PrefixIteratorImpl>(prefix, it);
+}
+
+int RocksDBStore::reshard(const vector<ColumnFamily>& new_cfs, ostream &out)
+{
+  assert(db);
+  string new_spec = dump_column_families(new_cfs);
+  dout(1) << __func__ << " '" << dump_column_families(sharding) << "' -> '"
+	  << new_spec << "'" << dendl;
+
+  // until we are done the db can only be opened to finish the job
+  int r = write_sharding(RESHARDING_FILE, new_spec);
+  if (r < 0) {
+    return r;
+  }
+
+  // create what is missing; column families with the right name are reused
+  rocksdb::Options base = db->GetOptions(default_cf);
+  for (auto& p : new_cfs) {
+    for (uint32_t i = 0; i < p.shard_cnt; ++i) {
+      string name = p.get_shard_name(i);
+      if (cf_handles.count(name)) {
+	continue;
+      }
+      rocksdb::ColumnFamilyOptions cf_opt;
+      r = prepare_cf_options(p.name, p.option, base, &cf_opt);
+      if (r < 0) {
+	return r;
+      }
+      rocksdb::ColumnFamilyHandle *cf;
+      rocksdb::Status status = db->CreateColumnFamily(cf_opt, name, &cf);
+      if (!status.ok()) {
+	derr << __func__ << " failed to create column family " << name
+	     << ": " << status.ToString() << dendl;
+	return -EIO;
+      }
+      add_column_family(name, static_cast<void*>(cf));
+      out << "created column family " << name << std::endl;
+    }
   }
+  std::unordered_map<string, prefix_shards> new_shards;
+  r = update_shard_map(new_cfs, &new_shards);
+  if (r < 0) {
+    return r;
+  }
+
+  // which prefix does each column family hold?  leftovers of an earlier,
+  // interrupted reshard are not in either layout and go by their name.
+  std::map<rocksdb::ColumnFamilyHandle*, string> cf_prefix;
+  for (auto& p : cf_shards) {
+    for (auto cf : p.second.handles) {
+      cf_prefix[cf] = p.first;
+    }
+  }
+  for (auto& p : new_shards) {
+    for (auto cf : p.second.handles) {
+      cf_prefix[cf] = p.first;
+    }
+  }
+  vector<rocksdb::ColumnFamilyHandle*> sources = { default_cf };
+  for (auto& p : cf_handles) {
+    auto cf = static_cast<rocksdb::ColumnFamilyHandle*>(p.second);
+    cf_prefix.insert(make_pair(cf, p.first));
+    sources.push_back(cf);
+  }
+
+  // move every key that lands elsewhere; put and delete share a batch so
+  // an interruption never loses or duplicates a key
+  uint64_t moved = 0;
+  rocksdb::WriteBatch bat;
+  rocksdb::WriteOptions woptions;
+  for (auto src : sources) {
+    std::unique_ptr<rocksdb::Iterator> it(
+      db->NewIterator(rocksdb::ReadOptions(), src));
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      rocksdb::Slice raw = it->key();
+      string prefix, key;
+      if (src == default_cf) {
+	if (split_key(raw, &prefix, &key) < 0) {
+	  continue;
+	}
+      } else {
+	prefix = cf_prefix[src];
+	key = raw.ToString();
+      }
+      rocksdb::ColumnFamilyHandle *dst = default_cf;
+      auto q = new_shards.find(prefix);
+      if (q != new_shards.end()) {
+	dst = get_shard_handle(q->second, key.data(), key.size());
+      }
+      if (dst == src) {
+	continue;
+      }
+      if (dst == default_cf) {
+	bat.Put(dst, combine_strings(prefix, key), it->value());
+      } else {
+	bat.Put(dst, key, it->value());
+      }
+      bat.Delete(src, raw);
+      if (++moved % RESHARD_BATCH_KEYS == 0) {
+	rocksdb::Status status = db->Write(woptions, &bat);
+	if (!status.ok()) {
+	  derr << __func__ << " write failed: " << status.ToString() << dendl;
+	  return -EIO;
+	}
+	bat.Clear();
+	dout(10) << __func__ << " moved " << moved << " keys" << dendl;
+      }
+    }
+    if (!it->status().ok()) {
+      derr << __func__ << " iteration failed: " << it->status().ToString()
+	   << dendl;
+      return -EIO;
+    }
+  }
+  woptions.sync = true;
+  rocksdb::Status status = db->Write(woptions, &bat);
+  if (!status.ok()) {
+    derr << __func__ << " write failed: " << status.ToString() << dendl;
+    return -EIO;
+  }
+  out << "moved " << moved << " keys" << std::endl;
+
+  // switch over.  the new layout is recorded first so that an interruption
+  // from here on only leaves empty column families behind.
+  r = write_sharding(SHARDING_DEF_FILE, new_spec);
+  if (r < 0) {
+    return r;
+  }
+  cf_shards.swap(new_shards);
+  sharding = new_cfs;
+
+  std::set<string> keep;
+  for (auto& p : new_cfs) {
+    for (uint32_t i = 0; i < p.shard_cnt; ++i) {
+      keep.insert(p.get_shard_name(i));
+    }
+  }
+  for (auto p = cf_handles.begin(); p != cf_handles.end(); ) {
+    if (keep.count(p->first)) {
+      ++p;
+      continue;
+    }
+    auto cf = static_cast<rocksdb::ColumnFamilyHandle*>(p->second);
+    status = db->DropColumnFamily(cf);
+    if (!status.ok()) {
+      derr << __func__ << " failed to drop column family " << p->first
+	   << ": " << status.ToString() << dendl;
+      return -EIO;
+    }
+    db->DestroyColumnFamilyHandle(cf);
+    out << "dropped column family " << p->first << std::endl;
+    p = cf_handles.erase(p);
+  }
+  status = get_env()->DeleteFile(path + "/" + RESHARDING_FILE);
+  if (!status.ok()) {
+    derr << __func__ << " failed to remove " << RESHARDING_FILE << ": "
+	 << status.ToString() << dendl;
+    return -EIO;
+  }
+
+  // get rid of the tombstones we left behind
+  compact();
+  return 0;
 }
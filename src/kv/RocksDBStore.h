@@ -33,6 +33,9 @@ enum {
   l_rocksdb_txns,
   l_rocksdb_txns_sync,
   l_rocksdb_get_latency,
+  l_rocksdb_get_range,
+  l_rocksdb_get_range_keys,
+  l_rocksdb_get_range_latency,
   l_rocksdb_submit_latency,
   l_rocksdb_submit_sync_latency,
   l_rocksdb_compact,
@@ -81,18 +84,46 @@ class RocksDBStore : public KeyValueDB {
   string options_str;
 
   uint64_t cache_size = 0;
+  uint64_t block_cache_size = 0;
   bool set_cache_flag = false;
 
   bool must_close_default_cf = false;
   rocksdb::ColumnFamilyHandle *default_cf = nullptr;
 
+  /// column families backing one prefix, and how keys are spread over them
+  struct prefix_shards {
+    uint32_t hash_l = 0;
+    uint32_t hash_h = UINT32_MAX;
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  };
+  std::unordered_map<string, prefix_shards> cf_shards; ///< prefix -> shards
+  vector<ColumnFamily> sharding;  ///< layout in use, as found on disk
+
+  /// dedicated block caches, carved out of the kv cache (prefix -> cache)
+  struct cf_cache_t {
+    double ratio = 0;
+    std::shared_ptr<rocksdb::Cache> cache;
+  };
+  std::map<string, cf_cache_t> cf_caches;
+  double cf_cache_ratio = 0;  ///< sum of cf_caches ratios
+
   int submit_common(rocksdb::WriteOptions& woptions, KeyValueDB::Transaction t);
   int install_cf_mergeop(const string &cf_name, rocksdb::ColumnFamilyOptions *cf_opt);
+  int prepare_cf_options(const string& prefix, const string& options,
+			 const rocksdb::Options& base,
+			 rocksdb::ColumnFamilyOptions *cf_opt);
+  void apply_cache_ratios(uint64_t total);
   int create_db_dir();
   int do_open(ostream &out, bool create_if_missing,
 	      const vector<ColumnFamily>* cfs = nullptr);
   int load_rocksdb_options(bool create_if_missing, rocksdb::Options& opt);
 
+  rocksdb::Env *get_env();
+  int read_sharding(const string& fn, string *spec);
+  int write_sharding(const string& fn, const string& spec);
+  int update_shard_map(const vector<ColumnFamily>& cfs,
+		       std::unordered_map<string, prefix_shards> *shards);
+
   // manage async compactions
   Mutex compact_queue_lock;
   Cond compact_queue_cond;
@@ -131,9 +162,7 @@ public:
   static int _test_init(const string& dir);
   int init(string options_str) override;
   /// compact rocksdb for all keys with a given prefix
-  void compact_prefix(const string& prefix) override {
-    compact_range(prefix, past_prefix(prefix));
-  }
+  void compact_prefix(const string& prefix) override;
   void compact_prefix_async(const string& prefix) override {
     compact_range_async(prefix, past_prefix(prefix));
   }
@@ -176,13 +205,35 @@ public:
 
   void close() override;
 
-  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& cf_name) {
-    auto iter = cf_handles.find(cf_name);
-    if (iter == cf_handles.end())
+  /// column family for prefix, if it is not hash sharded
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix) {
+    auto iter = cf_shards.find(prefix);
+    if (iter == cf_shards.end() || iter->second.handles.size() != 1)
+      return nullptr;
+    return iter->second.handles.front();
+  }
+  /// column family holding prefix/key, or nullptr for the default one
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix,
+					     const char *key, size_t keylen) {
+    auto iter = cf_shards.find(prefix);
+    if (iter == cf_shards.end())
+      return nullptr;
+    return get_shard_handle(iter->second, key, keylen);
+  }
+  rocksdb::ColumnFamilyHandle *get_cf_handle(const std::string& prefix,
+					     const std::string& key) {
+    return get_cf_handle(prefix, key.data(), key.size());
+  }
+  static rocksdb::ColumnFamilyHandle *get_shard_handle(
+    const prefix_shards& shards, const char *key, size_t keylen);
+  /// all column families holding prefix, or nullptr for the default one
+  const prefix_shards *get_cf_handles(const std::string& prefix) {
+    auto iter = cf_shards.find(prefix);
+    if (iter == cf_shards.end())
       return nullptr;
-    else
-      return static_cast<rocksdb::ColumnFamilyHandle*>(iter->second);
+    return &iter->second;
   }
+  int reshard(const vector<ColumnFamily>& new_cfs, ostream &out) override;
   int repair(std::ostream &out) override;
   void split_stats(const std::string &s, char delim, std::vector<std::string> &elems);
   void get_statistics(Formatter *f) override;
@@ -349,6 +400,16 @@ public:
     const char *key,
     size_t keylen,
     bufferlist *out) override;
+  int get_range(
+    const std::string &prefix,
+    const std::string &start,
+    bool after,
+    const std::string &end,
+    size_t skip,
+    size_t max_keys,
+    size_t max_bytes,
+    bufferlist *out,
+    bool *more) override;
 
 
   class RocksDBWholeSpaceIteratorImpl :
@@ -380,6 +441,7 @@ public:
     size_t value_size() override;
   };
 
+  class ShardMergeIteratorImpl;
   Iterator get_iterator(const std::string& prefix) override;
 
   /// Utility
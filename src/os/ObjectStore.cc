@@ -151,6 +151,63 @@ int ObjectStore::read_meta(const std::string& key,
   return 0;
 }
 
+int ObjectStore::omap_get_range(
+  CollectionHandle &c,
+  const ghobject_t &oid,
+  const string &start_after,
+  const string &filter_prefix,
+  size_t max_keys,
+  size_t max_bytes,
+  bufferlist *out,
+  bool *more)
+{
+  *more = false;
+  ObjectMap::ObjectMapIterator iter = get_omap_iterator(c, oid);
+  if (!iter) {
+    return -ENOENT;
+  }
+  iter->upper_bound(start_after);
+  if (filter_prefix > start_after) {
+    iter->lower_bound(filter_prefix);
+  }
+  unsigned len = out->length();
+  int num = 0;
+  for (; iter->valid(); iter->next(false)) {
+    string key = iter->key();
+    if (key.compare(0, filter_prefix.size(), filter_prefix) != 0) {
+      break;
+    }
+    if ((size_t)num >= max_keys || out->length() - len >= max_bytes) {
+      *more = true;
+      break;
+    }
+    encode(key, *out);
+    encode(iter->value(), *out);
+    ++num;
+  }
+  return num;
+}
+
+int ObjectStore::readv(
+  CollectionHandle &c,
+  vector<ReadvOp>& ops,
+  uint32_t op_flags)
+{
+  for (auto& op : ops) {
+    op.bl.clear();
+    op.omap.clear();
+    op.r = 0;
+    op.omap_r = 0;
+    if (op.want_data) {
+      op.r = read(c, op.oid, op.offset, op.length, op.bl, op_flags);
+    }
+    if (!op.omap_keys.empty()) {
+      op.omap_r = omap_get_values(c, op.oid, op.omap_keys, &op.omap);
+    }
+  }
+  return 0;
+}
+
 
 
 
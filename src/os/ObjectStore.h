@@ -27,6 +27,8 @@
 #include <sys/stat.h>
 #include <vector>
 #include <map>
+#include <numeric>
+#include <boost/container/small_vector.hpp>
 
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__sun)
 #include <sys/statvfs.h>
@@ -432,20 +434,19 @@ public:
       }
     } __attribute__ ((packed)) ;
 
+    /// collections and objects referenced by ops, indexed by their id
+    typedef boost::container::small_vector<coll_t, 2> coll_index_t;
+    typedef boost::container::small_vector<ghobject_t, 4> object_index_t;
+
   private:
     TransactionData data;
 
-    map<coll_t, __le32> coll_index;
-    map<ghobject_t, __le32> object_index;
-
-    __le32 coll_id {0};
-    __le32 object_id {0};
+    coll_index_t coll_index;
+    object_index_t object_index;
 
     bufferlist data_bl;
     bufferlist op_bl;
 
-    bufferptr op_ptr;
-
     list<Context *> on_applied;
     list<Context *> on_commit;
     list<Context *> on_applied_sync;
@@ -466,32 +467,26 @@ public:
       data(std::move(other.data)),
       coll_index(std::move(other.coll_index)),
       object_index(std::move(other.object_index)),
-      coll_id(other.coll_id),
-      object_id(other.object_id),
       data_bl(std::move(other.data_bl)),
       op_bl(std::move(other.op_bl)),
-      op_ptr(std::move(other.op_ptr)),
       on_applied(std::move(other.on_applied)),
       on_commit(std::move(other.on_commit)),
       on_applied_sync(std::move(other.on_applied_sync)) {
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.coll_index.clear();
+      other.object_index.clear();
     }
 
     Transaction& operator=(Transaction&& other) noexcept {
       data = std::move(other.data);
       coll_index = std::move(other.coll_index);
       object_index = std::move(other.object_index);
-      coll_id = other.coll_id;
-      object_id = other.object_id;
       data_bl = std::move(other.data_bl);
       op_bl = std::move(other.op_bl);
-      op_ptr = std::move(other.op_ptr);
       on_applied = std::move(other.on_applied);
       on_commit = std::move(other.on_commit);
       on_applied_sync = std::move(other.on_applied_sync);
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.coll_index.clear();
+      other.object_index.clear();
       return *this;
     }
 
@@ -499,7 +494,7 @@ public:
     Transaction& operator=(const Transaction& other) = default;
 
     // expose object_index for FileStore::Op's benefit
-    const map<ghobject_t, __le32>& get_object_index() const {
+    const object_index_t& get_object_index() const {
       return object_index;
     }
 
@@ -587,10 +582,8 @@ public:
       std::swap(on_commit, other.on_commit);
       std::swap(on_applied_sync, other.on_applied_sync);
 
-      std::swap(coll_index, other.coll_index);
-      std::swap(object_index, other.object_index);
-      std::swap(coll_id, other.coll_id);
-      std::swap(object_id, other.object_id);
+      coll_index.swap(other.coll_index);
+      object_index.swap(other.object_index);
       op_bl.swap(other.op_bl);
       data_bl.swap(other.data_bl);
     }
@@ -721,20 +714,14 @@ public:
 
       //append coll_index & object_index
       vector<__le32> cm(other.coll_index.size());
-      map<coll_t, __le32>::iterator coll_index_p;
-      for (coll_index_p = other.coll_index.begin();
-           coll_index_p != other.coll_index.end();
-           ++coll_index_p) {
-        cm[coll_index_p->second] = _get_coll_id(coll_index_p->first);
+      for (unsigned i = 0; i < other.coll_index.size(); ++i) {
+        cm[i] = _get_coll_id(other.coll_index[i]);
       }
 
       vector<__le32> om(other.object_index.size());
-      map<ghobject_t, __le32>::iterator object_index_p;
-      for (object_index_p = other.object_index.begin();
-           object_index_p != other.object_index.end();
-           ++object_index_p) {
-        om[object_index_p->second] = _get_object_id(object_index_p->first);
-      }      
+      for (unsigned i = 0; i < other.object_index.size(); ++i) {
+        om[i] = _get_object_id(other.object_index[i]);
+      }
 
       //the other.op_bl SHOULD NOT be changes during append operation,
       //we use additional bufferlist to avoid this problem
@@ -769,13 +756,13 @@ public:
       final_size += (coll_index.size() + object_index.size()) * sizeof(__le32);
 
       // coll_index first
-      for (auto p = coll_index.begin(); p != coll_index.end(); ++p) {
-	final_size += p->first.encoded_size();
+      for (auto& c : coll_index) {
+	final_size += c.encoded_size();
       }
 
       // object_index first
-      for (auto p = object_index.begin(); p != object_index.end(); ++p) {
-	final_size += p->first.encoded_size();
+      for (auto& o : object_index) {
+	final_size += o.encoded_size();
       }
 
       return data_bl.length() +
@@ -788,8 +775,8 @@ public:
       using ceph::encode;
       //layout: data_bl + op_bl + coll_index + object_index + data
       bufferlist bl;
-      encode(coll_index, bl);
-      encode(object_index, bl);
+      _encode_index(coll_index, bl);
+      _encode_index(object_index, bl);
 
       return data_bl.length() +
 	op_bl.length() +
@@ -848,32 +835,18 @@ public:
       bufferlist::const_iterator data_bl_p;
 
     public:
-      vector<coll_t> colls;
-      vector<ghobject_t> objects;
+      const coll_index_t& colls;
+      const object_index_t& objects;
 
     private:
       explicit iterator(Transaction *t)
         : t(t),
 	  data_bl_p(t->data_bl.cbegin()),
-          colls(t->coll_index.size()),
-          objects(t->object_index.size()) {
+          colls(t->coll_index),
+          objects(t->object_index) {
 
         ops = t->data.ops;
         op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
-
-        map<coll_t, __le32>::iterator coll_index_p;
-        for (coll_index_p = t->coll_index.begin();
-             coll_index_p != t->coll_index.end();
-             ++coll_index_p) {
-          colls[coll_index_p->second] = coll_index_p->first;
-        }
-
-        map<ghobject_t, __le32>::iterator object_index_p;
-        for (object_index_p = t->object_index.begin();
-             object_index_p != t->object_index.end();
-             ++object_index_p) {
-          objects[object_index_p->second] = object_index_p->first;
-        }
       }
 
       friend class Transaction;
@@ -954,35 +927,76 @@ private:
      * form of seat belts for the decoder.
      */
     Op* _get_next_op() {
-      if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
-        op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
+      // Op slots are carved out of a per-thread arena shared by every
+      // Transaction built on that thread (e.g. an OSD shard), so building
+      // a transaction rarely allocates for its ops.  Slots taken back to
+      // back are contiguous and coalesce into a single op_bl segment.
+      static thread_local bufferptr op_arena;
+      if (op_arena.length() == 0 || op_arena.offset() >= op_arena.length()) {
+        op_arena = bufferptr(sizeof(Op) * OPS_PER_PTR);
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      op_bl.append(op_arena, 0, sizeof(Op));
 
-      op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
+      char* p = op_arena.c_str();
+      op_arena.set_offset(op_arena.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       memset(p, 0, sizeof(Op));
       return reinterpret_cast<Op*>(p);
     }
+    // A transaction touches only a handful of collections and objects,
+    // so a linear scan of the flat index beats a node-based map.  Scan
+    // from the back: ops usually refer to the object named last.
     __le32 _get_coll_id(const coll_t& coll) {
-      map<coll_t, __le32>::iterator c = coll_index.find(coll);
-      if (c != coll_index.end())
-        return c->second;
-
-      __le32 index_id = coll_id++;
-      coll_index[coll] = index_id;
-      return index_id;
+      for (unsigned i = coll_index.size(); i > 0; --i) {
+        if (coll_index[i - 1] == coll)
+          return i - 1;
+      }
+      coll_index.push_back(coll);
+      return coll_index.size() - 1;
     }
     __le32 _get_object_id(const ghobject_t& oid) {
-      map<ghobject_t, __le32>::iterator o = object_index.find(oid);
-      if (o != object_index.end())
-        return o->second;
+      uint32_t hash = oid.hobj.get_hash();
+      for (unsigned i = object_index.size(); i > 0; --i) {
+        const ghobject_t& o = object_index[i - 1];
+        if (o.hobj.get_hash() == hash && o == oid)
+          return i - 1;
+      }
+      object_index.push_back(oid);
+      return object_index.size() - 1;
+    }
 
-      __le32 index_id = object_id++;
-      object_index[oid] = index_id;
-      return index_id;
+    /// encode an index as the map<key, __le32> it used to be, sorted by key
+    template<typename Index>
+    static void _encode_index(const Index& index, bufferlist& bl) {
+      using ceph::encode;
+      boost::container::small_vector<uint32_t, 8> order(index.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&index](uint32_t a, uint32_t b) {
+	  return index[a] < index[b];
+	});
+      __u32 n = index.size();
+      encode(n, bl);
+      for (auto i : order) {
+	encode(index[i], bl);
+	encode((__le32)i, bl);
+      }
+    }
+    template<typename Index>
+    static void _decode_index(Index& index, bufferlist::const_iterator& p) {
+      using ceph::decode;
+      __u32 n;
+      decode(n, p);
+      index.clear();
+      index.resize(n);
+      while (n--) {
+	typename Index::value_type k;
+	__le32 id;
+	decode(k, p);
+	decode(id, p);
+	if (id >= index.size())
+	  throw buffer::malformed_input("transaction index id out of range");
+	index[id] = std::move(k);
+      }
     }
 
 public:
@@ -1401,8 +1415,8 @@ public:
       ENCODE_START(9, 9, bl);
       encode(data_bl, bl);
       encode(op_bl, bl);
-      encode(coll_index, bl);
-      encode(object_index, bl);
+      _encode_index(coll_index, bl);
+      _encode_index(object_index, bl);
       data.encode(bl);
       ENCODE_FINISH(bl);
     }
@@ -1413,11 +1427,9 @@ public:
 
       decode(data_bl, bl);
       decode(op_bl, bl);
-      decode(coll_index, bl);
-      decode(object_index, bl);
+      _decode_index(coll_index, bl);
+      _decode_index(object_index, bl);
       data.decode(bl);
-      coll_id = coll_index.size();
-      object_id = object_index.size();
 
       DECODE_FINISH(bl);
     }
@@ -1655,6 +1667,90 @@ public:
      bufferlist& bl,
      uint32_t op_flags = 0) = 0;
 
+  /**
+   * read_async -- read a byte range without waiting for the device
+   *
+   * Like read(), but a store that has to go to the device may queue the
+   * I/O and return -EINPROGRESS instead of blocking the calling thread.
+   * on_complete is then completed, from a store thread and without any
+   * caller locks held, with the result read() would have returned; bl
+   * must stay valid until then.  Any other return value means the read
+   * finished inline, and on_complete is left untouched for the caller.
+   * The default implementation always finishes inline.
+   *
+   * @param cid collection for object
+   * @param oid oid of object
+   * @param offset location offset of first byte to be read
+   * @param len number of bytes to be read
+   * @param bl output bufferlist
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
+   * @param on_complete completion if the read goes asynchronous
+   * @returns -EINPROGRESS, or as read()
+   */
+  virtual int read_async(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl,
+    uint32_t op_flags,
+    Context *on_complete) {
+    return read(c, oid, offset, len, bl, op_flags);
+  }
+
+  /**
+   * is_cached -- whether an object's metadata is in memory
+   *
+   * A hint for callers that must not block: true means read_async() of
+   * oid will not have to look anything up in the backing kv store.
+   * It may be stale by the time the read is issued.
+   *
+   * @param cid collection for object
+   * @param oid oid of object
+   * @returns true if oid's metadata is cached
+   */
+  virtual bool is_cached(CollectionHandle &c, const ghobject_t& oid) {
+    return false;
+  }
+
+  /// one object's worth of work for readv()
+  struct ReadvOp {
+    ghobject_t oid;
+    uint64_t offset = 0;     ///< [in] data range; 0~0 reads the whole object
+    size_t length = 0;       ///< [in]
+    bool want_data = true;   ///< [in] false to only fetch omap_keys
+    set<string> omap_keys;   ///< [in] omap values to fetch along with data
+
+    int r = 0;               ///< [out] as read() would return
+    bufferlist bl;           ///< [out] data
+    int omap_r = 0;          ///< [out] as omap_get_values() would return
+    map<string, bufferlist> omap; ///< [out] omap values found
+
+    ReadvOp() {}
+    ReadvOp(const ghobject_t& oid, uint64_t offset, size_t length)
+      : oid(oid), offset(offset), length(length) {}
+  };
+
+  /**
+   * readv -- read data and omap values from many objects in one call
+   *
+   * Each op is completed as if by read() and, when omap_keys is not empty,
+   * omap_get_values(); per-op results land in the op itself.  Stores may
+   * use the batch to take the collection lock once, look up object
+   * metadata together and queue all device reads at once.  The default
+   * implementation simply loops.
+   *
+   * @param c collection for all objects
+   * @param ops objects and ranges to read, results are filled in
+   * @param op_flags is CEPH_OSD_OP_FLAG_*, applied to every data read
+   * @returns 0 if the batch was processed (see each op's r/omap_r), or
+   *          negative error code if none of it was.
+   */
+  virtual int readv(
+    CollectionHandle &c,
+    vector<ReadvOp>& ops,
+    uint32_t op_flags = 0);
+
   /**
    * fiemap -- get extent map of data of an object
    *
@@ -1825,6 +1921,28 @@ public:
     map<string, bufferlist> *out ///< [out] Returned keys and values
     ) = 0;
 
+  /**
+   * Get a bounded run of omap values in one go
+   *
+   * Appends encode(key) + encode(value) to out for each key after
+   * start_after that begins with filter_prefix, in order, stopping after
+   * max_keys keys or once out has grown by max_bytes.  This is exactly
+   * what an OMAPGETVALS reply carries between its count and truncated
+   * flag.  The default implementation walks get_omap_iterator().
+   *
+   * @returns number of keys appended, or negative error code
+   */
+  virtual int omap_get_range(
+    CollectionHandle &c,          ///< [in] Collection containing oid
+    const ghobject_t &oid,        ///< [in] Object containing omap
+    const string &start_after,    ///< [in] return keys after this one
+    const string &filter_prefix,  ///< [in] only keys with this prefix
+    size_t max_keys,              ///< [in] max keys to return
+    size_t max_bytes,             ///< [in] max bytes to return (soft)
+    bufferlist *out,              ///< [out] encoded key/value pairs
+    bool *more                    ///< [out] true if more keys remain
+    );
+
   /// Filters keys into out which are defined on oid
   virtual int omap_check_keys(
     CollectionHandle &c,     ///< [in] Collection containing oid
@@ -12,6 +12,7 @@
 #ifndef CEPH_OS_BLUESTORE_ALLOCATOR_H
 #define CEPH_OS_BLUESTORE_ALLOCATOR_H
 
+#include <functional>
 #include <ostream>
 #include "include/assert.h"
 #include "os/bluestore/bluestore_types.h"
@@ -45,6 +46,10 @@ public:
 
   virtual void dump() = 0;
 
+  /// enumerate every free extent; the caller must keep the allocator quiet
+  virtual void foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) = 0;
+
   virtual void init_add_free(uint64_t offset, uint64_t length) = 0;
   virtual void init_rm_free(uint64_t offset, uint64_t length) = 0;
 
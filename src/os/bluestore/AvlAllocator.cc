@@ -0,0 +1,336 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "AvlAllocator.h"
+#include "bluestore_types.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "avl_alloc 0x" << this << " "
+
+MEMPOOL_DEFINE_OBJECT_FACTORY(AvlAllocator::range_seg_t, avl_range_seg,
+			      bluestore_alloc);
+
+AvlAllocator::AvlAllocator(CephContext* cct, int64_t device_size)
+  : cct(cct),
+    num_total(device_size),
+    bf_threshold(cct->_conf->get_val<uint64_t>(
+		   "bluestore_avl_alloc_bf_threshold")),
+    bf_free_pct(cct->_conf->get_val<uint64_t>(
+		  "bluestore_avl_alloc_bf_free_pct"))
+{
+}
+
+AvlAllocator::~AvlAllocator()
+{
+  range_size_tree.clear();
+  range_tree.clear_and_dispose(dispose_rs{});
+}
+
+uint64_t AvlAllocator::_pick_block_first_fit(uint64_t *cursor,
+					     uint64_t size,
+					     uint64_t align)
+{
+  const auto compare = range_tree.key_comp();
+  auto rs_start = range_tree.lower_bound(range_seg_t{*cursor, size + *cursor},
+					 compare);
+  unsigned searched = 0;
+  for (auto rs = rs_start;
+       rs != range_tree.end() && searched < max_search_count;
+       ++rs, ++searched) {
+    uint64_t offset = p2roundup(rs->start, align);
+    if (offset + size <= rs->end) {
+      *cursor = offset + size;
+      return offset;
+    }
+  }
+  // If we reach end of the tree, wrap around to the beginning.
+  for (auto rs = range_tree.begin();
+       rs != rs_start && searched < max_search_count;
+       ++rs, ++searched) {
+    uint64_t offset = p2roundup(rs->start, align);
+    if (offset + size <= rs->end) {
+      *cursor = offset + size;
+      return offset;
+    }
+  }
+  return -1ULL;
+}
+
+uint64_t AvlAllocator::_pick_block_best_fit(uint64_t size, uint64_t align)
+{
+  // the smallest extents that are at least size long come first; we only
+  // need to go further when alignment eats into them
+  const auto compare = range_size_tree.key_comp();
+  for (auto rs = range_size_tree.lower_bound(range_seg_t{0, size}, compare);
+       rs != range_size_tree.end();
+       ++rs) {
+    uint64_t offset = p2roundup(rs->start, align);
+    if (offset + size <= rs->end) {
+      return offset;
+    }
+  }
+  return -1ULL;
+}
+
+void AvlAllocator::_add_to_tree(uint64_t start, uint64_t size)
+{
+  assert(size != 0);
+
+  uint64_t end = start + size;
+
+  auto rs_after = range_tree.upper_bound(range_seg_t{start, end},
+					 range_tree.key_comp());
+
+  /* Make sure we don't overlap with either of our neighbors */
+  auto rs_before = range_tree.end();
+  if (rs_after != range_tree.begin()) {
+    rs_before = std::prev(rs_after);
+  }
+
+  bool merge_before = (rs_before != range_tree.end() && rs_before->end == start);
+  bool merge_after = (rs_after != range_tree.end() && rs_after->start == end);
+
+  if (merge_before && merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_after->start = rs_before->start;
+    range_tree.erase_and_dispose(rs_before, dispose_rs{});
+    range_size_tree.insert(*rs_after);
+  } else if (merge_before) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    rs_before->end = end;
+    range_size_tree.insert(*rs_before);
+  } else if (merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_after->start = start;
+    range_size_tree.insert(*rs_after);
+  } else {
+    auto new_rs = new range_seg_t{start, end};
+    range_tree.insert_before(rs_after, *new_rs);
+    range_size_tree.insert(*new_rs);
+  }
+  num_free += size;
+}
+
+void AvlAllocator::_remove_from_tree(uint64_t start, uint64_t size)
+{
+  uint64_t end = start + size;
+
+  assert(size != 0);
+  assert(size <= num_free);
+
+  while (start < end) {
+    auto rs = range_tree.find(range_seg_t{start, end}, range_tree.key_comp());
+    /* Make sure we completely overlap with someone */
+    assert(rs != range_tree.end());
+    assert(rs->start <= start);
+    uint64_t rm_end = std::min(end, rs->end);
+
+    bool left_over = (rs->start != start);
+    bool right_over = (rs->end != rm_end);
+
+    range_size_tree.erase(range_size_tree.iterator_to(*rs));
+
+    if (left_over && right_over) {
+      auto new_seg = new range_seg_t{rm_end, rs->end};
+      rs->end = start;
+      range_tree.insert_before(std::next(rs), *new_seg);
+      range_size_tree.insert(*new_seg);
+      range_size_tree.insert(*rs);
+    } else if (left_over) {
+      rs->end = start;
+      range_size_tree.insert(*rs);
+    } else if (right_over) {
+      rs->start = rm_end;
+      range_size_tree.insert(*rs);
+    } else {
+      range_tree.erase_and_dispose(rs, dispose_rs{});
+    }
+    num_free -= rm_end - start;
+    start = rm_end;
+  }
+}
+
+int AvlAllocator::_allocate(uint64_t size, uint64_t unit, uint64_t *cursor,
+			    uint64_t *offset, uint64_t *length)
+{
+  uint64_t max_size = 0;
+  if (auto p = range_size_tree.rbegin(); p != range_size_tree.rend()) {
+    max_size = p->length();
+  }
+  if (max_size < size) {
+    if (max_size < unit) {
+      return -ENOSPC;
+    }
+    size = p2align(max_size, unit);
+  }
+
+  bool force_bf = size >= bf_threshold ||
+    (num_total > 0 && num_free * 100 / num_total < bf_free_pct);
+  uint64_t start;
+  while (true) {
+    start = -1ULL;
+    if (!force_bf) {
+      start = _pick_block_first_fit(cursor, size, unit);
+    }
+    if (start == -1ULL) {
+      start = _pick_block_best_fit(size, unit);
+    }
+    if (start != -1ULL) {
+      break;
+    }
+    // alignment got in the way; settle for less
+    if (size <= unit) {
+      return -ENOSPC;
+    }
+    size = std::max(unit, p2align(size / 2, unit));
+  }
+
+  ldout(cct, 30) << __func__ << " got 0x" << std::hex << start << "~" << size
+		 << std::dec << (force_bf ? " (best fit)" : "") << dendl;
+  _remove_from_tree(start, size);
+  *cursor = start + size;
+  *offset = start;
+  *length = size;
+  return 0;
+}
+
+int64_t AvlAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  PExtentVector *extents)
+{
+  ldout(cct, 10) << __func__ << " want_size 0x" << std::hex << want_size
+		 << " alloc_unit 0x" << alloc_unit
+		 << " hint 0x" << hint << std::dec
+		 << dendl;
+  assert(alloc_unit);
+  if (max_alloc_size == 0) {
+    max_alloc_size = want_size;
+  }
+
+  std::lock_guard<std::mutex> l(lock);
+  uint64_t cursor = hint ? hint : last_alloc;
+  uint64_t allocated_size = 0;
+  while (allocated_size < want_size) {
+    uint64_t offset, length;
+    uint64_t size = p2roundup(std::min(max_alloc_size,
+				       want_size - allocated_size),
+			      alloc_unit);
+    int r = _allocate(size, alloc_unit, &cursor, &offset, &length);
+    if (r < 0) {
+      break;
+    }
+    if (!extents->empty() &&
+	extents->back().end() == offset &&
+	extents->back().length + length <= max_alloc_size) {
+      extents->back().length += length;
+    } else {
+      extents->emplace_back(offset, length);
+    }
+    allocated_size += length;
+  }
+  last_alloc = cursor;
+
+  if (allocated_size == 0) {
+    return -ENOSPC;
+  }
+  return allocated_size;
+}
+
+void AvlAllocator::release(const interval_set<uint64_t>& release_set)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		   << std::dec << dendl;
+    _add_to_tree(offset, length);
+  }
+}
+
+uint64_t AvlAllocator::get_free()
+{
+  std::lock_guard<std::mutex> l(lock);
+  return num_free;
+}
+
+double AvlAllocator::get_fragmentation(uint64_t alloc_unit)
+{
+  assert(alloc_unit);
+  uint64_t max_intervals = 0;
+  uint64_t intervals = 0;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    max_intervals = num_free / alloc_unit;
+    intervals = range_tree.size();
+  }
+  ldout(cct, 30) << __func__ << " " << intervals << "/" << max_intervals
+		 << dendl;
+  assert(intervals <= max_intervals);
+  if (!intervals || max_intervals <= 1) {
+    return 0.0;
+  }
+  intervals--;
+  max_intervals--;
+  return (double)intervals / max_intervals;
+}
+
+void AvlAllocator::dump()
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 0) << __func__ << " range_tree: " << dendl;
+  for (auto& rs : range_tree) {
+    ldout(cct, 0) << std::hex
+		  << "0x" << rs.start << "~" << rs.end
+		  << std::dec
+		  << dendl;
+  }
+  ldout(cct, 0) << __func__ << " range_size_tree: " << dendl;
+  for (auto& rs : range_size_tree) {
+    ldout(cct, 0) << std::hex
+		  << "0x" << rs.start << "~" << rs.end
+		  << std::dec
+		  << dendl;
+  }
+}
+
+void AvlAllocator::foreach_free(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& rs : range_tree) {
+    notify(rs.start, rs.length());
+  }
+}
+
+void AvlAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _add_to_tree(offset, length);
+}
+
+void AvlAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _remove_from_tree(offset, length);
+}
+
+void AvlAllocator::shutdown()
+{
+  ldout(cct, 1) << __func__ << dendl;
+  std::lock_guard<std::mutex> l(lock);
+  range_size_tree.clear();
+  range_tree.clear_and_dispose(dispose_rs{});
+  num_free = 0;
+}
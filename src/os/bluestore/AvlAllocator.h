@@ -0,0 +1,139 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+#define CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+
+#include <mutex>
+
+#include <boost/intrusive/avl_set.hpp>
+
+#include "Allocator.h"
+#include "os/bluestore/bluestore_types.h"
+#include "include/mempool.h"
+
+/**
+ * AvlAllocator - free extents in two trees, by offset and by size
+ *
+ * Every free extent is a single node linked into an offset-ordered tree,
+ * used to coalesce on release and to allocate near a hint, and into a
+ * size-ordered tree, used for best-fit.  Small requests are placed first
+ * fit from the hint (or the end of the last allocation) to keep related
+ * data together; requests of at least bf_threshold, and every request once
+ * free space drops below bf_free_pct, take the smallest extent that fits
+ * instead, so large runs of free space are not nibbled away.
+ *
+ * Memory use is one node per free extent, regardless of device size.
+ */
+class AvlAllocator : public Allocator {
+public:
+  struct range_seg_t {
+    MEMPOOL_CLASS_HELPERS();  ///< memory monitoring
+    uint64_t start;  ///< starting offset of this segment
+    uint64_t end;    ///< ending offset (non-inclusive)
+
+    range_seg_t(uint64_t start, uint64_t end)
+      : start{start}, end{end} {}
+    uint64_t length() const {
+      return end - start;
+    }
+
+    // Tree is sorted by offset, greater offsets at the end of the tree.
+    struct before_t {
+      template<typename KeyLeft, typename KeyRight>
+      bool operator()(const KeyLeft& lhs, const KeyRight& rhs) const {
+	return lhs.end <= rhs.start;
+      }
+    };
+    boost::intrusive::avl_set_member_hook<> offset_hook;
+
+    // Tree is sorted by size, larger sizes at the end of the tree.
+    struct shorter_t {
+      template<typename KeyType>
+      bool operator()(const range_seg_t& lhs, const KeyType& rhs) const {
+	auto lhs_size = lhs.end - lhs.start;
+	auto rhs_size = rhs.end - rhs.start;
+	if (lhs_size < rhs_size) {
+	  return true;
+	} else if (lhs_size > rhs_size) {
+	  return false;
+	} else {
+	  return lhs.start < rhs.start;
+	}
+      }
+    };
+    boost::intrusive::avl_set_member_hook<> size_hook;
+  };
+
+private:
+  struct dispose_rs {
+    void operator()(range_seg_t* p) {
+      delete p;
+    }
+  };
+
+  using range_tree_t = boost::intrusive::avl_set<
+    range_seg_t,
+    boost::intrusive::compare<range_seg_t::before_t>,
+    boost::intrusive::member_hook<
+      range_seg_t,
+      boost::intrusive::avl_set_member_hook<>,
+      &range_seg_t::offset_hook>>;
+  using range_size_tree_t = boost::intrusive::avl_multiset<
+    range_seg_t,
+    boost::intrusive::compare<range_seg_t::shorter_t>,
+    boost::intrusive::member_hook<
+      range_seg_t,
+      boost::intrusive::avl_set_member_hook<>,
+      &range_seg_t::size_hook>>;
+
+  CephContext* cct;
+  std::mutex lock;
+
+  range_tree_t range_tree;            ///< main range tree
+  range_size_tree_t range_size_tree;  ///< same extents, by size
+
+  const int64_t num_total;  ///< device size
+  uint64_t num_free = 0;    ///< total bytes in freelist
+  uint64_t last_alloc = 0;  ///< first fit cursor
+
+  /// requests this large go best fit
+  uint64_t bf_threshold;
+  /// below this percentage of free space everything goes best fit
+  uint64_t bf_free_pct;
+  /// give up on first fit after looking at this many extents
+  static constexpr unsigned max_search_count = 100;
+
+  uint64_t _pick_block_first_fit(uint64_t *cursor, uint64_t size,
+				 uint64_t align);
+  uint64_t _pick_block_best_fit(uint64_t size, uint64_t align);
+  void _add_to_tree(uint64_t start, uint64_t size);
+  void _remove_from_tree(uint64_t start, uint64_t size);
+  int _allocate(uint64_t size, uint64_t unit, uint64_t *cursor,
+		uint64_t *offset, uint64_t *length);
+
+public:
+  AvlAllocator(CephContext* cct, int64_t device_size);
+  ~AvlAllocator() override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  void release(
+    const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation(uint64_t alloc_unit) override;
+
+  void dump() override;
+  void foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+};
+
+#endif
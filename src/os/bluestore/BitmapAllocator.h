@@ -43,6 +43,12 @@ public:
     return _get_fragmentation();
   }
 
+  void foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override
+  {
+    _foreach_free(notify);
+  }
+
   void init_add_free(uint64_t offset, uint64_t length) override;
   void init_rm_free(uint64_t offset, uint64_t length) override;
 
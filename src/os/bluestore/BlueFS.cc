@@ -44,6 +44,7 @@ static void slow_discard_cb(void *priv, void* priv2) {
 
 BlueFS::BlueFS(CephContext* cct)
   : cct(cct),
+    compact_thread(this),
     bdev(MAX_BDEV),
     ioc(MAX_BDEV),
     block_all(MAX_BDEV)
@@ -118,6 +119,34 @@ void BlueFS::_init_logger()
   b.add_u64_counter(l_bluefs_bytes_written_slow, "bytes_written_slow",
 		    "Bytes written to WAL/SSTs at slow device", NULL,
 		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+
+  PerfHistogramCommon::axis_config_d lat_axis_config{
+    "Latency (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    100000,   ///< 100usec buckets
+    32,
+  };
+  PerfHistogramCommon::axis_config_d log_size_axis_config{
+    "Log size (bytes)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    4096,
+    32,
+  };
+  b.add_time_avg(l_bluefs_log_compact_lat, "log_compact_lat",
+		 "Duration of metadata log compactions");
+  b.add_u64_counter_histogram(
+    l_bluefs_log_compact_lat_hist, "log_compact_lat_histogram",
+    lat_axis_config, log_size_axis_config,
+    "Histogram of log compaction duration by size of the log compacted");
+  b.add_time_avg(l_bluefs_log_compact_stall_lat, "log_compact_stall_lat",
+		 "Time log writers were held up by log compaction",
+		 NULL, PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter_histogram(
+    l_bluefs_log_compact_stall_hist, "log_compact_stall_histogram",
+    lat_axis_config, log_size_axis_config,
+    "Histogram of log writer stalls due to compaction by log size");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -460,6 +489,9 @@ int BlueFS::mount()
            << dendl;
 
   _init_logger();
+
+  compact_stop = false;
+  compact_thread.create("bluefs_compact");
   return 0;
 
  out:
@@ -471,6 +503,15 @@ void BlueFS::umount()
 {
   dout(1) << __func__ << dendl;
 
+  if (compact_thread.is_started()) {
+    {
+      std::lock_guard<std::mutex> l(lock);
+      compact_stop = true;
+      compact_cond.notify_all();
+    }
+    compact_thread.join();
+  }
+
   sync_metadata();
 
   _close_writer(log_writer);
@@ -509,23 +550,27 @@ int BlueFS::fsck()
   return 0;
 }
 
-int BlueFS::_write_super()
+void BlueFS::_encode_super(bufferlist& bl)
 {
-  // build superblock
-  bufferlist bl;
   encode(super, bl);
   uint32_t crc = bl.crc32c(-1);
   encode(crc, bl);
   dout(10) << __func__ << " super block length(encoded): " << bl.length() << dendl;
-  dout(10) << __func__ << " superblock " << super.version << dendl;
+  dout(10) << __func__ << " superblock " << super.version
+	   << " crc 0x" << std::hex << crc << std::dec << dendl;
   dout(10) << __func__ << " log_fnode " << super.log_fnode << dendl;
   assert(bl.length() <= get_super_length());
   bl.append_zero(get_super_length() - bl.length());
+}
 
+int BlueFS::_write_super()
+{
+  // build superblock
+  bufferlist bl;
+  _encode_super(bl);
   bdev[BDEV_DB]->write(get_super_offset(), bl, false);
   dout(20) << __func__ << " v " << super.version
-           << " crc 0x" << std::hex << crc
-           << " offset 0x" << get_super_offset() << std::dec
+           << " offset 0x" << std::hex << get_super_offset() << std::dec
            << dendl;
   return 0;
 }
@@ -1178,6 +1223,10 @@ uint64_t BlueFS::_estimate_log_size()
 void BlueFS::compact_log()
 {
   std::unique_lock<std::mutex> l(lock);
+  // let a background compaction finish rather than skip this one
+  while (new_log) {
+    log_cond.wait(l);
+  }
   if (cct->_conf->bluefs_compact_log_sync) {
      _compact_log_sync();
   } else {
@@ -1185,6 +1234,34 @@ void BlueFS::compact_log()
   }
 }
 
+void BlueFS::_compact_thread_entry()
+{
+  std::unique_lock<std::mutex> l(lock);
+  dout(10) << __func__ << " start" << dendl;
+  while (!compact_stop) {
+    if (compact_requested) {
+      compact_requested = false;
+      // the log may have been compacted (or grown) since we were asked
+      if (_should_compact_log()) {
+	_compact_log_async(l);
+      }
+      continue;
+    }
+    compact_cond.wait(l);
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+void BlueFS::_note_compact_stall(mono_time start)
+{
+  auto stall = mono_clock::now() - start;
+  logger->tinc(l_bluefs_log_compact_stall_lat, stall);
+  logger->hinc(l_bluefs_log_compact_stall_hist,
+	       std::chrono::duration_cast<std::chrono::nanoseconds>(
+		 stall).count(),
+	       log_writer->file->fnode.size);
+}
+
 bool BlueFS::_should_compact_log()
 {
   uint64_t current = log_writer->file->fnode.size;
@@ -1240,7 +1317,9 @@ void BlueFS::_compact_log_dump_metadata(bluefs_transaction_t *t)
 void BlueFS::_compact_log_sync()
 {
   dout(10) << __func__ << dendl;
+  auto start = mono_clock::now();
   File *log_file = log_writer->file.get();
+  uint64_t old_log_size = log_file->fnode.size;
 
   // clear out log (be careful who calls us!!!)
   log_t.clear();
@@ -1292,7 +1371,14 @@ void BlueFS::_compact_log_sync()
     pending_release[r.bdev].insert(r.offset, r.length);
   }
 
+  // everything above ran under the lock
+  auto dur = mono_clock::now() - start;
   logger->inc(l_bluefs_log_compactions);
+  logger->tinc(l_bluefs_log_compact_lat, dur);
+  logger->hinc(l_bluefs_log_compact_lat_hist,
+	       std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count(),
+	       old_log_size);
+  _note_compact_stall(start);
 }
 
 /*
@@ -1316,11 +1402,19 @@ void BlueFS::_compact_log_sync()
  * 7. Write the new superblock.
  *
  * 8. Release the old log space.  Clean up.
+ *
+ * Only #1, #2 and #6 need the lock; everything that waits on a device (the
+ * data flush before #1, the new log write and the superblock write) is done
+ * without it, so other threads keep appending to the log continuation
+ * throughout.  Appends only block if they need more runway before the new
+ * superblock is stable.  Normally this runs on compact_thread.
  */
 void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
 {
   dout(10) << __func__ << dendl;
+  auto start = mono_clock::now();
   File *log_file = log_writer->file.get();
+  uint64_t old_log_size = log_file->fnode.size;
   assert(!new_log);
   assert(!new_log_writer);
 
@@ -1329,6 +1423,12 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   new_log = new File;
   new_log->fnode.ino = 0;   // so that _flush_range won't try to log the fnode
 
+  // make file data durable before we log its metadata; nobody needs the
+  // lock for that.
+  l.unlock();
+  flush_bdev();
+  l.lock();
+
   // 0. wait for any racing flushes to complete.  (We do not want to block
   // in _flush_sync_log with jump_to set or else a racing thread might flush
   // our entries and our jump_to update won't be correct.)
@@ -1338,6 +1438,7 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   }
 
   // 1. allocate new log space and jump to it.
+  auto locked = mono_clock::now();
   old_log_jump_to = log_file->fnode.get_allocated();
   dout(10) << __func__ << " old_log_jump_to 0x" << std::hex << old_log_jump_to
            << " need 0x" << (old_log_jump_to + cct->_conf->bluefs_max_log_runway) << std::dec << dendl;
@@ -1350,12 +1451,16 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   // write the new entries
   log_t.op_file_update(log_file->fnode);
   log_t.op_jump(log_seq, old_log_jump_to);
-
-  flush_bdev();  // FIXME?
+  _note_compact_stall(locked);
 
   _flush_and_sync_log(l, 0, old_log_jump_to);
 
   // 2. prepare compacted log
+  //
+  // _flush_and_sync_log retook the lock after its aio wait and we must keep
+  // it until the dump is encoded: a log entry flushed in between would be
+  // both in the dump and in the continuation, under a seq replay skips.
+  locked = mono_clock::now();
   bluefs_transaction_t t;
   //avoid record two times in log_t and _compact_log_dump_metadata.
   log_t.clear();
@@ -1383,11 +1488,20 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   // 3. flush
   r = _flush(new_log_writer, true);
   assert(r == 0);
+  _note_compact_stall(locked);
 
   // 4. wait
   _flush_bdev_safely(new_log_writer);
 
+  // a flush that raced with us may still be in _flush_bdev_safely with the
+  // old log position; let it finish before we renumber it.
+  while (log_flushing) {
+    dout(10) << __func__ << " log is currently flushing, waiting" << dendl;
+    log_cond.wait(l);
+  }
+
   // 5. update our log fnode
+  locked = mono_clock::now();
   // discard first old_log_jump_to extents
   dout(10) << __func__ << " remove 0x" << std::hex << old_log_jump_to << std::dec
 	   << " of " << log_file->fnode.extents << dendl;
@@ -1427,15 +1541,20 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   log_writer->pos = log_writer->file->fnode.size =
     log_writer->pos - old_log_jump_to + new_log_jump_to;
 
-  // 6. write the super block to reflect the changes
+  // 6. write the super block to reflect the changes.  Until it is stable
+  // the old superblock still describes the continuation correctly, and
+  // appends that need runway wait for new_log_writer to go away.
   dout(10) << __func__ << " writing super" << dendl;
   super.log_fnode = log_file->fnode;
   ++super.version;
-  _write_super();
+  bufferlist super_bl;
+  _encode_super(super_bl);
+  _note_compact_stall(locked);
 
-  lock.unlock();
+  l.unlock();
+  bdev[BDEV_DB]->write(get_super_offset(), super_bl, false);
   flush_bdev();
-  lock.lock();
+  l.lock();
 
   // 7. release old space
   dout(10) << __func__ << " release old log extents " << old_extents << dendl;
@@ -1454,8 +1573,14 @@ void BlueFS::_compact_log_async(std::unique_lock<std::mutex>& l)
   new_log = nullptr;
   log_cond.notify_all();
 
-  dout(10) << __func__ << " log extents " << log_file->fnode.extents << dendl;
+  auto dur = mono_clock::now() - start;
+  dout(10) << __func__ << " log extents " << log_file->fnode.extents
+	   << ", took " << dur << dendl;
   logger->inc(l_bluefs_log_compactions);
+  logger->tinc(l_bluefs_log_compact_lat, dur);
+  logger->hinc(l_bluefs_log_compact_lat_hist,
+	       std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count(),
+	       old_log_size);
 }
 
 void BlueFS::_pad_bl(bufferlist& bl)
@@ -1524,9 +1649,13 @@ int BlueFS::_flush_and_sync_log(std::unique_lock<std::mutex>& l,
   if (runway < (int64_t)cct->_conf->bluefs_min_log_runway) {
     dout(10) << __func__ << " allocating more log runway (0x"
 	     << std::hex << runway << std::dec  << " remaining)" << dendl;
-    while (new_log_writer) {
-      dout(10) << __func__ << " waiting for async compaction" << dendl;
-      log_cond.wait(l);
+    if (new_log_writer) {
+      auto wait_start = mono_clock::now();
+      while (new_log_writer) {
+	dout(10) << __func__ << " waiting for async compaction" << dendl;
+	log_cond.wait(l);
+      }
+      _note_compact_stall(wait_start);
     }
     int r = _allocate(log_writer->file->fnode.prefer_bdev,
 		      cct->_conf->bluefs_max_log_runway,
@@ -2070,6 +2199,12 @@ void BlueFS::sync_metadata()
   if (_should_compact_log()) {
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync();
+    } else if (!compact_stop) {
+      if (!compact_requested) {
+	dout(10) << __func__ << " queueing log compaction" << dendl;
+	compact_requested = true;
+	compact_cond.notify_all();
+      }
     } else {
       _compact_log_async(l);
     }
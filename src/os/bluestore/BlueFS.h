@@ -8,6 +8,7 @@
 
 #include "bluefs_types.h"
 #include "common/RefCountedObj.h"
+#include "common/Thread.h"
 #include "BlockDevice.h"
 
 #include "boost/intrusive/list.hpp"
@@ -36,6 +37,10 @@ enum {
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
   l_bluefs_bytes_written_slow,
+  l_bluefs_log_compact_lat,
+  l_bluefs_log_compact_lat_hist,
+  l_bluefs_log_compact_stall_lat,
+  l_bluefs_log_compact_stall_hist,
   l_bluefs_last,
 };
 
@@ -244,6 +249,19 @@ private:
   FileRef new_log = nullptr;
   FileWriter *new_log_writer = nullptr;
 
+  // async log compaction runs here, off the threads appending to the log
+  struct CompactThread : public Thread {
+    BlueFS *fs;
+    explicit CompactThread(BlueFS *fs) : fs(fs) {}
+    void *entry() override {
+      fs->_compact_thread_entry();
+      return nullptr;
+    }
+  } compact_thread;
+  std::condition_variable compact_cond;
+  bool compact_requested = false;
+  bool compact_stop = true;    ///< no compaction thread to hand work to
+
   /*
    * There are up to 3 block devices:
    *
@@ -290,6 +308,8 @@ private:
   void _compact_log_dump_metadata(bluefs_transaction_t *t);
   void _compact_log_sync();
   void _compact_log_async(std::unique_lock<std::mutex>& l);
+  void _compact_thread_entry();
+  void _note_compact_stall(mono_time start);
 
   //void _aio_finish(void *priv);
 
@@ -316,6 +336,7 @@ private:
   void _invalidate_cache(FileRef f, uint64_t offset, uint64_t length);
 
   int _open_super();
+  void _encode_super(bufferlist& bl);
   int _write_super();
   int _replay(bool noop, bool to_stdout = false); ///< replay journal
 
@@ -29,8 +29,11 @@
 #include "common/errno.h"
 #include "common/safe_io.h"
 #include "common/PriorityCache.h"
+#include "common/numa.h"
 #include "Allocator.h"
+#include "MagazineAllocator.h"
 #include "FreelistManager.h"
+#include "OnodeL2Cache.h"
 #include "BlueFS.h"
 #include "BlueRocksEnv.h"
 #include "auth/Crypto.h"
@@ -71,6 +74,8 @@ const string PREFIX_DEFERRED = "L";  // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";   // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b"; // (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 offset -> shared_blob_t
+const string PREFIX_TIER_ALLOC = "D"; // freelist for the fast data tier
+const string PREFIX_TIER_ALLOC_BITMAP = "d";
 
 // write a label in the first block.  always use this size.  note that
 // bluefs makes a matching assumption about the location of its
@@ -1550,6 +1555,16 @@ void BlueStore::OnodeSpace::rename(
   o->key = new_okey;
 }
 
+BlueStore::OnodeRef BlueStore::OnodeSpace::peek(const ghobject_t& oid)
+{
+  std::lock_guard<std::recursive_mutex> l(cache->lock);
+  auto p = onode_map.find(oid);
+  if (p == onode_map.end()) {
+    return OnodeRef();
+  }
+  return p->second;
+}
+
 bool BlueStore::OnodeSpace::map_any(std::function<bool(OnodeRef)> f)
 {
   std::lock_guard<std::recursive_mutex> l(cache->lock);
@@ -2133,6 +2148,9 @@ void BlueStore::ExtentMap::update(KeyValueDB::Transaction t,
 	&key,
         [&](const string& final_key) {
           t->set(PREFIX_OBJ, final_key, it.bl);
+	  if (onode->c->store->onode_l2cache) {
+	    onode->c->store->onode_l2cache->insert(final_key, it.bl);
+	  }
         }
       );
     }
@@ -2212,6 +2230,9 @@ void BlueStore::ExtentMap::reshard(
       onode->key, shards[i].shard_info->offset, &key,
       [&](const string& final_key) {
 	t->rmkey(PREFIX_OBJ, final_key);
+	if (onode->c->store->onode_l2cache) {
+	  onode->c->store->onode_l2cache->invalidate(final_key);
+	}
       }
       );
   }
@@ -2669,6 +2690,25 @@ void BlueStore::ExtentMap::decode_spanning_blobs(
   }
 }
 
+void BlueStore::ExtentMap::_materialize()
+{
+  assert(lazy);
+  lazy = false;
+  if (lazy_spanning.length()) {
+    lazy_spanning.c_str();  // make it contiguous
+    auto p = lazy_spanning.front().begin_deep();
+    decode_spanning_blobs(p);
+  }
+  if (onode->onode.extent_map_shards.empty() && lazy_extents.length()) {
+    inline_bl.claim(lazy_extents);
+    decode_some(inline_bl);
+    inline_bl.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
+  }
+  lazy_spanning.clear();
+  lazy_extents.clear();
+  onode->c->store->logger->inc(l_bluestore_onode_materialize);
+}
+
 void BlueStore::ExtentMap::init_shards(bool loaded, bool dirty)
 {
   shards.resize(onode->onode.extent_map_shards.size());
@@ -2689,6 +2729,7 @@ void BlueStore::ExtentMap::fault_range(
   auto cct = onode->c->store->cct; //used by dout
   dout(30) << __func__ << " 0x" << std::hex << offset << "~" << length
 	   << std::dec << dendl;
+  materialize();
   auto start = seek_shard(offset);
   auto last = seek_shard(offset + length);
 
@@ -2704,9 +2745,17 @@ void BlueStore::ExtentMap::fault_range(
       dout(30) << __func__ << " opening shard 0x" << std::hex
 	       << p->shard_info->offset << std::dec << dendl;
       bufferlist v;
+      OnodeL2Cache *l2 = onode->c->store->onode_l2cache;
       generate_extent_shard_key_and_apply(
 	onode->key, p->shard_info->offset, &key,
         [&](const string& final_key) {
+	  if (l2) {
+	    if (l2->lookup(final_key, &v)) {
+	      onode->c->store->logger->inc(l_bluestore_onode_l2_hits);
+	      return;
+	    }
+	    onode->c->store->logger->inc(l_bluestore_onode_l2_misses);
+	  }
           int r = db->get(PREFIX_OBJ, final_key, &v);
           if (r < 0) {
 	    derr << __func__ << " missing shard 0x" << std::hex
@@ -2714,6 +2763,9 @@ void BlueStore::ExtentMap::fault_range(
 		 << dendl;
 	    assert(r >= 0);
           }
+	  if (l2) {
+	    l2->insert(final_key, v);
+	  }
         }
       );
       p->extents = decode_some(v);
@@ -3049,12 +3101,12 @@ bool BlueStore::WriteContext::has_conflict(
 #undef dout_prefix
 #define dout_prefix *_dout << "bluestore.DeferredBatch(" << this << ") "
 
-void BlueStore::DeferredBatch::prepare_write(
+uint64_t BlueStore::DeferredBatch::prepare_write(
   CephContext *cct,
   uint64_t seq, uint64_t offset, uint64_t length,
   bufferlist::const_iterator& blp)
 {
-  _discard(cct, offset, length);
+  uint64_t elided = _discard(cct, offset, length);
   auto i = iomap.insert(make_pair(offset, deferred_io()));
   assert(i.second);  // this should be a new insertion
   i.first->second.seq = seq;
@@ -3069,13 +3121,15 @@ void BlueStore::DeferredBatch::prepare_write(
 #ifdef DEBUG_DEFERRED
   _audit(cct);
 #endif
+  return elided;
 }
 
-void BlueStore::DeferredBatch::_discard(
+uint64_t BlueStore::DeferredBatch::_discard(
   CephContext *cct, uint64_t offset, uint64_t length)
 {
   generic_dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
 		   << std::dec << dendl;
+  uint64_t dropped = 0;
   auto p = iomap.lower_bound(offset);
   if (p != iomap.begin()) {
     --p;
@@ -3099,8 +3153,10 @@ void BlueStore::DeferredBatch::_discard(
 	n.bl.swap(tail);
 	n.seq = p->second.seq;
 	i->second -= length;
+	dropped += length;
       } else {
 	i->second -= end - offset;
+	dropped += end - offset;
       }
       assert(i->second >= 0);
       p->second.bl.swap(head);
@@ -3126,15 +3182,31 @@ void BlueStore::DeferredBatch::_discard(
       s.seq = p->second.seq;
       s.bl.substr_of(p->second.bl, drop_front, keep_tail);
       i->second -= drop_front;
+      dropped += drop_front;
     } else {
       dout(20) << __func__ << "  drop " << p->second.seq
 	       << " 0x" << std::hex << p->first << "~" << p->second.bl.length()
 	       << std::dec << dendl;
       i->second -= p->second.bl.length();
+      dropped += p->second.bl.length();
     }
     assert(i->second >= 0);
     p = iomap.erase(p);
   }
+  return dropped;
+}
+
+unsigned BlueStore::DeferredBatch::count_runs() const
+{
+  unsigned runs = 0;
+  uint64_t pos = 0;
+  for (auto& p : iomap) {
+    if (!runs || p.first != pos) {
+      ++runs;
+    }
+    pos = p.first + p.second.bl.length();
+  }
+  return runs;
 }
 
 void BlueStore::DeferredBatch::_audit(CephContext *cct)
@@ -3172,12 +3244,14 @@ BlueStore::Collection::Collection(BlueStore *store_, Cache *c, coll_t cid)
     if (p == store->zombie_osr_set.end()) {
       osr = new OpSequencer(store, cid);
       osr->shard = cid.hash_to_shard(store->m_finisher_num);
+      osr->kv_pipeline = cid.hash_to_shard(store->kv_pipeline_num);
     } else {
       osr = p->second;
       store->zombie_osr_set.erase(p);
       ldout(store->cct, 10) << "resurrecting zombie osr " << osr << dendl;
       osr->zombie = false;
       assert(osr->shard == cid.hash_to_shard(store->m_finisher_num));
+      assert(osr->kv_pipeline == cid.hash_to_shard(store->kv_pipeline_num));
     }
   }
 }
@@ -3302,27 +3376,53 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
 			<< pretty_binary_string(key) << dendl;
 
   bufferlist v;
-  int r = store->db->get(PREFIX_OBJ, key.c_str(), key.size(), &v);
-  ldout(store->cct, 20) << " r " << r << " v.len " << v.length() << dendl;
-  Onode *on;
-  if (v.length() == 0) {
-    assert(r == -ENOENT);
-    if (!store->cct->_conf->bluestore_debug_misc &&
-	!create)
-      return OnodeRef();
-
-    // new object, new onode
-    on = new Onode(this, oid, key);
+  int r;
+  OnodeL2Cache *l2 = store->onode_l2cache;
+  if (l2 && l2->lookup(key.c_str(), key.size(), &v)) {
+    store->logger->inc(l_bluestore_onode_l2_hits);
+    r = 0;
   } else {
-    // loaded
+    r = store->db->get(PREFIX_OBJ, key.c_str(), key.size(), &v);
+    if (l2) {
+      store->logger->inc(l_bluestore_onode_l2_misses);
+      if (r >= 0 && v.length()) {
+	l2->insert(key.c_str(), key.size(), v);
+      }
+    }
+  }
+  ldout(store->cct, 20) << " r " << r << " v.len " << v.length() << dendl;
+  if (v.length()) {
     assert(r >= 0);
-    on = new Onode(this, oid, key);
-    on->exists = true;
+    return add_loaded_onode(oid, key, v);
+  }
+  assert(r == -ENOENT);
+  if (!store->cct->_conf->bluestore_debug_misc &&
+      !create)
+    return OnodeRef();
+
+  // new object, new onode
+  o.reset(new Onode(this, oid, key));
+  return onode_map.add(oid, o);
+}
+
+BlueStore::OnodeRef BlueStore::Collection::add_loaded_onode(
+  const ghobject_t& oid,
+  const mempool::bluestore_cache_other::string& key,
+  bufferlist& v)
+{
+  Onode *on = new Onode(this, oid, key);
+  on->exists = true;
+  if (bluestore_onode_t::is_flat(v)) {
+    // only the fixed fields, attrs and shard table are decoded here; the
+    // spanning blobs and inline extents wait for the first fault_range
+    auto& em = on->extent_map;
+    on->onode.decode_flat(v, &em.lazy_spanning, &em.lazy_extents);
+    em.lazy_spanning.reassign_to_mempool(
+      mempool::mempool_bluestore_cache_other);
+    em.lazy = true;
+  } else {
     auto p = v.front().begin_deep();
     on->onode.decode(p);
-    for (auto& i : on->onode.attrs) {
-      i.second.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
-    }
 
     // initialize extent_map
     on->extent_map.decode_spanning_blobs(p);
@@ -3331,12 +3431,62 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
       on->extent_map.decode_some(on->extent_map.inline_bl);
       on->extent_map.inline_bl.reassign_to_mempool(
 	mempool::mempool_bluestore_cache_other);
-    } else {
-      on->extent_map.init_shards(false, false);
     }
   }
-  o.reset(on);
-  return onode_map.add(oid, o);
+  for (auto& i : on->onode.attrs) {
+    i.second.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
+  }
+  if (!on->onode.extent_map_shards.empty()) {
+    on->extent_map.init_shards(false, false);
+  }
+  return onode_map.add(oid, OnodeRef(on));
+}
+
+void BlueStore::Collection::prefetch_onodes(const vector<ghobject_t>& oids)
+{
+  assert(lock.is_locked());
+
+  map<string, const ghobject_t*> missing;
+  OnodeL2Cache *l2 = store->onode_l2cache;
+  for (auto& oid : oids) {
+    if (onode_map.lookup(oid)) {
+      continue;
+    }
+    mempool::bluestore_cache_other::string key;
+    get_object_key(store->cct, oid, &key);
+    bufferlist v;
+    if (l2 && l2->lookup(key.c_str(), key.size(), &v)) {
+      store->logger->inc(l_bluestore_onode_l2_hits);
+      add_loaded_onode(oid, key, v);
+      continue;
+    }
+    missing.emplace(string(key.c_str(), key.size()), &oid);
+  }
+  if (missing.empty()) {
+    return;
+  }
+
+  set<string> keys;
+  for (auto& i : missing) {
+    keys.insert(keys.end(), i.first);
+  }
+  map<string, bufferlist> found;
+  store->db->get(PREFIX_OBJ, keys, &found);
+  ldout(store->cct, 20) << __func__ << " looked up " << keys.size()
+			<< " onodes, found " << found.size() << dendl;
+  for (auto& i : found) {
+    if (i.second.length() == 0) {
+      continue;
+    }
+    if (l2) {
+      store->logger->inc(l_bluestore_onode_l2_misses);
+      l2->insert(i.first.c_str(), i.first.size(), i.second);
+    }
+    mempool::bluestore_cache_other::string key(i.first.c_str(),
+					       i.first.size());
+    add_loaded_onode(*missing[i.first], key, i.second);
+  }
+  // objects that don't exist are left for get_onode() to sort out
 }
 
 void BlueStore::Collection::split_cache(
@@ -3610,6 +3760,154 @@ void BlueStore::MempoolThread::_balance_cache_pri(int64_t *mem_avail,
 
 // =======================================================
 
+// TierThread
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.TierThread(" << this << ") "
+
+void *BlueStore::TierThread::entry()
+{
+  Mutex::Locker l(lock);
+  while (!stop) {
+    while (!promote_queue.empty() && !stop) {
+      auto p = promote_queue.front();
+      promote_queue.pop_front();
+      promote_queued.erase(p);
+      lock.Unlock();
+      CollectionRef c = store->_get_collection(p.first);
+      if (c) {
+	uint64_t moved;
+	int r = store->_tier_move(c, p.second, true, &moved);
+	ldout(store->cct, 20) << __func__ << " promote " << p.first << " "
+			      << p.second << " = " << r << ", 0x" << std::hex
+			      << moved << std::dec << " bytes" << dendl;
+      }
+      lock.Lock();
+    }
+    if (stop) {
+      break;
+    }
+    lock.Unlock();
+    _demote_some();
+    store->_update_tier_logger();
+    lock.Lock();
+    if (!promote_queue.empty()) {
+      continue;
+    }
+    utime_t wait;
+    wait.set_from_double(
+      store->cct->_conf->get_val<double>("bluestore_tier_agent_interval"));
+    cond.WaitInterval(lock, wait);
+  }
+  stop = false;
+  return NULL;
+}
+
+void BlueStore::TierThread::queue_promote(const coll_t& cid,
+					  const ghobject_t& oid)
+{
+  Mutex::Locker l(lock);
+  // hot objects will be seen again; don't let the queue grow unbounded
+  if (promote_queue.size() >= 1024) {
+    return;
+  }
+  auto k = make_pair(cid, oid);
+  if (promote_queued.insert(k).second) {
+    promote_queue.push_back(k);
+    cond.Signal();
+  }
+}
+
+void BlueStore::TierThread::_demote_some()
+{
+  CephContext *cct = store->cct;
+  uint64_t size = store->tier_extents.size();
+  uint64_t target = size *
+    cct->_conf->get_val<double>("bluestore_tier_demote_ratio");
+  auto used = [&]() {
+    return size - store->tier_alloc->get_free();
+  };
+  if (used() <= target) {
+    return;
+  }
+  unsigned max = cct->_conf->get_val<uint64_t>(
+    "bluestore_tier_demote_max_objects");
+  ldout(cct, 10) << __func__ << " used 0x" << std::hex << used()
+		 << " > target 0x" << target << std::dec
+		 << ", cursor " << demote_cid << " " << demote_next << dendl;
+
+  // continue the sweep where we left off
+  CollectionRef c;
+  bool wrapped = false;
+  {
+    RWLock::RLocker l(store->coll_lock);
+    const coll_t *next = nullptr;
+    for (auto& p : store->coll_map) {
+      if (p.first < demote_cid ||
+	  (p.first == demote_cid && demote_next == ghobject_t::get_max())) {
+	continue;
+      }
+      if (!next || p.first < *next) {
+	next = &p.first;
+	c = p.second;
+      }
+    }
+    if (!c && !store->coll_map.empty()) {
+      // wrap around
+      auto first = store->coll_map.begin();
+      for (auto p = first; p != store->coll_map.end(); ++p) {
+	if (p->first < first->first) {
+	  first = p;
+	}
+      }
+      c = first->second;
+      wrapped = true;
+    }
+  }
+  if (!c) {
+    return;
+  }
+  if (wrapped || c->cid != demote_cid) {
+    demote_cid = c->cid;
+    demote_next = ghobject_t();
+  }
+
+  vector<ghobject_t> ls;
+  ghobject_t next;
+  int r;
+  {
+    RWLock::RLocker l(c->lock);
+    r = store->_collection_list(c.get(), demote_next, ghobject_t::get_max(),
+				max, &ls, &next);
+  }
+  if (r < 0) {
+    demote_next = ghobject_t::get_max();
+    return;
+  }
+  demote_next = next;
+
+  for (auto& oid : ls) {
+    if (used() <= target) {
+      break;
+    }
+    unsigned temp;
+    {
+      std::lock_guard<std::mutex> l(c->tier_heat.lock);
+      temp = c->tier_heat.temperature(oid.hobj);
+    }
+    if (temp > 0) {
+      continue;
+    }
+    uint64_t moved;
+    r = store->_tier_move(c, oid, false, &moved);
+    ldout(cct, 20) << __func__ << " demote " << c->cid << " " << oid
+		   << " = " << r << ", 0x" << std::hex << moved << std::dec
+		   << " bytes" << dendl;
+  }
+}
+
+// =======================================================
+
 // OmapIteratorImpl
 
 #undef dout_prefix
@@ -3745,9 +4043,8 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
-    kv_sync_thread(this),
-    kv_finalize_thread(this),
-    mempool_thread(this)
+    mempool_thread(this),
+    tier_thread(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3764,11 +4061,10 @@ BlueStore::BlueStore(CephContext *cct,
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
-    kv_sync_thread(this),
-    kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    tier_thread(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3799,6 +4095,7 @@ const char **BlueStore::get_tracked_conf_keys() const
 {
   static const char* KEYS[] = {
     "bluestore_csum_type",
+    "bluestore_csum_batch_verify",
     "bluestore_compression_mode",
     "bluestore_compression_algorithm",
     "bluestore_compression_min_blob_size",
@@ -3808,6 +4105,9 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_compression_max_blob_size_ssd",
     "bluestore_compression_max_blob_size_hdd",
     "bluestore_compression_required_ratio",
+    "bluestore_compression_sample_size",
+    "bluestore_compression_sample_max_entropy",
+    "bluestore_compression_history_misses",
     "bluestore_max_alloc_size",
     "bluestore_prefer_deferred_size",
     "bluestore_prefer_deferred_size_hdd",
@@ -3815,6 +4115,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_coalesce",
+    "bluestore_deferred_flush_queue_depth",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -3823,6 +4125,13 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_max_blob_size",
     "bluestore_max_blob_size_ssd",
     "bluestore_max_blob_size_hdd",
+    "bluestore_tier_small_write_size",
+    "bluestore_tier_max_ratio",
+    "bluestore_tier_min_read_recency_for_promote",
+    "bluestore_tier_promote_max_object_size",
+    "bluestore_tier_hit_set_period",
+    "bluestore_tier_hit_set_count",
+    "bluestore_tier_hit_set_target_size",
     NULL
   };
   return KEYS;
@@ -3831,13 +4140,17 @@ const char **BlueStore::get_tracked_conf_keys() const
 void BlueStore::handle_conf_change(const md_config_t *conf,
 				   const std::set<std::string> &changed)
 {
-  if (changed.count("bluestore_csum_type")) {
+  if (changed.count("bluestore_csum_type") ||
+      changed.count("bluestore_csum_batch_verify")) {
     _set_csum();
   }
   if (changed.count("bluestore_compression_mode") ||
       changed.count("bluestore_compression_algorithm") ||
       changed.count("bluestore_compression_min_blob_size") ||
-      changed.count("bluestore_compression_max_blob_size")) {
+      changed.count("bluestore_compression_max_blob_size") ||
+      changed.count("bluestore_compression_sample_size") ||
+      changed.count("bluestore_compression_sample_max_entropy") ||
+      changed.count("bluestore_compression_history_misses")) {
     if (bdev) {
       _set_compression();
     }
@@ -3856,7 +4169,9 @@ void BlueStore::handle_conf_change(const md_config_t *conf,
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_coalesce") ||
+      changed.count("bluestore_deferred_flush_queue_depth")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -3878,6 +4193,15 @@ void BlueStore::handle_conf_change(const md_config_t *conf,
     throttle_deferred_bytes.reset_max(
       conf->bluestore_throttle_bytes + conf->bluestore_throttle_deferred_bytes);
   }
+  if (changed.count("bluestore_tier_small_write_size") ||
+      changed.count("bluestore_tier_max_ratio") ||
+      changed.count("bluestore_tier_min_read_recency_for_promote") ||
+      changed.count("bluestore_tier_promote_max_object_size") ||
+      changed.count("bluestore_tier_hit_set_period") ||
+      changed.count("bluestore_tier_hit_set_count") ||
+      changed.count("bluestore_tier_hit_set_target_size")) {
+    _set_tier_conf();
+  }
 }
 
 void BlueStore::_set_compression()
@@ -3895,6 +4219,14 @@ void BlueStore::_set_compression()
 
   compressor = nullptr;
 
+  // pools may enable compression on their own, so set these regardless
+  comp_sample_size =
+    cct->_conf->get_val<uint64_t>("bluestore_compression_sample_size");
+  comp_sample_max_entropy =
+    cct->_conf->get_val<double>("bluestore_compression_sample_max_entropy");
+  comp_history_misses =
+    cct->_conf->get_val<uint64_t>("bluestore_compression_history_misses");
+
   if (comp_mode == Compressor::COMP_NONE) {
     dout(10) << __func__ << " compression mode set to 'none', "
              << "ignore other compression settings" << dendl;
@@ -3936,6 +4268,9 @@ void BlueStore::_set_compression()
 	   << " alg " << (compressor ? compressor->get_type_name() : "(none)")
 	   << " min_blob " << comp_min_blob_size
 	   << " max_blob " << comp_max_blob_size
+	   << " sample " << comp_sample_size
+	   << " max_entropy " << comp_sample_max_entropy
+	   << " history_misses " << comp_history_misses
 	   << dendl;
 }
 
@@ -3945,9 +4280,11 @@ void BlueStore::_set_csum()
   int t = Checksummer::get_csum_string_type(cct->_conf->bluestore_csum_type);
   if (t > Checksummer::CSUM_NONE)
     csum_type = t;
+  csum_batch_verify = cct->_conf->get_val<bool>("bluestore_csum_batch_verify");
 
   dout(10) << __func__ << " csum_type "
 	   << Checksummer::get_csum_type_string(csum_type)
+	   << " batch_verify " << csum_batch_verify
 	   << dendl;
 }
 
@@ -3983,6 +4320,27 @@ void BlueStore::_set_blob_size()
            << std::dec << dendl;
 }
 
+void BlueStore::_set_tier_conf()
+{
+  tier_small_write_size =
+    cct->_conf->get_val<uint64_t>("bluestore_tier_small_write_size");
+  tier_max_ratio = cct->_conf->get_val<double>("bluestore_tier_max_ratio");
+  tier_min_read_recency = cct->_conf->get_val<uint64_t>(
+    "bluestore_tier_min_read_recency_for_promote");
+  tier_promote_max_object_size =
+    cct->_conf->get_val<uint64_t>("bluestore_tier_promote_max_object_size");
+  tier_hit_set_period =
+    cct->_conf->get_val<double>("bluestore_tier_hit_set_period");
+  tier_hit_set_count =
+    cct->_conf->get_val<uint64_t>("bluestore_tier_hit_set_count");
+  tier_hit_set_target_size =
+    cct->_conf->get_val<uint64_t>("bluestore_tier_hit_set_target_size");
+  dout(10) << __func__ << " small_write_size 0x" << std::hex
+	   << tier_small_write_size << std::dec
+	   << " max_ratio " << tier_max_ratio
+	   << " min_read_recency " << tier_min_read_recency << dendl;
+}
+
 void BlueStore::_set_finisher_num()
 {
   if (cct->_conf->bluestore_shard_finishers) {
@@ -4000,6 +4358,48 @@ void BlueStore::_set_finisher_num()
   assert(m_finisher_num != 0);
 }
 
+void BlueStore::_set_kv_pipeline_num()
+{
+  kv_pipeline_num = cct->_conf->get_val<uint64_t>("bluestore_kv_sync_pipelines");
+  assert(kv_pipeline_num > 0);
+  dout(10) << __func__ << " " << kv_pipeline_num << dendl;
+}
+
+int BlueStore::_set_onode_format()
+{
+  onode_format = cct->_conf->get_val<uint64_t>("bluestore_onode_format");
+  dout(10) << __func__ << " " << onode_format << dendl;
+  if (onode_format < 2) {
+    return 0;
+  }
+
+  // older code cannot decode flat onodes; make sure it refuses to mount
+  // rather than failing on the first onode it reads.
+  int32_t compat = 0;
+  {
+    bufferlist bl;
+    db->get(PREFIX_SUPER, "min_compat_ondisk_format", &bl);
+    auto p = bl.cbegin();
+    try {
+      decode(compat, p);
+    } catch (buffer::error& e) {
+      derr << __func__ << " unable to read min_compat_ondisk_format" << dendl;
+      return -EIO;
+    }
+  }
+  if (compat < flat_onode_compat_ondisk_format) {
+    dout(1) << __func__ << " raising min_compat_ondisk_format from "
+	    << compat << " to " << flat_onode_compat_ondisk_format << dendl;
+    bufferlist bl;
+    encode(flat_onode_compat_ondisk_format, bl);
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
+    int r = db->submit_transaction_sync(t);
+    assert(r == 0);
+  }
+  return 0;
+}
+
 int BlueStore::_set_cache_sizes()
 {
   assert(bdev);
@@ -4138,8 +4538,18 @@ void BlueStore::_init_logger()
     "Average read onode metadata latency");
   b.add_time_avg(l_bluestore_read_wait_aio_lat, "read_wait_aio_lat",
     "Average read latency");
+  b.add_time_avg(l_bluestore_readv_lat, "readv_lat",
+    "Average batched read latency");
+  b.add_u64_counter(l_bluestore_readv_ops, "readv_ops",
+    "Objects read through batched reads");
+  b.add_u64_counter(l_bluestore_read_async_ops, "read_async_ops",
+    "Reads that completed asynchronously");
   b.add_time_avg(l_bluestore_compress_lat, "compress_lat",
     "Average compress latency");
+  b.add_time_avg(l_bluestore_compress_queue_lat, "compress_queue_lat",
+    "Average time blobs waited for a compression worker");
+  b.add_u64_counter(l_bluestore_compress_queued_ops, "compress_queued_ops",
+    "Blobs handed to compression workers");
   b.add_time_avg(l_bluestore_decompress_lat, "decompress_lat",
     "Average decompress latency");
   b.add_time_avg(l_bluestore_csum_lat, "csum_lat",
@@ -4148,12 +4558,29 @@ void BlueStore::_init_logger()
     "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
     "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_compress_attempted_bytes,
+    "compress_attempted_bytes",
+    "Bytes handed to the compressor", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_compress_skipped_bytes,
+    "compress_skipped_bytes",
+    "Bytes not compressed because sampling or history predicted no gain",
+    NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_write_pad_bytes, "write_pad_bytes",
 		    "Sum for write-op padded bytes", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_deferred_write_ops, "deferred_write_ops",
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def", 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_deferred_write_elided_bytes,
+		    "deferred_write_elided_bytes",
+		    "Deferred write bytes overwritten before being written",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_deferred_write_merged_ios,
+		    "deferred_write_merged_ios",
+		    "Deferred writes merged into a neighbouring write");
+  b.add_u64_counter(l_bluestore_deferred_flush_throttled,
+		    "deferred_flush_throttled",
+		    "Deferred flushes held back by the flush queue depth");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4178,6 +4605,13 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_onode_shard_misses,
 		    "bluestore_onode_shard_misses",
 		    "Sum for onode-shard lookups missed in the cache");
+  b.add_u64_counter(l_bluestore_onode_l2_hits, "bluestore_onode_l2_hits",
+		    "Sum for onode and shard lookups hit in the l2 cache");
+  b.add_u64_counter(l_bluestore_onode_l2_misses, "bluestore_onode_l2_misses",
+		    "Sum for onode and shard lookups missed in the l2 cache");
+  b.add_u64_counter(l_bluestore_onode_materialize,
+		    "bluestore_onode_materialize",
+		    "Sum for flat onodes whose extent map was decoded on demand");
   b.add_u64(l_bluestore_extents, "bluestore_extents",
 	    "Number of extents in cache");
   b.add_u64(l_bluestore_blobs, "bluestore_blobs",
@@ -4228,6 +4662,36 @@ void BlueStore::_init_logger()
                     "Read EIO errors propagated to high level callers");
   b.add_u64(l_bluestore_fragmentation, "bluestore_fragmentation_micros",
             "How fragmented bluestore free space is (free extents / max possible number of free extents) * 1000");
+  b.add_u64_counter(l_bluestore_alloc_cache_hit, "bluestore_alloc_cache_hit",
+		    "Allocations served from the per-thread extent caches");
+  b.add_u64_counter(l_bluestore_alloc_cache_miss, "bluestore_alloc_cache_miss",
+		    "Cacheable allocations that needed a refill");
+  b.add_u64(l_bluestore_alloc_cache_bytes, "bluestore_alloc_cache_bytes",
+	    "Free space held in the per-thread extent caches",
+	    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_alloc_snapshot_loaded,
+		    "bluestore_alloc_snapshot_loaded",
+		    "Mounts that loaded the allocator from a snapshot");
+  b.add_u64_counter(l_bluestore_alloc_snapshot_rejected,
+		    "bluestore_alloc_snapshot_rejected",
+		    "Mounts that found a snapshot they could not use");
+  b.add_u64_counter(l_bluestore_tier_fast_write_bytes,
+		    "bluestore_tier_fast_write_bytes",
+		    "Sum for new data written to the fast tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_promote_bytes,
+		    "bluestore_tier_promote_bytes",
+		    "Sum for hot data moved to the fast tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_demote_bytes,
+		    "bluestore_tier_demote_bytes",
+		    "Sum for cold data moved off the fast tier",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_tier_move_errors,
+		    "bluestore_tier_move_errors",
+		    "Objects left in place because their data could not be read");
+  b.add_u64(l_bluestore_tier_fast_used, "bluestore_tier_fast_used",
+	    "Bytes allocated on the fast tier", NULL, 0, unit_t(UNIT_BYTES));
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -4425,6 +4889,9 @@ void BlueStore::_set_alloc_sizes(void)
       deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops_ssd;
     }
   }
+  deferred_coalesce = cct->_conf->get_val<bool>("bluestore_deferred_coalesce");
+  deferred_flush_queue_depth =
+    cct->_conf->get_val<uint64_t>("bluestore_deferred_flush_queue_depth");
 
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
@@ -4432,6 +4899,8 @@ void BlueStore::_set_alloc_sizes(void)
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " deferred_coalesce " << deferred_coalesce
+	   << " deferred_flush_queue_depth " << deferred_flush_queue_depth
 	   << dendl;
 }
 
@@ -4594,7 +5063,7 @@ void BlueStore::_close_fm()
   fm = NULL;
 }
 
-int BlueStore::_open_alloc()
+int BlueStore::_open_alloc(bool use_snapshot)
 {
   assert(alloc == NULL);
   assert(bdev->get_size());
@@ -4607,9 +5076,57 @@ int BlueStore::_open_alloc()
                << dendl;
     return -EINVAL;
   }
+  uint64_t cache_size = cct->_conf->get_val<uint64_t>(
+    "bluestore_allocator_cache_size");
+  if (cache_size) {
+    alloc_cache = new MagazineAllocator(
+      cct, alloc, min_alloc_size,
+      cct->_conf->get_val<uint64_t>("bluestore_allocator_cache_shards"),
+      cache_size,
+      cct->_conf->get_val<uint64_t>("bluestore_allocator_cache_max_alloc"));
+    alloc = alloc_cache;
+  }
 
   uint64_t num = 0, bytes = 0;
 
+  // a snapshot from the last clean umount is only good until the
+  // freelist changes; use it (or not) and forget it before that happens.
+  uint64_t snap_seq = 0;
+  {
+    bufferlist bl;
+    db->get(PREFIX_SUPER, "alloc_snapshot_seq", &bl);
+    if (bl.length()) {
+      auto p = bl.cbegin();
+      decode(snap_seq, p);
+    }
+  }
+  bool loaded = false;
+  if (snap_seq) {
+    if (use_snapshot &&
+	cct->_conf->get_val<bool>("bluestore_allocator_snapshot")) {
+      utime_t start = ceph_clock_now();
+      int r = _load_alloc_snapshot(snap_seq, &num, &bytes);
+      if (r == 0) {
+	loaded = true;
+	logger->inc(l_bluestore_alloc_snapshot_loaded);
+	dout(1) << __func__ << " loaded " << byte_u_t(bytes)
+		<< " in " << num << " extents from snapshot " << snap_seq
+		<< " in " << ceph_clock_now() - start << dendl;
+      } else {
+	logger->inc(l_bluestore_alloc_snapshot_rejected);
+	dout(1) << __func__ << " unable to use snapshot " << snap_seq << ": "
+		<< cpp_strerror(r) << ", rebuilding from freelist" << dendl;
+      }
+    }
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkey(PREFIX_SUPER, "alloc_snapshot_seq");
+    int r = db->submit_transaction_sync(t);
+    assert(r == 0);
+  }
+  if (loaded) {
+    return 0;
+  }
+
   dout(1) << __func__ << " opening allocation metadata" << dendl;
   // initialize from freelist
   fm->enumerate_reset();
@@ -4634,89 +5151,354 @@ int BlueStore::_open_alloc()
   return 0;
 }
 
-void BlueStore::_close_alloc()
-{
-  assert(bdev);
-  bdev->discard_drain();
-
-  assert(alloc);
-  alloc->shutdown();
-  delete alloc;
-  alloc = NULL;
-}
-
-int BlueStore::_open_fsid(bool create)
-{
-  assert(fsid_fd < 0);
-  int flags = O_RDWR;
-  if (create)
-    flags |= O_CREAT;
-  fsid_fd = ::openat(path_fd, "fsid", flags, 0644);
-  if (fsid_fd < 0) {
-    int err = -errno;
-    derr << __func__ << " " << cpp_strerror(err) << dendl;
-    return err;
-  }
-  return 0;
-}
+#define ALLOC_SNAPSHOT_DIR "bluestore"
+#define ALLOC_SNAPSHOT_FILE "alloc_snapshot"
 
-int BlueStore::_read_fsid(uuid_d *uuid)
+int BlueStore::_load_alloc_snapshot(uint64_t seq, uint64_t *num,
+				    uint64_t *bytes)
 {
-  char fsid_str[40];
-  memset(fsid_str, 0, sizeof(fsid_str));
-  int ret = safe_read(fsid_fd, fsid_str, sizeof(fsid_str));
-  if (ret < 0) {
-    derr << __func__ << " failed: " << cpp_strerror(ret) << dendl;
-    return ret;
-  }
-  if (ret > 36)
-    fsid_str[36] = 0;
-  else
-    fsid_str[ret] = 0;
-  if (!uuid->parse(fsid_str)) {
-    derr << __func__ << " unparsable uuid " << fsid_str << dendl;
-    return -EINVAL;
+  if (!bluefs) {
+    return -ENOENT;
   }
-  return 0;
-}
-
-int BlueStore::_write_fsid()
-{
-  int r = ::ftruncate(fsid_fd, 0);
+  uint64_t size;
+  utime_t mtime;
+  int r = bluefs->stat(ALLOC_SNAPSHOT_DIR, ALLOC_SNAPSHOT_FILE, &size, &mtime);
   if (r < 0) {
-    r = -errno;
-    derr << __func__ << " fsid truncate failed: " << cpp_strerror(r) << dendl;
     return r;
   }
-  string str = stringify(fsid) + "\n";
-  r = safe_write(fsid_fd, str.c_str(), str.length());
+  if (size < sizeof(uint32_t)) {
+    return -EIO;
+  }
+  BlueFS::FileReader *h;
+  r = bluefs->open_for_read(ALLOC_SNAPSHOT_DIR, ALLOC_SNAPSHOT_FILE, &h);
   if (r < 0) {
-    derr << __func__ << " fsid write failed: " << cpp_strerror(r) << dendl;
     return r;
   }
-  r = ::fsync(fsid_fd);
+  bufferlist bl;
+  r = bluefs->read(h, &h->buf, 0, size, &bl, NULL);
+  delete h;
   if (r < 0) {
-    r = -errno;
-    derr << __func__ << " fsid fsync failed: " << cpp_strerror(r) << dendl;
     return r;
   }
+  if ((uint64_t)r != size) {
+    return -EIO;
+  }
+
+  bufferlist payload;
+  payload.substr_of(bl, 0, size - sizeof(uint32_t));
+  vector<pair<uint64_t,uint64_t>> extents;
+  try {
+    uint32_t crc;
+    auto p = bl.cbegin();
+    p.advance(size - sizeof(uint32_t));
+    decode(crc, p);
+    if (crc != payload.crc32c(-1)) {
+      derr << __func__ << " bad crc" << dendl;
+      return -EIO;
+    }
+    uint8_t struct_v;
+    uint64_t file_seq, bdev_size, au;
+    p = payload.cbegin();
+    decode(struct_v, p);
+    decode(file_seq, p);
+    decode(bdev_size, p);
+    decode(au, p);
+    if (struct_v != 1 ||
+	file_seq != seq ||
+	bdev_size != bdev->get_size() ||
+	au != min_alloc_size) {
+      dout(1) << __func__ << " stale snapshot (v " << (int)struct_v
+	      << " seq " << file_seq << " size 0x" << std::hex << bdev_size
+	      << " min_alloc_size 0x" << au << std::dec << ")" << dendl;
+      return -ESTALE;
+    }
+    decode(extents, p);
+  } catch (buffer::error& e) {
+    derr << __func__ << " unable to decode: " << e.what() << dendl;
+    return -EIO;
+  }
+  for (auto& e : extents) {
+    alloc->init_add_free(e.first, e.second);
+    *bytes += e.second;
+  }
+  *num = extents.size();
   return 0;
 }
 
-void BlueStore::_close_fsid()
+void BlueStore::_write_alloc_snapshot()
 {
-  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
-  fsid_fd = -1;
-}
+  if (!bluefs || !cct->_conf->get_val<bool>("bluestore_allocator_snapshot")) {
+    return;
+  }
+  utime_t start = ceph_clock_now();
+  // released extents come back from discard asynchronously
+  bdev->discard_drain();
 
-int BlueStore::_lock_fsid()
-{
-  struct flock l;
-  memset(&l, 0, sizeof(l));
-  l.l_type = F_WRLCK;
-  l.l_whence = SEEK_SET;
-  int r = ::fcntl(fsid_fd, F_SETLK, &l);
-  if (r < 0) {
+  uint64_t seq = start.to_nsec();
+  vector<pair<uint64_t,uint64_t>> extents;
+  alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+      extents.emplace_back(offset, length);
+    });
+  bufferlist bl;
+  uint8_t struct_v = 1;
+  encode(struct_v, bl);
+  encode(seq, bl);
+  encode(bdev->get_size(), bl);
+  encode(min_alloc_size, bl);
+  encode(extents, bl);
+  uint32_t crc = bl.crc32c(-1);
+  encode(crc, bl);
+
+  int r = 0;
+  BlueFS::FileWriter *h;
+  if (!bluefs->dir_exists(ALLOC_SNAPSHOT_DIR)) {
+    r = bluefs->mkdir(ALLOC_SNAPSHOT_DIR);
+  }
+  if (r == 0) {
+    r = bluefs->open_for_write(ALLOC_SNAPSHOT_DIR, ALLOC_SNAPSHOT_FILE, &h,
+			       false);
+  }
+  if (r == 0) {
+    h->append(bl);
+    r = bluefs->fsync(h);
+    bluefs->close_writer(h);
+  }
+  if (r < 0) {
+    derr << __func__ << " failed to write snapshot: " << cpp_strerror(r)
+	 << dendl;
+    return;
+  }
+
+  bufferlist sbl;
+  encode(seq, sbl);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->set(PREFIX_SUPER, "alloc_snapshot_seq", sbl);
+  r = db->submit_transaction_sync(t);
+  assert(r == 0);
+  dout(1) << __func__ << " " << extents.size() << " extents, seq " << seq
+	  << " in " << ceph_clock_now() - start << dendl;
+}
+
+void BlueStore::_close_alloc()
+{
+  assert(bdev);
+  bdev->discard_drain();
+
+  assert(alloc);
+  alloc->shutdown();
+  delete alloc;
+  alloc = NULL;
+  alloc_cache = nullptr;
+}
+
+int BlueStore::_open_tier(bool create)
+{
+  assert(tier_bdev == NULL);
+  string bfn = path + "/block.db";
+  {
+    bufferlist bl;
+    db->get(PREFIX_SUPER, "tier_extents", &bl);
+    if (bl.length()) {
+      auto p = bl.cbegin();
+      decode(tier_extents, p);
+    }
+  }
+  if (tier_extents.empty()) {
+    uint64_t want = cct->_conf->get_val<uint64_t>("bluestore_tier_fast_size");
+    if (!create || want == 0) {
+      return 0;
+    }
+    if (!bluefs || bluefs_shared_bdev != BlueFS::BDEV_SLOW) {
+      dout(1) << __func__ << " no separate block.db, data tiering disabled"
+	      << dendl;
+      return 0;
+    }
+    // only take what bluefs can spare; rocksdb spills over to the slow
+    // device if it ever needs more than what is left.
+    uint64_t free = bluefs->get_free(BlueFS::BDEV_DB);
+    uint64_t keep = cct->_conf->get_val<uint64_t>(
+      "bluestore_bluefs_min_free");
+    want = std::min(want, free > keep ? free - keep : 0);
+    want = p2align(want, cct->_conf->bluefs_alloc_size);
+    if (want == 0) {
+      derr << __func__ << " no spare block.db capacity (free 0x" << std::hex
+	   << free << std::dec << "), data tiering disabled" << dendl;
+      return 0;
+    }
+    PExtentVector extents;
+    int r = bluefs->reclaim_blocks(BlueFS::BDEV_DB, want, &extents);
+    if (r < 0) {
+      derr << __func__ << " failed to reclaim block.db space: "
+	   << cpp_strerror(r) << dendl;
+      return r;
+    }
+    for (auto& e : extents) {
+      tier_extents.insert(e.offset, e.length);
+    }
+    // if we crash before this commits the space is merely lost to bluefs
+    KeyValueDB::Transaction t = db->get_transaction();
+    {
+      bufferlist bl;
+      encode(tier_extents, bl);
+      t->set(PREFIX_SUPER, "tier_extents", bl);
+    }
+    tier_fm = FreelistManager::create(cct, freelist_type, db,
+				      PREFIX_TIER_ALLOC);
+    tier_fm->create(bluefs->get_block_device_size(BlueFS::BDEV_DB),
+		    min_alloc_size, t);
+    db->submit_transaction_sync(t);
+    dout(1) << __func__ << " reserved 0x" << std::hex << tier_extents
+	    << std::dec << " of block.db for data" << dendl;
+  } else {
+    tier_fm = FreelistManager::create(cct, freelist_type, db,
+				      PREFIX_TIER_ALLOC);
+  }
+
+  int r = tier_fm->init();
+  if (r < 0) {
+    derr << __func__ << " tier freelist init failed: " << cpp_strerror(r)
+	 << dendl;
+    goto out_fm;
+  }
+
+  // our own handle on block.db: bluefs' does not deliver aio completions
+  tier_bdev = BlockDevice::create(cct, bfn, aio_cb, static_cast<void*>(this),
+				  NULL, NULL);
+  r = tier_bdev->open(bfn);
+  if (r < 0) {
+    derr << __func__ << " failed to open " << bfn << ": " << cpp_strerror(r)
+	 << dendl;
+    goto out_bdev;
+  }
+
+  tier_alloc = Allocator::create(cct, cct->_conf->bluestore_allocator,
+				 tier_bdev->get_size(), min_alloc_size);
+  if (!tier_alloc) {
+    r = -EINVAL;
+    goto out_bdev;
+  }
+  {
+    interval_set<uint64_t> free;
+    uint64_t offset, length;
+    tier_fm->enumerate_reset();
+    while (tier_fm->enumerate_next(&offset, &length)) {
+      free.insert(offset, length);
+    }
+    tier_fm->enumerate_reset();
+    free.intersection_of(tier_extents);
+    for (auto p = free.begin(); p != free.end(); ++p) {
+      tier_alloc->init_add_free(p.get_start(), p.get_len());
+    }
+    dout(1) << __func__ << " fast tier 0x" << std::hex << tier_extents.size()
+	    << " bytes, 0x" << free.size() << " free" << std::dec << dendl;
+  }
+  _update_tier_logger();
+  return 0;
+
+ out_bdev:
+  tier_bdev->close();
+  delete tier_bdev;
+  tier_bdev = NULL;
+ out_fm:
+  tier_fm->shutdown();
+  delete tier_fm;
+  tier_fm = NULL;
+  tier_extents.clear();
+  return r;
+}
+
+void BlueStore::_close_tier()
+{
+  if (tier_alloc) {
+    tier_alloc->shutdown();
+    delete tier_alloc;
+    tier_alloc = NULL;
+  }
+  if (tier_bdev) {
+    tier_bdev->close();
+    delete tier_bdev;
+    tier_bdev = NULL;
+  }
+  if (tier_fm) {
+    tier_fm->shutdown();
+    delete tier_fm;
+    tier_fm = NULL;
+  }
+  tier_extents.clear();
+}
+
+int BlueStore::_open_fsid(bool create)
+{
+  assert(fsid_fd < 0);
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
+  fsid_fd = ::openat(path_fd, "fsid", flags, 0644);
+  if (fsid_fd < 0) {
+    int err = -errno;
+    derr << __func__ << " " << cpp_strerror(err) << dendl;
+    return err;
+  }
+  return 0;
+}
+
+int BlueStore::_read_fsid(uuid_d *uuid)
+{
+  char fsid_str[40];
+  memset(fsid_str, 0, sizeof(fsid_str));
+  int ret = safe_read(fsid_fd, fsid_str, sizeof(fsid_str));
+  if (ret < 0) {
+    derr << __func__ << " failed: " << cpp_strerror(ret) << dendl;
+    return ret;
+  }
+  if (ret > 36)
+    fsid_str[36] = 0;
+  else
+    fsid_str[ret] = 0;
+  if (!uuid->parse(fsid_str)) {
+    derr << __func__ << " unparsable uuid " << fsid_str << dendl;
+    return -EINVAL;
+  }
+  return 0;
+}
+
+int BlueStore::_write_fsid()
+{
+  int r = ::ftruncate(fsid_fd, 0);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fsid truncate failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  string str = stringify(fsid) + "\n";
+  r = safe_write(fsid_fd, str.c_str(), str.length());
+  if (r < 0) {
+    derr << __func__ << " fsid write failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  r = ::fsync(fsid_fd);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fsid fsync failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  return 0;
+}
+
+void BlueStore::_close_fsid()
+{
+  VOID_TEMP_FAILURE_RETRY(::close(fsid_fd));
+  fsid_fd = -1;
+}
+
+int BlueStore::_lock_fsid()
+{
+  struct flock l;
+  memset(&l, 0, sizeof(l));
+  l.l_type = F_WRLCK;
+  l.l_whence = SEEK_SET;
+  int r = ::fcntl(fsid_fd, F_SETLK, &l);
+  if (r < 0) {
     int err = errno;
     derr << __func__ << " failed to lock " << path << "/fsid"
 	 << " (is another ceph-osd still running?)"
@@ -5035,6 +5817,10 @@ int BlueStore::_open_db(bool create, bool to_repair_db)
     }
   }
 
+  if (_kv_resharding) {
+    // let the kv store open a half resharded db so we can finish the job
+    kv_options["resharding"] = "1";
+  }
 
   db = KeyValueDB::create(cct,
 			  kv_backend,
@@ -5062,14 +5848,18 @@ int BlueStore::_open_db(bool create, bool to_repair_db)
   if (kv_backend == "rocksdb") {
     options = cct->_conf->bluestore_rocksdb_options;
 
-    map<string,string> cf_map;
-    cct->_conf->with_val<string>("bluestore_rocksdb_cfs",
-                                 get_str_map,
-                                 &cf_map,
-                                 " \t");
-    for (auto& i : cf_map) {
-      dout(10) << "column family " << i.first << ": " << i.second << dendl;
-      cfs.push_back(KeyValueDB::ColumnFamily(i.first, i.second));
+    ostringstream perr;
+    r = KeyValueDB::parse_column_families(
+      cct->_conf->get_val<string>("bluestore_rocksdb_cfs"), &cfs, &perr);
+    if (r < 0) {
+      derr << __func__ << " bad bluestore_rocksdb_cfs: " << perr.str()
+	   << dendl;
+      _close_db();
+      return r;
+    }
+    for (auto& i : cfs) {
+      dout(10) << "column family " << i.name << " shards " << i.shard_cnt
+	       << ": " << i.option << dendl;
     }
   }
 
@@ -5348,6 +6138,77 @@ int BlueStore::_open_collections(int *errors)
   return 0;
 }
 
+uint64_t BlueStore::_bump_onode_l2cache_epoch()
+{
+  // every read/write open of the db moves the epoch forward so that a
+  // cache file can never be trusted after the db has been modified
+  // without it.  with no l2 cache configured we only have to make sure
+  // no epoch is left behind: cache files are always stamped with an
+  // epoch >= 1, so a missing key (epoch 0) matches none of them.
+  uint64_t epoch = 0;
+  bufferlist bl;
+  db->get(PREFIX_SUPER, "onode_l2cache_epoch", &bl);
+  if (cct->_conf->get_val<string>("bluestore_onode_l2cache_path").empty()) {
+    if (bl.length()) {
+      KeyValueDB::Transaction t = db->get_transaction();
+      t->rmkey(PREFIX_SUPER, "onode_l2cache_epoch");
+      int r = db->submit_transaction_sync(t);
+      assert(r == 0);
+      dout(10) << __func__ << " l2 cache disabled, dropped epoch" << dendl;
+    }
+    return 0;
+  }
+  if (bl.length()) {
+    auto p = bl.cbegin();
+    decode(epoch, p);
+  }
+  bl.clear();
+  encode(epoch + 1, bl);
+  KeyValueDB::Transaction t = db->get_transaction();
+  t->set(PREFIX_SUPER, "onode_l2cache_epoch", bl);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
+  dout(10) << __func__ << " " << epoch << " -> " << epoch + 1 << dendl;
+  return epoch;
+}
+
+int BlueStore::_open_onode_l2cache()
+{
+  assert(onode_l2cache == nullptr);
+  string l2path = cct->_conf->get_val<string>("bluestore_onode_l2cache_path");
+  uint64_t epoch = _bump_onode_l2cache_epoch();
+  if (l2path.empty()) {
+    return 0;
+  }
+  onode_l2cache = new OnodeL2Cache(
+    cct, l2path,
+    cct->_conf->get_val<uint64_t>("bluestore_onode_l2cache_size"),
+    cct->_conf->get_val<uint64_t>("bluestore_onode_l2cache_slot_size"));
+  bool valid = false;
+  int r = onode_l2cache->open(fsid, epoch, &valid);
+  if (r == 0) {
+    r = onode_l2cache->start(epoch + 1);
+  }
+  if (r < 0) {
+    // the cache is an optimization only; carry on without it
+    derr << __func__ << " unable to open " << l2path << ": "
+	 << cpp_strerror(r) << ", continuing without onode l2 cache" << dendl;
+    onode_l2cache->close(false);
+    delete onode_l2cache;
+    onode_l2cache = nullptr;
+  }
+  return 0;
+}
+
+void BlueStore::_close_onode_l2cache(bool clean)
+{
+  if (onode_l2cache) {
+    onode_l2cache->close(clean);
+    delete onode_l2cache;
+    onode_l2cache = nullptr;
+  }
+}
+
 void BlueStore::_open_statfs()
 {
   bufferlist bl;
@@ -5654,6 +6515,37 @@ void BlueStore::set_cache_shards(unsigned num)
     cache_shards[i] = Cache::create(cct, cct->_conf->bluestore_cache_type,
 				    logger);
   }
+  // keep in sync with the OSD's op shard placement; the shard count is
+  // the same, so shard i is accessed from threads bound to the same node.
+  std::vector<int> numa_nodes;
+  if (cct->_conf->get_val<bool>("osd_numa_shard_affinity")) {
+    numa_nodes = get_online_numa_nodes();
+  }
+  for (unsigned i = 0; i < num; ++i) {
+    cache_shards[i]->numa_node = get_numa_node_for_shard(i, num, numa_nodes);
+  }
+}
+
+void BlueStore::_dump_numa_cache_stats(Formatter *f)
+{
+  map<int, vector<Cache*>> by_node;
+  for (auto i : cache_shards) {
+    by_node[i->numa_node].push_back(i);
+  }
+  for (auto& p : by_node) {
+    uint64_t onodes = 0, extents = 0, blobs = 0, buffers = 0, bytes = 0;
+    for (auto c : p.second) {
+      c->add_stats(&onodes, &extents, &blobs, &buffers, &bytes);
+    }
+    f->open_object_section(stringify(p.first).c_str());
+    f->dump_unsigned("shards", p.second.size());
+    f->dump_unsigned("onodes", onodes);
+    f->dump_unsigned("extents", extents);
+    f->dump_unsigned("blobs", blobs);
+    f->dump_unsigned("buffers", buffers);
+    f->dump_unsigned("buffer_bytes", bytes);
+    f->close_section();
+  }
 }
 
 int BlueStore::_mount(bool kv_only, bool open_db)
@@ -5721,10 +6613,14 @@ int BlueStore::_mount(bool kv_only, bool open_db)
   if (r < 0)
     goto out_db;
 
-  r = _open_alloc();
+  r = _open_alloc(true);
   if (r < 0)
     goto out_fm;
 
+  r = _open_tier(true);
+  if (r < 0)
+    goto out_alloc;
+
   r = _open_collections();
   if (r < 0)
     goto out_alloc;
@@ -5739,6 +6635,10 @@ int BlueStore::_mount(bool kv_only, bool open_db)
       goto out_coll;
   }
 
+  r = _open_onode_l2cache();
+  if (r < 0)
+    goto out_coll;
+
   _kv_start();
 
   r = _deferred_replay();
@@ -5746,15 +6646,23 @@ int BlueStore::_mount(bool kv_only, bool open_db)
     goto out_stop;
 
   mempool_thread.init();
+  mempool::register_numa_dumper(
+    "bluestore(" + path + ")",
+    [this](Formatter *f) { _dump_numa_cache_stats(f); });
+  if (tier_alloc) {
+    tier_thread.init();
+  }
 
   mounted = true;
   return 0;
 
  out_stop:
   _kv_stop();
+  _close_onode_l2cache(false);
  out_coll:
   _flush_cache();
  out_alloc:
+  _close_tier();
   _close_alloc();
  out_fm:
   _close_fm();
@@ -5774,16 +6682,23 @@ int BlueStore::umount()
   assert(_kv_only || mounted);
   dout(1) << __func__ << dendl;
 
+  if (!_kv_only && tier_alloc) {
+    tier_thread.shutdown();
+  }
   _osr_drain_all();
 
   mounted = false;
   if (!_kv_only) {
+    mempool::unregister_numa_dumper("bluestore(" + path + ")");
     mempool_thread.shutdown();
     dout(20) << __func__ << " stopping kv thread" << dendl;
     _kv_stop();
     _flush_cache();
+    _close_onode_l2cache(true);
     dout(20) << __func__ << " closing" << dendl;
 
+    _write_alloc_snapshot();
+    _close_tier();
     _close_alloc();
     _close_fm();
   }
@@ -5824,6 +6739,7 @@ int BlueStore::_fsck_check_extents(
   const PExtentVector& extents,
   bool compressed,
   mempool_dynamic_bitset &used_blocks,
+  interval_set<uint64_t> &tier_used,
   uint64_t granularity,
   BlueStoreRepairer* repairer,
   store_statfs_t& expected_statfs)
@@ -5837,6 +6753,21 @@ int BlueStore::_fsck_check_extents(
     if (compressed) {
       expected_statfs.compressed_allocated += e.length;
     }
+    if (_is_tier_offset(e.offset)) {
+      uint64_t off = e.offset - TIER_FAST_BASE;
+      if (!tier_extents.contains(off, e.length)) {
+	derr << "fsck error: " << oid << " extent " << e
+	     << " outside of the fast tier" << dendl;
+	++errors;
+      } else if (tier_used.intersects(off, e.length)) {
+	derr << "fsck error: " << oid << " extent " << e
+	     << " or a subset is already allocated (misreferenced)" << dendl;
+	++errors;
+      } else {
+	tier_used.insert(off, e.length);
+      }
+      continue;
+    }
     bool already = false;
     apply(
       e.offset, e.length, granularity, used_blocks,
@@ -5924,6 +6855,7 @@ int BlueStore::_fsck(bool deep, bool repair)
   uint64_t_btree_t used_sbids;
 
   mempool_dynamic_bitset used_blocks;
+  interval_set<uint64_t> tier_used;  ///< fast tier, relative to block.db
   KeyValueDB::Iterator it;
   store_statfs_t expected_statfs, actual_statfs;
   struct sb_info_t {
@@ -5975,6 +6907,11 @@ int BlueStore::_fsck(bool deep, bool repair)
   if (r < 0)
     goto out_db;
 
+  if (repair) {
+    // repair rewrites onodes behind the back of any onode l2 cache
+    _bump_onode_l2cache_epoch();
+  }
+
   r = _open_fm(false);
   if (r < 0)
     goto out_db;
@@ -5983,6 +6920,10 @@ int BlueStore::_fsck(bool deep, bool repair)
   if (r < 0)
     goto out_fm;
 
+  r = _open_tier(false);
+  if (r < 0)
+    goto out_alloc;
+
   r = _open_collections(&errors);
   if (r < 0)
     goto out_alloc;
@@ -6145,8 +7086,8 @@ int BlueStore::_fsck(bool deep, bool repair)
 	used_nids.insert(o->onode.nid);
       }
       ++num_objects;
-      num_spanning_blobs += o->extent_map.spanning_blob_map.size();
       o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+      num_spanning_blobs += o->extent_map.spanning_blob_map.size();
       _dump_onode(o);
       // shards
       if (!o->extent_map.shards.empty()) {
@@ -6302,6 +7243,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 	  errors += _fsck_check_extents(c->cid, oid, blob.get_extents(),
 					blob.is_compressed(),
 					used_blocks,
+					tier_used,
 					fm->get_alloc_size(),
 					repair ? &repairer : nullptr,
 					expected_statfs);
@@ -6394,6 +7336,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 				      extents,
 				      p->second.compressed,
 				      used_blocks,
+				      tier_used,
 				      fm->get_alloc_size(),
 				      repair ? &repairer : nullptr,
 				      expected_statfs);
@@ -6764,6 +7707,40 @@ int BlueStore::_fsck(bool deep, bool repair)
       used_blocks.flip();
     }
   }
+  if (tier_fm) {
+    interval_set<uint64_t> tier_free;
+    uint64_t offset, length;
+    tier_fm->enumerate_reset();
+    while (tier_fm->enumerate_next(&offset, &length)) {
+      tier_free.insert(offset, length);
+    }
+    tier_fm->enumerate_reset();
+    // the tier freelist spans all of block.db; we only own tier_extents
+    tier_free.intersection_of(tier_extents);
+    interval_set<uint64_t> false_free;
+    false_free.intersection_of(tier_free, tier_used);
+    for (auto p = false_free.begin(); p != false_free.end(); ++p) {
+      derr << "fsck error: fast tier free extent 0x" << std::hex
+	   << p.get_start() << "~" << p.get_len() << std::dec
+	   << " intersects allocated blocks" << dendl;
+      ++errors;
+      if (repair) {
+	repairer.fix_false_free(db, tier_fm, p.get_start(), p.get_len());
+      }
+    }
+    interval_set<uint64_t> leaked = tier_extents;
+    leaked.subtract(tier_free);
+    tier_used.subtract(false_free);
+    leaked.subtract(tier_used);
+    for (auto p = leaked.begin(); p != leaked.end(); ++p) {
+      derr << "fsck error: fast tier leaked extent 0x" << std::hex
+	   << p.get_start() << "~" << p.get_len() << std::dec << dendl;
+      ++errors;
+      if (repair) {
+	repairer.fix_leaked(db, tier_fm, p.get_start(), p.get_len());
+      }
+    }
+  }
   if (repair) {
     dout(5) << __func__ << " applying repair results" << dendl;
     repaired = repairer.apply(db);
@@ -6773,6 +7750,7 @@ int BlueStore::_fsck(bool deep, bool repair)
   mempool_thread.shutdown();
   _flush_cache();
  out_alloc:
+  _close_tier();
   _close_alloc();
  out_fm:
   _close_fm();
@@ -6882,6 +7860,16 @@ void BlueStore::inject_statfs(const store_statfs_t& new_statfs)
   repairer.apply(db);
 }
 
+void BlueStore::inject_alloc_snapshot_seq(uint64_t seq)
+{
+  bufferlist bl;
+  encode(seq, bl);
+  KeyValueDB::Transaction txn;
+  txn = db->get_transaction();
+  txn->set(PREFIX_SUPER, "alloc_snapshot_seq", bl);
+  db->submit_transaction_sync(txn);
+}
+
 void BlueStore::inject_misreference(coll_t cid1, ghobject_t oid1,
 				    coll_t cid2, ghobject_t oid2,
 				    uint64_t offset)
@@ -7014,8 +8002,9 @@ BlueStore::CollectionRef BlueStore::_get_collection(const coll_t& cid)
 void BlueStore::_queue_reap_collection(CollectionRef& c)
 {
   dout(10) << __func__ << " " << c << " " << c->cid << dendl;
-  // _reap_collections and this in the same thread,
-  // so no need a lock.
+  // with more than one kv pipeline, _reap_collections and this may
+  // run on different finalize threads.
+  std::lock_guard<std::mutex> l(removed_collections_lock);
   removed_collections.push_back(c);
 }
 
@@ -7024,8 +8013,7 @@ void BlueStore::_reap_collections()
 
   list<CollectionRef> removed_colls;
   {
-    // _queue_reap_collection and this in the same thread.
-    // So no need a lock.
+    std::lock_guard<std::mutex> l(removed_collections_lock);
     if (!removed_collections.empty())
       removed_colls.swap(removed_collections);
     else
@@ -7055,6 +8043,7 @@ void BlueStore::_reap_collections()
   if (removed_colls.empty()) {
     dout(10) << __func__ << " all reaped" << dendl;
   } else {
+    std::lock_guard<std::mutex> l(removed_collections_lock);
     removed_collections.splice(removed_collections.begin(), removed_colls);
   }
 }
@@ -7194,6 +8183,9 @@ int BlueStore::read(
     if (r == -EIO) {
       logger->inc(l_bluestore_read_eio);
     }
+    if (r >= 0 && tier_alloc) {
+      _tier_note_read(c, o);
+    }
   }
 
  out:
@@ -7244,56 +8236,60 @@ struct region_t {
 typedef list<region_t> regions2read_t;
 typedef map<BlueStore::BlobRef, regions2read_t> blobs2read_t;
 
-int BlueStore::_do_read(
-  Collection *c,
-  OnodeRef o,
-  uint64_t offset,
-  size_t length,
-  bufferlist& bl,
-  uint32_t op_flags)
-{
-  FUNCTRACE(cct);
-  int r = 0;
-
-  dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
-           << " size 0x" << o->onode.size << " (" << std::dec
-           << o->onode.size << ")" << dendl;
-  bl.clear();
+struct BlueStore::read_req_t {
+  Collection *c;
+  OnodeRef o;
+  uint64_t offset;
+  size_t length;
+  bool buffered = false;
 
-  if (offset >= o->onode.size) {
-    return r;
-  }
+  ready_regions_t ready_regions;
+  blobs2read_t blobs2read;
+  unsigned num_regions = 0;
+  vector<bufferlist> compressed_blob_bls;
+  bufferlist bl;
 
-  // generally, don't buffer anything, unless the client explicitly requests
-  // it.
-  bool buffered = false;
-  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
-    dout(20) << __func__ << " will do buffered read" << dendl;
-    buffered = true;
-  } else if (cct->_conf->bluestore_default_buffered_read &&
-	     (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
-			  CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
-    dout(20) << __func__ << " defaulting to buffered read" << dendl;
-    buffered = true;
-  }
+  read_req_t(Collection *c, OnodeRef o, uint64_t offset, size_t length)
+    : c(c), o(o), offset(offset), length(length) {}
+};
 
-  if (offset + length > o->onode.size) {
-    length = o->onode.size - offset;
+struct BlueStore::AsyncRead : public BlueStore::AioContext, public Context {
+  BlueStore *store;
+  CollectionRef c;
+  read_req_t rr;
+  IOContext ioc;
+  bufferlist *out;
+  Context *on_complete;
+  mono_clock::time_point start;
+
+  AsyncRead(BlueStore *store, Collection *c, OnodeRef o,
+	    uint64_t offset, size_t length, bufferlist *out,
+	    Context *on_complete, mono_clock::time_point start)
+    : store(store), c(c), rr(c, o, offset, length),
+      ioc(store->cct, static_cast<AioContext*>(this), true), // allow EIO
+      out(out), on_complete(on_complete), start(start) {}
+
+  // called from the aio thread; do the rest of the work elsewhere
+  void aio_finish(BlueStore *store) override {
+    store->finishers[c->osr->shard]->queue(this);
+  }
+  void finish(int r) override {
+    store->_finish_read_async(this);
   }
+};
 
+void BlueStore::_read_cache(read_req_t& rr)
+{
+  OnodeRef& o = rr.o;
   auto start = mono_clock::now();
-  o->extent_map.fault_range(db, offset, length);
+  o->extent_map.fault_range(db, rr.offset, rr.length);
   logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start);
   _dump_onode(o);
 
-  ready_regions_t ready_regions;
-
   // build blob-wise list to of stuff read (that isn't cached)
-  blobs2read_t blobs2read;
-  unsigned left = length;
-  uint64_t pos = offset;
-  unsigned num_regions = 0;
-  auto lp = o->extent_map.seek_lextent(offset);
+  unsigned left = rr.length;
+  uint64_t pos = rr.offset;
+  auto lp = o->extent_map.seek_lextent(rr.offset);
   while (left > 0 && lp != o->extent_map.extent_map.end()) {
     if (pos < lp->logical_offset) {
       unsigned hole = lp->logical_offset - pos;
@@ -7325,7 +8321,7 @@ int BlueStore::_do_read(
       if (pc != cache_res.end() &&
 	  pc->first == b_off) {
 	l = pc->second.length();
-	ready_regions[pos].claim(pc->second);
+	rr.ready_regions[pos].claim(pc->second);
 	dout(30) << __func__ << "    use cache 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
 	++pc;
@@ -7337,8 +8333,8 @@ int BlueStore::_do_read(
 	}
 	dout(30) << __func__ << "    will read 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
-	blobs2read[bptr].emplace_back(region_t(pos, b_off, l));
-	++num_regions;
+	rr.blobs2read[bptr].emplace_back(region_t(pos, b_off, l));
+	++rr.num_regions;
       }
       pos += l;
       b_off += l;
@@ -7347,35 +8343,31 @@ int BlueStore::_do_read(
     }
     ++lp;
   }
+}
 
-  // read raw blob data.  use aio if we have >1 blobs to read.
-  start = mono_clock::now(); // for the sake of simplicity
-                             // measure the whole block below.
-                             // The error isn't that much...
-  vector<bufferlist> compressed_blob_bls;
-  IOContext ioc(cct, NULL, true); // allow EIO
-  for (auto& p : blobs2read) {
+int BlueStore::_prepare_read_ioc(read_req_t& rr, IOContext *ioc,
+				 bool force_aio)
+{
+  int r = 0;
+  for (auto& p : rr.blobs2read) {
     const BlobRef& bptr = p.first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
 	     << " need " << p.second << std::dec << dendl;
     if (bptr->get_blob().is_compressed()) {
       // read the whole thing
-      if (compressed_blob_bls.empty()) {
+      if (rr.compressed_blob_bls.empty()) {
 	// ensure we avoid any reallocation on subsequent blobs
-	compressed_blob_bls.reserve(blobs2read.size());
+	rr.compressed_blob_bls.reserve(rr.blobs2read.size());
       }
-      compressed_blob_bls.push_back(bufferlist());
-      bufferlist& bl = compressed_blob_bls.back();
+      rr.compressed_blob_bls.push_back(bufferlist());
+      bufferlist& bl = rr.compressed_blob_bls.back();
       r = bptr->get_blob().map(
 	0, bptr->get_blob().get_ondisk_length(),
 	[&](uint64_t offset, uint64_t length) {
 	  int r;
 	  // use aio if there are more regions to read than those in this blob
-	  if (num_regions > p.second.size()) {
-	    r = bdev->aio_read(offset, length, &bl, &ioc);
-	  } else {
-	    r = bdev->read(offset, length, &bl, &ioc, false);
-	  }
+	  r = _bdev_read(offset, length, &bl, ioc,
+			 force_aio || rr.num_regions > p.second.size());
 	  if (r < 0)
             return r;
           return 0;
@@ -7416,11 +8408,8 @@ int BlueStore::_do_read(
 	  [&](uint64_t offset, uint64_t length) {
 	    int r;
 	    // use aio if there is more than one region to read
-	    if (num_regions > 1) {
-	      r = bdev->aio_read(offset, length, &reg.bl, &ioc);
-	    } else {
-	      r = bdev->read(offset, length, &reg.bl, &ioc, false);
-	    }
+	    r = _bdev_read(offset, length, &reg.bl, ioc,
+			   force_aio || rr.num_regions > 1);
 	    if (r < 0)
               return r;
             return 0;
@@ -7438,29 +8427,56 @@ int BlueStore::_do_read(
       }
     }
   }
-  if (ioc.has_pending_aios()) {
-    bdev->aio_submit(&ioc);
-    dout(20) << __func__ << " waiting for aio" << dendl;
-    ioc.aio_wait();
-    r = ioc.get_return_value();
-    if (r < 0) {
-      assert(r == -EIO); // no other errors allowed
+  return 0;
+}
+
+int BlueStore::_generate_read_result(read_req_t& rr)
+{
+  int r = 0;
+  OnodeRef& o = rr.o;
+  blobs2read_t& blobs2read = rr.blobs2read;
+  ready_regions_t& ready_regions = rr.ready_regions;
+
+  // verify everything we read in one pass; independent csum blocks can then
+  // be hashed side by side instead of one region at a time
+  bool batch_csum = csum_batch_verify;
+  if (batch_csum) {
+    vector<csum_region_t> csum_regions;
+    auto cp = rr.compressed_blob_bls.begin();
+    for (auto& b2r : blobs2read) {
+      const bluestore_blob_t& blob = b2r.first->get_blob();
+      if (blob.is_compressed()) {
+	assert(cp != rr.compressed_blob_bls.end());
+	if (blob.has_csum()) {
+	  csum_regions.push_back(csum_region_t{
+	      &blob, 0, &*cp, b2r.second.front().logical_offset});
+	}
+	++cp;
+      } else if (blob.has_csum()) {
+	for (auto& reg : b2r.second) {
+	  csum_regions.push_back(csum_region_t{
+	      &blob, reg.r_off, &reg.bl, reg.logical_offset});
+	}
+      }
+    }
+    if (!csum_regions.empty() &&
+	_verify_csum_batch(o, csum_regions) < 0) {
       return -EIO;
     }
   }
-  logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - start);
 
   // enumerate and decompress desired blobs
-  auto p = compressed_blob_bls.begin();
+  auto p = rr.compressed_blob_bls.begin();
   blobs2read_t::iterator b2r_it = blobs2read.begin();
   while (b2r_it != blobs2read.end()) {
     const BlobRef& bptr = b2r_it->first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
 	     << " need 0x" << b2r_it->second << std::dec << dendl;
     if (bptr->get_blob().is_compressed()) {
-      assert(p != compressed_blob_bls.end());
+      assert(p != rr.compressed_blob_bls.end());
       bufferlist& compressed_bl = *p++;
-      if (_verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
+      if (!batch_csum &&
+	  _verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
 		       b2r_it->second.front().logical_offset) < 0) {
 	return -EIO;
       }
@@ -7468,7 +8484,7 @@ int BlueStore::_do_read(
       r = _decompress(compressed_bl, &raw_bl);
       if (r < 0)
 	return r;
-      if (buffered) {
+      if (rr.buffered) {
 	bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(), 0,
 				       raw_bl);
       }
@@ -7478,11 +8494,12 @@ int BlueStore::_do_read(
       }
     } else {
       for (auto& reg : b2r_it->second) {
-	if (_verify_csum(o, &bptr->get_blob(), reg.r_off, reg.bl,
+	if (!batch_csum &&
+	    _verify_csum(o, &bptr->get_blob(), reg.r_off, reg.bl,
 			 reg.logical_offset) < 0) {
 	  return -EIO;
 	}
-	if (buffered) {
+	if (rr.buffered) {
 	  bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(),
 					 reg.r_off, reg.bl);
 	}
@@ -7496,9 +8513,12 @@ int BlueStore::_do_read(
   }
 
   // generate a resulting buffer
+  bufferlist& bl = rr.bl;
+  uint64_t offset = rr.offset;
+  uint64_t length = rr.length;
   auto pr = ready_regions.begin();
   auto pr_end = ready_regions.end();
-  pos = 0;
+  uint64_t pos = 0;
   while (pos < length) {
     if (pr != pr_end && pr->first == pos + offset) {
       dout(30) << __func__ << " assemble 0x" << std::hex << pos
@@ -7523,10 +8543,361 @@ int BlueStore::_do_read(
   assert(bl.length() == length);
   assert(pos == length);
   assert(pr == pr_end);
-  r = bl.length();
+  return bl.length();
+}
+
+int BlueStore::_do_read(
+  Collection *c,
+  OnodeRef o,
+  uint64_t offset,
+  size_t length,
+  bufferlist& bl,
+  uint32_t op_flags)
+{
+  FUNCTRACE(cct);
+  int r = 0;
+
+  dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
+           << " size 0x" << o->onode.size << " (" << std::dec
+           << o->onode.size << ")" << dendl;
+  bl.clear();
+
+  if (offset >= o->onode.size) {
+    return r;
+  }
+
+  if (offset + length > o->onode.size) {
+    length = o->onode.size - offset;
+  }
+
+  read_req_t rr(c, o, offset, length);
+  rr.buffered = _is_buffered_read(op_flags);
+  _read_cache(rr);
+
+  // read raw blob data.  use aio if we have >1 blobs to read.
+  auto start = mono_clock::now(); // for the sake of simplicity
+                                  // measure the whole block below.
+                                  // The error isn't that much...
+  IOContext ioc(cct, NULL, true); // allow EIO
+  r = _prepare_read_ioc(rr, &ioc, false);
+  if (r < 0) {
+    return r;
+  }
+  if (ioc.has_pending_aios()) {
+    bdev->aio_submit(&ioc);
+    dout(20) << __func__ << " waiting for aio" << dendl;
+    ioc.aio_wait();
+    r = ioc.get_return_value();
+    if (r < 0) {
+      assert(r == -EIO); // no other errors allowed
+      return -EIO;
+    }
+  }
+  logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - start);
+
+  r = _generate_read_result(rr);
+  if (r >= 0) {
+    bl.claim(rr.bl);
+  }
   return r;
 }
 
+bool BlueStore::_is_buffered_read(uint32_t op_flags)
+{
+  // generally, don't buffer anything, unless the client explicitly requests
+  // it.
+  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
+    dout(20) << __func__ << " will do buffered read" << dendl;
+    return true;
+  } else if (cct->_conf->bluestore_default_buffered_read &&
+	     (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+			  CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
+    dout(20) << __func__ << " defaulting to buffered read" << dendl;
+    return true;
+  }
+  return false;
+}
+
+int BlueStore::readv(
+  CollectionHandle &c_,
+  vector<ReadvOp>& ops,
+  uint32_t op_flags)
+{
+  auto start = mono_clock::now();
+  Collection *c = static_cast<Collection *>(c_.get());
+  const coll_t &cid = c->get_cid();
+  dout(15) << __func__ << " " << cid << " " << ops.size() << " ops" << dendl;
+  if (!c->exists)
+    return -ENOENT;
+
+  {
+    RWLock::RLocker l(c->lock);
+
+    // look up every onode first, missing ones in a single kv pass
+    auto start1 = mono_clock::now();
+    vector<ghobject_t> oids;
+    oids.reserve(ops.size());
+    for (auto& op : ops) {
+      oids.push_back(op.oid);
+    }
+    c->prefetch_onodes(oids);
+    vector<OnodeRef> onodes(ops.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+      auto& op = ops[i];
+      op.bl.clear();
+      op.omap.clear();
+      op.r = 0;
+      op.omap_r = 0;
+      OnodeRef o = c->get_onode(op.oid, false);
+      if (!o || !o->exists) {
+	if (op.want_data)
+	  op.r = -ENOENT;
+	if (!op.omap_keys.empty())
+	  op.omap_r = -ENOENT;
+	continue;
+      }
+      onodes[i] = o;
+    }
+    logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start1);
+
+    // collect what each op needs from disk; the vector must not reallocate
+    // once reads are queued against its buffers
+    bool buffered = _is_buffered_read(op_flags);
+    vector<read_req_t> rrs;
+    rrs.reserve(ops.size());
+    vector<int> rr_of(ops.size(), -1);
+    unsigned num_regions = 0;
+    for (size_t i = 0; i < ops.size(); ++i) {
+      auto& op = ops[i];
+      OnodeRef& o = onodes[i];
+      if (!o || !op.want_data) {
+	continue;
+      }
+      uint64_t offset = op.offset;
+      uint64_t length = op.length;
+      if (offset == length && offset == 0)
+	length = o->onode.size;
+      if (offset >= o->onode.size) {
+	continue;
+      }
+      if (offset + length > o->onode.size) {
+	length = o->onode.size - offset;
+      }
+      rr_of[i] = rrs.size();
+      rrs.emplace_back(c, o, offset, length);
+      rrs.back().buffered = buffered;
+      _read_cache(rrs.back());
+      num_regions += rrs.back().num_regions;
+    }
+
+    // and queue all of it in one go
+    start1 = mono_clock::now();
+    IOContext ioc(cct, NULL, true); // allow EIO
+    for (size_t i = 0; i < ops.size(); ++i) {
+      if (rr_of[i] < 0) {
+	continue;
+      }
+      int r = _prepare_read_ioc(rrs[rr_of[i]], &ioc, num_regions > 1);
+      if (r < 0) {
+	ops[i].r = r;
+	rr_of[i] = -1;
+      }
+    }
+    bool batch_eio = false;
+    if (ioc.has_pending_aios()) {
+      bdev->aio_submit(&ioc);
+      dout(20) << __func__ << " waiting for aio" << dendl;
+      ioc.aio_wait();
+      int r = ioc.get_return_value();
+      if (r < 0) {
+	assert(r == -EIO); // no other errors allowed
+	batch_eio = true;
+      }
+    }
+    logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - start1);
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+      auto& op = ops[i];
+      OnodeRef& o = onodes[i];
+      if (!o) {
+	continue;
+      }
+      if (rr_of[i] >= 0) {
+	read_req_t& rr = rrs[rr_of[i]];
+	if (batch_eio) {
+	  // we can't tell whose read failed; redo each on its own so the
+	  // error lands on the right object
+	  op.r = _do_read(c, o, rr.offset, rr.length, op.bl, op_flags);
+	} else {
+	  op.r = _generate_read_result(rr);
+	  if (op.r >= 0) {
+	    op.bl.claim(rr.bl);
+	  }
+	}
+	if (op.r == -EIO) {
+	  logger->inc(l_bluestore_read_eio);
+	}
+      }
+      if (op.want_data && op.r >= 0 && tier_alloc) {
+	_tier_note_read(c, o);
+      }
+      if (!op.omap_keys.empty()) {
+	_omap_get_values(o, op.omap_keys, &op.omap);
+      }
+    }
+  }
+
+  for (auto& op : ops) {
+    if (op.r >= 0 && _debug_data_eio(op.oid)) {
+      op.r = -EIO;
+      derr << __func__ << " " << c->cid << " " << op.oid << " INJECT EIO"
+	   << dendl;
+    }
+    dout(20) << __func__ << "  " << op.oid
+	     << " 0x" << std::hex << op.offset << "~" << op.length << std::dec
+	     << " = " << op.r << ", " << op.omap.size() << "/"
+	     << op.omap_keys.size() << " omap keys" << dendl;
+  }
+  dout(10) << __func__ << " " << cid << " " << ops.size() << " ops done"
+	   << dendl;
+  logger->inc(l_bluestore_readv_ops, ops.size());
+  logger->tinc(l_bluestore_readv_lat, mono_clock::now() - start);
+  return 0;
+}
+
+int BlueStore::read_async(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  uint64_t offset,
+  size_t length,
+  bufferlist& bl,
+  uint32_t op_flags,
+  Context *on_complete)
+{
+  auto start = mono_clock::now();
+  Collection *c = static_cast<Collection *>(c_.get());
+  const coll_t &cid = c->get_cid();
+  dout(15) << __func__ << " " << cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << dendl;
+  if (!c->exists)
+    return -ENOENT;
+
+  bl.clear();
+  int r = 0;
+  {
+    RWLock::RLocker l(c->lock);
+    auto start1 = mono_clock::now();
+    OnodeRef o = c->get_onode(oid, false);
+    logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start1);
+    if (!o || !o->exists) {
+      r = -ENOENT;
+      goto out;
+    }
+
+    if (offset == length && offset == 0)
+      length = o->onode.size;
+    if (tier_alloc) {
+      _tier_note_read(c, o);
+    }
+    if (offset >= o->onode.size) {
+      goto out;
+    }
+    if (offset + length > o->onode.size) {
+      length = o->onode.size - offset;
+    }
+
+    AsyncRead *ar = new AsyncRead(this, c, o, offset, length, &bl,
+				  on_complete, start);
+    ar->rr.buffered = _is_buffered_read(op_flags);
+    _read_cache(ar->rr);
+    r = _prepare_read_ioc(ar->rr, &ar->ioc, true);
+    if (r < 0 || !ar->ioc.has_pending_aios()) {
+      // failed, or everything was cached; finish right here
+      if (r >= 0) {
+	r = _generate_read_result(ar->rr);
+	if (r >= 0) {
+	  bl.claim(ar->rr.bl);
+	}
+      }
+      delete ar;
+      goto out;
+    }
+    dout(20) << __func__ << " " << oid << " submitting "
+	     << ar->ioc.num_pending.load() << " aios" << dendl;
+    logger->inc(l_bluestore_read_async_ops);
+    // ar may be gone as soon as this returns
+    bdev->aio_submit(&ar->ioc);
+    return -EINPROGRESS;
+  }
+
+ out:
+  if (r == -EIO) {
+    logger->inc(l_bluestore_read_eio);
+  }
+  if (r >= 0 && _debug_data_eio(oid)) {
+    r = -EIO;
+    derr << __func__ << " " << c->cid << " " << oid << " INJECT EIO" << dendl;
+  }
+  dout(10) << __func__ << " " << cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << " = " << r << dendl;
+  logger->tinc(l_bluestore_read_lat, mono_clock::now() - start);
+  return r;
+}
+
+bool BlueStore::is_cached(CollectionHandle &c_, const ghobject_t& oid)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  if (!c->lock.try_get_read()) {
+    return false;
+  }
+  bool cached = false;
+  OnodeRef o = c->onode_map.peek(oid);
+  if (o) {
+    // a shard that is not loaded would be read from the kv store
+    cached = true;
+    for (auto& s : o->extent_map.shards) {
+      if (!s.loaded) {
+	cached = false;
+	break;
+      }
+    }
+  }
+  c->lock.put_read();
+  dout(20) << __func__ << " " << c->cid << " " << oid << " = " << cached
+	   << dendl;
+  return cached;
+}
+
+void BlueStore::_finish_read_async(AsyncRead *ar)
+{
+  read_req_t& rr = ar->rr;
+  int r = ar->ioc.get_return_value();
+  if (r < 0) {
+    assert(r == -EIO); // no other errors allowed
+  } else {
+    RWLock::RLocker l(ar->c->lock);
+    r = _generate_read_result(rr);
+    if (r >= 0) {
+      ar->out->claim(rr.bl);
+    }
+  }
+  if (r == -EIO) {
+    logger->inc(l_bluestore_read_eio);
+  }
+  if (r >= 0 && _debug_data_eio(rr.o->oid)) {
+    r = -EIO;
+    derr << __func__ << " " << ar->c->cid << " " << rr.o->oid
+	 << " INJECT EIO" << dendl;
+  }
+  dout(10) << __func__ << " " << ar->c->cid << " " << rr.o->oid
+	   << " 0x" << std::hex << rr.offset << "~" << rr.length << std::dec
+	   << " = " << r << dendl;
+  logger->tinc(l_bluestore_read_lat, mono_clock::now() - ar->start);
+  ar->on_complete->complete(r);
+}
+
 int BlueStore::_verify_csum(OnodeRef& o,
 			    const bluestore_blob_t* blob, uint64_t blob_xoffset,
 			    const bufferlist& bl,
@@ -7538,26 +8909,7 @@ int BlueStore::_verify_csum(OnodeRef& o,
   int r = blob->verify_csum(blob_xoffset, bl, &bad, &bad_csum);
   if (r < 0) {
     if (r == -1) {
-      PExtentVector pex;
-      blob->map(
-	bad,
-	blob->get_csum_chunk_size(),
-	[&](uint64_t offset, uint64_t length) {
-	  pex.emplace_back(bluestore_pextent_t(offset, length));
-          return 0;
-	});
-      derr << __func__ << " bad "
-	   << Checksummer::get_csum_type_string(blob->csum_type)
-	   << "/0x" << std::hex << blob->get_csum_chunk_size()
-	   << " checksum at blob offset 0x" << bad
-	   << ", got 0x" << bad_csum << ", expected 0x"
-	   << blob->get_csum_item(bad / blob->get_csum_chunk_size()) << std::dec
-	   << ", device location " << pex
-	   << ", logical extent 0x" << std::hex
-	   << (logical_offset + bad - blob_xoffset) << "~"
-	   << blob->get_csum_chunk_size() << std::dec
-	   << ", object " << o->oid
-	   << dendl;
+      _log_bad_csum(o, blob, blob_xoffset, logical_offset, bad, bad_csum);
     } else {
       derr << __func__ << " failed with exit code: " << cpp_strerror(r) << dendl;
     }
@@ -7566,6 +8918,64 @@ int BlueStore::_verify_csum(OnodeRef& o,
   return r;
 }
 
+int BlueStore::_verify_csum_batch(OnodeRef& o,
+				  const vector<csum_region_t>& regions) const
+{
+  auto start = mono_clock::now();
+  vector<Checksummer::verify_item_t> items;
+  items.reserve(regions.size());
+  for (auto& i : regions) {
+    items.emplace_back(i.blob->csum_type, i.blob->get_csum_chunk_size(),
+		       i.blob_xoffset, i.bl, &i.blob->csum_data);
+  }
+  int r = Checksummer::verify_batch(items);
+  if (r > 0) {
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (items[i].bad_off >= 0) {
+	_log_bad_csum(o, regions[i].blob, regions[i].blob_xoffset,
+		      regions[i].logical_offset, items[i].bad_off,
+		      items[i].bad_csum);
+      }
+    }
+    r = -1;
+  } else if (r < 0) {
+    derr << __func__ << " failed with exit code: " << cpp_strerror(r) << dendl;
+  }
+  dout(30) << __func__ << " " << regions.size() << " regions, r = " << r
+	   << dendl;
+  logger->tinc(l_bluestore_csum_lat, mono_clock::now() - start);
+  return r;
+}
+
+void BlueStore::_log_bad_csum(OnodeRef& o,
+			      const bluestore_blob_t* blob,
+			      uint64_t blob_xoffset,
+			      uint64_t logical_offset,
+			      int bad,
+			      uint64_t bad_csum) const
+{
+  PExtentVector pex;
+  blob->map(
+    bad,
+    blob->get_csum_chunk_size(),
+    [&](uint64_t offset, uint64_t length) {
+      pex.emplace_back(bluestore_pextent_t(offset, length));
+      return 0;
+    });
+  derr << "_verify_csum bad "
+       << Checksummer::get_csum_type_string(blob->csum_type)
+       << "/0x" << std::hex << blob->get_csum_chunk_size()
+       << " checksum at blob offset 0x" << bad
+       << ", got 0x" << bad_csum << ", expected 0x"
+       << blob->get_csum_item(bad / blob->get_csum_chunk_size()) << std::dec
+       << ", device location " << pex
+       << ", logical extent 0x" << std::hex
+       << (logical_offset + bad - blob_xoffset) << "~"
+       << blob->get_csum_chunk_size() << std::dec
+       << ", object " << o->oid
+       << dendl;
+}
+
 int BlueStore::_decompress(bufferlist& source, bufferlist* result)
 {
   int r = 0;
@@ -8094,7 +9504,67 @@ int BlueStore::omap_get_values(
     return -ENOENT;
   RWLock::RLocker l(c->lock);
   int r = 0;
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists) {
+    r = -ENOENT;
+    goto out;
+  }
+  _omap_get_values(o, keys, out);
+ out:
+  dout(10) << __func__ << " " << c->get_cid() << " oid " << oid << " = " << r
+	   << dendl;
+  return r;
+}
+
+void BlueStore::_omap_get_values(
+  OnodeRef& o,
+  const set<string>& keys,
+  map<string, bufferlist> *out)
+{
+  if (!o->onode.has_omap() || keys.empty())
+    return;
+  const string& prefix =
+    o->onode.is_pgmeta_omap() ? PREFIX_PGMETA_OMAP : PREFIX_OMAP;
+  o->flush();
   string final_key;
+  _key_encode_u64(o->onode.nid, &final_key);
+  final_key.push_back('.');
+  // look them all up at once; the kv store can then share the work
+  set<string> final_keys;
+  for (auto& k : keys) {
+    final_key.resize(9); // keep prefix
+    final_key += k;
+    final_keys.insert(final_keys.end(), final_key);
+  }
+  map<string, bufferlist> vals;
+  db->get(prefix, final_keys, &vals);
+  for (auto& p : vals) {
+    dout(30) << __func__ << "  got " << pretty_binary_string(p.first)
+	     << " -> " << p.first.substr(9) << dendl;
+    out->emplace(p.first.substr(9), std::move(p.second));
+  }
+}
+
+int BlueStore::omap_get_range(
+  CollectionHandle &c_,         ///< [in] Collection containing oid
+  const ghobject_t &oid,        ///< [in] Object containing omap
+  const string &start_after,    ///< [in] return keys after this one
+  const string &filter_prefix,  ///< [in] only keys with this prefix
+  size_t max_keys,              ///< [in] max keys to return
+  size_t max_bytes,             ///< [in] max bytes to return (soft)
+  bufferlist *out,              ///< [out] encoded key/value pairs
+  bool *more                    ///< [out] true if more keys remain
+  )
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  dout(15) << __func__ << " " << c->get_cid() << " oid " << oid
+	   << " after " << start_after << " prefix " << filter_prefix
+	   << " max " << max_keys << dendl;
+  *more = false;
+  if (!c->exists)
+    return -ENOENT;
+  RWLock::RLocker l(c->lock);
+  int r = 0;
   OnodeRef o = c->get_onode(oid, false);
   if (!o || !o->exists) {
     r = -ENOENT;
@@ -8102,26 +9572,36 @@ int BlueStore::omap_get_values(
   }
   if (!o->onode.has_omap())
     goto out;
+  o->flush();
   {
     const string& prefix =
       o->onode.is_pgmeta_omap() ? PREFIX_PGMETA_OMAP : PREFIX_OMAP;
-    o->flush();
-    _key_encode_u64(o->onode.nid, &final_key);
-    final_key.push_back('.');
-    for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
-      final_key.resize(9); // keep prefix
-      final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-	out->insert(make_pair(*p, val));
-      }
+    string head, start, end;
+    get_omap_key(o->onode.nid, string(), &head);
+    bool after = true;
+    if (filter_prefix > start_after) {
+      get_omap_key(o->onode.nid, filter_prefix, &start);
+      after = false;
+    } else {
+      get_omap_key(o->onode.nid, start_after, &start);
+    }
+    // stop at the first key past everything that starts with filter_prefix
+    string p = filter_prefix;
+    while (!p.empty() && (unsigned char)p.back() == 0xff) {
+      p.pop_back();
+    }
+    if (p.empty()) {
+      get_omap_tail(o->onode.nid, &end);
+    } else {
+      ++p.back();
+      get_omap_key(o->onode.nid, p, &end);
     }
+    r = db->get_range(prefix, start, after, end, head.size(),
+		      max_keys, max_bytes, out, more);
   }
  out:
   dout(10) << __func__ << " " << c->get_cid() << " oid " << oid << " = " << r
-	   << dendl;
+	   << (*more ? " (more)" : "") << dendl;
   return r;
 }
 
@@ -8357,10 +9837,12 @@ int BlueStore::_open_super_meta()
   _set_csum();
   _set_compression();
   _set_blob_size();
+  _set_tier_conf();
 
   _set_finisher_num();
+  _set_kv_pipeline_num();
 
-  return 0;
+  return _set_onode_format();
 }
 
 int BlueStore::_upgrade_super()
@@ -8370,6 +9852,7 @@ int BlueStore::_upgrade_super()
   assert(ondisk_format > 0);
   assert(ondisk_format < latest_ondisk_format);
 
+  KeyValueDB::Transaction t = db->get_transaction();
   if (ondisk_format == 1) {
     // changes:
     // - super: added ondisk_format
@@ -8377,7 +9860,6 @@ int BlueStore::_upgrade_super()
     // - super: added min_compat_ondisk_format
     // - super: added min_alloc_size
     // - super: removed min_min_alloc_size
-    KeyValueDB::Transaction t = db->get_transaction();
     {
       bufferlist bl;
       db->get(PREFIX_SUPER, "min_min_alloc_size", &bl);
@@ -8394,10 +9876,16 @@ int BlueStore::_upgrade_super()
       t->rmkey(PREFIX_SUPER, "min_min_alloc_size");
     }
     ondisk_format = 2;
-    _prepare_ondisk_format_super(t);
-    int r = db->submit_transaction_sync(t);
-    assert(r == 0);
   }
+  if (ondisk_format == 2) {
+    // changes:
+    // - onodes may be stored in the flat format (bluestore_onode_format=2),
+    //   in which case min_compat_ondisk_format is raised to 3
+    ondisk_format = 3;
+  }
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
 
   // done
   dout(1) << __func__ << " done" << dendl;
@@ -8484,7 +9972,7 @@ void BlueStore::_txc_state_proc(TransContext *txc)
     switch (txc->state) {
     case TransContext::STATE_PREPARE:
       txc->log_state_latency(logger, l_bluestore_state_prepare_lat);
-      if (txc->ioc.has_pending_aios()) {
+      if (txc->ioc.has_pending_aios() || txc->tier_ioc.has_pending_aios()) {
 	txc->state = TransContext::STATE_AIO_WAIT;
 	txc->had_ios = true;
 	_txc_aio_submit(txc);
@@ -8505,8 +9993,7 @@ void BlueStore::_txc_state_proc(TransContext *txc)
       txc->log_state_latency(logger, l_bluestore_state_io_done_lat);
       txc->state = TransContext::STATE_KV_QUEUED;
       if (cct->_conf->bluestore_sync_submit_transaction) {
-	if (txc->last_nid >= nid_max ||
-	    txc->last_blobid >= blobid_max) {
+	if (!_kv_check_max(txc)) {
 	  dout(20) << __func__
 		   << " last_{nid,blobid} exceeds max, submit via kv thread"
 		   << dendl;
@@ -8520,6 +10007,8 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	} else if (txc->osr->txc_with_unstable_io) {
 	  dout(20) << __func__ << " prior txc(s) with unstable ios "
 		   << txc->osr->txc_with_unstable_io.load() << dendl;
+	} else if (txc->kv_barrier) {
+	  dout(20) << __func__ << " kv barrier, submit via kv thread" << dendl;
 	} else if (cct->_conf->bluestore_debug_randomize_serial_transaction &&
 		   rand() % cct->_conf->bluestore_debug_randomize_serial_transaction
 		   == 0) {
@@ -8533,16 +10022,18 @@ void BlueStore::_txc_state_proc(TransContext *txc)
 	}
       }
       {
-	std::lock_guard<std::mutex> l(kv_lock);
-	kv_queue.push_back(txc);
-	kv_cond.notify_one();
+	KVPipeline *p = kv_pipelines[txc->osr->kv_pipeline];
+	std::lock_guard<std::mutex> l(p->kv_lock);
+	p->kv_queue.push_back(txc);
+	p->kv_cond.notify_one();
 	if (txc->state != TransContext::STATE_KV_SUBMITTED) {
-	  kv_queue_unsubmitted.push_back(txc);
+	  p->kv_queue_unsubmitted.push_back(txc);
 	  ++txc->osr->kv_committing_serially;
 	}
 	if (txc->had_ios)
-	  kv_ios++;
-	kv_throttle_costs += txc->cost;
+	  p->kv_ios++;
+	p->kv_throttle_costs += txc->cost;
+	p->logger->set(l_bluestore_kv_pipeline_queue, p->kv_queue.size());
       }
       return;
     case TransContext::STATE_KV_SUBMITTED:
@@ -8707,14 +10198,22 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
   for (interval_set<uint64_t>::iterator p = pallocated->begin();
        p != pallocated->end();
        ++p) {
-    fm->allocate(p.get_start(), p.get_len(), t);
+    if (_is_tier_offset(p.get_start())) {
+      tier_fm->allocate(p.get_start() - TIER_FAST_BASE, p.get_len(), t);
+    } else {
+      fm->allocate(p.get_start(), p.get_len(), t);
+    }
   }
   for (interval_set<uint64_t>::iterator p = preleased->begin();
        p != preleased->end();
        ++p) {
     dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
 	     << "~" << p.get_len() << std::dec << dendl;
-    fm->release(p.get_start(), p.get_len(), t);
+    if (_is_tier_offset(p.get_start())) {
+      tier_fm->release(p.get_start() - TIER_FAST_BASE, p.get_len(), t);
+    } else {
+      fm->release(p.get_start(), p.get_len(), t);
+    }
   }
 
   _txc_update_store_statfs(txc);
@@ -8826,6 +10325,12 @@ void BlueStore::_txc_finish(TransContext *txc)
   }
   logger->set(l_bluestore_fragmentation,
     (uint64_t)(alloc->get_fragmentation(min_alloc_size) * 1000));
+  if (alloc_cache) {
+    auto st = alloc_cache->get_stats();
+    logger->set(l_bluestore_alloc_cache_hit, st.hits);
+    logger->set(l_bluestore_alloc_cache_miss, st.misses);
+    logger->set(l_bluestore_alloc_cache_bytes, st.cached_bytes);
+  }
 }
 
 void BlueStore::_txc_release_alloc(TransContext *txc)
@@ -8833,6 +10338,16 @@ void BlueStore::_txc_release_alloc(TransContext *txc)
   // it's expected we're called with lazy_release_lock already taken!
   if (likely(!cct->_conf->bluestore_debug_no_reuse_blocks)) {
     int r = 0;
+    if (tier_alloc) {
+      // we never discard on the fast tier; it is shared with bluefs
+      interval_set<uint64_t> tier_released;
+      _tier_split(&txc->released, &tier_released);
+      if (!tier_released.empty()) {
+	dout(10) << __func__ << " " << txc << " tier " << std::hex
+		 << tier_released << std::dec << dendl;
+	tier_alloc->release(tier_released);
+      }
+    }
     if (cct->_conf->bdev_enable_discard && cct->_conf->bdev_async_discard) {
       r = bdev->queue_discard(txc->released);
       if (r == 0) {
@@ -8878,11 +10393,8 @@ void BlueStore::_osr_drain_preceding(TransContext *txc)
       deferred_lock.unlock();
     }
   }
-  {
-    // wake up any previously finished deferred events
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
-  }
+  // wake up any previously finished deferred events
+  _kv_notify_primary();
   osr->drain_preceding(txc);
   --deferred_aggressive;
   dout(10) << __func__ << " " << osr << " done" << dendl;
@@ -8914,14 +10426,11 @@ void BlueStore::_osr_drain_all()
     // submit anything pending
     deferred_try_submit();
   }
-  {
-    // wake up any previously finished deferred events
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
-  }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_cond.notify_one();
+  // wake up any previously finished deferred events
+  _kv_notify_primary();
+  for (auto p : kv_pipelines) {
+    std::lock_guard<std::mutex> l(p->kv_finalize_lock);
+    p->kv_finalize_cond.notify_one();
   }
   for (auto osr : s) {
     dout(20) << __func__ << " drain " << osr << dendl;
@@ -8961,44 +10470,79 @@ void BlueStore::_kv_start()
     finishers.push_back(f);
   }
 
+  assert(kv_pipelines.empty());
+  for (int i = 0; i < kv_pipeline_num; ++i) {
+    KVPipeline *p = new KVPipeline(this, i);
+    PerfCountersBuilder b(cct, "bluestore-kv-" + stringify(i),
+			  l_bluestore_kv_pipeline_first,
+			  l_bluestore_kv_pipeline_last);
+    b.add_u64(l_bluestore_kv_pipeline_queue, "queue",
+	      "Transactions queued for kv sync");
+    b.add_u64(l_bluestore_kv_pipeline_committing, "committing",
+	      "Transactions in the current kv sync batch");
+    b.add_u64_counter(l_bluestore_kv_pipeline_commits, "commits",
+		      "kv sync batches committed");
+    b.add_u64_counter(l_bluestore_kv_pipeline_txcs, "txcs",
+		      "Transactions committed");
+    b.add_time_avg(l_bluestore_kv_pipeline_flush_lat, "flush_lat",
+		   "Average kv sync flush latency");
+    b.add_time_avg(l_bluestore_kv_pipeline_commit_lat, "commit_lat",
+		   "Average kv sync commit latency");
+    b.add_time_avg(l_bluestore_kv_pipeline_lat, "lat",
+		   "Average kv sync latency");
+    p->logger = b.create_perf_counters();
+    cct->get_perfcounters_collection()->add(p->logger);
+    kv_pipelines.push_back(p);
+  }
+
   deferred_finisher.start();
   for (auto f : finishers) {
     f->start();
   }
-  kv_sync_thread.create("bstore_kv_sync");
-  kv_finalize_thread.create("bstore_kv_final");
+  _compress_start();
+  for (auto p : kv_pipelines) {
+    if (p->is_primary()) {
+      p->kv_sync_thread.create("bstore_kv_sync");
+      p->kv_finalize_thread.create("bstore_kv_final");
+    } else {
+      // thread names are limited to 16 chars
+      p->kv_sync_thread.create(("bstore_kvsync" + stringify(p->id)).c_str());
+      p->kv_finalize_thread.create(("bstore_kvfin" + stringify(p->id)).c_str());
+    }
+  }
 }
 
 void BlueStore::_kv_stop()
 {
   dout(10) << __func__ << dendl;
-  {
-    std::unique_lock<std::mutex> l(kv_lock);
-    while (!kv_sync_started) {
-      kv_cond.wait(l);
+  _compress_stop();
+  for (auto p : kv_pipelines) {
+    std::unique_lock<std::mutex> l(p->kv_lock);
+    while (!p->kv_sync_started) {
+      p->kv_cond.wait(l);
     }
-    kv_stop = true;
-    kv_cond.notify_all();
+    p->kv_stop = true;
+    p->kv_cond.notify_all();
   }
-  {
-    std::unique_lock<std::mutex> l(kv_finalize_lock);
-    while (!kv_finalize_started) {
-      kv_finalize_cond.wait(l);
+  for (auto p : kv_pipelines) {
+    std::unique_lock<std::mutex> l(p->kv_finalize_lock);
+    while (!p->kv_finalize_started) {
+      p->kv_finalize_cond.wait(l);
     }
-    kv_finalize_stop = true;
-    kv_finalize_cond.notify_all();
+    p->kv_finalize_stop = true;
+    p->kv_finalize_cond.notify_all();
   }
-  kv_sync_thread.join();
-  kv_finalize_thread.join();
-  assert(removed_collections.empty());
-  {
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_stop = false;
+  for (auto p : kv_pipelines) {
+    p->kv_sync_thread.join();
+    p->kv_finalize_thread.join();
   }
-  {
-    std::lock_guard<std::mutex> l(kv_finalize_lock);
-    kv_finalize_stop = false;
+  assert(removed_collections.empty());
+  for (auto p : kv_pipelines) {
+    cct->get_perfcounters_collection()->remove(p->logger);
+    delete p->logger;
+    delete p;
   }
+  kv_pipelines.clear();
   dout(10) << __func__ << " stopping finishers" << dendl;
   deferred_finisher.wait_for_empty();
   deferred_finisher.stop();
@@ -9009,42 +10553,118 @@ void BlueStore::_kv_stop()
   dout(10) << __func__ << " stopped" << dendl;
 }
 
-void BlueStore::_kv_sync_thread()
+void BlueStore::_kv_notify_primary()
 {
-  dout(10) << __func__ << " start" << dendl;
+  if (kv_pipelines.empty()) {
+    return;
+  }
+  KVPipeline *p = kv_pipelines.front();
+  std::lock_guard<std::mutex> l(p->kv_lock);
+  p->kv_cond.notify_one();
+}
+
+void BlueStore::_kv_wait_for_max(TransContext *txc)
+{
+  // only the primary pipeline persists new {nid,blobid}_max values; a
+  // txc that went past the current limits must not be submitted until
+  // the new limits are durable.
+  std::unique_lock<std::mutex> l(kv_max_lock);
+  while (txc->last_nid >= nid_max ||
+	 txc->last_blobid >= blobid_max) {
+    dout(20) << __func__ << " txc " << txc
+	     << " last_nid " << txc->last_nid << " nid_max " << nid_max
+	     << " last_blobid " << txc->last_blobid
+	     << " blobid_max " << blobid_max << dendl;
+    kv_max_wanted = true;
+    l.unlock();
+    _kv_notify_primary();
+    l.lock();
+    if (txc->last_nid < nid_max && txc->last_blobid < blobid_max) {
+      break;
+    }
+    kv_max_cond.wait(l);
+  }
+}
+
+/*
+ * true if txc's nids and blobids are covered by the persisted limits, so
+ * that it may be submitted directly.  only the primary pipeline raises
+ * the limits, and it does so ahead of time only when it runs; a txc on
+ * another pipeline that gets close to them asks it to, so that traffic
+ * on the other pipelines alone does not stall at (or run past) them.
+ */
+bool BlueStore::_kv_check_max(TransContext *txc)
+{
+  bool primary = txc->osr->kv_pipeline == 0;
+  bool notify = false;
+  bool ok;
+  {
+    std::lock_guard<std::mutex> l(kv_max_lock);
+    if (!primary &&
+	!kv_max_wanted &&
+	(txc->last_nid + cct->_conf->bluestore_nid_prealloc/2 > nid_max ||
+	 txc->last_blobid + cct->_conf->bluestore_blobid_prealloc/2 >
+	 blobid_max)) {
+      dout(20) << __func__ << " txc " << txc << " near limits, waking primary"
+	       << dendl;
+      kv_max_wanted = true;
+      notify = true;
+    }
+    ok = txc->last_nid < nid_max && txc->last_blobid < blobid_max;
+  }
+  if (notify) {
+    // not under kv_max_lock: the primary takes it with its kv_lock held
+    _kv_notify_primary();
+  }
+  return ok;
+}
+
+void BlueStore::_kv_sync_thread(KVPipeline *p)
+{
+  dout(10) << __func__ << " " << p->id << " start" << dendl;
   deque<DeferredBatch*> deferred_stable_queue; ///< deferred ios done + stable
-  std::unique_lock<std::mutex> l(kv_lock);
-  assert(!kv_sync_started);
-  kv_sync_started = true;
-  kv_cond.notify_all();
+  auto& kv_committing = p->kv_committing;
+  std::unique_lock<std::mutex> l(p->kv_lock);
+  assert(!p->kv_sync_started);
+  p->kv_sync_started = true;
+  p->kv_cond.notify_all();
   while (true) {
     assert(kv_committing.empty());
-    if (kv_queue.empty() &&
-	((deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
+    bool max_wanted = false;
+    if (p->is_primary()) {
+      std::lock_guard<std::mutex> m(kv_max_lock);
+      max_wanted = kv_max_wanted;
+      kv_max_wanted = false;
+    }
+    if (p->kv_queue.empty() && !max_wanted &&
+	((p->deferred_done_queue.empty() && deferred_stable_queue.empty()) ||
 	 !deferred_aggressive)) {
-      if (kv_stop)
+      if (p->kv_stop)
 	break;
-      dout(20) << __func__ << " sleep" << dendl;
-      kv_cond.wait(l);
-      dout(20) << __func__ << " wake" << dendl;
+      dout(20) << __func__ << " " << p->id << " sleep" << dendl;
+      p->kv_cond.wait(l);
+      dout(20) << __func__ << " " << p->id << " wake" << dendl;
     } else {
       deque<TransContext*> kv_submitting;
       deque<DeferredBatch*> deferred_done, deferred_stable;
       uint64_t aios = 0, costs = 0;
 
-      dout(20) << __func__ << " committing " << kv_queue.size()
-	       << " submitting " << kv_queue_unsubmitted.size()
-	       << " deferred done " << deferred_done_queue.size()
+      dout(20) << __func__ << " " << p->id
+	       << " committing " << p->kv_queue.size()
+	       << " submitting " << p->kv_queue_unsubmitted.size()
+	       << " deferred done " << p->deferred_done_queue.size()
 	       << " stable " << deferred_stable_queue.size()
 	       << dendl;
-      kv_committing.swap(kv_queue);
-      kv_submitting.swap(kv_queue_unsubmitted);
-      deferred_done.swap(deferred_done_queue);
+      kv_committing.swap(p->kv_queue);
+      kv_submitting.swap(p->kv_queue_unsubmitted);
+      deferred_done.swap(p->deferred_done_queue);
       deferred_stable.swap(deferred_stable_queue);
-      aios = kv_ios;
-      costs = kv_throttle_costs;
-      kv_ios = 0;
-      kv_throttle_costs = 0;
+      aios = p->kv_ios;
+      costs = p->kv_throttle_costs;
+      p->kv_ios = 0;
+      p->kv_throttle_costs = 0;
+      p->logger->set(l_bluestore_kv_pipeline_queue, 0);
+      p->logger->set(l_bluestore_kv_pipeline_committing, kv_committing.size());
       l.unlock();
 
       dout(30) << __func__ << " committing " << kv_committing << dendl;
@@ -9081,6 +10701,9 @@ void BlueStore::_kv_sync_thread()
 		 << ", flushing, deferred done->stable" << dendl;
 	// flush/barrier on block device
 	bdev->flush();
+	if (tier_bdev) {
+	  tier_bdev->flush();
+	}
 
 	// if we flush then deferred done are now deferred stable
 	deferred_stable.insert(deferred_stable.end(), deferred_done.begin(),
@@ -9095,9 +10718,11 @@ void BlueStore::_kv_sync_thread()
       // increase {nid,blobid}_max?  note that this covers both the
       // case where we are approaching the max and the case we passed
       // it.  in either case, we increase the max in the earlier txn
-      // we submit.
+      // we submit.  only the primary pipeline does this so that the
+      // persisted values never go backwards.
       uint64_t new_nid_max = 0, new_blobid_max = 0;
-      if (nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
+      if (p->is_primary() &&
+	  nid_last + cct->_conf->bluestore_nid_prealloc/2 > nid_max) {
 	KeyValueDB::Transaction t =
 	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
 	new_nid_max = nid_last + cct->_conf->bluestore_nid_prealloc;
@@ -9106,7 +10731,8 @@ void BlueStore::_kv_sync_thread()
 	t->set(PREFIX_SUPER, "nid_max", bl);
 	dout(10) << __func__ << " new_nid_max " << new_nid_max << dendl;
       }
-      if (blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
+      if (p->is_primary() &&
+	  blobid_last + cct->_conf->bluestore_blobid_prealloc/2 > blobid_max) {
 	KeyValueDB::Transaction t =
 	  kv_submitting.empty() ? synct : kv_submitting.front()->t;
 	new_blobid_max = blobid_last + cct->_conf->bluestore_blobid_prealloc;
@@ -9118,6 +10744,9 @@ void BlueStore::_kv_sync_thread()
 
       for (auto txc : kv_committing) {
 	if (txc->state == TransContext::STATE_KV_QUEUED) {
+	  if (!p->is_primary()) {
+	    _kv_wait_for_max(txc);
+	  }
 	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
 	  int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
 	  assert(r == 0);
@@ -9149,7 +10778,7 @@ void BlueStore::_kv_sync_thread()
       throttle_bytes.put(costs);
 
       PExtentVector bluefs_gift_extents;
-      if (bluefs &&
+      if (bluefs && p->is_primary() &&
 	  after_flush - bluefs_last_balance >
 	  ceph::make_timespan(cct->_conf->bluestore_bluefs_balance_interval)) {
 	bluefs_last_balance = after_flush;
@@ -9182,36 +10811,41 @@ void BlueStore::_kv_sync_thread()
       int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
       assert(r == 0);
 
+      size_t num_committed = kv_committing.size();
       {
-	std::unique_lock<std::mutex> m(kv_finalize_lock);
-	if (kv_committing_to_finalize.empty()) {
-	  kv_committing_to_finalize.swap(kv_committing);
+	std::unique_lock<std::mutex> m(p->kv_finalize_lock);
+	if (p->kv_committing_to_finalize.empty()) {
+	  p->kv_committing_to_finalize.swap(kv_committing);
 	} else {
-	  kv_committing_to_finalize.insert(
-	      kv_committing_to_finalize.end(),
+	  p->kv_committing_to_finalize.insert(
+	      p->kv_committing_to_finalize.end(),
 	      kv_committing.begin(),
 	      kv_committing.end());
 	  kv_committing.clear();
 	}
-	if (deferred_stable_to_finalize.empty()) {
-	  deferred_stable_to_finalize.swap(deferred_stable);
+	if (p->deferred_stable_to_finalize.empty()) {
+	  p->deferred_stable_to_finalize.swap(deferred_stable);
 	} else {
-	  deferred_stable_to_finalize.insert(
-	      deferred_stable_to_finalize.end(),
+	  p->deferred_stable_to_finalize.insert(
+	      p->deferred_stable_to_finalize.end(),
 	      deferred_stable.begin(),
 	      deferred_stable.end());
 	  deferred_stable.clear();
 	}
-	kv_finalize_cond.notify_one();
+	p->kv_finalize_cond.notify_one();
       }
 
-      if (new_nid_max) {
-	nid_max = new_nid_max;
-	dout(10) << __func__ << " nid_max now " << nid_max << dendl;
-      }
-      if (new_blobid_max) {
-	blobid_max = new_blobid_max;
-	dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+      if (new_nid_max || new_blobid_max) {
+	std::lock_guard<std::mutex> m(kv_max_lock);
+	if (new_nid_max) {
+	  nid_max = new_nid_max;
+	  dout(10) << __func__ << " nid_max now " << nid_max << dendl;
+	}
+	if (new_blobid_max) {
+	  blobid_max = new_blobid_max;
+	  dout(10) << __func__ << " blobid_max now " << blobid_max << dendl;
+	}
+	kv_max_cond.notify_all();
       }
 
       {
@@ -9219,7 +10853,8 @@ void BlueStore::_kv_sync_thread()
 	ceph::timespan dur_flush = after_flush - start;
 	ceph::timespan dur_kv = finish - after_flush;
 	ceph::timespan dur = finish - start;
-	dout(20) << __func__ << " committed " << kv_committing.size()
+	dout(20) << __func__ << " " << p->id
+	  << " committed " << num_committed
 	  << " cleaned " << deferred_stable.size()
 	  << " in " << dur
 	  << " (" << dur_flush << " flush + " << dur_kv << " kv commit)"
@@ -9227,9 +10862,15 @@ void BlueStore::_kv_sync_thread()
 	logger->tinc(l_bluestore_kv_flush_lat, dur_flush);
 	logger->tinc(l_bluestore_kv_commit_lat, dur_kv);
 	logger->tinc(l_bluestore_kv_lat, dur);
+	p->logger->inc(l_bluestore_kv_pipeline_commits);
+	p->logger->inc(l_bluestore_kv_pipeline_txcs, num_committed);
+	p->logger->set(l_bluestore_kv_pipeline_committing, 0);
+	p->logger->tinc(l_bluestore_kv_pipeline_flush_lat, dur_flush);
+	p->logger->tinc(l_bluestore_kv_pipeline_commit_lat, dur_kv);
+	p->logger->tinc(l_bluestore_kv_pipeline_lat, dur);
       }
 
-      if (bluefs) {
+      if (bluefs && p->is_primary()) {
 	if (!bluefs_gift_extents.empty()) {
 	  _commit_bluefs_freespace(bluefs_gift_extents);
 	}
@@ -9247,32 +10888,32 @@ void BlueStore::_kv_sync_thread()
       deferred_stable_queue.swap(deferred_done);
     }
   }
-  dout(10) << __func__ << " finish" << dendl;
-  kv_sync_started = false;
+  dout(10) << __func__ << " " << p->id << " finish" << dendl;
+  p->kv_sync_started = false;
 }
 
-void BlueStore::_kv_finalize_thread()
+void BlueStore::_kv_finalize_thread(KVPipeline *p)
 {
   deque<TransContext*> kv_committed;
   deque<DeferredBatch*> deferred_stable;
-  dout(10) << __func__ << " start" << dendl;
-  std::unique_lock<std::mutex> l(kv_finalize_lock);
-  assert(!kv_finalize_started);
-  kv_finalize_started = true;
-  kv_finalize_cond.notify_all();
+  dout(10) << __func__ << " " << p->id << " start" << dendl;
+  std::unique_lock<std::mutex> l(p->kv_finalize_lock);
+  assert(!p->kv_finalize_started);
+  p->kv_finalize_started = true;
+  p->kv_finalize_cond.notify_all();
   while (true) {
     assert(kv_committed.empty());
     assert(deferred_stable.empty());
-    if (kv_committing_to_finalize.empty() &&
-	deferred_stable_to_finalize.empty()) {
-      if (kv_finalize_stop)
+    if (p->kv_committing_to_finalize.empty() &&
+	p->deferred_stable_to_finalize.empty()) {
+      if (p->kv_finalize_stop)
 	break;
-      dout(20) << __func__ << " sleep" << dendl;
-      kv_finalize_cond.wait(l);
-      dout(20) << __func__ << " wake" << dendl;
+      dout(20) << __func__ << " " << p->id << " sleep" << dendl;
+      p->kv_finalize_cond.wait(l);
+      dout(20) << __func__ << " " << p->id << " wake" << dendl;
     } else {
-      kv_committed.swap(kv_committing_to_finalize);
-      deferred_stable.swap(deferred_stable_to_finalize);
+      kv_committed.swap(p->kv_committing_to_finalize);
+      deferred_stable.swap(p->deferred_stable_to_finalize);
       l.unlock();
       dout(20) << __func__ << " kv_committed " << kv_committed << dendl;
       dout(20) << __func__ << " deferred_stable " << deferred_stable << dendl;
@@ -9308,8 +10949,8 @@ void BlueStore::_kv_finalize_thread()
       l.lock();
     }
   }
-  dout(10) << __func__ << " finish" << dendl;
-  kv_finalize_started = false;
+  dout(10) << __func__ << " " << p->id << " finish" << dendl;
+  p->kv_finalize_started = false;
 }
 
 bluestore_deferred_op_t *BlueStore::_get_deferred_op(
@@ -9336,18 +10977,26 @@ void BlueStore::_deferred_queue(TransContext *txc)
   ++deferred_queue_size;
   txc->osr->deferred_pending->txcs.push_back(*txc);
   bluestore_deferred_transaction_t& wt = *txc->deferred_txn;
+  uint64_t elided = 0;
   for (auto opi = wt.ops.begin(); opi != wt.ops.end(); ++opi) {
     const auto& op = *opi;
     assert(op.op == bluestore_deferred_op_t::OP_WRITE);
     bufferlist::const_iterator p = op.data.begin();
     for (auto e : op.extents) {
-      txc->osr->deferred_pending->prepare_write(
+      elided += txc->osr->deferred_pending->prepare_write(
 	cct, wt.seq, e.offset, e.length, p);
     }
   }
+  if (elided) {
+    logger->inc(l_bluestore_deferred_write_elided_bytes, elided);
+  }
   if (deferred_aggressive &&
       !txc->osr->deferred_running) {
-    _deferred_submit_unlock(txc->osr.get());
+    if (deferred_coalesce) {
+      _deferred_flush_unlock({txc->osr.get()});
+    } else {
+      _deferred_submit_unlock(txc->osr.get());
+    }
   } else {
     deferred_lock.unlock();
   }
@@ -9363,6 +11012,19 @@ void BlueStore::deferred_try_submit()
   for (auto& osr : deferred_queue) {
     osrs.push_back(&osr);
   }
+  if (deferred_coalesce) {
+    vector<OpSequencer*> ready;
+    for (auto& osr : osrs) {
+      if (osr->deferred_pending && !osr->deferred_running) {
+	ready.push_back(osr.get());
+      }
+    }
+    if (!ready.empty()) {
+      _deferred_flush_unlock(ready);
+      deferred_lock.lock();
+    }
+    return;
+  }
   for (auto& osr : osrs) {
     if (osr->deferred_pending) {
       if (!osr->deferred_running) {
@@ -9435,6 +11097,136 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   bdev->aio_submit(&b->ioc);
 }
 
+/*
+ * Write the pending batches of several osrs as one flush.  Their ios are
+ * overlaid in deferred seq order, so a range written by more than one
+ * batch is only written with its newest data, adjacent ios become one
+ * aio, and the aios go out in C-SCAN order from where the previous flush
+ * ended.  Batches are taken while the aios in flight stay below
+ * deferred_flush_queue_depth; the rest keep accumulating in their osr and
+ * go out (larger) once a flush completes.
+ */
+void BlueStore::_deferred_flush_unlock(const vector<OpSequencer*>& osrs)
+{
+  DeferredFlush *f = new DeferredFlush(cct);
+  uint64_t qd = deferred_aggressive ? 0 : deferred_flush_queue_depth.load();
+  for (auto osr : osrs) {
+    assert(osr->deferred_pending);
+    assert(!osr->deferred_running);
+    unsigned runs = osr->deferred_pending->count_runs();
+    if (qd && (deferred_flush_ios || !f->batches.empty()) &&
+	deferred_flush_ios + f->reserved_ios + runs > qd) {
+      dout(20) << __func__ << " queue depth " << qd << " reached with "
+	       << deferred_flush_ios << " in flight" << dendl;
+      deferred_flush_throttled = true;
+      break;
+    }
+    f->reserved_ios += runs;
+    auto b = osr->deferred_pending;
+    deferred_queue_size -= b->seq_bytes.size();
+    assert(deferred_queue_size >= 0);
+    osr->deferred_running = b;
+    osr->deferred_pending = nullptr;
+    f->batches.push_back(b);
+  }
+  if (f->batches.empty()) {
+    deferred_lock.unlock();
+    logger->inc(l_bluestore_deferred_flush_throttled);
+    delete f;
+    return;
+  }
+  deferred_flush_ios += f->reserved_ios;
+  uint64_t head = deferred_elevator_pos;
+  deferred_lock.unlock();
+
+  dout(10) << __func__ << " " << f->batches.size() << " of " << osrs.size()
+	   << " osrs, ~" << f->reserved_ios << " ios" << dendl;
+
+  unsigned num_ios = 0;
+  DeferredBatch merged(cct, nullptr);
+  DeferredBatch *src = f->batches.front();
+  for (auto b : f->batches) {
+    for (auto& txc : b->txcs) {
+      txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+    }
+    num_ios += b->iomap.size();
+  }
+  if (f->batches.size() > 1) {
+    // each batch is already free of overlaps; apply them oldest first
+    vector<pair<uint64_t,decltype(src->iomap)::iterator>> ios;
+    ios.reserve(num_ios);
+    for (auto b : f->batches) {
+      for (auto p = b->iomap.begin(); p != b->iomap.end(); ++p) {
+	ios.emplace_back(p->second.seq, p);
+      }
+    }
+    std::stable_sort(ios.begin(), ios.end(),
+		     [](const auto& a, const auto& b) {
+		       return a.first < b.first;
+		     });
+    uint64_t elided = 0;
+    for (auto& i : ios) {
+      bufferlist::const_iterator p = i.second->second.bl.begin();
+      elided += merged.prepare_write(cct, i.first, i.second->first,
+				     i.second->second.bl.length(), p);
+    }
+    if (elided) {
+      logger->inc(l_bluestore_deferred_write_elided_bytes, elided);
+    }
+    src = &merged;
+  }
+
+  // elevator: from the head position up, then wrap around
+  auto write_run = [&](uint64_t start, bufferlist& bl) {
+    dout(20) << __func__ << " write 0x" << std::hex
+	     << start << "~" << bl.length()
+	     << " crc " << bl.crc32c(-1) << std::dec << dendl;
+    head = start + bl.length();
+    if (!g_conf->bluestore_debug_omit_block_device_write) {
+      logger->inc(l_bluestore_deferred_write_ops);
+      logger->inc(l_bluestore_deferred_write_bytes, bl.length());
+      int r = bdev->aio_write(start, bl, &f->ioc, false);
+      assert(r == 0);
+    }
+  };
+  unsigned aios = 0;
+  auto split = src->iomap.lower_bound(head);
+  for (auto pass : { std::make_pair(split, src->iomap.end()),
+		     std::make_pair(src->iomap.begin(), split) }) {
+    uint64_t start = 0, pos = 0;
+    bufferlist bl;
+    for (auto i = pass.first; i != pass.second; ++i) {
+      if (bl.length() && i->first != pos) {
+	write_run(start, bl);
+	++aios;
+	bl.clear();
+      }
+      if (!bl.length()) {
+	start = i->first;
+	pos = start;
+      }
+      dout(20) << __func__ << "   seq " << i->second.seq << " 0x"
+	       << std::hex << pos << "~" << i->second.bl.length() << std::dec
+	       << dendl;
+      pos += i->second.bl.length();
+      bl.claim_append(i->second.bl);
+    }
+    if (bl.length()) {
+      write_run(start, bl);
+      ++aios;
+    }
+  }
+  if (num_ios > aios) {
+    logger->inc(l_bluestore_deferred_write_merged_ios, num_ios - aios);
+  }
+  {
+    std::lock_guard<std::mutex> l(deferred_lock);
+    deferred_elevator_pos = head;
+  }
+
+  bdev->aio_submit(&f->ioc);
+}
+
 struct C_DeferredTrySubmit : public Context {
   BlueStore *store;
   C_DeferredTrySubmit(BlueStore *s) : store(s) {}
@@ -9443,6 +11235,27 @@ struct C_DeferredTrySubmit : public Context {
   }
 };
 
+void BlueStore::_deferred_flush_finish(DeferredFlush *f)
+{
+  dout(10) << __func__ << " " << f << " " << f->batches.size() << " batches"
+	   << dendl;
+  for (auto b : f->batches) {
+    _deferred_aio_finish(b->osr);
+  }
+  bool retry = false;
+  {
+    std::lock_guard<std::mutex> l(deferred_lock);
+    assert(deferred_flush_ios >= f->reserved_ios);
+    deferred_flush_ios -= f->reserved_ios;
+    std::swap(retry, deferred_flush_throttled);
+  }
+  if (retry) {
+    dout(20) << __func__ << " queuing async deferred_try_submit" << dendl;
+    deferred_finisher.queue(new C_DeferredTrySubmit(this));
+  }
+  delete f;
+}
+
 void BlueStore::_deferred_aio_finish(OpSequencer *osr)
 {
   dout(10) << __func__ << " osr " << osr << dendl;
@@ -9477,15 +11290,15 @@ void BlueStore::_deferred_aio_finish(OpSequencer *osr)
       }
     }
     throttle_deferred_bytes.put(costs);
-    std::lock_guard<std::mutex> l(kv_lock);
-    deferred_done_queue.emplace_back(b);
+    KVPipeline *p = kv_pipelines.front();
+    std::lock_guard<std::mutex> l(p->kv_lock);
+    p->deferred_done_queue.emplace_back(b);
   }
 
   // in the normal case, do not bother waking up the kv thread; it will
   // catch us on the next commit anyway.
   if (deferred_aggressive) {
-    std::lock_guard<std::mutex> l(kv_lock);
-    kv_cond.notify_one();
+    _kv_notify_primary();
   }
 }
 
@@ -9565,6 +11378,12 @@ int BlueStore::queue_transactions(
   OpSequencer *osr = c->osr.get();
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
+  // keep background tier moves from interleaving with our onode updates
+  std::unique_lock<std::mutex> tier_l(c->tier_lock, std::defer_lock);
+  if (tier_alloc) {
+    tier_l.lock();
+  }
+
   // prepare
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit);
@@ -9588,6 +11407,9 @@ int BlueStore::queue_transactions(
   }
 
   _txc_finalize_kv(txc, txc->t);
+  if (tier_l.owns_lock()) {
+    tier_l.unlock();
+  }
   if (handle)
     handle->suspend_tp_timeout();
 
@@ -9600,11 +11422,8 @@ int BlueStore::queue_transactions(
 	       << dendl;
       ++deferred_aggressive;
       deferred_try_submit();
-      {
-	// wake up any previously finished deferred events
-	std::lock_guard<std::mutex> l(kv_lock);
-	kv_cond.notify_one();
-      }
+      // wake up any previously finished deferred events
+      _kv_notify_primary();
       throttle_deferred_bytes.get(txc->cost);
       --deferred_aggressive;
    }
@@ -9617,8 +11436,18 @@ int BlueStore::queue_transactions(
   logger->inc(l_bluestore_txc);
 
   // execute (start)
+  bool kv_barrier = txc->kv_barrier;
   _txc_state_proc(txc);
 
+  if (kv_barrier) {
+    // collection create/remove/split may be followed by txcs on other
+    // sequencers (and hence other kv pipelines) that depend on it.  make
+    // sure it reaches the kv WAL before we return so that anything queued
+    // after us lands behind it.
+    dout(20) << __func__ << " waiting for kv barrier txc to submit" << dendl;
+    osr->flush();
+  }
+
   // we're immediately readable (unlike FileStore)
   for (auto c : on_applied_sync) {
     c->complete(0);
@@ -9635,7 +11464,28 @@ int BlueStore::queue_transactions(
 void BlueStore::_txc_aio_submit(TransContext *txc)
 {
   dout(10) << __func__ << " txc " << txc << dendl;
-  bdev->aio_submit(&txc->ioc);
+  // count both iocs before submitting either; each completes separately
+  bool main = txc->ioc.has_pending_aios();
+  bool tier = txc->tier_ioc.has_pending_aios();
+  txc->num_aio_iocs = (main ? 1 : 0) + (tier ? 1 : 0);
+  if (main) {
+    bdev->aio_submit(&txc->ioc);
+  }
+  if (tier) {
+    tier_bdev->aio_submit(&txc->tier_ioc);
+  }
+}
+
+void BlueStore::_txc_aio_write(TransContext *txc, uint64_t offset,
+			       bufferlist& bl, bool buffered)
+{
+  if (_is_tier_offset(offset)) {
+    assert(tier_bdev);
+    tier_bdev->aio_write(offset - TIER_FAST_BASE, bl, &txc->tier_ioc,
+			 buffered);
+  } else {
+    bdev->aio_write(offset, bl, &txc->ioc, buffered);
+  }
 }
 
 void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
@@ -9646,7 +11496,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
 
   vector<CollectionRef> cvec(i.colls.size());
   unsigned j = 0;
-  for (vector<coll_t>::iterator p = i.colls.begin(); p != i.colls.end();
+  for (auto p = i.colls.begin(); p != i.colls.end();
        ++p, ++j) {
     cvec[j] = _get_collection(*p);
   }
@@ -9666,6 +11516,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
     case Transaction::OP_RMCOLL:
       {
         const coll_t &cid = i.get_cid(op->cid);
+	txc->kv_barrier = kv_pipeline_num > 1;
 	r = _remove_collection(txc, cid, &c);
 	if (!r)
 	  continue;
@@ -9676,6 +11527,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       {
 	assert(!c);
 	const coll_t &cid = i.get_cid(op->cid);
+	txc->kv_barrier = kv_pipeline_num > 1;
 	r = _create_collection(txc, cid, op->split_bits, &c);
 	if (!r)
 	  continue;
@@ -9690,6 +11542,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
       {
         uint32_t bits = op->split_bits;
         uint32_t rem = op->split_rem;
+	txc->kv_barrier = kv_pipeline_num > 1;
 	r = _split_collection(txc, c, cvec[op->dest_cid], bits, rem);
 	if (!r)
 	  continue;
@@ -10192,6 +12045,9 @@ void BlueStore::_do_write_small(
 	dout(20) << __func__ << " ignoring distant " << *b << dendl;
       } else if (!b->get_blob().is_mutable()) {
 	dout(20) << __func__ << " ignoring immutable " << *b << dendl;
+      } else if (!_tier_match(wctx, b->get_blob())) {
+	// we are moving data between tiers; don't write it in place
+	dout(20) << __func__ << " ignoring other tier " << *b << dendl;
       } else if (ep->logical_offset % min_alloc_size !=
 		  ep->blob_offset % min_alloc_size) {
 	dout(20) << __func__ << " ignoring offset-skewed " << *b << dendl;
@@ -10231,7 +12087,8 @@ void BlueStore::_do_write_small(
 			      wctx->buffered ? 0 : Buffer::FLAG_NOCACHE);
 
 	  if (!g_conf->bluestore_debug_omit_block_device_write) {
-	    if (b_len <= prefer_deferred_size) {
+	    if (b_len <= prefer_deferred_size &&
+		!_is_tier_blob(b->get_blob())) {
 	      dout(20) << __func__ << " deferring small 0x" << std::hex
 		       << b_len << std::dec << " unused write via deferred" << dendl;
 	      bluestore_deferred_op_t *op = _get_deferred_op(txc, o);
@@ -10247,8 +12104,7 @@ void BlueStore::_do_write_small(
 	      b->get_blob().map_bl(
 		b_off, bl,
 		[&](uint64_t offset, bufferlist& t) {
-		  bdev->aio_write(offset, t,
-				  &txc->ioc, wctx->buffered);
+		  _txc_aio_write(txc, offset, t, wctx->buffered);
 		});
 	    }
 	  }
@@ -10276,11 +12132,13 @@ void BlueStore::_do_write_small(
 	  head_read = tail_read = 0;
 	}
 
-	// chunk-aligned deferred overwrite?
+	// chunk-aligned deferred overwrite?  (deferred writes only ever
+	// target the main device; fast tier blobs are rewritten instead)
 	if (b->get_blob().get_ondisk_length() >= b_off + b_len &&
 	    b_off % chunk_size == 0 &&
 	    b_len % chunk_size == 0 &&
-	    b->get_blob().is_allocated(b_off, b_len)) {
+	    b->get_blob().is_allocated(b_off, b_len) &&
+	    !_is_tier_blob(b->get_blob())) {
 
 	  _apply_padding(head_pad, tail_pad, bl);
 
@@ -10389,7 +12247,8 @@ void BlueStore::_do_write_small(
       auto bstart = prev_ep->blob_start();
       dout(20) << __func__ << " considering " << *b
 	       << " bstart 0x" << std::hex << bstart << std::dec << dendl;
-      if (b->can_reuse_blob(min_alloc_size,
+      if (_tier_match(wctx, b->get_blob()) &&
+	  b->can_reuse_blob(min_alloc_size,
 			    max_bsize,
                             offset0 - bstart,
                             &alloc_len)) {
@@ -10467,70 +12326,292 @@ void BlueStore::_do_write_big(
     BlobRef b;
     uint32_t b_off = 0;
 
-    //attempting to reuse existing blob
-    if (!wctx->compress) {
-      // look for an existing mutable blob we can reuse
-      auto begin = o->extent_map.extent_map.begin();
-      auto end = o->extent_map.extent_map.end();
-      auto ep = o->extent_map.seek_lextent(offset);
-      auto prev_ep = ep;
-      if (prev_ep != begin) {
-        --prev_ep;
-      } else {
-        prev_ep = end; // to avoid this extent check as it's a duplicate
+    //attempting to reuse existing blob
+    if (!wctx->compress) {
+      // look for an existing mutable blob we can reuse
+      auto begin = o->extent_map.extent_map.begin();
+      auto end = o->extent_map.extent_map.end();
+      auto ep = o->extent_map.seek_lextent(offset);
+      auto prev_ep = ep;
+      if (prev_ep != begin) {
+        --prev_ep;
+      } else {
+        prev_ep = end; // to avoid this extent check as it's a duplicate
+      }
+      auto min_off = offset >= max_bsize ? offset - max_bsize : 0;
+      // search suitable extent in both forward and reverse direction in
+      // [offset - target_max_blob_size, offset + target_max_blob_size] range
+      // then check if blob can be reused via can_reuse_blob func.
+      bool any_change;
+      do {
+	any_change = false;
+	if (ep != end && ep->logical_offset < offset + max_bsize) {
+	  if (offset >= ep->blob_start() &&
+	      _tier_match(wctx, ep->blob->get_blob()) &&
+              ep->blob->can_reuse_blob(min_alloc_size, max_bsize,
+	                               offset - ep->blob_start(),
+	                               &l)) {
+	    b = ep->blob;
+	    b_off = offset - ep->blob_start();
+            prev_ep = end; // to avoid check below
+	    dout(20) << __func__ << " reuse blob " << *b << std::hex
+		     << " (0x" << b_off << "~" << l << ")" << std::dec << dendl;
+	  } else {
+	    ++ep;
+	    any_change = true;
+	  }
+	}
+
+	if (prev_ep != end && prev_ep->logical_offset >= min_off) {
+	  if (_tier_match(wctx, prev_ep->blob->get_blob()) &&
+	      prev_ep->blob->can_reuse_blob(min_alloc_size, max_bsize,
+                                    	    offset - prev_ep->blob_start(),
+                                    	    &l)) {
+	    b = prev_ep->blob;
+	    b_off = offset - prev_ep->blob_start();
+	    dout(20) << __func__ << " reuse blob " << *b << std::hex
+		     << " (0x" << b_off << "~" << l << ")" << std::dec << dendl;
+	  } else if (prev_ep != begin) {
+	    --prev_ep;
+	    any_change = true;
+	  } else {
+	    prev_ep = end; // to avoid useless first extent re-check
+	  }
+	}
+      } while (b == nullptr && any_change);
+    }
+    if (b == nullptr) {
+      b = c->new_blob();
+      b_off = 0;
+      new_blob = true;
+    }
+
+    bufferlist t;
+    blp.copy(l, t);
+    wctx->write(offset, b, l, b_off, t, b_off, l, false, new_blob);
+    offset += l;
+    length -= l;
+    logger->inc(l_bluestore_write_big_blobs);
+  }
+}
+
+bool BlueStore::_is_tier_blob(const bluestore_blob_t& blob) const
+{
+  for (auto& p : blob.get_extents()) {
+    if (p.is_valid() && _is_tier_offset(p.offset)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BlueStore::_tier_place_fast(const WriteContext *wctx, uint64_t need)
+{
+  if (!tier_alloc || wctx->tier == WriteContext::TIER_SLOW) {
+    return false;
+  }
+  if (wctx->tier == WriteContext::TIER_AUTO && need > tier_small_write_size) {
+    return false;
+  }
+  uint64_t size = tier_extents.size();
+  uint64_t used = size - tier_alloc->get_free();
+  return used + need <= size * tier_max_ratio;
+}
+
+void BlueStore::_tier_split(interval_set<uint64_t> *in,
+			    interval_set<uint64_t> *out)
+{
+  for (auto p = in->begin(); p != in->end(); ++p) {
+    if (_is_tier_offset(p.get_start())) {
+      out->insert(p.get_start() - TIER_FAST_BASE, p.get_len());
+    }
+  }
+  for (auto p = out->begin(); p != out->end(); ++p) {
+    in->erase(p.get_start() + TIER_FAST_BASE, p.get_len());
+  }
+}
+
+int BlueStore::_bdev_read(uint64_t offset, uint64_t length, bufferlist *bl,
+			  IOContext *ioc, bool use_aio)
+{
+  if (_is_tier_offset(offset)) {
+    // ioc is submitted to bdev, so read the fast tier synchronously
+    return tier_bdev->read(offset - TIER_FAST_BASE, length, bl, ioc, false);
+  }
+  if (use_aio) {
+    return bdev->aio_read(offset, length, bl, ioc);
+  }
+  return bdev->read(offset, length, bl, ioc, false);
+}
+
+void BlueStore::_update_tier_logger()
+{
+  if (tier_alloc) {
+    logger->set(l_bluestore_tier_fast_used,
+		tier_extents.size() - tier_alloc->get_free());
+  }
+}
+
+void BlueStore::_compress_start()
+{
+  unsigned n = cct->_conf->get_val<uint64_t>("bluestore_compression_threads");
+  dout(10) << __func__ << " " << n << " threads" << dendl;
+  compress_stop = false;
+  for (unsigned i = 0; i < n; ++i) {
+    CompressThread *t = new CompressThread(this);
+    t->create(("bstore_compr" + stringify(i)).c_str());
+    compress_threads.push_back(t);
+  }
+}
+
+void BlueStore::_compress_stop()
+{
+  dout(10) << __func__ << dendl;
+  {
+    std::lock_guard<std::mutex> l(compress_lock);
+    compress_stop = true;
+    compress_cond.notify_all();
+  }
+  for (auto t : compress_threads) {
+    t->join();
+    delete t;
+  }
+  compress_threads.clear();
+  assert(compress_queue.empty());
+}
+
+void BlueStore::_compress_thread()
+{
+  std::unique_lock<std::mutex> l(compress_lock);
+  while (true) {
+    if (compress_queue.empty()) {
+      if (compress_stop) {
+	break;
+      }
+      compress_cond.wait(l);
+      continue;
+    }
+    CompressJob *job = compress_queue.front();
+    compress_queue.pop_front();
+    compress_queue_bytes -= job->in->length();
+    l.unlock();
+
+    logger->tinc(l_bluestore_compress_queue_lat,
+		 mono_clock::now() - job->queued);
+    _compress_blob(job);
+    {
+      // the submitter may free the batch as soon as pending hits zero
+      CompressBatch *batch = job->batch;
+      std::lock_guard<std::mutex> bl(batch->lock);
+      if (--batch->pending == 0) {
+	batch->cond.notify_all();
+      }
+    }
+
+    l.lock();
+  }
+}
+
+void BlueStore::_compress_blob(CompressJob *job)
+{
+  auto start = mono_clock::now();
+
+  // FIXME: memory alignment here is bad
+  bufferlist t;
+  int r = job->c->compress(*job->in, t);
+  assert(r == 0);
+
+  bluestore_compression_header_t chdr;
+  chdr.type = job->c->get_type();
+  chdr.length = t.length();
+  encode(chdr, *job->out);
+  job->out->claim_append(t);
+
+  logger->tinc(l_bluestore_compress_lat, mono_clock::now() - start);
+}
+
+bool BlueStore::_compress_history_skip(
+  const Collection *c,
+  const Onode *o) const
+{
+  uint32_t limit = comp_history_misses;
+  if (!limit) {
+    return false;
+  }
+  // every limit'th write is compressed anyway, in case the data changed
+  uint32_t misses = std::max(o->compress_misses, c->compress_misses);
+  return misses >= limit && misses % limit != 0;
+}
+
+void BlueStore::_compress_blobs(vector<CompressJob>& jobs)
+{
+  if (compress_threads.empty() || jobs.size() < 2) {
+    for (auto& j : jobs) {
+      _compress_blob(&j);
+    }
+    return;
+  }
+
+  // Keep the first blob for ourselves and queue the rest.  Blobs that
+  // would push the queue past its byte limit are compressed inline,
+  // which throttles the writer instead of growing the queue.
+  CompressBatch batch;
+  vector<CompressJob*> inline_jobs;
+  uint64_t max_bytes =
+    cct->_conf->get_val<uint64_t>("bluestore_compression_queue_max_bytes");
+  {
+    std::lock_guard<std::mutex> l(compress_lock);
+    auto now = mono_clock::now();
+    for (size_t i = 1; i < jobs.size(); ++i) {
+      CompressJob& j = jobs[i];
+      if (compress_queue_bytes + j.in->length() > max_bytes) {
+	inline_jobs.push_back(&j);
+	continue;
       }
-      auto min_off = offset >= max_bsize ? offset - max_bsize : 0;
-      // search suitable extent in both forward and reverse direction in
-      // [offset - target_max_blob_size, offset + target_max_blob_size] range
-      // then check if blob can be reused via can_reuse_blob func.
-      bool any_change;
-      do {
-	any_change = false;
-	if (ep != end && ep->logical_offset < offset + max_bsize) {
-	  if (offset >= ep->blob_start() &&
-              ep->blob->can_reuse_blob(min_alloc_size, max_bsize,
-	                               offset - ep->blob_start(),
-	                               &l)) {
-	    b = ep->blob;
-	    b_off = offset - ep->blob_start();
-            prev_ep = end; // to avoid check below
-	    dout(20) << __func__ << " reuse blob " << *b << std::hex
-		     << " (0x" << b_off << "~" << l << ")" << std::dec << dendl;
-	  } else {
-	    ++ep;
-	    any_change = true;
-	  }
-	}
+      j.batch = &batch;
+      j.queued = now;
+      compress_queue.push_back(&j);
+      compress_queue_bytes += j.in->length();
+      ++batch.pending;
+    }
+    if (batch.pending) {
+      compress_cond.notify_all();
+    }
+  }
+  dout(20) << __func__ << " " << jobs.size() << " blobs, " << batch.pending
+	   << " queued" << dendl;
+  logger->inc(l_bluestore_compress_queued_ops, batch.pending);
 
-	if (prev_ep != end && prev_ep->logical_offset >= min_off) {
-	  if (prev_ep->blob->can_reuse_blob(min_alloc_size, max_bsize,
-                                    	    offset - prev_ep->blob_start(),
-                                    	    &l)) {
-	    b = prev_ep->blob;
-	    b_off = offset - prev_ep->blob_start();
-	    dout(20) << __func__ << " reuse blob " << *b << std::hex
-		     << " (0x" << b_off << "~" << l << ")" << std::dec << dendl;
-	  } else if (prev_ep != begin) {
-	    --prev_ep;
-	    any_change = true;
-	  } else {
-	    prev_ep = end; // to avoid useless first extent re-check
-	  }
+  _compress_blob(&jobs[0]);
+  for (auto j : inline_jobs) {
+    _compress_blob(j);
+  }
+
+  // take back whatever the workers have not picked up yet
+  while (true) {
+    CompressJob *j = nullptr;
+    {
+      std::lock_guard<std::mutex> l(compress_lock);
+      for (auto p = compress_queue.begin(); p != compress_queue.end(); ++p) {
+	if ((*p)->batch == &batch) {
+	  j = *p;
+	  compress_queue.erase(p);
+	  compress_queue_bytes -= j->in->length();
+	  break;
 	}
-      } while (b == nullptr && any_change);
+      }
     }
-    if (b == nullptr) {
-      b = c->new_blob();
-      b_off = 0;
-      new_blob = true;
+    if (!j) {
+      break;
     }
+    _compress_blob(j);
+    std::lock_guard<std::mutex> l(batch.lock);
+    --batch.pending;
+  }
 
-    bufferlist t;
-    blp.copy(l, t);
-    wctx->write(offset, b, l, b_off, t, b_off, l, false, new_blob);
-    offset += l;
-    length -= l;
-    logger->inc(l_bluestore_write_big_blobs);
+  std::unique_lock<std::mutex> l(batch.lock);
+  while (batch.pending) {
+    batch.cond.wait(l);
   }
 }
 
@@ -10593,28 +12674,48 @@ int BlueStore::_do_alloc_write(
     }
   );
 
-  // compress (as needed) and calc needed space
-  uint64_t need = 0;
-  auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
-  for (auto& wi : wctx->writes) {
-    if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
-
-      // compress
+  // compress (as needed), possibly in parallel.  Unless forced, skip
+  // blobs that recently written data or a sample of the blob itself say
+  // will not compress; those are left with an empty compressed_bl.
+  bool compress_tried = false;
+  if (c) {
+    vector<CompressJob> jobs;
+    uint64_t attempted = 0, skipped = 0;
+    bool skip_all = wctx->compress_adaptive &&
+      _compress_history_skip(coll.get(), o.get());
+    size_t sample = comp_sample_size;
+    double max_entropy = comp_sample_max_entropy;
+    for (auto& wi : wctx->writes) {
+      if (wi.blob_length <= min_alloc_size) {
+	continue;
+      }
       assert(wi.b_off == 0);
       assert(wi.blob_length == wi.bl.length());
+      if (wctx->compress_adaptive &&
+	  (skip_all ||
+	   (sample &&
+	    Compressor::estimate_entropy(wi.bl, sample) > max_entropy))) {
+	skipped += wi.blob_length;
+	continue;
+      }
+      jobs.emplace_back(c, &wi.bl, &wi.compressed_bl);
+      attempted += wi.blob_length;
+    }
+    dout(20) << __func__ << std::hex << " compressing 0x" << attempted
+	     << " skipping 0x" << skipped << std::dec
+	     << (skip_all ? " (history)" : "") << dendl;
+    logger->inc(l_bluestore_compress_attempted_bytes, attempted);
+    logger->inc(l_bluestore_compress_skipped_bytes, skipped);
+    compress_tried = attempted || skipped;
+    _compress_blobs(jobs);
+  }
 
-      // FIXME: memory alignment here is bad
-      bufferlist t;
-      int r = c->compress(wi.bl, t);
-      assert(r == 0);
-
-      bluestore_compression_header_t chdr;
-      chdr.type = c->get_type();
-      chdr.length = t.length();
-      encode(chdr, wi.compressed_bl);
-      wi.compressed_bl.claim_append(t);
-
+  // calc needed space
+  uint64_t need = 0;
+  bool compress_hit = false;
+  auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
+  for (auto& wi : wctx->writes) {
+    if (wi.compressed_bl.length()) {
       wi.compressed_len = wi.compressed_bl.length();
       uint64_t newlen = p2roundup(wi.compressed_len, min_alloc_size);
       uint64_t want_len_raw = wi.blob_length * crr;
@@ -10633,6 +12734,7 @@ int BlueStore::_do_alloc_write(
 	txc->statfs_delta.compressed_allocated() += newlen;
 	logger->inc(l_bluestore_compress_success_count);
 	wi.compressed = true;
+	compress_hit = true;
 	need += newlen;
       } else {
 	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
@@ -10645,18 +12747,48 @@ int BlueStore::_do_alloc_write(
 	logger->inc(l_bluestore_compress_rejected_count);
 	need += wi.blob_length;
       }
-      logger->tinc(l_bluestore_compress_lat,
-                  mono_clock::now() - start);
     } else {
       need += wi.blob_length;
     }
   }
+  if (compress_tried && wctx->compress_adaptive) {
+    if (compress_hit) {
+      o->compress_misses = 0;
+      coll->compress_misses = 0;
+    } else {
+      ++o->compress_misses;
+      ++coll->compress_misses;
+    }
+  }
+
   PExtentVector prealloc;
   prealloc.reserve(2 * wctx->writes.size());;
   int prealloc_left = 0;
-  prealloc_left = alloc->allocate(
-    need, min_alloc_size, need,
-    0, &prealloc);
+  bool fast = _tier_place_fast(wctx, need);
+  if (fast) {
+    prealloc_left = tier_alloc->allocate(
+      need, min_alloc_size, need,
+      0, &prealloc);
+    if (prealloc_left < (int64_t)need) {
+      dout(20) << __func__ << " fast tier allocation failed, using main device"
+	       << dendl;
+      if (prealloc_left > 0) {
+	tier_alloc->release(prealloc);
+      }
+      prealloc.clear();
+      fast = false;
+    } else {
+      for (auto& p : prealloc) {
+	p.offset += TIER_FAST_BASE;
+      }
+      logger->inc(l_bluestore_tier_fast_write_bytes, need);
+    }
+  }
+  if (!fast) {
+    prealloc_left = alloc->allocate(
+      need, min_alloc_size, need,
+      0, &prealloc);
+  }
   if (prealloc_left  < 0) {
     derr << __func__ << " failed to allocate 0x" << std::hex << need << std::dec
 	 << dendl;
@@ -10664,7 +12796,8 @@ int BlueStore::_do_alloc_write(
   }
   assert(prealloc_left == (int64_t)need);
 
-  dout(20) << __func__ << " prealloc " << prealloc << dendl;
+  dout(20) << __func__ << " prealloc " << prealloc
+	   << (fast ? " (fast tier)" : "") << dendl;
   auto prealloc_pos = prealloc.begin();
 
   for (auto& wi : wctx->writes) {
@@ -10765,9 +12898,9 @@ int BlueStore::_do_alloc_write(
     _buffer_cache_write(txc, wi.b, b_off, wi.bl,
                         wctx->buffered ? 0 : Buffer::FLAG_NOCACHE);
 
-    // queue io
+    // queue io.  the fast tier is flash; never defer there.
     if (!g_conf->bluestore_debug_omit_block_device_write) {
-      if (l->length() <= prefer_deferred_size.load()) {
+      if (!fast && l->length() <= prefer_deferred_size.load()) {
 	dout(20) << __func__ << " deferring small 0x" << std::hex
 		 << l->length() << std::dec << " write via deferred" << dendl;
 	bluestore_deferred_op_t *op = _get_deferred_op(txc, o);
@@ -10784,7 +12917,7 @@ int BlueStore::_do_alloc_write(
 	b->get_blob().map_bl(
 	  b_off, *l,
 	  [&](uint64_t offset, bufferlist& t) {
-	    bdev->aio_write(offset, t, &txc->ioc, false);
+	    _txc_aio_write(txc, offset, t, false);
 	  });
       }
     }
@@ -10942,6 +13075,7 @@ void BlueStore::_choose_write_options(
     }
   );
 
+  wctx->compress_adaptive = cm != Compressor::COMP_FORCE;
   wctx->compress = (cm != Compressor::COMP_NONE) &&
     ((cm == Compressor::COMP_FORCE) ||
      (cm == Compressor::COMP_AGGRESSIVE &&
@@ -11057,6 +13191,205 @@ int BlueStore::_do_gc(
   return 0;
 }
 
+void BlueStore::_tier_note_read(Collection *c, OnodeRef& o)
+{
+  auto& h = c->tier_heat;
+  const hobject_t& hoid = o->oid.hobj;
+  unsigned temp;
+  {
+    std::lock_guard<std::mutex> l(h.lock);
+    utime_t now = ceph_clock_now();
+    if (h.current &&
+	(double)(now - h.current_start) > tier_hit_set_period) {
+      h.current->seal();
+      h.history.push_front(std::move(h.current));
+      while (h.history.size() > tier_hit_set_count) {
+	h.history.pop_back();
+      }
+    }
+    if (!h.current) {
+      HitSet::Params params(
+	new BloomHitSet::Params(.05, tier_hit_set_target_size, now.sec()));
+      h.current.reset(new HitSet(params));
+      h.current_start = now;
+    }
+    h.current->insert(hoid);
+    temp = h.temperature(hoid);
+  }
+  if (temp < tier_min_read_recency ||
+      o->onode.size > tier_promote_max_object_size) {
+    return;
+  }
+  // only look at what is loaded; the tier thread does the full check
+  for (auto& e : o->extent_map.extent_map) {
+    auto& blob = e.blob->get_blob();
+    if (blob.is_shared()) {
+      continue;
+    }
+    for (auto& p : blob.get_extents()) {
+      if (p.is_valid() && !_is_tier_offset(p.offset)) {
+	dout(20) << __func__ << " " << o->oid << " temperature " << temp
+		 << ", promoting" << dendl;
+	tier_thread.queue_promote(c->cid, o->oid);
+	return;
+      }
+    }
+  }
+}
+
+void BlueStore::_tier_get_misplaced(OnodeRef& o, bool to_fast,
+				    interval_set<uint64_t> *misplaced)
+{
+  for (auto& e : o->extent_map.extent_map) {
+    auto& blob = e.blob->get_blob();
+    if (blob.is_shared()) {
+      // leave clones alone; moving them would unshare the data
+      continue;
+    }
+    for (auto& p : blob.get_extents()) {
+      if (p.is_valid() && _is_tier_offset(p.offset) != to_fast) {
+	misplaced->union_insert(e.logical_offset, e.length);
+	break;
+      }
+    }
+  }
+}
+
+/// rewrite the misplaced ranges of o, whose contents the caller has
+/// already read into data (one bufferlist per range, in order)
+int BlueStore::_tier_rewrite(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef& o,
+  bool to_fast,
+  const interval_set<uint64_t>& misplaced,
+  vector<bufferlist>& data)
+{
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex << misplaced
+	   << std::dec << (to_fast ? " to fast" : " to slow") << dendl;
+  WriteContext wctx;
+  _choose_write_options(c, o, 0, &wctx);
+  wctx.tier = to_fast ? WriteContext::TIER_FAST : WriteContext::TIER_SLOW;
+
+  auto bl = data.begin();
+  for (auto p = misplaced.begin(); p != misplaced.end(); ++p, ++bl) {
+    assert(bl != data.end());
+    _do_write_data(txc, c, o, p.get_start(), p.get_len(), *bl, &wctx);
+  }
+
+  int r = _do_alloc_write(txc, c, o, &wctx);
+  if (r < 0) {
+    derr << __func__ << " _do_alloc_write failed with " << cpp_strerror(r)
+	 << dendl;
+    return r;
+  }
+  _wctx_finish(txc, c, o, &wctx);
+
+  uint64_t start = misplaced.range_start();
+  uint64_t len = misplaced.range_end() - start;
+  o->extent_map.compress_extent_map(start, len);
+  o->extent_map.dirty_range(start, len);
+  txc->write_onode(o);
+  return 0;
+}
+
+int BlueStore::_tier_move(CollectionRef& c, const ghobject_t& oid,
+			  bool to_fast, uint64_t *moved)
+{
+  dout(15) << __func__ << " " << c->cid << " " << oid
+	   << (to_fast ? " to fast" : " to slow") << dendl;
+  *moved = 0;
+
+  // new txcs on this collection wait for us (see queue_transactions), so
+  // nothing can change the onode between our check and our commit, and
+  // our onode update is ordered with everyone else's.
+  std::unique_lock<std::mutex> tier_l(c->tier_lock);
+  TransContext *txc = nullptr;
+  {
+    RWLock::WLocker l(c->lock);
+    if (!c->exists) {
+      return -ENOENT;
+    }
+    OnodeRef o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return -ENOENT;
+    }
+    if (to_fast && o->onode.size > tier_promote_max_object_size) {
+      return 0;
+    }
+    o->extent_map.fault_range(db, 0, o->onode.size);
+    interval_set<uint64_t> misplaced;
+    _tier_get_misplaced(o, to_fast, &misplaced);
+    if (misplaced.empty()) {
+      return 0;
+    }
+    if (to_fast) {
+      WriteContext wctx;
+      wctx.tier = WriteContext::TIER_FAST;
+      if (!_tier_place_fast(&wctx, misplaced.size())) {
+	dout(20) << __func__ << " fast tier is full" << dendl;
+	return -ENOSPC;
+      }
+    }
+
+    // read (and so verify) everything before we touch the onode; an
+    // object we cannot read is simply left where it is
+    vector<bufferlist> data;
+    data.reserve(misplaced.num_intervals());
+    for (auto p = misplaced.begin(); p != misplaced.end(); ++p) {
+      data.emplace_back();
+      int r = _do_read(c.get(), o, p.get_start(), p.get_len(), data.back(),
+		       0);
+      if (r >= 0 && r != (int)p.get_len()) {
+	r = -EIO;
+      }
+      if (r < 0) {
+	derr << __func__ << " error " << cpp_strerror(r) << " reading "
+	     << oid << " 0x" << std::hex << p.get_start() << "~"
+	     << p.get_len() << std::dec << ", leaving it in place" << dendl;
+	logger->inc(l_bluestore_tier_move_errors);
+	return r;
+      }
+    }
+
+    txc = _txc_create(c.get(), c->osr.get(), nullptr);
+    int r = _tier_rewrite(txc, c, o, to_fast, misplaced, data);
+    if (r < 0) {
+      // we may have already modified the onode; same as a failed op
+      derr << __func__ << " error " << cpp_strerror(r) << " moving " << oid
+	   << dendl;
+      assert(0 == "unexpected error");
+    }
+    *moved = misplaced.size();
+  }
+  _txc_calc_cost(txc);
+  _txc_write_nodes(txc, txc->t);
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist bl;
+    encode(*txc->deferred_txn, bl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, bl);
+  }
+  _txc_finalize_kv(txc, txc->t);
+  tier_l.unlock();
+
+  throttle_bytes.get(txc->cost);
+  if (txc->deferred_txn &&
+      !throttle_deferred_bytes.get_or_fail(txc->cost)) {
+    ++deferred_aggressive;
+    deferred_try_submit();
+    _kv_notify_primary();
+    throttle_deferred_bytes.get(txc->cost);
+    --deferred_aggressive;
+  }
+  logger->inc(to_fast ? l_bluestore_tier_promote_bytes :
+	      l_bluestore_tier_demote_bytes, *moved);
+  _txc_state_proc(txc);
+  return 0;
+}
+
 int BlueStore::_do_write(
   TransContext *txc,
   CollectionRef& c,
@@ -11292,10 +13625,16 @@ int BlueStore::_do_remove(
     generate_extent_shard_key_and_apply(o->key, s.shard_info->offset, &key,
       [&](const string& final_key) {
         txc->t->rmkey(PREFIX_OBJ, final_key);
+	if (onode_l2cache) {
+	  onode_l2cache->invalidate(final_key);
+	}
       }
     );
   }
   txc->t->rmkey(PREFIX_OBJ, o->key.c_str(), o->key.size());
+  if (onode_l2cache) {
+    onode_l2cache->invalidate(o->key.c_str(), o->key.size());
+  }
   txc->note_removed_object(o);
   o->extent_map.clear();
   o->onode = bluestore_onode_t();
@@ -11318,6 +13657,7 @@ int BlueStore::_do_remove(
 
   dout(20) << __func__ << " checking for unshareable blobs on " << h
 	   << " " << h->oid << dendl;
+  h->extent_map.materialize();
   map<SharedBlob*,bluestore_extent_ref_map_t> expect;
   for (auto& e : h->extent_map.extent_map) {
     const bluestore_blob_t& b = e.blob->get_blob();
@@ -11841,6 +14181,9 @@ int BlueStore::_rename(TransContext *txc,
   }
 
   txc->t->rmkey(PREFIX_OBJ, oldo->key.c_str(), oldo->key.size());
+  if (onode_l2cache) {
+    onode_l2cache->invalidate(oldo->key.c_str(), oldo->key.size());
+  }
 
   // rewrite shards
   {
@@ -11851,6 +14194,9 @@ int BlueStore::_rename(TransContext *txc,
       generate_extent_shard_key_and_apply(oldo->key, s.shard_info->offset, &key,
         [&](const string& final_key) {
           txc->t->rmkey(PREFIX_OBJ, final_key);
+	  if (onode_l2cache) {
+	    onode_l2cache->invalidate(final_key);
+	  }
         }
       );
       s.dirty = true;
@@ -12010,6 +14356,12 @@ int BlueStore::_split_collection(TransContext *txc,
 
   c->split_cache(d.get());
 
+  // onode keys do not depend on the collection, but be conservative and
+  // drop the whole l2 cache; splits are rare.
+  if (onode_l2cache) {
+    onode_l2cache->invalidate_all();
+  }
+
   // adjust bits.  note that this will be redundant for all but the first
   // split call for this parent (first child).
   c->cnode.bits = bits;
@@ -12162,7 +14514,9 @@ void BlueStore::generate_db_histogram(Formatter *f)
     } else if (key.first == PREFIX_DEFERRED) {
 	hist.update_hist_entry(hist.key_hist, PREFIX_DEFERRED, key_size, value_size);
 	num_deferred++;
-    } else if (key.first == PREFIX_ALLOC || key.first == PREFIX_ALLOC_BITMAP) {
+    } else if (key.first == PREFIX_ALLOC || key.first == PREFIX_ALLOC_BITMAP ||
+	       key.first == PREFIX_TIER_ALLOC ||
+	       key.first == PREFIX_TIER_ALLOC_BITMAP) {
 	hist.update_hist_entry(hist.key_hist, PREFIX_ALLOC, key_size, value_size);
 	num_alloc++;
     } else if (key.first == PREFIX_SHARED_BLOB) {
@@ -12253,6 +14607,19 @@ void BlueStore::_apply_padding(uint64_t head_pad,
 
 void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
 {
+  bufferlist bl;
+  if (onode_format >= 2 && o->extent_map.lazy) {
+    // the extent map was never touched (e.g., an xattr-only update); pass
+    // its encoded sections through without decoding them.
+    o->onode.encode_flat(o->extent_map.lazy_spanning,
+			 o->extent_map.lazy_extents, bl);
+    dout(20) << __func__  << " onode " << o->oid << " is " << bl.length()
+	     << " (flat, extent map untouched)" << dendl;
+    _record_onode_value(o, txn, bl);
+    return;
+  }
+  o->extent_map.materialize();
+
   // finalize extent_map shards
   o->extent_map.update(txn, false);
   if (o->extent_map.needs_reshard()) {
@@ -12266,6 +14633,27 @@ void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
     logger->inc(l_bluestore_onode_reshard);
   }
 
+  if (onode_format >= 2) {
+    bufferlist spanning;
+    {
+      size_t bound = 0;
+      o->extent_map.bound_encode_spanning_blobs(bound);
+      auto p = spanning.get_contiguous_appender(bound, true);
+      o->extent_map.encode_spanning_blobs(p);
+    }
+    if (o->onode.extent_map_shards.empty()) {
+      o->onode.encode_flat(spanning, o->extent_map.inline_bl, bl);
+    } else {
+      o->onode.encode_flat(spanning, bufferlist(), bl);
+    }
+    dout(20) << __func__  << " onode " << o->oid << " is " << bl.length()
+	     << " (flat, " << spanning.length() << " bytes spanning blobs + "
+	     << o->extent_map.inline_bl.length() << " bytes inline extents)"
+	     << dendl;
+    _record_onode_value(o, txn, bl);
+    return;
+  }
+
   // bound encode
   size_t bound = 0;
   denc(o->onode, bound);
@@ -12275,7 +14663,6 @@ void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
   }
 
   // encode
-  bufferlist bl;
   unsigned onode_part, blob_part, extent_part;
   {
     auto p = bl.get_contiguous_appender(bound, true);
@@ -12295,8 +14682,112 @@ void BlueStore::_record_onode(OnodeRef &o, KeyValueDB::Transaction &txn)
 	    << extent_part << " bytes inline extents)"
 	    << dendl;
 
+  _record_onode_value(o, txn, bl);
+}
 
+void BlueStore::_record_onode_value(OnodeRef &o,
+				    KeyValueDB::Transaction &txn,
+				    bufferlist& bl)
+{
   txn->set(PREFIX_OBJ, o->key.c_str(), o->key.size(), bl);
+  if (onode_l2cache) {
+    onode_l2cache->insert(o->key.c_str(), o->key.size(), bl);
+  }
+}
+
+int BlueStore::convert_onode_format()
+{
+  assert(mounted);
+  dout(1) << __func__ << " to format " << onode_format << dendl;
+  bool flat = onode_format >= 2;
+  uint64_t num = 0, converted = 0, errors = 0;
+  unsigned pending = 0;
+  KeyValueDB::Transaction t = db->get_transaction();
+  CollectionRef c;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OBJ);
+  for (it->lower_bound(string()); it->valid(); it->next()) {
+    if (is_extent_shard_key(it->key())) {
+      continue;
+    }
+    ++num;
+    bufferlist v = it->value();
+    if (bluestore_onode_t::is_flat(v) == flat) {
+      continue;
+    }
+    ghobject_t oid;
+    int r = get_key_object(it->key(), &oid);
+    if (r < 0) {
+      derr << __func__ << " bad object key "
+	   << pretty_binary_string(it->key()) << dendl;
+      ++errors;
+      continue;
+    }
+    if (!c || !c->contains(oid)) {
+      c = nullptr;
+      RWLock::RLocker l(coll_lock);
+      for (auto& p : coll_map) {
+	if (p.second->contains(oid)) {
+	  c = p.second;
+	  break;
+	}
+      }
+      if (!c) {
+	derr << __func__ << " stray object " << oid
+	     << " not owned by any collection" << dendl;
+	++errors;
+	continue;
+      }
+    }
+    RWLock::WLocker l(c->lock);
+    OnodeRef o = c->get_onode(oid, false);
+    assert(o);
+    _record_onode(o, t);
+    ++converted;
+    if (++pending >= 1024) {
+      db->submit_transaction_sync(t);
+      t = db->get_transaction();
+      pending = 0;
+    }
+  }
+  if (!flat && !errors) {
+    // no flat onodes remain; older code can read us again
+    bufferlist bl;
+    encode(min_compat_ondisk_format, bl);
+    t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
+  }
+  db->submit_transaction_sync(t);
+  dout(1) << __func__ << " converted " << converted << " of " << num
+	  << " onodes, " << errors << " errors" << dendl;
+  return errors ? -EIO : 0;
+}
+
+int BlueStore::reshard(const string& new_sharding, ostream& out)
+{
+  vector<KeyValueDB::ColumnFamily> new_cfs;
+  ostringstream perr;
+  int r = KeyValueDB::parse_column_families(new_sharding, &new_cfs, &perr);
+  if (r < 0) {
+    derr << __func__ << " bad sharding '" << new_sharding << "': "
+	 << perr.str() << dendl;
+    out << "bad sharding: " << perr.str() << std::endl;
+    return r;
+  }
+  dout(1) << __func__ << " to '" << new_sharding << "'" << dendl;
+
+  _kv_resharding = true;
+  KeyValueDB *kvdb;
+  r = start_kv_only(&kvdb);
+  if (r < 0) {
+    _kv_resharding = false;
+    return r;
+  }
+  r = kvdb->reshard(new_cfs, out);
+  if (r < 0) {
+    derr << __func__ << " failed: " << cpp_strerror(r) << dendl;
+  }
+  umount();
+  _kv_resharding = false;
+  return r;
 }
 
 // ===========================================
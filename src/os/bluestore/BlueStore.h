@@ -37,6 +37,7 @@
 #include "common/Throttle.h"
 #include "common/perf_counters.h"
 #include "common/PriorityCache.h"
+#include "osd/HitSet.h"
 #include "compressor/Compressor.h"
 #include "os/ObjectStore.h"
 
@@ -45,8 +46,10 @@
 #include "common/EventTrace.h"
 
 class Allocator;
+class MagazineAllocator;
 class FreelistManager;
 class BlueFS;
+class OnodeL2Cache;
 class BlueStoreRepairer;
 
 //#define DEBUG_CACHE
@@ -80,14 +83,24 @@ enum {
   l_bluestore_read_lat,
   l_bluestore_read_onode_meta_lat,
   l_bluestore_read_wait_aio_lat,
+  l_bluestore_readv_lat,
+  l_bluestore_readv_ops,
+  l_bluestore_read_async_ops,
   l_bluestore_compress_lat,
+  l_bluestore_compress_queue_lat,
+  l_bluestore_compress_queued_ops,
   l_bluestore_decompress_lat,
   l_bluestore_csum_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_attempted_bytes,
+  l_bluestore_compress_skipped_bytes,
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_write_elided_bytes,
+  l_bluestore_deferred_write_merged_ios,
+  l_bluestore_deferred_flush_throttled,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -99,6 +112,9 @@ enum {
   l_bluestore_onode_misses,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
+  l_bluestore_onode_l2_hits,
+  l_bluestore_onode_l2_misses,
+  l_bluestore_onode_materialize,
   l_bluestore_extents,
   l_bluestore_blobs,
   l_bluestore_buffers,
@@ -121,9 +137,31 @@ enum {
   l_bluestore_gc_merged,
   l_bluestore_read_eio,
   l_bluestore_fragmentation,
+  l_bluestore_alloc_cache_hit,
+  l_bluestore_alloc_cache_miss,
+  l_bluestore_alloc_cache_bytes,
+  l_bluestore_alloc_snapshot_loaded,
+  l_bluestore_alloc_snapshot_rejected,
+  l_bluestore_tier_fast_write_bytes,
+  l_bluestore_tier_promote_bytes,
+  l_bluestore_tier_demote_bytes,
+  l_bluestore_tier_move_errors,
+  l_bluestore_tier_fast_used,
   l_bluestore_last
 };
 
+enum {
+  l_bluestore_kv_pipeline_first = 732530,
+  l_bluestore_kv_pipeline_queue,
+  l_bluestore_kv_pipeline_committing,
+  l_bluestore_kv_pipeline_commits,
+  l_bluestore_kv_pipeline_txcs,
+  l_bluestore_kv_pipeline_flush_lat,
+  l_bluestore_kv_pipeline_commit_lat,
+  l_bluestore_kv_pipeline_lat,
+  l_bluestore_kv_pipeline_last
+};
+
 class BlueStore : public ObjectStore,
 		  public md_config_obs_t {
   // -----------------------------------------------------
@@ -753,6 +791,10 @@ public:
 
     bufferlist inline_bl;    ///< cached encoded map, if unsharded; empty=>dirty
 
+    bool lazy = false;        ///< flat onode sections below not yet decoded
+    bufferlist lazy_spanning; ///< encoded spanning blobs
+    bufferlist lazy_extents;  ///< encoded inline extents, if unsharded
+
     uint32_t needs_reshard_begin = 0;
     uint32_t needs_reshard_end = 0;
 
@@ -787,9 +829,20 @@ public:
       extent_map.clear_and_dispose(DeleteDisposer());
       shards.clear();
       inline_bl.clear();
+      lazy = false;
+      lazy_spanning.clear();
+      lazy_extents.clear();
       clear_needs_reshard();
     }
 
+    /// decode whatever a flat onode load left undecoded
+    void materialize() {
+      if (lazy) {
+	_materialize();
+      }
+    }
+    void _materialize();
+
     bool encode_some(uint32_t offset, uint32_t length, bufferlist& bl,
 		     unsigned *pn);
     unsigned decode_some(bufferlist& bl);
@@ -1033,6 +1086,9 @@ public:
     std::mutex flush_lock;  ///< protect flush_txns
     std::condition_variable flush_cond;   ///< wait here for uncommitted txns
 
+    /// writes in a row whose compression failed or was skipped
+    uint32_t compress_misses = 0;
+
     Onode(Collection *c, const ghobject_t& o,
 	  const mempool::bluestore_cache_other::string& k)
       : nref(0),
@@ -1060,6 +1116,7 @@ public:
     CephContext* cct;
     PerfCounters *logger;
     std::recursive_mutex lock;          ///< protect lru and other structures
+    int numa_node = -1;                 ///< node we are bound to, or -1
 
     std::atomic<uint64_t> num_extents = {0};
     std::atomic<uint64_t> num_blobs = {0};
@@ -1323,6 +1380,8 @@ public:
 
     OnodeRef add(const ghobject_t& oid, OnodeRef o);
     OnodeRef lookup(const ghobject_t& o);
+    /// lookup() without touching the lru or counting a hit or miss
+    OnodeRef peek(const ghobject_t& o);
     void remove(const ghobject_t& oid) {
       onode_map.erase(oid);
     }
@@ -1360,7 +1419,41 @@ public:
     //pool options
     pool_opts_t pool_opts;
 
+    /// writes in a row, to any object, whose compression failed or was
+    /// skipped; protected by lock like the onodes
+    uint32_t compress_misses = 0;
+
+    /// recent read hits, as in the cache tier agent: a bloom HitSet per
+    /// period plus a short history of sealed ones (see _tier_note_read)
+    struct TierHeat {
+      std::mutex lock;
+      std::unique_ptr<HitSet> current;
+      utime_t current_start;
+      std::list<std::unique_ptr<HitSet>> history;  ///< sealed, newest first
+
+      /// number of recent hit sets that contain o; caller holds lock
+      unsigned temperature(const hobject_t& o) const {
+	unsigned t = current && current->contains(o) ? 1 : 0;
+	for (auto& h : history) {
+	  if (h->contains(o)) {
+	    ++t;
+	  }
+	}
+	return t;
+      }
+    } tier_heat;
+
+    /// serializes txc construction against background tier moves
+    std::mutex tier_lock;
+
     OnodeRef get_onode(const ghobject_t& oid, bool create);
+    /// build an Onode from its encoded form and add it to the cache
+    OnodeRef add_loaded_onode(
+      const ghobject_t& oid,
+      const mempool::bluestore_cache_other::string& key,
+      bufferlist& v);
+    /// load any of oids not yet cached with a single kv lookup
+    void prefetch_onodes(const vector<ghobject_t>& oids);
 
     // the terminology is confusing here, sorry!
     //
@@ -1578,6 +1671,8 @@ public:
     volatile_statfs statfs_delta;
 
     IOContext ioc;
+    IOContext tier_ioc;        ///< aios to the fast data tier, if any
+    std::atomic<unsigned> num_aio_iocs = {0}; ///< iocs with aios in flight
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
 
     uint64_t seq = 0;
@@ -1587,11 +1682,14 @@ public:
     uint64_t last_nid = 0;     ///< if non-zero, highest new nid we allocated
     uint64_t last_blobid = 0;  ///< if non-zero, highest new blobid we allocated
 
+    bool kv_barrier = false;   ///< must be kv submitted before later txcs queue
+
     explicit TransContext(CephContext* cct, Collection *c, OpSequencer *o,
 			  list<Context*> *on_commits)
       : ch(c),
 	osr(o),
 	ioc(cct, this),
+	tier_ioc(cct, this),
 	start(ceph_clock_now()) {
       last_stamp = start;
       if (on_commits) {
@@ -1623,7 +1721,9 @@ public:
     }
 
     void aio_finish(BlueStore *store) override {
-      store->txc_aio_finish(this);
+      if (--num_aio_iocs == 0) {
+	store->txc_aio_finish(this);
+      }
     }
   };
 
@@ -1646,22 +1746,39 @@ public:
     /// bytes of pending io for each deferred seq (may be 0)
     map<uint64_t,int> seq_bytes;
 
-    void _discard(CephContext *cct, uint64_t offset, uint64_t length);
+    /// drop any pending io in the range; @returns bytes dropped
+    uint64_t _discard(CephContext *cct, uint64_t offset, uint64_t length);
     void _audit(CephContext *cct);
 
     DeferredBatch(CephContext *cct, OpSequencer *osr)
       : osr(osr), ioc(cct, this) {}
 
-    /// prepare a write
-    void prepare_write(CephContext *cct,
-		       uint64_t seq, uint64_t offset, uint64_t length,
-		       bufferlist::const_iterator& p);
+    /// prepare a write; @returns bytes of older pending io it overwrote
+    uint64_t prepare_write(CephContext *cct,
+			   uint64_t seq, uint64_t offset, uint64_t length,
+			   bufferlist::const_iterator& p);
+
+    /// number of contiguous runs in iomap (i.e., aios if written alone)
+    unsigned count_runs() const;
 
     void aio_finish(BlueStore *store) override {
       store->_deferred_aio_finish(osr);
     }
   };
 
+  /// the running DeferredBatches of several osrs, written as one
+  struct DeferredFlush final : public AioContext {
+    vector<DeferredBatch*> batches;
+    IOContext ioc;
+    unsigned reserved_ios = 0;  ///< counted against the flush queue depth
+
+    explicit DeferredFlush(CephContext *cct) : ioc(cct, this) {}
+
+    void aio_finish(BlueStore *store) override {
+      store->_deferred_flush_finish(this);
+    }
+  };
+
   class OpSequencer : public RefCountedObject {
   public:
     std::mutex qlock;
@@ -1683,6 +1800,7 @@ public:
     coll_t cid;
 
     size_t shard;
+    size_t kv_pipeline;  ///< index into BlueStore::kv_pipelines
 
     uint64_t last_seq = 0;
 
@@ -1767,23 +1885,68 @@ public:
       boost::intrusive::list_member_hook<>,
       &OpSequencer::deferred_osr_queue_item> > deferred_osr_queue_t;
 
+  struct KVPipeline;
+
   struct KVSyncThread : public Thread {
     BlueStore *store;
-    explicit KVSyncThread(BlueStore *s) : store(s) {}
+    KVPipeline *pipeline;
+    KVSyncThread(BlueStore *s, KVPipeline *p) : store(s), pipeline(p) {}
     void *entry() override {
-      store->_kv_sync_thread();
+      store->_kv_sync_thread(pipeline);
       return NULL;
     }
   };
   struct KVFinalizeThread : public Thread {
     BlueStore *store;
-    explicit KVFinalizeThread(BlueStore *s) : store(s) {}
+    KVPipeline *pipeline;
+    KVFinalizeThread(BlueStore *s, KVPipeline *p) : store(s), pipeline(p) {}
     void *entry() {
-      store->_kv_finalize_thread();
+      store->_kv_finalize_thread(pipeline);
       return NULL;
     }
   };
 
+  /// an independent kv sync + finalize pipeline
+  ///
+  /// Each OpSequencer is bound to one pipeline (hashed by cid), which
+  /// preserves per-sequencer ordering.  Pipeline 0 is the primary: it
+  /// also owns deferred write cleanup, {nid,blobid}_max preallocation
+  /// and bluefs free space balancing.
+  struct KVPipeline {
+    unsigned id;
+    PerfCounters *logger = nullptr;
+
+    KVSyncThread kv_sync_thread;
+    std::mutex kv_lock;
+    std::condition_variable kv_cond;
+    bool kv_sync_started = false;
+    bool kv_stop = false;
+    deque<TransContext*> kv_queue;             ///< ready, already submitted
+    deque<TransContext*> kv_queue_unsubmitted; ///< ready, need submit by kv thread
+    deque<TransContext*> kv_committing;        ///< currently syncing
+    deque<DeferredBatch*> deferred_done_queue; ///< deferred ios done (primary)
+    uint64_t kv_ios = 0;
+    uint64_t kv_throttle_costs = 0;
+
+    KVFinalizeThread kv_finalize_thread;
+    std::mutex kv_finalize_lock;
+    std::condition_variable kv_finalize_cond;
+    bool kv_finalize_started = false;
+    bool kv_finalize_stop = false;
+    deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
+    deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+
+    KVPipeline(BlueStore *s, unsigned i)
+      : id(i),
+	kv_sync_thread(s, this),
+	kv_finalize_thread(s, this) {
+    }
+
+    bool is_primary() const {
+      return id == 0;
+    }
+  };
+
   struct DBHistogram {
     struct value_dist {
       uint64_t count;
@@ -1821,6 +1984,18 @@ private:
   std::string freelist_type;
   FreelistManager *fm = nullptr;
   Allocator *alloc = nullptr;
+  MagazineAllocator *alloc_cache = nullptr; ///< alloc, if it is cached
+  OnodeL2Cache *onode_l2cache = nullptr; ///< optional persistent onode cache
+
+  /// Data tiering: blobs may live on spare block.db capacity that we
+  /// reclaimed from bluefs.  Those extents are addressed as
+  /// TIER_FAST_BASE + (block.db offset) so that the rest of the code can
+  /// keep treating pextents as plain offsets.
+  static constexpr uint64_t TIER_FAST_BASE = 1ull << 48;
+  BlockDevice *tier_bdev = nullptr;
+  FreelistManager *tier_fm = nullptr;
+  Allocator *tier_alloc = nullptr;
+  interval_set<uint64_t> tier_extents;  ///< block.db extents we own
   uuid_d fsid;
   int path_fd = -1;  ///< open handle to $path
   int fsid_fd = -1;  ///< open handle (locked) to $path/fsid
@@ -1851,32 +2026,57 @@ private:
   deferred_osr_queue_t deferred_queue; ///< osr's with deferred io pending
   int deferred_queue_size = 0;         ///< num txc's queued across all osrs
   atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
+  uint64_t deferred_flush_ios = 0;     ///< coalesced aios in flight
+  bool deferred_flush_throttled = false; ///< batches held back by queue depth
+  uint64_t deferred_elevator_pos = 0;  ///< where the last flush ended
   Finisher deferred_finisher;
 
   int m_finisher_num = 1;
   vector<Finisher*> finishers;
 
-  KVSyncThread kv_sync_thread;
-  std::mutex kv_lock;
-  std::condition_variable kv_cond;
+  /// a set of blobs from one write; the submitter waits for pending == 0
+  struct CompressBatch {
+    std::mutex lock;
+    std::condition_variable cond;
+    unsigned pending = 0;
+  };
+  struct CompressJob {
+    CompressorRef c;
+    bufferlist *in;         ///< raw blob
+    bufferlist *out;        ///< compression header + compressed data
+    CompressBatch *batch = nullptr;
+    mono_clock::time_point queued;
+    CompressJob(CompressorRef c, bufferlist *in, bufferlist *out)
+      : c(c), in(in), out(out) {}
+  };
+  struct CompressThread : public Thread {
+    BlueStore *store;
+    explicit CompressThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_compress_thread();
+      return NULL;
+    }
+  };
+  std::mutex compress_lock;
+  std::condition_variable compress_cond;
+  std::deque<CompressJob*> compress_queue;
+  uint64_t compress_queue_bytes = 0;  ///< raw bytes waiting for a worker
+  bool compress_stop = false;
+  vector<CompressThread*> compress_threads;
+
   bool _kv_only = false;
-  bool kv_sync_started = false;
-  bool kv_stop = false;
-  bool kv_finalize_started = false;
-  bool kv_finalize_stop = false;
-  deque<TransContext*> kv_queue;             ///< ready, already submitted
-  deque<TransContext*> kv_queue_unsubmitted; ///< ready, need submit by kv thread
-  deque<TransContext*> kv_committing;        ///< currently syncing
-  deque<DeferredBatch*> deferred_done_queue;   ///< deferred ios done
-
-  KVFinalizeThread kv_finalize_thread;
-  std::mutex kv_finalize_lock;
-  std::condition_variable kv_finalize_cond;
-  deque<TransContext*> kv_committing_to_finalize;   ///< pending finalization
-  deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
+  bool _kv_resharding = false;
+  int kv_pipeline_num = 1;
+  vector<KVPipeline*> kv_pipelines;  ///< [0] is the primary pipeline
+
+  /// non-primary pipelines wait here for the primary to raise {nid,blobid}_max
+  std::mutex kv_max_lock;
+  std::condition_variable kv_max_cond;
+  bool kv_max_wanted = false;
 
   PerfCounters *logger = nullptr;
 
+  std::mutex removed_collections_lock;  ///< finalize threads race on this
   list<CollectionRef> removed_collections;
 
   RWLock debug_read_error_lock = {"BlueStore::debug_read_error_lock"};
@@ -1884,6 +2084,7 @@ private:
   set<ghobject_t> debug_mdata_error_objects;
 
   std::atomic<int> csum_type = {Checksummer::CSUM_CRC32C};
+  std::atomic<bool> csum_batch_verify = {true};
 
   uint64_t block_size = 0;     ///< block size of block device (power of 2)
   uint64_t block_mask = 0;     ///< mask to get just the block offset
@@ -1902,6 +2103,10 @@ private:
   ///< number threshold for forced deferred writes
   std::atomic<int> deferred_batch_ops = {0};
 
+  ///< merge deferred batches across osrs, and the aio budget for doing so
+  std::atomic<bool> deferred_coalesce = {true};
+  std::atomic<uint64_t> deferred_flush_queue_depth = {0};
+
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
@@ -1913,11 +2118,20 @@ private:
   CompressorRef compressor;
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
+  std::atomic<uint64_t> comp_sample_size = {0};  ///< 0 to never sample
+  std::atomic<double> comp_sample_max_entropy = {1.0};
+  std::atomic<uint32_t> comp_history_misses = {0};  ///< 0 to ignore history
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
 
-  uint64_t kv_ios = 0;
-  uint64_t kv_throttle_costs = 0;
+  // fast data tier tunables (see _set_tier_conf)
+  std::atomic<uint64_t> tier_small_write_size = {0};
+  std::atomic<double> tier_max_ratio = {0};
+  std::atomic<unsigned> tier_min_read_recency = {0};
+  std::atomic<uint64_t> tier_promote_max_object_size = {0};
+  std::atomic<double> tier_hit_set_period = {0};
+  std::atomic<unsigned> tier_hit_set_count = {0};
+  std::atomic<uint64_t> tier_hit_set_target_size = {0};
 
   // cache trim control
   uint64_t cache_size = 0;      ///< total cache size
@@ -2066,6 +2280,38 @@ private:
                             PriorityCache::Priority pri);
   } mempool_thread;
 
+  struct TierThread : public Thread {
+    BlueStore *store;
+    Cond cond;
+    Mutex lock;
+    bool stop = false;
+    list<pair<coll_t,ghobject_t>> promote_queue;
+    set<pair<coll_t,ghobject_t>> promote_queued;
+    coll_t demote_cid;          ///< demotion cursor
+    ghobject_t demote_next;
+
+    explicit TierThread(BlueStore *s)
+      : store(s),
+	lock("BlueStore::TierThread::lock") {}
+
+    void *entry() override;
+    void init() {
+      assert(stop == false);
+      create("bstore_tier");
+    }
+    void shutdown() {
+      lock.Lock();
+      stop = true;
+      cond.Signal();
+      lock.Unlock();
+      join();
+    }
+    void queue_promote(const coll_t& cid, const ghobject_t& oid);
+
+  private:
+    void _demote_some();
+  } tier_thread;
+
   // --------------------------------------------------------
   // private methods
 
@@ -2082,7 +2328,10 @@ private:
   void _close_fsid();
   void _set_alloc_sizes();
   void _set_blob_size();
+  void _set_tier_conf();
   void _set_finisher_num();
+  void _set_kv_pipeline_num();
+  int _set_onode_format();
 
   int _open_bdev(bool create);
   void _close_bdev();
@@ -2094,10 +2343,18 @@ private:
   void _close_db();
   int _open_fm(bool create);
   void _close_fm();
-  int _open_alloc();
+  int _open_alloc(bool use_snapshot = false);
   void _close_alloc();
+  int _load_alloc_snapshot(uint64_t seq, uint64_t *num, uint64_t *bytes);
+  void _write_alloc_snapshot();
+  int _open_tier(bool create);
+  void _close_tier();
   int _open_collections(int *errors=0);
   void _close_collections();
+  uint64_t _bump_onode_l2cache_epoch();
+  int _open_onode_l2cache();
+  void _close_onode_l2cache(bool clean);
+  void _dump_numa_cache_stats(Formatter *f);
 
   int _setup_block_symlink_or_file(string name, string path, uint64_t size,
 				   bool create);
@@ -2140,6 +2397,8 @@ private:
   void _txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t);
   void _txc_state_proc(TransContext *txc);
   void _txc_aio_submit(TransContext *txc);
+  void _txc_aio_write(TransContext *txc, uint64_t offset, bufferlist& bl,
+		      bool buffered);
 public:
   void txc_aio_finish(void *p) {
     _txc_state_proc(static_cast<TransContext*>(p));
@@ -2158,8 +2417,11 @@ private:
 
   void _kv_start();
   void _kv_stop();
-  void _kv_sync_thread();
-  void _kv_finalize_thread();
+  void _kv_sync_thread(KVPipeline *p);
+  void _kv_finalize_thread(KVPipeline *p);
+  void _kv_wait_for_max(TransContext *txc);
+  bool _kv_check_max(TransContext *txc);
+  void _kv_notify_primary();
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, OnodeRef o);
   void _deferred_queue(TransContext *txc);
@@ -2167,6 +2429,8 @@ public:
   void deferred_try_submit();
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
+  void _deferred_flush_unlock(const vector<OpSequencer*>& osrs);
+  void _deferred_flush_finish(DeferredFlush *f);
   void _deferred_aio_finish(OpSequencer *osr);
   int _deferred_replay();
 
@@ -2182,6 +2446,7 @@ private:
     const PExtentVector& extents,
     bool compressed,
     mempool_dynamic_bitset &used_blocks,
+    interval_set<uint64_t> &tier_used,
     uint64_t granularity,
     BlueStoreRepairer* repairer,
     store_statfs_t& expected_statfs);
@@ -2216,15 +2481,19 @@ private:
 		      bufferlist& padded);
 
   void _record_onode(OnodeRef &o, KeyValueDB::Transaction &txn);
+  void _record_onode_value(OnodeRef &o, KeyValueDB::Transaction &txn,
+			   bufferlist& bl);
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 2;        ///< our version
+  const int32_t latest_ondisk_format = 3;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 2;    ///< who can read us
+  const int32_t flat_onode_compat_ondisk_format = 3; ///< who can read flat onodes
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
+  int onode_format = 1;       ///< format new onodes are written in
 
   int _upgrade_super();  ///< upgrade (called during open_super)
   void _prepare_ondisk_format_super(KeyValueDB::Transaction& t);
@@ -2292,6 +2561,12 @@ public:
   }
   int _fsck(bool deep, bool repair);
 
+  /// rewrite every onode in the configured bluestore_onode_format
+  int convert_onode_format();
+
+  /// move the kv store to another column family layout (offline)
+  int reshard(const string& new_sharding, ostream& out);
+
   void set_cache_shards(unsigned num) override;
 
   int validate_hobject_key(const hobject_t &obj) const override {
@@ -2344,8 +2619,32 @@ public:
     size_t len,
     bufferlist& bl,
     uint32_t op_flags = 0);
+  int readv(
+    CollectionHandle &c,
+    vector<ReadvOp>& ops,
+    uint32_t op_flags = 0) override;
+  int read_async(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl,
+    uint32_t op_flags,
+    Context *on_complete) override;
+  bool is_cached(CollectionHandle &c, const ghobject_t& oid) override;
 
 private:
+  // _do_read() in phases, so that readv() can share one IOContext
+  struct read_req_t;
+  bool _is_buffered_read(uint32_t op_flags);
+  void _read_cache(read_req_t& rr);
+  int _prepare_read_ioc(read_req_t& rr, IOContext *ioc, bool force_aio);
+  int _generate_read_result(read_req_t& rr);
+  struct AsyncRead;
+  void _finish_read_async(AsyncRead *ar);
+  void _omap_get_values(OnodeRef& o, const set<string>& keys,
+			map<string, bufferlist> *out);
+
   int _fiemap(CollectionHandle &c_, const ghobject_t& oid,
  	     uint64_t offset, size_t len, interval_set<uint64_t>& destset);
 public:
@@ -2406,6 +2705,17 @@ public:
     map<string, bufferlist> *out ///< [out] Returned keys and values
     ) override;
 
+  int omap_get_range(
+    CollectionHandle &c,          ///< [in] Collection containing oid
+    const ghobject_t &oid,        ///< [in] Object containing omap
+    const string &start_after,    ///< [in] return keys after this one
+    const string &filter_prefix,  ///< [in] only keys with this prefix
+    size_t max_keys,              ///< [in] max keys to return
+    size_t max_bytes,             ///< [in] max bytes to return (soft)
+    bufferlist *out,              ///< [out] encoded key/value pairs
+    bool *more                    ///< [out] true if more keys remain
+    ) override;
+
   /// Filters keys into out which are defined on oid
   int omap_check_keys(
     CollectionHandle &c,                ///< [in] Collection containing oid
@@ -2477,6 +2787,8 @@ public:
   void inject_misreference(coll_t cid1, ghobject_t oid1,
 			   coll_t cid2, ghobject_t oid2,
 			   uint64_t offset);
+  /// point the next mount at an allocator snapshot that does not exist
+  void inject_alloc_snapshot_seq(uint64_t seq);
 
   void compact() override {
     assert(db);
@@ -2519,6 +2831,22 @@ private:
     uint64_t blob_xoffset,
     const bufferlist& bl,
     uint64_t logical_offset) const;
+  struct csum_region_t {
+    const bluestore_blob_t *blob;
+    uint64_t blob_xoffset;
+    const bufferlist *bl;
+    uint64_t logical_offset;
+  };
+  int _verify_csum_batch(
+    OnodeRef& o,
+    const vector<csum_region_t>& regions) const;
+  void _log_bad_csum(
+    OnodeRef& o,
+    const bluestore_blob_t* blob,
+    uint64_t blob_xoffset,
+    uint64_t logical_offset,
+    int bad,
+    uint64_t bad_csum) const;
   int _decompress(bufferlist& source, bufferlist* result);
 
 
@@ -2528,8 +2856,15 @@ private:
   struct WriteContext {
     bool buffered = false;          ///< buffered write
     bool compress = false;          ///< compressed write
+    bool compress_adaptive = true;  ///< may skip data unlikely to compress
     uint64_t target_blob_size = 0;  ///< target (max) blob size
     unsigned csum_order = 0;        ///< target checksum chunk order
+    enum {
+      TIER_AUTO,                    ///< small writes go to the fast tier
+      TIER_FAST,
+      TIER_SLOW,
+    };
+    int tier = TIER_AUTO;           ///< where new allocations go
 
     old_extent_map_t old_extents;   ///< must deref these blobs
 
@@ -2576,8 +2911,10 @@ private:
     void fork(const WriteContext& other) {
       buffered = other.buffered;
       compress = other.compress;
+      compress_adaptive = other.compress_adaptive;
       target_blob_size = other.target_blob_size;
       csum_order = other.csum_order;
+      tier = other.tier;
     }
     void write(
       uint64_t loffs,
@@ -2621,6 +2958,38 @@ private:
     uint64_t offset, uint64_t length,
     bufferlist::iterator& blp,
     WriteContext *wctx);
+  bool _is_tier_offset(uint64_t offset) const {
+    return offset >= TIER_FAST_BASE;
+  }
+  bool _is_tier_blob(const bluestore_blob_t& blob) const;
+  bool _tier_place_fast(const WriteContext *wctx, uint64_t need);
+  void _tier_split(interval_set<uint64_t> *in, interval_set<uint64_t> *out);
+  int _bdev_read(uint64_t offset, uint64_t length, bufferlist *bl,
+		 IOContext *ioc, bool use_aio);
+  /// true if wctx may put (more) data into this blob
+  bool _tier_match(const WriteContext *wctx,
+		   const bluestore_blob_t& blob) const {
+    return wctx->tier == WriteContext::TIER_AUTO ||
+      _is_tier_blob(blob) == (wctx->tier == WriteContext::TIER_FAST);
+  }
+  void _tier_note_read(Collection *c, OnodeRef& o);
+  void _tier_get_misplaced(OnodeRef& o, bool to_fast,
+			   interval_set<uint64_t> *misplaced);
+  int _tier_move(CollectionRef& c, const ghobject_t& oid, bool to_fast,
+		 uint64_t *moved);
+  int _tier_rewrite(TransContext *txc, CollectionRef& c, OnodeRef& o,
+		    bool to_fast, const interval_set<uint64_t>& misplaced,
+		    vector<bufferlist>& data);
+  void _update_tier_logger();
+
+  void _compress_start();
+  void _compress_stop();
+  void _compress_thread();
+  void _compress_blob(CompressJob *job);
+  /// true if the recent history of o or c says not to bother compressing
+  bool _compress_history_skip(const Collection *c, const Onode *o) const;
+  /// compress jobs, spreading them over the compression threads if any
+  void _compress_blobs(vector<CompressJob>& jobs);
   int _do_alloc_write(
     TransContext *txc,
     CollectionRef c,
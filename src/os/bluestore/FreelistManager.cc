@@ -14,13 +14,19 @@ FreelistManager *FreelistManager::create(
   // put the freelistmanagers in different prefixes because the merge
   // op is per prefix, has to done pre-db-open, and we don't know the
   // freelist type until after we open the db.
-  assert(prefix == "B");
-  if (type == "bitmap")
+  // "D" is the freelist for BlueStore's fast data tier (see
+  // bluestore_tier_fast_size).
+  assert(prefix == "B" || prefix == "D");
+  if (type == "bitmap") {
+    if (prefix == "D")
+      return new BitmapFreelistManager(cct, kvdb, "D", "d");
     return new BitmapFreelistManager(cct, kvdb, "B", "b");
+  }
   return NULL;
 }
 
 void FreelistManager::setup_merge_operators(KeyValueDB *db)
 {
   BitmapFreelistManager::setup_merge_operator(db, "b");
+  BitmapFreelistManager::setup_merge_operator(db, "d");
 }
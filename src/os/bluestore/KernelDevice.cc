@@ -19,6 +19,7 @@
 #include <fcntl.h>
 
 #include "KernelDevice.h"
+#include "ioring.h"
 #include "include/types.h"
 #include "include/compat.h"
 #include "include/stringify.h"
@@ -38,7 +39,6 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     fd_buffered(-1),
     aio(false), dio(false),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     discard_callback(d_cb),
     discard_callback_priv(d_cbpriv),
     aio_stop(false),
@@ -349,14 +349,40 @@ int KernelDevice::_aio_start()
 {
   if (aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
+    if (cct->_conf->get_val<bool>("bdev_ioring")) {
+      if (ioring_queue_t::supported()) {
+	// completion polling needs polled hw queues, which only make
+	// sense (and are only set up) for solid state devices
+	bool hipri = !rotational &&
+	  cct->_conf->get_val<bool>("bdev_ioring_hipri");
+	dout(1) << __func__ << " using io_uring"
+		<< (hipri ? " (hipri)" : "") << dendl;
+	io_queue.reset(new ioring_queue_t(
+	  cct->_conf->bdev_aio_max_queue_depth,
+	  hipri,
+	  cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll")));
+      } else {
+	derr << __func__ << " io_uring requested but not supported by this "
+	     << "build or kernel; falling back to libaio" << dendl;
+      }
+    }
+    bool ioring = !!io_queue;
+    if (!io_queue) {
+      io_queue.reset(new aio_queue_t(cct->_conf->bdev_aio_max_queue_depth));
+    }
+    std::vector<int> fds = {fd_direct, fd_buffered};
+    int r = io_queue->init(fds);
     if (r < 0) {
-      if (r == -EAGAIN) {
+      if (ioring) {
+	derr << __func__ << " io_uring setup failed: " << cpp_strerror(r)
+	     << dendl;
+      } else if (r == -EAGAIN) {
 	derr << __func__ << " io_setup(2) failed with EAGAIN; "
 	     << "try increasing /proc/sys/fs/aio-max-nr" << dendl;
       } else {
 	derr << __func__ << " io_setup(2) failed: " << cpp_strerror(r) << dendl;
       }
+      io_queue.reset();
       return r;
     }
     aio_thread.create("bstore_aio");
@@ -371,7 +397,8 @@ void KernelDevice::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
+    io_queue.reset();
   }
 }
 
@@ -426,7 +453,7 @@ void KernelDevice::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -658,7 +685,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e,
 			     pending, priv, &retries);
   
   if (retries)
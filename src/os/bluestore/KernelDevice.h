@@ -41,7 +41,7 @@ class KernelDevice : public BlockDevice {
   std::atomic<bool> io_since_flush = {false};
   std::mutex flush_mutex;
 
-  aio_queue_t aio_queue;
+  std::unique_ptr<io_queue_t> io_queue;  ///< libaio or io_uring, see open()
   aio_callback_t discard_callback;
   void *discard_callback_priv;
   bool aio_stop;
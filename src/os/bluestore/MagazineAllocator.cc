@@ -0,0 +1,293 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "MagazineAllocator.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "magazine_alloc " << this << " "
+
+static const unsigned MAX_CLASSES = 16;
+
+static std::atomic<unsigned> next_thread_slot = {0};
+static thread_local unsigned thread_slot = next_thread_slot++;
+
+MagazineAllocator::MagazineAllocator(
+  CephContext* cct, Allocator *backing, uint64_t unit,
+  unsigned num_shards, uint64_t cache_size, uint64_t max_alloc)
+  : cct(cct), backing(backing), unit(unit),
+    shards(std::max(1u, num_shards))
+{
+  assert(unit);
+  while (num_classes < MAX_CLASSES && _class_size(num_classes) <= max_alloc) {
+    ++num_classes;
+  }
+  num_classes = std::max(1u, num_classes);
+  // keep room for at least a couple of the largest extents in each class
+  class_cap = std::max(cache_size / shards.size() / num_classes,
+		       2 * _class_size(num_classes - 1));
+  for (auto& s : shards) {
+    s.mags.resize(num_classes);
+  }
+  ldout(cct, 10) << __func__ << " unit 0x" << std::hex << unit
+		 << " max class 0x" << _class_size(num_classes - 1)
+		 << " class cap 0x" << class_cap << std::dec
+		 << " shards " << shards.size() << dendl;
+}
+
+MagazineAllocator::~MagazineAllocator()
+{
+}
+
+MagazineAllocator::shard_t& MagazineAllocator::_shard()
+{
+  return shards[thread_slot % shards.size()];
+}
+
+int MagazineAllocator::_get_class(uint64_t len) const
+{
+  for (unsigned c = 0; c < num_classes; ++c) {
+    if (_class_size(c) == len) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+bool MagazineAllocator::_try_pop(shard_t& s, unsigned c,
+				 PExtentVector *extents)
+{
+  std::lock_guard<std::mutex> l(s.lock);
+  auto& m = s.mags[c];
+  if (m.empty()) {
+    return false;
+  }
+  extents->emplace_back(m.back());
+  m.pop_back();
+  uint64_t bytes = _class_size(c);
+  s.bytes -= bytes;
+  cached_bytes -= bytes;
+  return true;
+}
+
+void MagazineAllocator::_refill(shard_t& s, unsigned c, unsigned want,
+				int64_t hint)
+{
+  uint64_t cs = _class_size(c);
+  uint64_t batch = std::max<uint64_t>(want * cs, p2align(class_cap / 2, cs));
+  PExtentVector got;
+  int64_t r = backing->allocate(batch, cs, cs, hint, &got);
+  if (r <= 0) {
+    return;
+  }
+  ldout(cct, 20) << __func__ << " class 0x" << std::hex << cs
+		 << " got 0x" << r << std::dec << " in " << got.size()
+		 << " extents" << dendl;
+  std::lock_guard<std::mutex> l(s.lock);
+  auto& m = s.mags[c];
+  for (auto& e : got) {
+    for (uint64_t o = 0; o < e.length; o += cs) {
+      m.emplace_back(e.offset + o, cs);
+    }
+  }
+  s.bytes += r;
+  cached_bytes += r;
+  ++refills;
+}
+
+void MagazineAllocator::_drain_all()
+{
+  interval_set<uint64_t> to_release;
+  uint64_t bytes = 0;
+  for (auto& s : shards) {
+    std::lock_guard<std::mutex> l(s.lock);
+    for (auto& m : s.mags) {
+      for (auto& e : m) {
+	to_release.insert(e.offset, e.length);
+      }
+      m.clear();
+    }
+    bytes += s.bytes;
+    s.bytes = 0;
+  }
+  if (!to_release.empty()) {
+    ldout(cct, 10) << __func__ << " 0x" << std::hex << bytes << std::dec
+		   << dendl;
+    cached_bytes -= bytes;
+    backing->release(to_release);
+    ++drains;
+  }
+}
+
+int64_t MagazineAllocator::allocate(
+  uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+  int64_t hint, PExtentVector *extents)
+{
+  size_t orig_size = extents->size();
+  int64_t r;
+  int c = -1;
+
+  if (alloc_unit == unit &&
+      (!max_alloc_size || want_size <= max_alloc_size)) {
+    c = _get_class(want_size);
+  }
+  if (c < 0) {
+    ++bypass;
+    goto direct;
+  }
+  {
+    shard_t& s = _shard();
+    if (_try_pop(s, c, extents)) {
+      ++hits;
+      return want_size;
+    }
+    ++misses;
+    _refill(s, c, 1, hint);
+    if (_try_pop(s, c, extents)) {
+      return want_size;
+    }
+  }
+
+ direct:
+  r = backing->allocate(want_size, alloc_unit, max_alloc_size, hint,
+			extents);
+  if (r < (int64_t)want_size && cached_bytes.load() > 0) {
+    // the free space we need may be sitting in the magazines
+    if (r > 0) {
+      interval_set<uint64_t> partial;
+      for (size_t i = orig_size; i < extents->size(); ++i) {
+	partial.insert((*extents)[i].offset, (*extents)[i].length);
+      }
+      extents->resize(orig_size);
+      backing->release(partial);
+    }
+    _drain_all();
+    r = backing->allocate(want_size, alloc_unit, max_alloc_size, hint,
+			  extents);
+  }
+  return r;
+}
+
+void MagazineAllocator::release(
+  const interval_set<uint64_t>& release_set)
+{
+  interval_set<uint64_t> to_release;
+  uint64_t max_len = _class_size(num_classes - 1);
+  uint64_t added = 0, drained = 0;
+  shard_t& s = _shard();
+  {
+    std::lock_guard<std::mutex> l(s.lock);
+    for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+      uint64_t offset = p.get_start();
+      uint64_t length = p.get_len();
+      if (length > max_len || offset % unit || length % unit) {
+	to_release.insert(offset, length);
+	continue;
+      }
+      while (length) {
+	unsigned c = num_classes - 1;
+	while (_class_size(c) > length) {
+	  --c;
+	}
+	uint64_t cs = _class_size(c);
+	s.mags[c].emplace_back(offset, cs);
+	added += cs;
+	offset += cs;
+	length -= cs;
+      }
+    }
+    for (unsigned c = 0; c < num_classes; ++c) {
+      auto& m = s.mags[c];
+      uint64_t cs = _class_size(c);
+      if (m.size() * cs <= class_cap) {
+	continue;
+      }
+      // return the coldest half in one go
+      size_t n = m.size() / 2;
+      for (size_t i = 0; i < n; ++i) {
+	to_release.insert(m[i].offset, m[i].length);
+      }
+      m.erase(m.begin(), m.begin() + n);
+      drained += n * cs;
+    }
+    s.bytes += added;
+    s.bytes -= drained;
+  }
+  cached_bytes += added;
+  cached_bytes -= drained;
+  if (!to_release.empty()) {
+    backing->release(to_release);
+  }
+  if (drained) {
+    ++drains;
+  }
+}
+
+uint64_t MagazineAllocator::get_free()
+{
+  return backing->get_free() + cached_bytes;
+}
+
+double MagazineAllocator::get_fragmentation(uint64_t alloc_unit)
+{
+  return backing->get_fragmentation(alloc_unit);
+}
+
+void MagazineAllocator::dump()
+{
+  auto st = get_stats();
+  ldout(cct, 0) << __func__ << " hits " << st.hits
+		<< " misses " << st.misses
+		<< " bypass " << st.bypass
+		<< " refills " << st.refills
+		<< " drains " << st.drains
+		<< " cached 0x" << std::hex << st.cached_bytes << std::dec
+		<< dendl;
+  backing->dump();
+}
+
+void MagazineAllocator::foreach_free(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  for (auto& s : shards) {
+    std::lock_guard<std::mutex> l(s.lock);
+    for (auto& m : s.mags) {
+      for (auto& e : m) {
+	notify(e.offset, e.length);
+      }
+    }
+  }
+  backing->foreach_free(notify);
+}
+
+void MagazineAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  backing->init_add_free(offset, length);
+}
+
+void MagazineAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  // the range may be sitting in a magazine
+  _drain_all();
+  backing->init_rm_free(offset, length);
+}
+
+void MagazineAllocator::shutdown()
+{
+  _drain_all();
+  backing->shutdown();
+}
+
+MagazineAllocator::stats_t MagazineAllocator::get_stats() const
+{
+  stats_t st;
+  st.hits = hits;
+  st.misses = misses;
+  st.bypass = bypass;
+  st.refills = refills;
+  st.drains = drains;
+  st.cached_bytes = cached_bytes;
+  return st;
+}
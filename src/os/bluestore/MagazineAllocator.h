@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_MAGAZINEALLOCATOR_H
+#define CEPH_OS_BLUESTORE_MAGAZINEALLOCATOR_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Allocator.h"
+
+/**
+ * MagazineAllocator - per-thread free extent caches in front of an Allocator
+ *
+ * Every backing allocator serializes allocate() and release() behind one
+ * mutex, which all the op shards and the kv sync thread fight over.  This
+ * front end keeps a small stock of free extents ("magazines") per shard,
+ * one list per power-of-two multiple of the allocation unit, up to
+ * max_alloc.  Threads are spread across the shards, so the common small
+ * allocation is served under an uncontended lock.  Magazines are refilled
+ * and drained in batches, so the backing allocator's lock is taken once
+ * per batch instead of once per op.
+ *
+ * Only a request for exactly one size class is served from the cache, as a
+ * single contiguous extent.  Anything else (other sizes, odd alloc_unit,
+ * a max_alloc below the request) goes straight to the backing allocator
+ * with its hint, so we never hand out a request scattered over several
+ * cached extents.  If the backing allocator runs dry the magazines are
+ * flushed back and the request retried, so caching never causes ENOSPC.
+ */
+class MagazineAllocator : public Allocator {
+public:
+  struct stats_t {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bypass = 0;   ///< requests that did not fit the cache
+    uint64_t refills = 0;
+    uint64_t drains = 0;
+    uint64_t cached_bytes = 0;
+  };
+
+private:
+  struct alignas(64) shard_t {
+    std::mutex lock;
+    std::vector<PExtentVector> mags;  ///< per size class, lifo
+    uint64_t bytes = 0;
+  };
+
+  CephContext* cct;
+  std::unique_ptr<Allocator> backing;
+  const uint64_t unit;
+  unsigned num_classes = 0;
+  uint64_t class_cap;      ///< max bytes per size class per shard
+  std::vector<shard_t> shards;
+
+  std::atomic<uint64_t> hits = {0};
+  std::atomic<uint64_t> misses = {0};
+  std::atomic<uint64_t> bypass = {0};
+  std::atomic<uint64_t> refills = {0};
+  std::atomic<uint64_t> drains = {0};
+  std::atomic<uint64_t> cached_bytes = {0};
+
+  shard_t& _shard();
+  uint64_t _class_size(unsigned c) const {
+    return unit << c;
+  }
+  /// size class of exactly len bytes, or -1 if there is none
+  int _get_class(uint64_t len) const;
+  bool _try_pop(shard_t& s, unsigned c, PExtentVector *extents);
+  void _refill(shard_t& s, unsigned c, unsigned want, int64_t hint);
+  void _drain_all();
+
+public:
+  MagazineAllocator(CephContext* cct, Allocator *backing, uint64_t unit,
+		    unsigned num_shards, uint64_t cache_size,
+		    uint64_t max_alloc);
+  ~MagazineAllocator() override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  void release(
+    const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation(uint64_t alloc_unit) override;
+
+  void dump() override;
+  void foreach_free(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+
+  stats_t get_stats() const;
+};
+
+#endif
@@ -0,0 +1,227 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "OnodeL2Cache.h"
+#include "include/ceph_hash.h"
+#include "include/crc32c.h"
+#include "common/debug.h"
+#include "common/errno.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "onode_l2cache(" << path << ") "
+
+#define ONODE_L2CACHE_MAGIC 0x4f4e4f44454c3243ull  // "ONODEL2C"
+
+OnodeL2Cache::~OnodeL2Cache()
+{
+  assert(fd < 0);
+  assert(base == nullptr);
+}
+
+uint64_t OnodeL2Cache::_slot_index(const char *key, size_t key_len) const
+{
+  return ceph_str_hash_rjenkins(key, key_len) % num_slots;
+}
+
+void OnodeL2Cache::_write_header(bool sync)
+{
+  header->generation = generation;
+  if (sync) {
+    ::msync(base, slot_size, MS_SYNC);
+  }
+}
+
+int OnodeL2Cache::open(const uuid_d& fsid, uint64_t epoch, bool *valid)
+{
+  *valid = false;
+  if (slot_size < 512 || (slot_size & (slot_size - 1)) ||
+      size < slot_size * 2) {
+    derr << __func__ << " bad geometry size 0x" << std::hex << size
+	 << " slot_size 0x" << slot_size << std::dec << dendl;
+    return -EINVAL;
+  }
+  size = size / slot_size * slot_size;
+  num_slots = size / slot_size - 1;  // first slot holds the header
+
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    int r = -errno;
+    derr << __func__ << " open got: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  struct stat st;
+  int r = ::fstat(fd, &st);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fstat got: " << cpp_strerror(r) << dendl;
+    goto out_fd;
+  }
+  if ((uint64_t)st.st_size != size) {
+    dout(1) << __func__ << " resizing from 0x" << std::hex << st.st_size
+	    << " to 0x" << size << std::dec << dendl;
+    r = ::ftruncate(fd, size);
+    if (r < 0) {
+      r = -errno;
+      derr << __func__ << " ftruncate got: " << cpp_strerror(r) << dendl;
+      goto out_fd;
+    }
+  }
+  base = (char*)::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       fd, 0);
+  if (base == MAP_FAILED) {
+    r = -errno;
+    base = nullptr;
+    derr << __func__ << " mmap got: " << cpp_strerror(r) << dendl;
+    goto out_fd;
+  }
+
+  header = reinterpret_cast<header_t*>(base);
+  if (header->magic == ONODE_L2CACHE_MAGIC &&
+      header->fsid == fsid &&
+      header->epoch == epoch &&
+      header->clean == 1 &&
+      header->slot_size == slot_size &&
+      header->num_slots == num_slots) {
+    *valid = true;
+    generation = header->generation;
+  } else {
+    dout(1) << __func__ << " discarding contents (magic "
+	    << (header->magic == ONODE_L2CACHE_MAGIC)
+	    << " epoch " << header->epoch << " != " << epoch
+	    << " clean " << header->clean << ")" << dendl;
+    if (header->magic == ONODE_L2CACHE_MAGIC) {
+      generation = header->generation + 1;
+    } else {
+      // fresh (zeroed) or foreign file; slots are guarded by crc
+      generation = 1;
+    }
+    header->magic = ONODE_L2CACHE_MAGIC;
+    header->fsid = fsid;
+    header->slot_size = slot_size;
+    header->num_slots = num_slots;
+  }
+  dout(1) << __func__ << " " << num_slots << " slots of 0x" << std::hex
+	  << slot_size << std::dec << " generation " << generation
+	  << (*valid ? " (warm)" : " (cold)") << dendl;
+  return 0;
+
+ out_fd:
+  VOID_TEMP_FAILURE_RETRY(::close(fd));
+  fd = -1;
+  return r;
+}
+
+int OnodeL2Cache::start(uint64_t new_epoch)
+{
+  header->clean = 0;
+  header->epoch = new_epoch;
+  _write_header(true);
+  return 0;
+}
+
+void OnodeL2Cache::close(bool clean)
+{
+  if (base) {
+    if (clean) {
+      // make sure the slots are durable before we claim they are valid
+      ::msync(base, size, MS_SYNC);
+      header->clean = 1;
+      _write_header(true);
+      dout(1) << __func__ << " clean, epoch " << header->epoch
+	      << " generation " << generation << dendl;
+    }
+    ::munmap(base, size);
+    base = nullptr;
+    header = nullptr;
+  }
+  if (fd >= 0) {
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    fd = -1;
+  }
+}
+
+bool OnodeL2Cache::lookup(const char *key, size_t key_len, bufferlist *bl)
+{
+  uint64_t index = _slot_index(key, key_len);
+  std::lock_guard<std::mutex> l(_lock(index));
+  slot_t *s = _slot(index);
+  if (s->generation != generation ||
+      s->key_len != key_len ||
+      sizeof(slot_t) + s->key_len + s->val_len > slot_size) {
+    return false;
+  }
+  const char *k = reinterpret_cast<const char*>(s + 1);
+  if (memcmp(k, key, key_len) != 0) {
+    return false;
+  }
+  uint32_t crc = ceph_crc32c(-1, (const unsigned char*)k,
+			     key_len + s->val_len);
+  if (crc != s->crc) {
+    derr << __func__ << " bad crc in slot " << index << dendl;
+    s->generation = 0;
+    return false;
+  }
+  bufferptr bp = buffer::create(s->val_len);
+  memcpy(bp.c_str(), k + key_len, s->val_len);
+  bl->append(std::move(bp));
+  return true;
+}
+
+void OnodeL2Cache::insert(const char *key, size_t key_len,
+			  const bufferlist& bl)
+{
+  uint64_t index = _slot_index(key, key_len);
+  std::lock_guard<std::mutex> l(_lock(index));
+  slot_t *s = _slot(index);
+  if (sizeof(slot_t) + key_len + bl.length() > slot_size) {
+    // too big to cache; make sure we do not leave a stale copy behind
+    if (s->generation == generation &&
+	s->key_len == key_len &&
+	memcmp(s + 1, key, key_len) == 0) {
+      s->generation = 0;
+    }
+    return;
+  }
+  s->generation = 0;
+  char *k = reinterpret_cast<char*>(s + 1);
+  memcpy(k, key, key_len);
+  bl.copy(0, bl.length(), k + key_len);
+  s->key_len = key_len;
+  s->val_len = bl.length();
+  s->crc = ceph_crc32c(-1, (const unsigned char*)k, key_len + bl.length());
+  s->generation = generation;
+}
+
+void OnodeL2Cache::invalidate(const char *key, size_t key_len)
+{
+  uint64_t index = _slot_index(key, key_len);
+  std::lock_guard<std::mutex> l(_lock(index));
+  slot_t *s = _slot(index);
+  if (s->generation == generation &&
+      s->key_len == key_len &&
+      memcmp(s + 1, key, key_len) == 0) {
+    s->generation = 0;
+  }
+}
+
+void OnodeL2Cache::invalidate_all()
+{
+  // slot readers compare against generation under their stripe lock, so
+  // take them all to make the switch atomic with respect to lookups.
+  for (auto& i : locks) {
+    i.lock();
+  }
+  ++generation;
+  _write_header(false);
+  for (auto& i : locks) {
+    i.unlock();
+  }
+  dout(10) << __func__ << " generation " << generation << dendl;
+}
@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_ONODEL2CACHE_H
+#define CEPH_OS_BLUESTORE_ONODEL2CACHE_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#include "include/buffer.h"
+#include "include/uuid.h"
+
+class CephContext;
+
+/**
+ * OnodeL2Cache - second level cache for encoded onodes and extent shards
+ *
+ * A fixed size, direct-mapped hash table living in an mmap'd file on a
+ * fast local device (SSD or PMEM).  Entries are keyed by the PREFIX_OBJ
+ * key (i.e., the ghobject_t, plus the shard offset for extent shards) and
+ * hold exactly the bytes that are stored in the kv store, each protected
+ * by a crc32c.  Entries that do not fit in a slot are simply not cached.
+ *
+ * The file is only trusted on mount if it was closed cleanly for the same
+ * fsid and the same kv epoch; otherwise the generation is bumped, which
+ * invalidates every slot in O(1).
+ */
+class OnodeL2Cache {
+public:
+  struct header_t {
+    uint64_t magic;
+    uuid_d fsid;
+    uint64_t epoch;      ///< kv epoch this file is consistent with
+    uint64_t generation; ///< slots with another generation are invalid
+    uint64_t slot_size;
+    uint64_t num_slots;
+    uint32_t clean;      ///< 1 if closed cleanly
+  };
+
+  struct slot_t {
+    uint64_t generation;
+    uint32_t key_len;
+    uint32_t val_len;
+    uint32_t crc;        ///< crc32c over key and value
+    uint32_t pad;
+    // key bytes, then value bytes
+  };
+
+private:
+  CephContext *cct;
+  std::string path;
+  int fd = -1;
+  char *base = nullptr;
+  uint64_t size = 0;
+  uint64_t slot_size = 0;
+  uint64_t num_slots = 0;
+  header_t *header = nullptr;
+
+  static const unsigned LOCK_STRIPES = 128;
+  std::mutex locks[LOCK_STRIPES];
+  std::atomic<uint64_t> generation = {0};
+
+  uint64_t _slot_index(const char *key, size_t key_len) const;
+  slot_t *_slot(uint64_t index) const {
+    return reinterpret_cast<slot_t*>(base + slot_size * (index + 1));
+  }
+  std::mutex& _lock(uint64_t index) {
+    return locks[index % LOCK_STRIPES];
+  }
+  void _write_header(bool sync);
+
+public:
+  OnodeL2Cache(CephContext *cct, const std::string& path,
+	       uint64_t size, uint64_t slot_size)
+    : cct(cct), path(path), size(size), slot_size(slot_size) {}
+  ~OnodeL2Cache();
+
+  /// open (or create) the backing file; *valid is set if its contents
+  /// can be trusted for the given fsid and kv epoch.
+  int open(const uuid_d& fsid, uint64_t epoch, bool *valid);
+
+  /// mark the file dirty and consistent with new_epoch once closed cleanly
+  int start(uint64_t new_epoch);
+
+  /// flush and close; mark the file clean if requested
+  void close(bool clean);
+
+  bool lookup(const char *key, size_t key_len, bufferlist *bl);
+  bool lookup(const std::string& key, bufferlist *bl) {
+    return lookup(key.c_str(), key.size(), bl);
+  }
+  void insert(const char *key, size_t key_len, const bufferlist& bl);
+  void insert(const std::string& key, const bufferlist& bl) {
+    insert(key.c_str(), key.size(), bl);
+  }
+  void invalidate(const char *key, size_t key_len);
+  void invalidate(const std::string& key) {
+    invalidate(key.c_str(), key.size());
+  }
+
+  /// drop every entry in O(1)
+  void invalidate_all();
+
+  uint64_t get_num_slots() const {
+    return num_slots;
+  }
+};
+
+#endif
@@ -288,6 +288,17 @@ void StupidAllocator::dump()
   }
 }
 
+void StupidAllocator::foreach_free(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& bin : free) {
+    for (auto p = bin.begin(); p != bin.end(); ++p) {
+      notify(p.get_start(), p.get_len());
+    }
+  }
+}
+
 void StupidAllocator::init_add_free(uint64_t offset, uint64_t length)
 {
   std::lock_guard<std::mutex> l(lock);
@@ -195,6 +195,8 @@ int main(int argc, char **argv)
   string key, value;
   int log_level = 30;
   bool fsck_deep = false;
+  int onode_format = 0;
+  string new_sharding;
   po::options_description po_options("Options");
   po_options.add_options()
     ("help,h", "produce help message")
@@ -206,10 +208,12 @@ int main(int argc, char **argv)
     ("deep", po::value<bool>(&fsck_deep), "deep fsck (read all data)")
     ("key,k", po::value<string>(&key), "label metadata key name")
     ("value,v", po::value<string>(&value), "label metadata value")
+    ("onode-format", po::value<int>(&onode_format), "onode format to convert to (1=legacy, 2=flat)")
+    ("sharding", po::value<string>(&new_sharding), "column family layout to reshard to (default: bluestore_rocksdb_cfs)")
     ;
   po::options_description po_positional("Positional options");
   po_positional.add_options()
-    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump")
+    ("command", po::value<string>(&action), "fsck, repair, bluefs-export, bluefs-bdev-sizes, bluefs-bdev-expand, show-label, set-label-key, rm-label-key, prime-osd-dir, bluefs-log-dump, convert-onode-format, reshard")
     ;
   po::options_description po_all("All options");
   po_all.add(po_options).add(po_positional);
@@ -245,6 +249,22 @@ int main(int argc, char **argv)
       exit(EXIT_FAILURE);
     }
   }
+  if (action == "convert-onode-format") {
+    if (path.empty()) {
+      cerr << "must specify bluestore path" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (onode_format != 1 && onode_format != 2) {
+      cerr << "must specify --onode-format 1 or 2" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (action == "reshard") {
+    if (path.empty()) {
+      cerr << "must specify bluestore path" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
   if (action == "prime-osd-dir") {
     if (devs.size() != 1) {
       cerr << "must specify the main bluestore device" << std::endl;
@@ -310,6 +330,11 @@ int main(int argc, char **argv)
   }
   args.push_back("--no-log-to-stderr");
   args.push_back("--err-to-stderr");
+  string onode_format_str = stringify(onode_format);
+  if (onode_format) {
+    args.push_back("--bluestore-onode-format");
+    args.push_back(onode_format_str.c_str());
+  }
 
   for (auto& i : ceph_option_strings) {
     args.push_back(i.c_str());
@@ -622,6 +647,34 @@ int main(int argc, char **argv)
     delete fs;
   } else if (action == "bluefs-log-dump") {
     log_dump(cct.get(), path, devs);
+  } else if (action == "convert-onode-format") {
+    validate_path(cct.get(), path, false);
+    BlueStore bluestore(cct.get(), path);
+    int r = bluestore.mount();
+    if (r < 0) {
+      cerr << "failed to mount: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    r = bluestore.convert_onode_format();
+    bluestore.umount();
+    if (r < 0) {
+      cerr << "error from convert-onode-format: " << cpp_strerror(r)
+	   << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    cout << action << " success" << std::endl;
+  } else if (action == "reshard") {
+    validate_path(cct.get(), path, false);
+    if (new_sharding.empty()) {
+      new_sharding = cct->_conf->get_val<string>("bluestore_rocksdb_cfs");
+    }
+    BlueStore bluestore(cct.get(), path);
+    int r = bluestore.reshard(new_sharding, cout);
+    if (r < 0) {
+      cerr << "error from reshard: " << cpp_strerror(r) << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    cout << action << " success" << std::endl;
   } else {
     cerr << "unrecognized action " << action << std::endl;
     return 1;
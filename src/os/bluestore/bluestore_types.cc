@@ -1063,6 +1063,112 @@ void bluestore_onode_t::generate_test_instances(list<bluestore_onode_t*>& o)
   // FIXME
 }
 
+const bluestore_onode_t::flat_header_t *bluestore_onode_t::get_flat_header(
+  bufferlist& v)
+{
+  if (v.length() < sizeof(flat_header_t)) {
+    return nullptr;
+  }
+  auto h = reinterpret_cast<const flat_header_t*>(v.c_str());
+  if (h->struct_v != FLAT_V ||
+      h->compat_v > FLAT_V ||
+      h->header_len > v.length() ||
+      h->header_len < sizeof(flat_header_t) ||
+      (uint64_t)h->attrs_off + h->attrs_len > v.length() ||
+      (uint64_t)h->shards_off + (uint64_t)h->num_shards *
+        sizeof(flat_shard_t) > v.length() ||
+      (uint64_t)h->spanning_off + h->spanning_len > v.length() ||
+      (uint64_t)h->extents_off + h->extents_len > v.length()) {
+    return nullptr;
+  }
+  return h;
+}
+
+void bluestore_onode_t::encode_flat(
+  const bufferlist& spanning,
+  const bufferlist& extents,
+  bufferlist& bl) const
+{
+  size_t shards_len = extent_map_shards.size() * sizeof(flat_shard_t);
+  size_t bound = sizeof(flat_header_t) + shards_len;
+  denc(attrs, bound);
+
+  flat_header_t h;
+  memset(&h, 0, sizeof(h));
+  h.struct_v = FLAT_V;
+  h.compat_v = FLAT_COMPAT_V;
+  h.header_len = sizeof(h);
+  h.flags = flags;
+  h.nid = nid;
+  h.size = size;
+  h.expected_object_size = expected_object_size;
+  h.expected_write_size = expected_write_size;
+  h.alloc_hint_flags = alloc_hint_flags;
+
+  bufferlist meta;
+  {
+    auto p = meta.get_contiguous_appender(bound, true);
+    char *hp = p.get_pos_add(sizeof(h));
+    h.shards_off = sizeof(h);
+    h.num_shards = extent_map_shards.size();
+    for (auto& i : extent_map_shards) {
+      flat_shard_t s;
+      s.offset = i.offset;
+      s.bytes = i.bytes;
+      memcpy(p.get_pos_add(sizeof(s)), &s, sizeof(s));
+    }
+    h.attrs_off = p.get_logical_offset();
+    denc(attrs, p);
+    h.attrs_len = p.get_logical_offset() - h.attrs_off;
+    h.spanning_off = p.get_logical_offset();
+    h.spanning_len = spanning.length();
+    h.extents_off = h.spanning_off + spanning.length();
+    h.extents_len = extents.length();
+    memcpy(hp, &h, sizeof(h));
+  }
+  bl.claim_append(meta);
+  bl.append(spanning);
+  bl.append(extents);
+}
+
+void bluestore_onode_t::decode_flat(
+  bufferlist& v,
+  bufferlist *spanning,
+  bufferlist *extents)
+{
+  const flat_header_t *h = get_flat_header(v);
+  if (!h) {
+    throw buffer::malformed_input("bad flat bluestore_onode_t");
+  }
+  nid = h->nid;
+  size = h->size;
+  flags = h->flags;
+  expected_object_size = h->expected_object_size;
+  expected_write_size = h->expected_write_size;
+  alloc_hint_flags = h->alloc_hint_flags;
+
+  extent_map_shards.resize(h->num_shards);
+  auto s = reinterpret_cast<const flat_shard_t*>(v.c_str() + h->shards_off);
+  for (unsigned i = 0; i < h->num_shards; ++i, ++s) {
+    extent_map_shards[i].offset = s->offset;
+    extent_map_shards[i].bytes = s->bytes;
+  }
+
+  attrs.clear();
+  if (h->attrs_len) {
+    bufferptr a(v.front(), h->attrs_off, h->attrs_len);
+    auto p = a.begin_deep();
+    denc(attrs, p);
+  }
+
+  if (spanning) {
+    spanning->substr_of(v, h->spanning_off, h->spanning_len);
+  }
+  if (extents) {
+    extents->substr_of(v, h->extents_off, h->extents_len);
+  }
+}
+
 // bluestore_deferred_op_t
 
 void bluestore_deferred_op_t::dump(Formatter *f) const
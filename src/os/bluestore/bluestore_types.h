@@ -955,6 +955,59 @@ struct bluestore_onode_t {
   }
   void dump(Formatter *f) const;
   static void generate_test_instances(list<bluestore_onode_t*>& o);
+
+  // -- flat format --
+  //
+  // The legacy onode value is denc(onode) + spanning blobs + denc(inline
+  // extents), all of which must be decoded before anything can be used.
+  // The flat format starts with a fixed-width header carrying the scalar
+  // fields and an offset table for the variable sections, so that the
+  // scalar fields can be read in place and the spanning blob and inline
+  // extent sections can be left undecoded until the extent map is needed.
+  //
+  // Legacy values start with the denc struct_v (1); flat values start
+  // with FLAT_V.
+  static const __u8 FLAT_V = 2;
+  static const __u8 FLAT_COMPAT_V = 2;
+
+  struct flat_header_t {
+    __u8 struct_v;
+    __u8 compat_v;
+    ceph_le16 header_len;    ///< sizeof(flat_header_t) when written
+    ceph_le32 flags;
+    ceph_le64 nid;
+    ceph_le64 size;
+    ceph_le32 expected_object_size;
+    ceph_le32 expected_write_size;
+    ceph_le32 alloc_hint_flags;
+    ceph_le32 attrs_off;     ///< denc(attrs)
+    ceph_le32 attrs_len;
+    ceph_le32 shards_off;    ///< flat_shard_t[num_shards]
+    ceph_le32 num_shards;
+    ceph_le32 spanning_off;  ///< ExtentMap::encode_spanning_blobs()
+    ceph_le32 spanning_len;
+    ceph_le32 extents_off;   ///< inline extent map, if unsharded
+    ceph_le32 extents_len;
+  } __attribute__ ((packed));
+
+  struct flat_shard_t {
+    ceph_le32 offset;
+    ceph_le32 bytes;
+  } __attribute__ ((packed));
+
+  static bool is_flat(const bufferlist& v) {
+    return v.length() && (__u8)v[0] == FLAT_V;
+  }
+
+  /// return the fixed header of a flat value, or nullptr if malformed
+  static const flat_header_t *get_flat_header(bufferlist& v);
+
+  void encode_flat(const bufferlist& spanning, const bufferlist& extents,
+		   bufferlist& bl) const;
+
+  /// decode the scalar fields, attrs and shard table of a flat value.  the
+  /// spanning blob and inline extent sections are returned undecoded.
+  void decode_flat(bufferlist& v, bufferlist *spanning, bufferlist *extents);
 };
 WRITE_CLASS_DENC(bluestore_onode_t::shard_info)
 WRITE_CLASS_DENC(bluestore_onode_t)
@@ -262,6 +262,44 @@ protected:
 
   friend class AllocatorLevel02<AllocatorLevel01Loose>;
 
+  template <class Func>
+  void _foreach_free(Func notify)
+  {
+    uint64_t run_start = 0;
+    uint64_t run_len = 0;  // in l0 entries
+    auto flush = [&]() {
+      if (run_len) {
+        notify(run_start * l0_granularity, run_len * l0_granularity);
+        run_len = 0;
+      }
+    };
+    for (uint64_t i = 0; i < l0.size(); ++i) {
+      auto v = l0[i];
+      if (v == all_slot_clear) {
+        flush();
+        continue;
+      }
+      if (v == all_slot_set) {
+        if (!run_len) {
+          run_start = i * bits_per_slot;
+        }
+        run_len += bits_per_slot;
+        continue;
+      }
+      for (uint64_t j = 0; j < bits_per_slot; ++j) {
+        if (v & (slot_t(1) << j)) {
+          if (!run_len) {
+            run_start = i * bits_per_slot + j;
+          }
+          ++run_len;
+        } else {
+          flush();
+        }
+      }
+    }
+    flush();
+  }
+
   void _init(uint64_t capacity, uint64_t _alloc_unit, bool mark_as_free = true)
   {
     l0_granularity = _alloc_unit;
@@ -744,6 +782,12 @@ protected:
   {
     last_pos = 0;
   }
+  template <class Func>
+  void _foreach_free(Func notify)
+  {
+    std::lock_guard<std::mutex> l(lock);
+    l1._foreach_free(notify);
+  }
   double _get_fragmentation() {
     std::lock_guard<std::mutex> l(lock);
     return l1.get_fragmentation();
@@ -0,0 +1,238 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ioring.h"
+
+#if defined(HAVE_LIBURING)
+
+#include <unistd.h>
+#include <liburing.h>
+
+struct ioring_data {
+  struct io_uring ring;
+  std::map<int, int> fixed_fds;  ///< real fd -> index in registered files
+};
+
+static int find_fixed_fd(ioring_data *d, int real_fd)
+{
+  auto p = d->fixed_fds.find(real_fd);
+  if (p == d->fixed_fds.end()) {
+    return -1;
+  }
+  return p->second;
+}
+
+static void init_sqe(ioring_data *d, struct io_uring_sqe *sqe, aio_t *io)
+{
+  int fixed_fd = find_fixed_fd(d, io->fd);
+  assert(fixed_fd >= 0);
+
+  if (io->iocb.aio_lio_opcode == IO_CMD_PWRITEV) {
+    io_uring_prep_writev(sqe, fixed_fd, &io->iov[0], io->iov.size(),
+			 io->offset);
+  } else if (io->iocb.aio_lio_opcode == IO_CMD_PREADV) {
+    io_uring_prep_readv(sqe, fixed_fd, &io->iov[0], io->iov.size(),
+			io->offset);
+  } else {
+    assert(0 == "unexpected aio opcode");
+  }
+  io_uring_sqe_set_data(sqe, io);
+  io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+}
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, bool hipri, bool sq_thread)
+  : d(new ioring_data),
+    iodepth(iodepth),
+    hipri(hipri),
+    sq_thread(sq_thread)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+}
+
+/*
+ * get_next_completed() waits on the CQ without sq_mutex.  Without
+ * IORING_FEAT_EXT_ARG liburing implements the wait timeout by queueing
+ * its own timeout SQE, which would race submit_batch(), so we insist on
+ * a kernel that passes the timeout directly.
+ */
+static bool has_ext_arg(struct io_uring *ring)
+{
+#if defined(IORING_FEAT_EXT_ARG)
+  return ring->features & IORING_FEAT_EXT_ARG;
+#else
+  return false;
+#endif
+}
+
+bool ioring_queue_t::supported()
+{
+  struct io_uring ring;
+  int r = io_uring_queue_init(16, &ring, 0);
+  if (r < 0) {
+    return false;
+  }
+  bool ok = has_ext_arg(&ring);
+  io_uring_queue_exit(&ring);
+  return ok;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  unsigned flags = 0;
+  if (hipri) {
+    flags |= IORING_SETUP_IOPOLL;
+  }
+  if (sq_thread) {
+    flags |= IORING_SETUP_SQPOLL;
+  }
+  int r = io_uring_queue_init(iodepth, &d->ring, flags);
+  if (r < 0) {
+    return r;
+  }
+  if (!has_ext_arg(&d->ring)) {
+    io_uring_queue_exit(&d->ring);
+    return -EOPNOTSUPP;
+  }
+  // fixed files save the fget/fput per request and are required for
+  // SQPOLL on older kernels
+  r = io_uring_register_files(&d->ring, &fds[0], fds.size());
+  if (r < 0) {
+    io_uring_queue_exit(&d->ring);
+    return r;
+  }
+  int idx = 0;
+  for (int fd : fds) {
+    d->fixed_fds[fd] = idx++;
+  }
+  return 0;
+}
+
+void ioring_queue_t::shutdown()
+{
+  d->fixed_fds.clear();
+  io_uring_queue_exit(&d->ring);
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  // same backoff as aio_queue_t: 2^16 * 125us = ~8 seconds
+  int attempts = 16;
+  int delay = 125;
+  int done = 0;
+
+  std::lock_guard<std::mutex> l(sq_mutex);
+  aio_iter cur = begin;
+  while (cur != end) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&d->ring);
+    if (!sqe) {
+      // SQ ring is full; push what we have queued to the kernel and retry
+      int r = io_uring_submit(&d->ring);
+      if (r < 0) {
+	return r;
+      }
+      if (r == 0) {
+	if (attempts-- <= 0) {
+	  return -EAGAIN;
+	}
+	usleep(delay);
+	delay *= 2;
+	(*retries)++;
+      } else {
+	attempts = 16;
+	delay = 125;
+      }
+      continue;
+    }
+    cur->priv = priv;
+    init_sqe(d.get(), sqe, &*cur);
+    ++cur;
+    ++done;
+  }
+  assert(aios_size >= done);
+  int r = io_uring_submit(&d->ring);
+  if (r < 0) {
+    return r;
+  }
+  return done;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  struct io_uring_cqe *cqe = nullptr;
+  struct __kernel_timespec t = {
+    timeout_ms / 1000,
+    (timeout_ms % 1000) * 1000 * 1000
+  };
+  int r;
+  do {
+    r = io_uring_wait_cqe_timeout(&d->ring, &cqe, &t);
+  } while (r == -EINTR);
+  if (r == -ETIME) {
+    return 0;
+  }
+  if (r < 0) {
+    return r;
+  }
+
+  struct io_uring_cqe *cqes[max];
+  unsigned n = io_uring_peek_batch_cqe(&d->ring, cqes, max);
+  int done = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    // only our own requests carry an aio_t; skip anything liburing
+    // queued internally
+    uint64_t data = cqes[i]->user_data;
+    if (data == 0 || data == LIBURING_UDATA_TIMEOUT) {
+      continue;
+    }
+    paio[done] = reinterpret_cast<aio_t*>(data);
+    paio[done]->rval = cqes[i]->res;
+    ++done;
+  }
+  io_uring_cq_advance(&d->ring, n);
+  return done;
+}
+
+#else // #if defined(HAVE_LIBURING)
+
+struct ioring_data {};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, bool hipri, bool sq_thread)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+}
+
+bool ioring_queue_t::supported()
+{
+  return false;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  return -EOPNOTSUPP;
+}
+
+void ioring_queue_t::shutdown()
+{
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  return -EOPNOTSUPP;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  return -EOPNOTSUPP;
+}
+
+#endif // #if defined(HAVE_LIBURING)
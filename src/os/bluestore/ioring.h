@@ -0,0 +1,37 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include "acconfig.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "aio.h"
+
+struct ioring_data;
+
+/// io_uring based queue; reuses aio_t as the request descriptor
+struct ioring_queue_t final : public io_queue_t {
+  std::unique_ptr<ioring_data> d;
+  unsigned iodepth = 0;
+  bool hipri = false;      ///< IORING_SETUP_IOPOLL: busy-poll for completions
+  bool sq_thread = false;  ///< IORING_SETUP_SQPOLL: kernel thread polls the SQ
+
+  std::mutex sq_mutex;     ///< SQ ring is single producer
+
+  ioring_queue_t(unsigned iodepth, bool hipri, bool sq_thread);
+  ~ioring_queue_t() final;
+
+  /// true if the running kernel (and build) can set up a ring
+  static bool supported();
+
+  int init(std::vector<int> &fds) final;
+  void shutdown() final;
+
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+};
@@ -24,6 +24,7 @@
 #include "include/types.h"
 #include "include/stringify.h"
 #include "include/unordered_map.h"
+#include "common/deleter.h"
 #include "common/errno.h"
 #include "MemStore.h"
 #include "include/compat.h"
@@ -1525,6 +1526,10 @@ struct MemStore::PageSetObject : public Object {
             uint64_t dstoff) override;
   int truncate(uint64_t offset) override;
 
+  /// copy the bytes of [srcoff,srcoff+len) from src into our own pages
+  int copy_range(Object *src, uint64_t srcoff, uint64_t len,
+                 uint64_t dstoff);
+
   void encode(bufferlist& bl) const override {
     ENCODE_START(1, 1, bl);
     encode(data_len, bl);
@@ -1552,50 +1557,33 @@ thread_local PageSet::page_vector MemStore::PageSetObject::tls_pages;
 
 int MemStore::PageSetObject::read(uint64_t offset, uint64_t len, bufferlist& bl)
 {
-  const auto start = offset;
   const auto end = offset + len;
-  auto remaining = len;
+  const auto page_size = data.get_page_size();
 
   DEFINE_PAGE_VECTOR(tls_pages);
   data.get_range(offset, len, tls_pages);
 
-  // allocate a buffer for the data
-  buffer::ptr buf(len);
-
-  auto p = tls_pages.begin();
-  while (remaining) {
-    // no more pages in range
-    if (p == tls_pages.end() || (*p)->offset >= end) {
-      buf.zero(offset - start, remaining);
-      break;
-    }
-    auto page = *p;
-
+  for (auto &page : tls_pages) {
     // fill any holes between pages with zeroes
     if (page->offset > offset) {
-      const auto count = std::min(remaining, page->offset - offset);
-      buf.zero(offset - start, count);
-      remaining -= count;
+      bl.append_zero(page->offset - offset);
       offset = page->offset;
-      if (!remaining)
-        break;
     }
 
-    // read from page
+    // hand out the page itself rather than a copy.  the buffer holds a
+    // page ref, so a later write to the page copies it first (see
+    // PageSet::alloc_range) and this buffer keeps the old contents.
     const auto page_offset = offset - page->offset;
-    const auto count = min(remaining, data.get_page_size() - page_offset);
-
-    buf.copy_in(offset - start, count, page->data + page_offset);
-
-    remaining -= count;
+    const auto count = std::min(end - offset, page_size - page_offset);
+    bufferptr bp(buffer::claim_buffer(page_size, page->data,
+                                      make_deleter([ref = page] {})));
+    bl.append(bufferptr(bp, page_offset, count));
     offset += count;
-
-    ++p;
   }
+  if (offset < end)
+    bl.append_zero(end - offset);
 
   tls_pages.clear(); // drop page refs
-
-  bl.append(std::move(buf));
   return len;
 }
 
@@ -1628,6 +1616,32 @@ int MemStore::PageSetObject::write(uint64_t offset, const bufferlist &src)
 
 int MemStore::PageSetObject::clone(Object *src, uint64_t srcoff,
                                    uint64_t len, uint64_t dstoff)
+{
+  auto &src_data = static_cast<PageSetObject*>(src)->data;
+  const uint64_t page_size = data.get_page_size();
+  if (src != this && srcoff == dstoff &&
+      src_data.get_page_size() == page_size) {
+    // share the whole pages in the range and copy only the partial
+    // pages at either end
+    const uint64_t end = srcoff + len;
+    const uint64_t first = p2roundup(srcoff, page_size);
+    const uint64_t last = p2align(end, page_size);
+    if (first < last) {
+      if (srcoff < first)
+        copy_range(src, srcoff, first - srcoff, srcoff);
+      data.share_range(src_data, first, last - first);
+      if (last < end)
+        copy_range(src, last, end - last, last);
+      if (data_len < end)
+        data_len = end;
+      return 0;
+    }
+  }
+  return copy_range(src, srcoff, len, dstoff);
+}
+
+int MemStore::PageSetObject::copy_range(Object *src, uint64_t srcoff,
+                                        uint64_t len, uint64_t dstoff)
 {
   const int64_t delta = dstoff - srcoff;
 
@@ -1731,6 +1745,9 @@ int MemStore::PageSetObject::truncate(uint64_t size)
   data.get_range(page_offset, page_size, tls_pages);
   if (tls_pages.empty())
     return 0;
+  tls_pages.clear();
+  // the page may be shared; this makes it ours
+  data.alloc_range(size, page_offset + page_size - size, tls_pages);
 
   auto page = tls_pages.begin();
   auto data = (*page)->data;
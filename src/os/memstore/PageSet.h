@@ -19,19 +19,20 @@
 #include <atomic>
 #include <cassert>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
-#include <boost/intrusive/avl_set.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "include/encoding.h"
 
 struct Page {
   char *const data;
-  boost::intrusive::avl_set_member_hook<> hook;
   uint64_t offset;
 
-  // avoid RefCountedObject because it has a virtual destructor
-  std::atomic<uint16_t> nrefs;
+  // avoid RefCountedObject because it has a virtual destructor.  besides
+  // the PageSets that hold a page, readers hold refs while they look at
+  // it, and so do buffers handed out by zero-copy reads
+  std::atomic<uint32_t> nrefs;
   void get() { ++nrefs; }
   void put() { if (--nrefs == 0) delete this; }
 
@@ -39,18 +40,6 @@ struct Page {
   friend void intrusive_ptr_add_ref(Page *p) { p->get(); }
   friend void intrusive_ptr_release(Page *p) { p->put(); }
 
-  // key-value comparison functor for avl
-  struct Less {
-    bool operator()(uint64_t offset, const Page &page) const {
-      return offset < page.offset;
-    }
-    bool operator()(const Page &page, uint64_t offset) const {
-      return page.offset < offset;
-    }
-    bool operator()(const Page &lhs, const Page &rhs) const {
-      return lhs.offset < rhs.offset;
-    }
-  };
   void encode(bufferlist &bl, size_t page_size) const {
     using ceph::encode;
     bl.append(buffer::copy(data, page_size));
@@ -69,7 +58,7 @@ struct Page {
     // allocate the Page and its data in a single buffer
     auto buffer = new char[page_size + sizeof(Page)];
     // place the Page structure at the end of the buffer
-    return new (buffer + page_size) Page(buffer, offset);
+    return Ref(new (buffer + page_size) Page(buffer, offset), false);
   }
 
   // copy disabled
@@ -84,57 +73,61 @@ struct Page {
   }
 };
 
+/*
+ * The pages of an object, indexed by page offset in a hash table.
+ *
+ * Pages may be shared with other PageSets (see share_range()) and with
+ * readers; alloc_range() copies a shared page before handing it out for
+ * writing, so whoever else holds it keeps seeing the old contents.  The
+ * index is only touched under mutex, readers included, so the reference
+ * count that decides the copy is stable while alloc_range() looks at it.
+ */
 class PageSet {
  public:
   // alloc_range() and get_range() return page refs in a vector
   typedef std::vector<Page::Ref> page_vector;
 
  private:
-  // store pages in a boost intrusive avl_set
-  typedef Page::Less page_cmp;
-  typedef boost::intrusive::member_hook<Page,
-          boost::intrusive::avl_set_member_hook<>,
-          &Page::hook> member_option;
-  typedef boost::intrusive::avl_set<Page,
-          boost::intrusive::compare<page_cmp>, member_option> page_set;
-
-  typedef typename page_set::iterator iterator;
-
-  page_set pages;
+  typedef std::unordered_map<uint64_t, Page::Ref> page_map;
+  page_map pages;
   uint64_t page_size;
 
   typedef std::mutex lock_type;
   lock_type mutex;
 
-  void free_pages(iterator cur, iterator end) {
-    while (cur != end) {
-      Page *page = &*cur;
-      cur = pages.erase(cur);
-      page->put();
-    }
+  uint64_t page_start(uint64_t offset) const {
+    return offset & ~(page_size-1);
   }
 
-  int count_pages(uint64_t offset, uint64_t len) const {
-    // count the overlapping pages
-    int count = 0;
-    if (offset % page_size) {
-      count++;
-      size_t rem = page_size - offset % page_size;
-      len = len <= rem ? 0 : len - rem;
+  /// the pages overlapping [offset,offset+length) that exist, in order
+  void _get_range(uint64_t offset, uint64_t length, page_vector &range) {
+    if (pages.empty() || !length)
+      return;
+    const uint64_t end = offset + length;
+    if (pages.size() < (end - page_start(offset)) / page_size) {
+      // sparse: cheaper to scan the (few) pages than to probe every offset
+      const size_t first = range.size();
+      for (auto& p : pages) {
+        if (p.first < end && p.first + page_size > offset)
+          range.push_back(p.second);
+      }
+      std::sort(range.begin() + first, range.end(),
+                [](const Page::Ref& a, const Page::Ref& b) {
+                  return a->offset < b->offset;
+                });
+      return;
+    }
+    for (uint64_t o = page_start(offset); o < end; o += page_size) {
+      auto p = pages.find(o);
+      if (p != pages.end())
+        range.push_back(p->second);
     }
-    count += len / page_size;
-    if (len % page_size)
-      count++;
-    return count;
   }
 
  public:
   explicit PageSet(size_t page_size) : page_size(page_size) {}
   PageSet(PageSet &&rhs)
     : pages(std::move(rhs.pages)), page_size(rhs.page_size) {}
-  ~PageSet() {
-    free_pages(pages.begin(), pages.end());
-  }
 
   // disable copy
   PageSet(const PageSet&) = delete;
@@ -144,74 +137,88 @@ class PageSet {
   size_t size() const { return pages.size(); }
   size_t get_page_size() const { return page_size; }
 
-  // allocate all pages that intersect the range [offset,length)
+  // allocate all pages that intersect the range [offset,length), making
+  // private copies of any that are shared
   void alloc_range(uint64_t offset, uint64_t length, page_vector &range) {
-    // loop in reverse so we can provide hints to avl_set::insert_check()
-    //	and get O(1) insertions after the first
-    uint64_t position = offset + length - 1;
-
-    range.resize(count_pages(offset, length));
-    auto out = range.rbegin();
+    range.clear();
+    range.reserve((page_start(offset + length - 1) - page_start(offset)) /
+                  page_size + 1);
 
     std::lock_guard<lock_type> lock(mutex);
-    iterator cur = pages.end();
-    while (length) {
-      const uint64_t page_offset = position & ~(page_size-1);
-
-      typename page_set::insert_commit_data commit;
-      auto insert = pages.insert_check(cur, page_offset, page_cmp(), commit);
-      if (insert.second) {
-        auto page = Page::create(page_size, page_offset);
-        cur = pages.insert_commit(*page, commit);
+    const uint64_t end = offset + length;
+    for (uint64_t o = page_start(offset); o < end; o += page_size) {
+      auto& slot = pages[o];
+      if (!slot) {
+        slot = Page::create(page_size, o);
 
         // assume that the caller will write to the range [offset,length),
         //  so we only need to zero memory outside of this range
 
         // zero end of page past offset + length
-        if (offset + length < page->offset + page_size)
-          std::fill(page->data + offset + length - page->offset,
-                    page->data + page_size, 0);
+        if (end < o + page_size)
+          std::fill(slot->data + end - o, slot->data + page_size, 0);
         // zero front of page between page_offset and offset
-        if (offset > page->offset)
-          std::fill(page->data, page->data + offset - page->offset, 0);
-      } else { // exists
-        cur = insert.first;
+        if (offset > o)
+          std::fill(slot->data, slot->data + offset - o, 0);
+      } else if (slot->nrefs > 1) {
+        // somebody else can see this page; copy on write
+        auto copy = Page::create(page_size, o);
+        std::copy(slot->data, slot->data + page_size, copy->data);
+        slot = std::move(copy);
       }
-      // add a reference to output vector
-      out->reset(&*cur);
-      ++out;
-
-      auto c = std::min(length, (position & (page_size-1)) + 1);
-      position -= c;
-      length -= c;
+      range.push_back(slot);
     }
-    // make sure we sized the vector correctly
-    assert(out == range.rend());
   }
 
-  // return all allocated pages that intersect the range [offset,length)
+  // return all allocated pages that intersect the range [offset,length).
+  // the refs are taken under the lock, so a concurrent alloc_range() either
+  // sees them and copies the page, or hands it out before we find it
   void get_range(uint64_t offset, uint64_t length, page_vector &range) {
-    auto cur = pages.lower_bound(offset & ~(page_size-1), page_cmp());
-    while (cur != pages.end() && cur->offset < offset + length)
-      range.push_back(&*cur++);
+    std::lock_guard<lock_type> lock(mutex);
+    _get_range(offset, length, range);
+  }
+
+  // make [offset,offset+length) refer to the same pages as in src,
+  // including its holes.  offset and length must be page aligned.
+  void share_range(PageSet &src, uint64_t offset, uint64_t length) {
+    assert(src.page_size == page_size);
+    assert(page_start(offset) == offset && page_start(length) == length);
+    std::unique_lock<lock_type> l1(mutex, std::defer_lock);
+    std::unique_lock<lock_type> l2(src.mutex, std::defer_lock);
+    std::lock(l1, l2);
+    const uint64_t end = offset + length;
+    for (uint64_t o = offset; o < end; o += page_size) {
+      auto p = src.pages.find(o);
+      if (p == src.pages.end())
+        pages.erase(o);
+      else
+        pages[o] = p->second;
+    }
   }
 
   void free_pages_after(uint64_t offset) {
     std::lock_guard<lock_type> lock(mutex);
-    auto cur = pages.lower_bound(offset & ~(page_size-1), page_cmp());
-    if (cur == pages.end())
-      return;
-    if (cur->offset < offset)
-      cur++;
-    free_pages(cur, pages.end());
+    for (auto p = pages.begin(); p != pages.end(); ) {
+      // a page that starts before offset keeps its tail; truncate zeroes it
+      if (p->first >= offset)
+        p = pages.erase(p);
+      else
+        ++p;
+    }
   }
 
   void encode(bufferlist &bl) const {
     using ceph::encode;
     encode(page_size, bl);
-    unsigned count = pages.size();
+    std::vector<const Page*> sorted;
+    sorted.reserve(pages.size());
+    for (auto& p : pages)
+      sorted.push_back(p.second.get());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const Page *a, const Page *b) { return a->offset > b->offset; });
+    unsigned count = sorted.size();
     encode(count, bl);
-    for (auto p = pages.rbegin(); p != pages.rend(); ++p)
+    for (auto p : sorted)
       p->encode(bl, page_size);
   }
   void decode(bufferlist::const_iterator &p) {
@@ -220,11 +227,11 @@ class PageSet {
     decode(page_size, p);
     unsigned count;
     decode(count, p);
-    auto cur = pages.end();
+    pages.reserve(count);
     for (unsigned i = 0; i < count; i++) {
       auto page = Page::create(page_size);
       page->decode(p, page_size);
-      cur = pages.insert_before(cur, *page);
+      pages[page->offset] = std::move(page);
     }
   }
 };
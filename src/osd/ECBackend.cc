@@ -956,6 +956,29 @@ void ECBackend::handle_sub_read(
 {
   trace.event("handle sub read");
   shard_id_t shard = get_parent()->whoami_shard().shard;
+
+  // issue the complete chunk reads up front, one store call per set of
+  // fadvise flags rather than one per extent
+  map<uint32_t, vector<ObjectStore::ReadvOp>> batches;
+  map<const boost::tuple<uint64_t, uint64_t, uint32_t>*,
+      pair<uint32_t, size_t>> batched;
+  for (auto& i : op.to_read) {
+    auto& subchunks = op.subchunks.find(i.first)->second;
+    if (subchunks.size() != 1 ||
+	subchunks.front().second != ec_impl->get_sub_chunk_count()) {
+      continue;
+    }
+    for (auto& j : i.second) {
+      auto& batch = batches[j.get<2>()];
+      batched[&j] = make_pair(j.get<2>(), batch.size());
+      batch.emplace_back(ghobject_t(i.first, ghobject_t::NO_GEN, shard),
+			 j.get<0>(), j.get<1>());
+    }
+  }
+  for (auto& b : batches) {
+    store->readv(ch, b.second, b.first);
+  }
+
   for(auto i = op.to_read.begin();
       i != op.to_read.end();
       ++i) {
@@ -979,12 +1002,10 @@ void ECBackend::handle_sub_read(
           (op.subchunks.find(i->first)->second.front().second == 
                                             ec_impl->get_sub_chunk_count())) {
         dout(25) << __func__ << " case1: reading the complete chunk/shard." << dendl;
-        r = store->read(
-	  ch,
-	  ghobject_t(i->first, ghobject_t::NO_GEN, shard),
-	  j->get<0>(),
-	  j->get<1>(),
-	  bl, j->get<2>()); // Allow EIO return
+	auto& pos = batched[&*j];
+	auto& rop = batches[pos.first][pos.second];
+	r = rop.r; // Allow EIO return
+	bl.claim(rop.bl);
       } else {
         dout(25) << __func__ << " case2: going to do fragmented read." << dendl;
         for (int m = 0; m < (int)j->get<1>(); m += sinfo.get_chunk_size()) {
@@ -2436,13 +2457,10 @@ int ECBackend::be_deep_scrub(
     stride += sinfo.get_chunk_size() - (stride % sinfo.get_chunk_size());
 
   bufferlist bl;
-  r = store->read(
-    ch,
-    ghobject_t(
-      poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
-    pos.data_pos,
-    stride, bl,
-    fadvise_flags);
+  r = be_deep_scrub_read(poid, pos, o.size, stride, fadvise_flags, &bl);
+  if (r == -EINPROGRESS) {
+    return r;
+  }
   if (r < 0) {
     dout(20) << __func__ << "  " << poid << " got "
 	     << r << " on read, read_error" << dendl;
@@ -49,6 +49,7 @@
 #include "common/pick_address.h"
 #include "common/SubProcess.h"
 #include "common/blkdev.h"
+#include "common/numa.h"
 
 #include "os/ObjectStore.h"
 #ifdef HAVE_LIBFUSE
@@ -616,6 +617,42 @@ float OSDService::get_failsafe_full_ratio()
   return full_ratio;
 }
 
+void OSDService::note_client_op_latency(utime_t now, utime_t lat)
+{
+  // racy read-modify-write is fine for an estimate
+  double avg = client_op_lat_avg;
+  client_op_lat_avg = avg + ((double)lat - avg) * .05;
+  client_op_last_stamp = now;
+}
+
+double OSDService::get_scrub_sleep()
+{
+  double sleep = cct->_conf->osd_scrub_sleep;
+  double target = cct->_conf->get_val<double>(
+    "osd_scrub_client_latency_target");
+  if (target <= 0)
+    return sleep;
+
+  // an idle osd has no recent client latency to protect
+  double lat = 0;
+  if ((double)ceph_clock_now() - client_op_last_stamp < 1.0)
+    lat = client_op_lat_avg;
+  utime_t t;
+  t.set_from_double(lat);
+  logger->tset(l_osd_scrub_client_lat, t);
+  if (lat > target) {
+    // back off in proportion to how far client ops are over target
+    double max_sleep = cct->_conf->get_val<double>("osd_scrub_sleep_max");
+    double throttled = std::min(max_sleep,
+				std::max(sleep, target) * lat / target);
+    if (throttled > sleep) {
+      logger->inc(l_osd_scrub_throttled);
+      sleep = throttled;
+    }
+  }
+  return sleep;
+}
+
 void OSDService::check_full_status(float ratio)
 {
   Mutex::Locker l(full_status_lock);
@@ -1950,6 +1987,12 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
 
   // initialize shards
   num_shards = get_num_op_shards();
+  std::vector<int> numa_nodes;
+  if (cct->_conf->get_val<bool>("osd_numa_shard_affinity")) {
+    numa_nodes = get_online_numa_nodes();
+    dout(1) << __func__ << " spreading " << num_shards << " op shards over "
+	    << "numa nodes " << numa_nodes << dendl;
+  }
   for (uint32_t i = 0; i < num_shards; i++) {
     OSDShard *one_shard = new OSDShard(
       i,
@@ -1958,13 +2001,35 @@ OSD::OSD(CephContext *cct_, ObjectStore *store_,
       cct->_conf->osd_op_pq_max_tokens_per_priority,
       cct->_conf->osd_op_pq_min_cost,
       op_queue);
+    one_shard->numa_node = get_numa_node_for_shard(i, num_shards,
+						   numa_nodes);
     shards.push_back(one_shard);
   }
+  service.object_info_cache.init(
+    num_shards, cct->_conf->get_val<uint64_t>("osd_object_info_cache_size"));
+  service.snapset_cache.init(
+    num_shards, cct->_conf->get_val<uint64_t>("osd_object_info_cache_size"));
+
+  if (cct->_conf->get_val<bool>("osd_op_run_to_completion")) {
+    string ms_type = cct->_conf->ms_public_type.empty() ?
+      cct->_conf->get_val<string>("ms_type") : cct->_conf->ms_public_type;
+    if (ms_type.find("async") == 0) {
+      num_inline_workers = cct->_conf->ms_async_op_threads;
+      dout(1) << __func__ << " running client reads to completion on "
+	      << num_inline_workers << " messenger workers" << dendl;
+    } else {
+      dout(0) << __func__ << " osd_op_run_to_completion requires the async"
+	      << " messenger, not " << ms_type << "; ignoring" << dendl;
+    }
+  }
 }
 
 OSD::~OSD()
 {
   while (!shards.empty()) {
+    if (shards.back()->inline_hb) {
+      cct->get_heartbeat_map()->remove_worker(shards.back()->inline_hb);
+    }
     delete shards.back();
     shards.pop_back();
   }
@@ -3042,6 +3107,12 @@ void OSD::create_logger()
     "Latency of IO before calling queue(before really queue into ShardedOpWq)"); // client io before queue op_wq latency
   osd_plb.add_time_avg(l_osd_op_before_dequeue_op_lat, "op_before_dequeue_op_lat",
     "Latency of IO before calling dequeue_op(already dequeued and get PG lock)"); // client io before dequeue_op latency
+  osd_plb.add_u64_counter(
+    l_osd_op_thread_hops, "op_thread_hops",
+    "Thread handoffs of client operations before completion");
+  osd_plb.add_u64_counter(
+    l_osd_op_inline, "op_inline",
+    "Client operations run to completion on a messenger thread");
 
   osd_plb.add_u64_counter(
     l_osd_sop, "subop", "Suboperations");
@@ -3176,6 +3247,15 @@ void OSD::create_logger()
     l_osd_object_ctx_cache_hit, "object_ctx_cache_hit", "Object context cache hits");
   osd_plb.add_u64_counter(
     l_osd_object_ctx_cache_total, "object_ctx_cache_total", "Object context cache lookups");
+  osd_plb.add_u64_counter(
+    l_osd_object_info_cache_hit, "object_info_cache_hit",
+    "Decoded object info/snapset reused from the shard cache");
+  osd_plb.add_u64_counter(
+    l_osd_object_info_cache_miss, "object_info_cache_miss",
+    "Object info/snapset read and decoded from the store");
+  osd_plb.add_u64_counter(
+    l_osd_object_info_cache_evict, "object_info_cache_evict",
+    "Object info/snapset evicted from the shard cache");
 
   osd_plb.add_u64_counter(l_osd_op_cache_hit, "op_cache_hit");
   osd_plb.add_time_avg(
@@ -3193,6 +3273,19 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(
     l_osd_pg_biginfo, "osd_pg_biginfo", "PG updated its biginfo attr");
 
+  osd_plb.add_u64_counter(
+    l_osd_scrub_read_bytes, "scrub_read_bytes",
+    "Object data read by deep scrub", NULL, 0, unit_t(UNIT_BYTES));
+  osd_plb.add_time_avg(
+    l_osd_scrub_sleep_lat, "scrub_sleep_lat",
+    "Delay between scrub chunks");
+  osd_plb.add_u64_counter(
+    l_osd_scrub_throttled, "scrub_throttled",
+    "Scrub chunks delayed longer because client ops were slow");
+  osd_plb.add_time(
+    l_osd_scrub_client_lat, "scrub_client_lat",
+    "Recent client op latency seen by the scrub throttle");
+
   logger = osd_plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -6473,7 +6566,8 @@ void OSD::ms_fast_dispatch(Message *m)
     enqueue_op(
       static_cast<MOSDFastDispatchOp*>(m)->get_spg(),
       op,
-      static_cast<MOSDFastDispatchOp*>(m)->get_map_epoch());
+      static_cast<MOSDFastDispatchOp*>(m)->get_map_epoch(),
+      true);
   } else {
     // legacy client, and this is an MOSDOp (the *only* fast dispatch
     // message that didn't have an explicit spg_t); we need to map
@@ -8792,7 +8886,8 @@ bool OSD::op_is_discardable(const MOSDOp *op)
   return false;
 }
 
-void OSD::enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch)
+void OSD::enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch,
+		     bool fast_dispatch)
 {
   utime_t latency = ceph_clock_now() - op->get_req()->get_recv_stamp();
   dout(15) << "enqueue_op " << op << " prio " << op->get_req()->get_priority()
@@ -8805,14 +8900,66 @@ void OSD::enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch)
   op->osd_trace.keyval("cost", op->get_req()->get_cost());
   op->mark_queued_for_pg();
   logger->tinc(l_osd_op_before_queue_op_lat, latency);
-  op_shardedwq.queue(
-    OpQueueItem(
-      unique_ptr<OpQueueItem::OpQueueable>(new PGOpItem(pg, op)),
-      op->get_req()->get_cost(),
-      op->get_req()->get_priority(),
-      op->get_req()->get_recv_stamp(),
-      op->get_req()->get_source().num(),
-      epoch));
+  OpQueueItem qi(
+    unique_ptr<OpQueueItem::OpQueueable>(new PGOpItem(pg, op)),
+    op->get_req()->get_cost(),
+    op->get_req()->get_priority(),
+    op->get_req()->get_recv_stamp(),
+    op->get_req()->get_source().num(),
+    epoch);
+  if (fast_dispatch && num_inline_workers &&
+      op->get_req()->get_type() == CEPH_MSG_OSD_OP &&
+      may_run_inline(op) &&
+      op_shardedwq.run_inline(qi, op)) {
+    return;
+  }
+  op_shardedwq.queue(std::move(qi));
+}
+
+bool OSD::may_run_inline(OpRequestRef& op)
+{
+  // a messenger thread must not block, so only take plain reads, which
+  // park on the store instead of waiting for it (osd_async_read).
+  // writes wait for the journal and everything else may read synchronously.
+  if (!cct->_conf->get_val<bool>("osd_async_read")) {
+    return false;
+  }
+  MOSDOp *m = static_cast<MOSDOp*>(op->get_nonconst_req());
+  if (m->finish_decode()) {
+    op->reset_desc();   // for TrackedOp
+    m->clear_payload();
+  }
+  if (m->ops.empty()) {
+    return false;
+  }
+  for (auto& osd_op : m->ops) {
+    if (osd_op.op.op != CEPH_OSD_OP_READ) {
+      return false;
+    }
+  }
+  if (op->rmw_flags == 0 && init_op_flags(op) < 0) {
+    return false;
+  }
+  return op->may_read() && !op->may_write() && !op->may_cache();
+}
+
+int OSD::get_inline_worker()
+{
+  // messenger workers are numbered in the order they first dispatch to us
+  static thread_local const OSD *worker_osd = nullptr;
+  static thread_local uint32_t worker = 0;
+  if (worker_osd != this) {
+    worker_osd = this;
+    worker = next_inline_worker++;
+    if (worker < num_inline_workers) {
+      // the shards this worker runs inline beat with this thread
+      for (uint32_t i = worker; i < shards.size(); i += num_inline_workers) {
+	shards[i]->inline_hb = cct->get_heartbeat_map()->add_worker(
+	  shards[i]->shard_name + "::inline", pthread_self());
+      }
+    }
+  }
+  return worker < num_inline_workers ? (int)worker : -1;
 }
 
 void OSD::enqueue_peering_evt(spg_t pgid, PGPeeringEventRef evt)
@@ -9640,6 +9787,22 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
   uint32_t shard_index = thread_index % osd->num_shards;
   auto& sdata = osd->shards[shard_index];
   assert(sdata);
+  if (sdata->numa_node >= 0) {
+    // a worker always serves the same shard; bind it on first use so that
+    // the onodes and buffers it faults in are allocated node-locally.
+    static thread_local int bound_numa_node = -1;
+    if (bound_numa_node != sdata->numa_node) {
+      int r = set_current_thread_numa_node(sdata->numa_node);
+      if (r < 0) {
+	dout(0) << __func__ << " failed to bind to numa node "
+		<< sdata->numa_node << ": " << cpp_strerror(r) << dendl;
+      } else {
+	dout(10) << __func__ << " thread " << thread_index << " bound to numa"
+		 << " node " << sdata->numa_node << dendl;
+      }
+      bound_numa_node = sdata->numa_node;
+    }
+  }
   // peek at spg_t
   sdata->shard_lock.Lock();
   if (sdata->pqueue->empty()) {
@@ -9939,6 +10102,65 @@ void OSD::ShardedOpWQ::_enqueue_front(OpQueueItem&& item)
   sdata->sdata_wait_lock.Unlock();
 }
 
+bool OSD::ShardedOpWQ::run_inline(OpQueueItem& item, OpRequestRef& op)
+{
+  const auto token = item.get_ordering_token();
+  uint32_t shard_index = token.hash_to_shard(osd->shards.size());
+  int worker = osd->get_inline_worker();
+  if (worker < 0 ||
+      shard_index % osd->num_inline_workers != (uint32_t)worker) {
+    return false;
+  }
+  auto& sdata = osd->shards[shard_index];
+  assert(sdata);
+
+  // only an idle pg may be run here: anything queued, waiting or running
+  // for it must go first, and that ordering is kept by the pqueue and the
+  // slot.  the pqueue cannot be searched by pg, so it must be empty.
+  sdata->shard_lock.Lock();
+  if (osd->is_stopping() || !sdata->pqueue->empty()) {
+    sdata->shard_lock.Unlock();
+    return false;
+  }
+  auto p = sdata->pg_slots.find(token);
+  if (p == sdata->pg_slots.end()) {
+    sdata->shard_lock.Unlock();
+    return false;
+  }
+  OSDShardPGSlot *slot = p->second.get();
+  if (!slot->pg ||
+      slot->num_running ||
+      slot->waiting_for_split ||
+      !slot->to_process.empty() ||
+      !slot->waiting.empty() ||
+      !slot->waiting_peering.empty() ||
+      item.get_map_epoch() > sdata->shard_osdmap->get_epoch()) {
+    sdata->shard_lock.Unlock();
+    return false;
+  }
+  // never block a messenger thread on the pg lock
+  PGRef pg = slot->pg;
+  if (!pg->try_lock()) {
+    sdata->shard_lock.Unlock();
+    return false;
+  }
+  sdata->shard_lock.Unlock();
+  // nor on a kv lookup for the object
+  if (!pg->can_run_inline(op)) {
+    pg->unlock();
+    return false;
+  }
+
+  dout(20) << __func__ << " " << item << " pg " << pg << dendl;
+  osd->logger->inc(l_osd_op_inline);
+  ThreadPool::TPHandle tp_handle(osd->cct, sdata->inline_hb,
+				 timeout_interval, suicide_interval);
+  tp_handle.reset_tp_timeout();
+  item.run(osd, sdata, pg, tp_handle);
+  osd->cct->get_heartbeat_map()->clear_timeout(sdata->inline_hb);
+  return true;
+}
+
 namespace ceph { 
 namespace osd_cmds { 
 
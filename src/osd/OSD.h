@@ -42,6 +42,7 @@
 #include "Session.h"
 
 #include "osd/OpQueueItem.h"
+#include "osd/ObjectInfoCache.h"
 
 #include <atomic>
 #include <map>
@@ -103,6 +104,8 @@ enum {
 
   l_osd_op_before_queue_op_lat,
   l_osd_op_before_dequeue_op_lat,
+  l_osd_op_thread_hops,
+  l_osd_op_inline,
 
   l_osd_sop,
   l_osd_sop_inb,
@@ -175,6 +178,9 @@ enum {
 
   l_osd_object_ctx_cache_hit,
   l_osd_object_ctx_cache_total,
+  l_osd_object_info_cache_hit,
+  l_osd_object_info_cache_miss,
+  l_osd_object_info_cache_evict,
 
   l_osd_op_cache_hit,
   l_osd_tier_flush_lat,
@@ -185,6 +191,11 @@ enum {
   l_osd_pg_fastinfo,
   l_osd_pg_biginfo,
 
+  l_osd_scrub_read_bytes,
+  l_osd_scrub_sleep_lat,
+  l_osd_scrub_throttled,
+  l_osd_scrub_client_lat,
+
   l_osd_last,
 };
 
@@ -278,6 +289,10 @@ public:
   md_config_cacher_t<uint64_t> osd_max_object_size;
   md_config_cacher_t<bool> osd_skip_data_digest;
 
+  /// decoded object metadata shared by the PGs of each op shard
+  ObjectInfoCache<object_info_t> object_info_cache;
+  ObjectInfoCache<SnapSet> snapset_cache;
+
   void enqueue_back(OpQueueItem&& qi);
   void enqueue_front(OpQueueItem&& qi);
 
@@ -701,6 +716,13 @@ public:
   Mutex sleep_lock;
   SafeTimer sleep_timer;
 
+  // recent client op latency, for the scrub throttle
+  std::atomic<double> client_op_lat_avg = {0};    ///< ewma, seconds
+  std::atomic<double> client_op_last_stamp = {0};
+  void note_client_op_latency(utime_t now, utime_t lat);
+  /// delay between scrub chunks, stretched while client ops are slow
+  double get_scrub_sleep();
+
   // -- tids --
   // for ops i issue
   std::atomic<unsigned int> last_tid{0};
@@ -1106,6 +1128,11 @@ struct OSDShard {
 
   string shard_name;
 
+  int numa_node = -1;  ///< node our workers are bound to, or -1
+
+  /// heartbeat of the messenger thread running this shard's ops inline
+  heartbeat_handle_d *inline_hb = nullptr;
+
   string sdata_wait_lock_name;
   Mutex sdata_wait_lock;
   Cond sdata_cond;
@@ -1652,6 +1679,11 @@ protected:
    *
    * Multiple worker threads can operate on each shard.
    *
+   * With osd_op_run_to_completion, each messenger worker owns a fixed set
+   * of shards, and a client op for one of them that finds its pg idle
+   * (nothing queued, waiting or running) skips the pqueue and is run by
+   * the messenger thread itself; everything else takes the path above.
+   *
    * Under normal circumstances, num_running == to_process.size().  There are
    * two times when that is not true: (1) when waiting_for_pg == true and
    * to_process is accumulating requests that are waiting for the pg to be
@@ -1691,6 +1723,9 @@ protected:
 
     /// requeue an old item (at the front of the line)
     void _enqueue_front(OpQueueItem&& item) override;
+
+    /// run a client op to completion on the calling messenger thread
+    bool run_inline(OpQueueItem& item, OpRequestRef& op);
       
     void return_waiting_threads() override {
       for(uint32_t i = 0; i < osd->num_shards; i++) {
@@ -1739,7 +1774,8 @@ protected:
   } op_shardedwq;
 
 
-  void enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch);
+  void enqueue_op(spg_t pg, OpRequestRef& op, epoch_t epoch,
+		  bool fast_dispatch = false);
   void dequeue_op(
     PGRef pg, OpRequestRef op,
     ThreadPool::TPHandle &handle);
@@ -1821,6 +1857,14 @@ public:
   vector<OSDShard*> shards;
   uint32_t num_shards = 0;
 
+  /// messenger workers sharing the shards for run-to-completion, or 0
+  uint32_t num_inline_workers = 0;
+  std::atomic<uint32_t> next_inline_worker = {0};
+  /// the calling messenger worker's index, or -1 if it runs no shards
+  int get_inline_worker();
+  /// true if op can run on a messenger worker without blocking it
+  bool may_run_inline(OpRequestRef& op);
+
   void inc_num_pgs() {
     ++num_pgs;
   }
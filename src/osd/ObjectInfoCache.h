@@ -0,0 +1,113 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OBJECTINFOCACHE_H
+#define CEPH_OSD_OBJECTINFOCACHE_H
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "common/Mutex.h"
+#include "include/unordered_map.h"
+#include "osd_types.h"
+
+/**
+ * ObjectInfoCache
+ *
+ * Holds decoded per-object metadata (object_info_t, SnapSet) that
+ * outlives the PG's own object and snapset contexts, so that an object
+ * which falls out of a PG's small object_contexts LRU does not have to
+ * read and decode its xattrs again on the next op.  There is one shard
+ * per OSD op shard, chosen by pgid, each a bounded LRU behind its own
+ * lock.
+ *
+ * A PG stashes a value when the context holding it goes away and takes
+ * it back out when it creates the next context for that object, so at
+ * any time a value lives either in a context or here, never both.
+ * Every value carries the tag of the PG state it was valid in (see
+ * PrimaryLogPG::object_info_cache_tag()); take() only returns values
+ * whose tag still matches, and stale ones simply age out.
+ */
+template <class V>
+class ObjectInfoCache {
+  struct Shard {
+    Mutex lock;
+    std::list<std::pair<hobject_t, std::pair<uint64_t, V>>> lru;
+    ceph::unordered_map<hobject_t,
+			typename decltype(lru)::iterator> contents;
+    Shard() : lock("ObjectInfoCache::Shard::lock") {}
+  };
+  std::vector<std::unique_ptr<Shard>> shards;
+  size_t max_per_shard = 0;
+
+  Shard& get_shard(const spg_t& pgid) {
+    return *shards[pgid.hash_to_shard(shards.size())];
+  }
+
+public:
+  void init(unsigned num_shards, size_t max_size) {
+    assert(shards.empty());
+    if (!num_shards || !max_size)
+      return;
+    max_per_shard = std::max<size_t>(1, max_size / num_shards);
+    for (unsigned i = 0; i < num_shards; ++i) {
+      shards.emplace_back(new Shard);
+    }
+  }
+
+  bool enabled() const {
+    return !shards.empty();
+  }
+
+  /// stash v for oid; returns the number of entries evicted for it
+  unsigned put(const spg_t& pgid, const hobject_t& oid, uint64_t tag, V&& v) {
+    if (!enabled())
+      return 0;
+    Shard& s = get_shard(pgid);
+    Mutex::Locker l(s.lock);
+    auto p = s.contents.find(oid);
+    if (p != s.contents.end()) {
+      p->second->second = std::make_pair(tag, std::move(v));
+      s.lru.splice(s.lru.begin(), s.lru, p->second);
+      return 0;
+    }
+    s.lru.emplace_front(oid, std::make_pair(tag, std::move(v)));
+    s.contents[oid] = s.lru.begin();
+    unsigned evicted = 0;
+    while (s.lru.size() > max_per_shard) {
+      s.contents.erase(s.lru.back().first);
+      s.lru.pop_back();
+      ++evicted;
+    }
+    return evicted;
+  }
+
+  /// remove oid's entry; true (and *v filled in) if it matched tag
+  bool take(const spg_t& pgid, const hobject_t& oid, uint64_t tag, V *v) {
+    if (!enabled())
+      return false;
+    Shard& s = get_shard(pgid);
+    Mutex::Locker l(s.lock);
+    auto p = s.contents.find(oid);
+    if (p == s.contents.end())
+      return false;
+    bool match = p->second->second.first == tag;
+    if (match)
+      *v = std::move(p->second->second.second);
+    s.lru.erase(p->second);
+    s.contents.erase(p);
+    return match;
+  }
+};
+
+#endif
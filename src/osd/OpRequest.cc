@@ -47,6 +47,7 @@ void OpRequest::_dump(Formatter *f) const
 {
   Message *m = request;
   f->dump_string("flag_point", state_string());
+  f->dump_unsigned("thread_hops", thread_hops);
   if (m->get_orig_source().is_client()) {
     f->open_object_section("client_info");
     stringstream client_name, client_addr;
@@ -139,6 +140,7 @@ void OpRequest::mark_flag_point(uint8_t flag, const char *s) {
 #ifdef WITH_LTTNG
   uint8_t old_flags = hit_flag_points;
 #endif
+  mark_thread();
   mark_event(s);
   hit_flag_points |= flag;
   latest_flag_point = flag;
@@ -151,6 +153,7 @@ void OpRequest::mark_flag_point_string(uint8_t flag, const string& s) {
 #ifdef WITH_LTTNG
   uint8_t old_flags = hit_flag_points;
 #endif
+  mark_thread();
   mark_event_string(s);
   hit_flag_points |= flag;
   latest_flag_point = flag;
@@ -84,6 +84,8 @@ private:
   uint8_t hit_flag_points;
   uint8_t latest_flag_point;
   utime_t dequeued_time;
+  pthread_t last_thread = pthread_self(); ///< thread that last handled us
+  uint32_t thread_hops = 0;               ///< times we changed threads
   static const uint8_t flag_queued_for_pg=1 << 0;
   static const uint8_t flag_reached_pg =  1 << 1;
   static const uint8_t flag_delayed =     1 << 2;
@@ -160,6 +162,18 @@ public:
     dequeued_time = deq_time;
   }
 
+  /// note that the calling thread is now handling this op
+  void mark_thread() {
+    pthread_t self = pthread_self();
+    if (!pthread_equal(self, last_thread)) {
+      last_thread = self;
+      ++thread_hops;
+    }
+  }
+  uint32_t get_thread_hops() const {
+    return thread_hops;
+  }
+
   osd_reqid_t get_reqid() const {
     return reqid;
   }
@@ -383,6 +383,17 @@ void PG::lock(bool no_lockdep) const
   dout(30) << "lock" << dendl;
 }
 
+bool PG::try_lock() const
+{
+  if (!_lock.TryLock())
+    return false;
+  assert(!dirty_info);
+  assert(!dirty_big_info);
+
+  dout(30) << "try_lock" << dendl;
+  return true;
+}
+
 std::ostream& PG::gen_prefix(std::ostream& out) const
 {
   OSDMapRef mapref = osdmap_ref;
@@ -4722,10 +4733,13 @@ void PG::replica_scrub(
  */
 void PG::scrub(epoch_t queued, ThreadPool::TPHandle &handle)
 {
-  if (cct->_conf->osd_scrub_sleep > 0 &&
-      (scrubber.state == PG::Scrubber::NEW_CHUNK ||
+  double scrub_sleep = 0;
+  if ((scrubber.state == PG::Scrubber::NEW_CHUNK ||
        scrubber.state == PG::Scrubber::INACTIVE) &&
-       scrubber.needs_sleep) {
+      scrubber.needs_sleep) {
+    scrub_sleep = osd->get_scrub_sleep();
+  }
+  if (scrub_sleep > 0) {
     ceph_assert(!scrubber.sleeping);
     dout(20) << __func__ << " state is INACTIVE|NEW_CHUNK, sleeping" << dendl;
 
@@ -4754,8 +4768,11 @@ void PG::scrub(epoch_t queued, ThreadPool::TPHandle &handle)
           pg->scrubber.sleep_start = utime_t();
           pg->unlock();
         });
+    utime_t t;
+    t.set_from_double(scrub_sleep);
+    osd->logger->tinc(l_osd_scrub_sleep_lat, t);
     Mutex::Locker l(osd->sleep_lock);
-    osd->sleep_timer.add_event_after(cct->_conf->osd_scrub_sleep,
+    osd->sleep_timer.add_event_after(scrub_sleep,
                                            scrub_requeue_callback);
     scrubber.sleeping = true;
     scrubber.sleep_start = ceph_clock_now();
@@ -5094,7 +5111,9 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
 	  scrubber.deep,
 	  handle);
 	if (ret == -EINPROGRESS) {
-	  requeue_scrub();
+	  // a pending deep scrub read-ahead requeues us once it lands
+	  if (!scrubber.primary_scrubmap_pos.waiting_read)
+	    requeue_scrub();
 	  done = true;
 	  break;
 	}
@@ -5198,7 +5217,8 @@ void PG::chunky_scrub(ThreadPool::TPHandle &handle)
 	    handle);
 	}
 	if (ret == -EINPROGRESS) {
-	  requeue_scrub();
+	  if (!scrubber.replica_scrubmap_pos.waiting_read)
+	    requeue_scrub();
 	  done = true;
 	  break;
 	}
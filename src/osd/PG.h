@@ -281,6 +281,7 @@ public:
     handle.reset_tp_timeout();
   }
   void lock(bool no_lockdep = false) const;
+  bool try_lock() const;
   void unlock() const {
     //generic_dout(0) << this << " " << info.pgid << " unlock" << dendl;
     assert(!dirty_info);
@@ -457,6 +458,8 @@ public:
     OpRequestRef& op,
     ThreadPool::TPHandle &handle
   ) = 0;
+  /// true if op can run without a synchronous metadata lookup (pg locked)
+  virtual bool can_run_inline(OpRequestRef& op) = 0;
 
   virtual void snap_trimmer(epoch_t epoch_queued) = 0;
   virtual int do_command(
@@ -617,6 +617,132 @@ int PGBackend::be_scan_list(
   return 0;
 }
 
+/// strides of one object read ahead of the one being hashed
+struct ScrubReadahead {
+  struct Read {
+    uint64_t off = 0;
+    bufferlist bl;
+    int r = 0;
+    bool done = false;
+  };
+  hobject_t oid;
+  PGBackend::Listener *parent;
+  Mutex lock;  ///< protects Read::r, bl and done, and the wakeup
+  std::deque<std::shared_ptr<Read>> reads;  ///< in offset order
+  /// requeues the scrub once waiting_for completes
+  GenContext<ThreadPool::TPHandle&> *wakeup = nullptr;
+  Read *waiting_for = nullptr;
+
+  ScrubReadahead(const hobject_t& oid, PGBackend::Listener *parent)
+    : oid(oid), parent(parent), lock("ScrubReadahead::lock") {}
+  ~ScrubReadahead() {
+    delete wakeup;
+  }
+
+  void finish(Read *rd, int r) {
+    GenContext<ThreadPool::TPHandle&> *c = nullptr;
+    {
+      Mutex::Locker l(lock);
+      rd->r = r;
+      rd->done = true;
+      if (waiting_for == rd) {
+	std::swap(c, wakeup);
+	waiting_for = nullptr;
+      }
+    }
+    if (c)
+      parent->schedule_recovery_work(c);
+  }
+};
+
+/*
+ * Read the deep scrub stride at pos.data_pos.  With
+ * osd_deep_scrub_read_ahead > 1 the following strides of the object
+ * (up to its stat size) are queued with read_async() too, so the
+ * device works on them while we hash this one.
+ *
+ * We are called with the pg locked, so we never wait for a read-ahead:
+ * its completion may be queued behind callbacks that need the pg lock.
+ * If the stride we want is still in flight we return -EINPROGRESS and
+ * the read's completion requeues the scrub.
+ */
+int PGBackend::be_deep_scrub_read(
+  const hobject_t &poid,
+  ScrubMapBuilder &pos,
+  uint64_t size,
+  uint64_t stride,
+  uint32_t fadvise_flags,
+  bufferlist *bl)
+{
+  ghobject_t goid(poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard);
+  uint64_t depth = cct->_conf->get_val<uint64_t>("osd_deep_scrub_read_ahead");
+  int r;
+  if (depth <= 1) {
+    r = store->read(ch, goid, pos.data_pos, stride, *bl, fadvise_flags);
+  } else {
+    auto& ra = pos.readahead;
+    if (ra && (ra->oid != poid ||
+	       (!ra->reads.empty() &&
+		ra->reads.front()->off != (uint64_t)pos.data_pos))) {
+      ra.reset();
+    }
+    if (ra && !ra->reads.empty()) {
+      auto rd = ra->reads.front();
+      {
+	Mutex::Locker l(ra->lock);
+	if (!rd->done) {
+	  dout(20) << __func__ << " " << poid << " read-ahead at "
+		   << pos.data_pos << " still in flight" << dendl;
+	  if (!ra->wakeup) {
+	    ra->wakeup = get_parent()->bless_unlocked_gencontext(
+	      make_gen_lambda_context<ThreadPool::TPHandle&>(
+		[this](ThreadPool::TPHandle&) {
+		  get_parent()->scrub_read_ready();
+		}).release());
+	    ra->waiting_for = rd.get();
+	  }
+	  pos.waiting_read = true;
+	  return -EINPROGRESS;
+	}
+      }
+      ra->reads.pop_front();
+      r = rd->r;
+      bl->claim(rd->bl);
+    } else {
+      if (!ra)
+	ra = std::make_shared<ScrubReadahead>(poid, get_parent());
+      r = store->read(ch, goid, pos.data_pos, stride, *bl, fadvise_flags);
+    }
+    if (r < (int)stride) {
+      // error or end of object; anything still in flight is dropped
+      // once it completes
+      ra.reset();
+    } else {
+      while (ra->reads.size() < depth - 1) {
+	uint64_t off = ra->reads.empty() ?
+	  pos.data_pos + stride : ra->reads.back()->off + stride;
+	if (off >= size)
+	  break;
+	auto rd = std::make_shared<ScrubReadahead::Read>();
+	rd->off = off;
+	ra->reads.push_back(rd);
+	auto c = new FunctionContext([ra, rd](int r) {
+	    ra->finish(rd.get(), r);
+	  });
+	int rr = store->read_async(ch, goid, off, stride, rd->bl,
+				   fadvise_flags, c);
+	if (rr != -EINPROGRESS) {
+	  delete c;
+	  ra->finish(rd.get(), rr);
+	}
+      }
+    }
+  }
+  if (r > 0)
+    get_parent()->get_logger()->inc(l_osd_scrub_read_bytes, r);
+  return r;
+}
+
 bool PGBackend::be_compare_scrub_objects(
   pg_shard_t auth_shard,
   const ScrubMap::object &auth,
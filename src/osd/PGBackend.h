@@ -258,6 +258,10 @@ typedef std::shared_ptr<const OSDMap> OSDMapRef;
      virtual void schedule_recovery_work(
        GenContext<ThreadPool::TPHandle&> *c) = 0;
 
+     /// called with the pg locked once a deep scrub read-ahead that
+     /// the scrub is waiting for has completed
+     virtual void scrub_read_ready() = 0;
+
      virtual pg_shard_t whoami_shard() const = 0;
      int whoami() const {
        return whoami_shard().osd;
@@ -597,6 +601,13 @@ typedef std::shared_ptr<const OSDMap> OSDMapRef;
      ScrubMap &map,
      ScrubMapBuilder &pos,
      ScrubMap::object &o) = 0;
+   int be_deep_scrub_read(
+     const hobject_t &oid,
+     ScrubMapBuilder &pos,
+     uint64_t size,
+     uint64_t stride,
+     uint32_t fadvise_flags,
+     bufferlist *bl);
    void be_large_omap_check(
      const map<pg_shard_t,ScrubMap*> &maps,
      const set<hobject_t> &master_set,
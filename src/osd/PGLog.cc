@@ -29,6 +29,26 @@ static ostream& _prefix(std::ostream *_dout, const PGLog *pglog)
   return pglog->gen_prefix(*_dout);
 }
 
+namespace {
+/// Values for many log keys, encoded back to back into one buffer.  Each
+/// key gets a slice of it instead of a buffer of its own, which saves an
+/// allocation per key and keeps the transaction from pinning mostly empty
+/// append buffers.
+struct log_key_batch {
+  map<string,bufferlist> *km;
+  bufferlist bl;
+
+  explicit log_key_batch(map<string,bufferlist> *km) : km(km) {}
+
+  template <typename F>
+  void add(const string& key, F&& f) {
+    unsigned off = bl.length();
+    f(bl);
+    (*km)[key].substr_of(bl, off, bl.length() - off);
+  }
+};
+} // anonymous namespace
+
 //////////////////// PGLog::IndexedLog ////////////////////
 
 void PGLog::IndexedLog::split_out_child(
@@ -83,12 +103,12 @@ void PGLog::IndexedLog::trim(
 	*write_from_dups = e.version;
       }
       dups.push_back(pg_log_dup_t(e));
-      index(dups.back());
+      index(std::prev(dups.cend()));
       for (const auto& extra : e.extra_reqids) {
 	// note: extras have the same version as outer op
 	dups.push_back(pg_log_dup_t(e.version, extra.second,
 				    extra.first, e.return_code));
-	index(dups.back());
+	index(std::prev(dups.cend()));
       }
     }
 
@@ -475,7 +495,7 @@ bool PGLog::merge_log_dups(const pg_log_t& olog) {
       // since our log.dups is empty just copy them
       for (const auto& i : olog.dups) {
 	log.dups.push_back(i);
-	log.index(log.dups.back());
+	log.index(std::prev(log.dups.cend()));
       }
     } else {
       // since our log.dups is not empty try to extend on each end
@@ -497,8 +517,7 @@ bool PGLog::merge_log_dups(const pg_log_t& olog) {
 
 	  auto prev = insert_cursor;
 	  --prev;
-	  // be sure to pass reference of copy in log.dups
-	  log.index(*prev);
+	  log.index(prev);
 
 	  --insert_cursor; // make sure we insert in reverse order
 	}
@@ -519,8 +538,7 @@ bool PGLog::merge_log_dups(const pg_log_t& olog) {
 	  last = i->version;
 	  auto prev = insert_cursor;
 	  --prev;
-	  // be sure to pass address of copy in log.dups
-	  log.index(*prev);
+	  log.index(prev);
 	}
 	mark_dirty_to_dups(last);
       }
@@ -687,12 +705,13 @@ void PGLog::_write_log_and_missing_wo_missing(
     clear_after(log_keys_debug, dirty_from.get_key_name());
   }
 
+  log_key_batch batch(km);
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end() && p->version <= dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	p->encode_with_checksum(bl);
+      });
   }
 
   for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
@@ -700,9 +719,9 @@ void PGLog::_write_log_and_missing_wo_missing(
 	 (p->version >= dirty_from || p->version >= writeout_from) &&
 	 p->version >= dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	p->encode_with_checksum(bl);
+      });
   }
 
   if (log_keys_debug) {
@@ -737,9 +756,9 @@ void PGLog::_write_log_and_missing_wo_missing(
   for (const auto& entry : log.dups) {
     if (entry.version > dirty_to_dups)
       break;
-    bufferlist bl;
-    encode(entry, bl);
-    (*km)[entry.get_key_name()].claim(bl);
+    batch.add(entry.get_key_name(), [&](bufferlist& bl) {
+	encode(entry, bl);
+      });
   }
 
   for (list<pg_log_dup_t>::reverse_iterator p = log.dups.rbegin();
@@ -747,9 +766,9 @@ void PGLog::_write_log_and_missing_wo_missing(
 	 (p->version >= dirty_from_dups || p->version >= write_from_dups) &&
 	 p->version >= dirty_to_dups;
        ++p) {
-    bufferlist bl;
-    encode(*p, bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	encode(*p, bl);
+      });
   }
 
   if (dirty_divergent_priors) {
@@ -816,12 +835,13 @@ void PGLog::_write_log_and_missing(
     clear_after(log_keys_debug, dirty_from.get_key_name());
   }
 
+  log_key_batch batch(km);
   for (list<pg_log_entry_t>::iterator p = log.log.begin();
        p != log.log.end() && p->version <= dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	p->encode_with_checksum(bl);
+      });
   }
 
   for (list<pg_log_entry_t>::reverse_iterator p = log.log.rbegin();
@@ -829,9 +849,9 @@ void PGLog::_write_log_and_missing(
 	 (p->version >= dirty_from || p->version >= writeout_from) &&
 	 p->version >= dirty_to;
        ++p) {
-    bufferlist bl(sizeof(*p) * 2);
-    p->encode_with_checksum(bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	p->encode_with_checksum(bl);
+      });
   }
 
   if (log_keys_debug) {
@@ -866,9 +886,9 @@ void PGLog::_write_log_and_missing(
   for (const auto& entry : log.dups) {
     if (entry.version > dirty_to_dups)
       break;
-    bufferlist bl;
-    encode(entry, bl);
-    (*km)[entry.get_key_name()].claim(bl);
+    batch.add(entry.get_key_name(), [&](bufferlist& bl) {
+	encode(entry, bl);
+      });
   }
 
   for (list<pg_log_dup_t>::reverse_iterator p = log.dups.rbegin();
@@ -876,9 +896,9 @@ void PGLog::_write_log_and_missing(
 	 (p->version >= dirty_from_dups || p->version >= write_from_dups) &&
 	 p->version >= dirty_to_dups;
        ++p) {
-    bufferlist bl;
-    encode(*p, bl);
-    (*km)[p->get_key_name()].claim(bl);
+    batch.add(p->get_key_name(), [&](bufferlist& bl) {
+	encode(*p, bl);
+      });
   }
 
   if (clear_divergent_priors) {
@@ -899,7 +919,9 @@ void PGLog::_write_log_and_missing(
 	to_remove.insert(key);
       } else {
 	uint64_t features = missing.may_include_deletes ? CEPH_FEATURE_OSD_RECOVERY_DELETES : 0;
-	encode(make_pair(obj, item), (*km)[key], features);
+	batch.add(key, [&](bufferlist& bl) {
+	    encode(make_pair(obj, item), bl, features);
+	  });
       }
     });
   if (require_rollback) {
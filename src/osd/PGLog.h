@@ -20,6 +20,8 @@
 #include "include/assert.h"
 #include "osd_types.h"
 #include "os/ObjectStore.h"
+#include "common/bloom_filter.hpp"
+#include "include/hash.h"
 #include <list>
 
 constexpr auto PGLOG_INDEXED_OBJECTS          = 1 << 0;
@@ -78,11 +80,53 @@ public:
    * IndexLog - adds in-memory index of the log, by oid.
    * plus some methods to manipulate it all.
    */
+  /// hash and compare soid pointers by value, so that the objects index
+  /// can be keyed on the soid inside the entry it points at rather than
+  /// on a copy of it
+  struct soid_ptr_hash {
+    size_t operator()(const hobject_t *h) const {
+      return std::hash<hobject_t>()(*h);
+    }
+  };
+  struct soid_ptr_equal {
+    bool operator()(const hobject_t *l, const hobject_t *r) const {
+      return *l == *r;
+    }
+  };
+  typedef mempool::osd_pglog::unordered_map<
+    const hobject_t*, pg_log_entry_t*,
+    soid_ptr_hash, soid_ptr_equal> object_index_t;
+
   struct IndexedLog : public pg_log_t {
-    mutable ceph::unordered_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
-    mutable ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
-    mutable ceph::unordered_map<osd_reqid_t,pg_log_dup_t*> dup_index;
+    // ptrs into log.  be careful!  objects is keyed by &entry->soid of
+    // the entry it maps to; look objects up with find(&oid).
+    mutable object_index_t objects;
+    mutable mempool::osd_pglog::unordered_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
+    mutable mempool::osd_pglog::unordered_multimap<osd_reqid_t,pg_log_entry_t*> extra_caller_ops;
+
+    /**
+     * dups are only consulted to catch replayed client requests, so
+     * rather than an exact hash index we keep bloom filters: one over
+     * all dups, so that the common miss costs a single probe, and one
+     * per bucket of dup_bucket_size consecutive dups.  a bucket covers
+     * the dup versions in (previous bucket's last, last], starting at
+     * first; a filter hit is confirmed by scanning just that stretch of
+     * dups.  removing a dup leaves its bits behind, which only costs an
+     * extra scan.
+     */
+    static constexpr unsigned dup_bucket_size = 256;
+    static constexpr double dup_bucket_fpp = .01;
+    typedef mempool::osd_pglog::list<pg_log_dup_t>::const_iterator
+      dup_iterator;
+    struct dup_bucket_t {
+      eversion_t last;     ///< newest dup version covered by this bucket
+      dup_iterator first;  ///< oldest dup in this bucket
+      bloom_filter filter;
+      dup_bucket_t(eversion_t v, dup_iterator first)
+	: last(v), first(first), filter(dup_bucket_size, dup_bucket_fpp, 0) {}
+    };
+    mutable bloom_filter dup_filter;  ///< every dup indexed since the last rebuild
+    mutable mempool::osd_pglog::list<dup_bucket_t> dup_filters;
 
     // recovery pointers
     list<pg_log_entry_t>::iterator complete_to; // not inclusive of referenced item
@@ -119,6 +163,75 @@ public:
       }
     }
 
+    /// hash of a dup's reqid as kept in the dup bloom filters
+    static uint32_t dup_hash(const osd_reqid_t &r) {
+      // std::hash<osd_reqid_t> is too weak for the bloom filter
+      return rjhash64(rjhash64(r.name.num() ^ r.tid) ^ r.inc);
+    }
+
+    /// size the filter over all dups for twice the current ones
+    void _reset_dup_filter() const {
+      dup_filter = bloom_filter(
+	std::max<size_t>(2 * dups.size(), dup_bucket_size), dup_bucket_fpp, 0);
+    }
+
+    /// add the dup at i, already in dups, to the filters
+    void _index_dup(dup_iterator i) const {
+      // the bits of removed dups pile up in dup_filter; once it is full
+      // rebuild it from the dups we still have
+      if (dup_filter.is_full()) {
+	_reset_dup_filter();
+	for (auto& d : dups) {
+	  dup_filter.insert(dup_hash(d.reqid));
+	}
+      } else {
+	dup_filter.insert(dup_hash(i->reqid));
+      }
+
+      if (dup_filters.empty() || i->version > dup_filters.back().last) {
+	if (dup_filters.empty() || dup_filters.back().filter.is_full()) {
+	  dup_filters.emplace_back(i->version, i);
+	} else {
+	  dup_filters.back().last = i->version;
+	}
+	dup_filters.back().filter.insert(dup_hash(i->reqid));
+	return;
+      }
+      // older than the newest bucket (merge_log_dups); the first bucket
+      // whose range covers it takes it.  if that piles up too much in one
+      // bucket, drop the filters and rebuild them on the next lookup.
+      for (auto b = dup_filters.begin(); b != dup_filters.end(); ++b) {
+	if (i->version <= b->last) {
+	  if (b->filter.element_count() >= 2 * dup_bucket_size) {
+	    dup_filters.clear();
+	    indexed_data &= ~PGLOG_INDEXED_DUPS;
+	    return;
+	  }
+	  b->filter.insert(dup_hash(i->reqid));
+	  // it may have been inserted in front of the bucket's first dup
+	  auto older = b == dup_filters.begin() ? nullptr : &*std::prev(b);
+	  while (b->first != dups.begin() &&
+		 (!older || std::prev(b->first)->version > older->last)) {
+	    --b->first;
+	  }
+	  return;
+	}
+      }
+    }
+
+    /// point the objects index at e, re-keying the slot on e's own soid
+    void _index_object(pg_log_entry_t *e) const {
+      auto p = objects.find(&e->soid);
+      if (p == objects.end()) {
+	objects.emplace(&e->soid, e);
+      } else {
+	auto nh = objects.extract(p);
+	nh.key() = &e->soid;
+	nh.mapped() = e;
+	objects.insert(std::move(nh));
+      }
+    }
+
     void reset_rollback_info_trimmed_to_riter() {
       rollback_info_trimmed_to_riter = log.rbegin();
       while (rollback_info_trimmed_to_riter != log.rend() &&
@@ -245,7 +358,7 @@ public:
       if (!(indexed_data & PGLOG_INDEXED_OBJECTS)) {
          index_objects();
       }
-      return objects.count(oid);
+      return objects.count(&oid);
     }
 
     bool logged_req(const osd_reqid_t &r) const {
@@ -270,15 +383,14 @@ public:
       assert(version);
       assert(user_version);
       assert(return_code);
-      ceph::unordered_map<osd_reqid_t,pg_log_entry_t*>::const_iterator p;
       if (!(indexed_data & PGLOG_INDEXED_CALLER_OPS)) {
         index_caller_ops();
       }
-      p = caller_ops.find(r);
-      if (p != caller_ops.end()) {
-	*version = p->second->version;
-	*user_version = p->second->user_version;
-	*return_code = p->second->return_code;
+      auto c = caller_ops.find(r);
+      if (c != caller_ops.end()) {
+	*version = c->second->version;
+	*user_version = c->second->user_version;
+	*return_code = c->second->return_code;
 	return true;
       }
 
@@ -287,7 +399,7 @@ public:
       if (!(indexed_data & PGLOG_INDEXED_EXTRA_CALLER_OPS)) {
         index_extra_caller_ops();
       }
-      p = extra_caller_ops.find(r);
+      auto p = extra_caller_ops.find(r);
       if (p != extra_caller_ops.end()) {
 	for (auto i = p->second->extra_reqids.begin();
 	     i != p->second->extra_reqids.end();
@@ -302,20 +414,39 @@ public:
 	assert(0 == "in extra_caller_ops but not extra_reqids");
       }
 
-      if (!(indexed_data & PGLOG_INDEXED_DUPS)) {
-        index_dups();
-      }
-      auto q = dup_index.find(r);
-      if (q != dup_index.end()) {
-	*version = q->second->version;
-	*user_version = q->second->user_version;
-	*return_code = q->second->return_code;
+      auto q = get_dup(r);
+      if (q) {
+	*version = q->version;
+	*user_version = q->user_version;
+	*return_code = q->return_code;
 	return true;
       }
 
       return false;
     }
 
+    /// find the newest dup for the given reqid, or nullptr
+    const pg_log_dup_t *get_dup(const osd_reqid_t &r) const {
+      if (!(indexed_data & PGLOG_INDEXED_DUPS)) {
+        index_dups();
+      }
+      uint32_t h = dup_hash(r);
+      if (!dup_filter.contains(h))
+	return nullptr;
+      for (auto b = dup_filters.rbegin(); b != dup_filters.rend(); ++b) {
+	if (!b->filter.contains(h))
+	  continue;
+	const pg_log_dup_t *found = nullptr;
+	for (auto p = b->first; p != dups.end() && p->version <= b->last; ++p) {
+	  if (p->reqid == r)
+	    found = &*p;
+	}
+	if (found)
+	  return found;
+      }
+      return nullptr;
+    }
+
     /// get a (bounded) list of recent reqids for the given object
     void get_object_reqids(const hobject_t& oid, unsigned max,
 			   mempool::osd_pglog::vector<pair<osd_reqid_t, version_t> > *pls) const {
@@ -324,7 +455,7 @@ public:
       if (!(indexed_data & PGLOG_INDEXED_OBJECTS)) {
         index_objects();
       }
-      if (objects.count(oid) == 0)
+      if (objects.count(&oid) == 0)
 	return;
       for (list<pg_log_entry_t>::const_reverse_iterator i = log.rbegin();
            i != log.rend();
@@ -356,9 +487,10 @@ public:
       if (to_index & PGLOG_INDEXED_EXTRA_CALLER_OPS)
 	extra_caller_ops.clear();
       if (to_index & PGLOG_INDEXED_DUPS) {
-	dup_index.clear();
-	for (auto& i : dups) {
-	  dup_index[i.reqid] = const_cast<pg_log_dup_t*>(&i);
+	dup_filters.clear();
+	_reset_dup_filter();
+	for (auto i = dups.cbegin(); i != dups.cend(); ++i) {
+	  _index_dup(i);
 	}
       }
 
@@ -373,7 +505,7 @@ public:
 	     ++i) {
 	  if (to_index & PGLOG_INDEXED_OBJECTS) {
 	    if (i->object_is_indexed()) {
-	      objects[i->soid] = const_cast<pg_log_entry_t*>(&(*i));
+	      _index_object(const_cast<pg_log_entry_t*>(&(*i)));
 	    }
 	  }
 
@@ -415,9 +547,10 @@ public:
 
     void index(pg_log_entry_t& e) {
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        if (objects.count(e.soid) == 0 ||
-            objects[e.soid]->version < e.version)
-          objects[e.soid] = &e;
+	auto p = objects.find(&e.soid);
+        if (p == objects.end() ||
+            p->second->version < e.version)
+          _index_object(&e);
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
 	// divergent merge_log indexes new before unindexing old
@@ -438,14 +571,14 @@ public:
       objects.clear();
       caller_ops.clear();
       extra_caller_ops.clear();
-      dup_index.clear();
+      dup_filters.clear();
       indexed_data = 0;
     }
 
     void unindex(const pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
       if (indexed_data & PGLOG_INDEXED_OBJECTS) {
-	auto it = objects.find(e.soid);
+	auto it = objects.find(&e.soid);
         if (it != objects.end() && it->second->version == e.version)
           objects.erase(it);
       }
@@ -461,8 +594,7 @@ public:
         for (auto j = e.extra_reqids.begin();
              j != e.extra_reqids.end();
              ++j) {
-          for (ceph::unordered_multimap<osd_reqid_t,pg_log_entry_t*>::iterator k =
-		 extra_caller_ops.find(j->first);
+          for (auto k = extra_caller_ops.find(j->first);
                k != extra_caller_ops.end() && k->first == j->first;
                ++k) {
             if (k->second == &e) {
@@ -474,18 +606,34 @@ public:
       }
     }
 
-    void index(pg_log_dup_t& e) {
+    /// index the dup at i, which has just been added to dups
+    void index(dup_iterator i) {
       if (indexed_data & PGLOG_INDEXED_DUPS) {
-	dup_index[e.reqid] = &e;
+	_index_dup(i);
       }
     }
 
+    /// call before removing e from the front or back of dups
     void unindex(const pg_log_dup_t& e) {
-      if (indexed_data & PGLOG_INDEXED_DUPS) {
-	auto i = dup_index.find(e.reqid);
-	if (i != dup_index.end()) {
-	  dup_index.erase(i);
+      // whole buckets are only dropped once no dup they cover remains
+      // (extra reqids share their op's version); otherwise e just leaves
+      // stale bits behind, but no bucket may keep pointing at it.
+      if (!(indexed_data & PGLOG_INDEXED_DUPS) || dups.empty())
+	return;
+      if (&e == &dups.front()) {
+	auto next = std::next(dups.cbegin());
+	while (!dup_filters.empty() &&
+	       (next == dups.cend() ||
+		dup_filters.front().last < next->version)) {
+	  dup_filters.pop_front();
 	}
+	if (!dup_filters.empty() && &*dup_filters.front().first == &e)
+	  dup_filters.front().first = next;
+      } else if (&e == &dups.back()) {
+	if (!dup_filters.empty() && &*dup_filters.back().first == &e)
+	  dup_filters.pop_back();
+      } else {
+	assert(0 == "dups are only removed from the front or back");
       }
     }
 
@@ -511,7 +659,7 @@ public:
 
       // to our index
       if ((indexed_data & PGLOG_INDEXED_OBJECTS) && e.object_is_indexed()) {
-        objects[e.soid] = &(log.back());
+        _index_object(&(log.back()));
       }
       if (indexed_data & PGLOG_INDEXED_CALLER_OPS) {
         if (e.reqid_is_indexed()) {
@@ -910,8 +1058,7 @@ protected:
 		       << " last_divergent_update: " << last_divergent_update
 		       << dendl;
 
-    ceph::unordered_map<hobject_t, pg_log_entry_t*>::const_iterator objiter =
-      log.objects.find(hoid);
+    auto objiter = log.objects.find(&hoid);
     if (objiter != log.objects.end() &&
 	objiter->second->version >= first_divergent_update) {
       /// Case 1)
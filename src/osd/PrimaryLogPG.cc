@@ -193,11 +193,12 @@ Context *PrimaryLogPG::bless_context(Context *c) {
 class PrimaryLogPG::C_PG_ObjectContext : public Context {
   PrimaryLogPGRef pg;
   ObjectContext *obc;
+  uint64_t cache_tag;
   public:
   C_PG_ObjectContext(PrimaryLogPG *p, ObjectContext *o) :
-    pg(p), obc(o) {}
+    pg(p), obc(o), cache_tag(p->object_info_cache_tag()) {}
   void finish(int r) override {
-    pg->object_context_destructor_callback(obc);
+    pg->object_context_destructor_callback(obc, cache_tag);
   }
 };
 
@@ -276,14 +277,31 @@ void PrimaryLogPG::OpContext::finish_read(PrimaryLogPG *pg)
 {
   assert(inflightreads > 0);
   --inflightreads;
-  if (async_reads_complete()) {
-    assert(pg->in_progress_async_reads.size());
-    assert(pg->in_progress_async_reads.front().second == this);
-    pg->in_progress_async_reads.pop_front();
+  if (!async_reads_complete()) {
+    return;
+  }
+
+  // Replicated reads can come back out of order.  Keep replies in order
+  // per object: a read that finished early waits for older ones on the
+  // same object, and finishing those releases it.
+  const hobject_t soid = obc->obs.oi.soid;
+  auto& q = pg->in_progress_async_reads;
+  assert(q.size());
+  while (true) {
+    auto i = std::find_if(
+      q.begin(), q.end(),
+      [&soid](const pair<OpRequestRef, OpContext*>& p) {
+	return p.second->obc->obs.oi.soid == soid;
+      });
+    if (i == q.end() || !i->second->async_reads_complete()) {
+      break;
+    }
+    OpContext *ctx = i->second;
+    q.erase(i);
 
     // Restart the op context now that all reads have been
     // completed. Read failures will be handled by the op finisher
-    pg->execute_ctx(this);
+    pg->execute_ctx(ctx);
   }
 }
 
@@ -375,7 +393,7 @@ void PrimaryLogPG::on_local_recover(
   if (!is_delete && pg_log.get_missing().is_missing(recovery_info.soid) &&
       pg_log.get_missing().get_items().find(recovery_info.soid)->second.need > recovery_info.version) {
     assert(is_primary());
-    const pg_log_entry_t *latest = pg_log.get_log().objects.find(recovery_info.soid)->second;
+    const pg_log_entry_t *latest = pg_log.get_log().objects.find(&recovery_info.soid)->second;
     if (latest->op == pg_log_entry_t::LOST_REVERT &&
 	latest->reverting_to == recovery_info.version) {
       dout(10) << " got old revert version " << recovery_info.version
@@ -517,6 +535,18 @@ void PrimaryLogPG::schedule_recovery_work(
   osd->queue_recovery_context(this, c);
 }
 
+void PrimaryLogPG::scrub_read_ready()
+{
+  assert(is_locked());
+  if (scrubber.primary_scrubmap_pos.waiting_read ||
+      scrubber.replica_scrubmap_pos.waiting_read) {
+    dout(20) << __func__ << " requeueing scrub" << dendl;
+    scrubber.primary_scrubmap_pos.waiting_read = false;
+    scrubber.replica_scrubmap_pos.waiting_read = false;
+    requeue_scrub();
+  }
+}
+
 void PrimaryLogPG::send_message_osd_cluster(
   int peer, Message *m, epoch_t from_epoch)
 {
@@ -1701,6 +1731,28 @@ void PrimaryLogPG::handle_backoff(OpRequestRef& op)
   session->ack_backoff(cct, m->pgid, m->id, begin, end);
 }
 
+bool PrimaryLogPG::can_run_inline(OpRequestRef& op)
+{
+  assert(is_locked());
+  // get_object_context() and the store read both fall back to kv
+  // lookups on a cache miss, which must not run on a messenger thread
+  const MOSDOp *m = static_cast<const MOSDOp*>(op->get_req());
+  if (m->get_snapid() != CEPH_NOSNAP) {
+    return false;  // clones are found through the snapset
+  }
+  const hobject_t& soid = m->get_hobj();
+  if (!object_contexts.lookup(soid)) {
+    dout(20) << __func__ << " " << soid << " no cached obc" << dendl;
+    return false;
+  }
+  if (!osd->store->is_cached(
+	ch, ghobject_t(soid, ghobject_t::NO_GEN, pg_whoami.shard))) {
+    dout(20) << __func__ << " " << soid << " onode not cached" << dendl;
+    return false;
+  }
+  return true;
+}
+
 void PrimaryLogPG::do_request(
   OpRequestRef& op,
   ThreadPool::TPHandle &handle)
@@ -3885,7 +3937,6 @@ void PrimaryLogPG::execute_ctx(OpContext *ctx)
   if (result == -EINPROGRESS || pending_async_reads) {
     // come back later.
     if (pending_async_reads) {
-      assert(pool.info.is_erasure());
       in_progress_async_reads.push_back(make_pair(op, ctx));
       ctx->start_async_reads(this);
     }
@@ -4062,12 +4113,15 @@ void PrimaryLogPG::log_op_stats(OpContext *ctx)
   uint64_t inb = ctx->bytes_written;
   uint64_t outb = ctx->bytes_read;
 
+  op->mark_thread();
   osd->logger->inc(l_osd_op);
+  osd->logger->inc(l_osd_op_thread_hops, op->get_thread_hops());
 
   osd->logger->inc(l_osd_op_outb, outb);
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->tinc(l_osd_op_lat, latency);
   osd->logger->tinc(l_osd_op_process_lat, process_latency);
+  osd->note_client_op_latency(now, latency);
 
   if (op->may_read() && op->may_write()) {
     osd->logger->inc(l_osd_op_rw);
@@ -5402,13 +5456,25 @@ int PrimaryLogPG::do_read(OpContext *ctx, OSDOp& osd_op) {
     trimmed_read = true;
   }
 
+  // replicated reads may wait for the store asynchronously too, but only
+  // plain client reads: nested ops (checksum, cmpext, ...) want the data
+  // right away, and SYNC_READ says so on the tin
+  bool async_read = pool.info.is_erasure();
+  if (!async_read &&
+      op.op == CEPH_OSD_OP_READ &&
+      ctx->op && !ctx->op->may_write() &&
+      ctx->ops && !ctx->ops->empty() &&
+      &osd_op >= &ctx->ops->front() && &osd_op <= &ctx->ops->back()) {
+    async_read = cct->_conf->get_val<bool>("osd_async_read");
+  }
+
   // read into a buffer
   int result = 0;
   if (trimmed_read && op.extent.length == 0) {
     // read size was trimmed to zero and it is expected to do nothing
     // a read operation of 0 bytes does *not* do nothing, this is why
     // the trimmed_read boolean is needed
-  } else if (pool.info.is_erasure()) {
+  } else if (async_read) {
     // The initialisation below is required to silence a false positive
     // -Wmaybe-uninitialized warning
     boost::optional<uint32_t> maybe_crc = boost::make_optional(false, uint32_t());
@@ -5721,6 +5787,10 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	result = do_read(ctx, osd_op);
       } else {
 	result = op_finisher->execute();
+	if (result == -EIO && !pool.info.is_erasure()) {
+	  // an async replicated read; repair as a sync one would
+	  result = rep_repair_primary_object(soid, ctx->op);
+	}
       }
       break;
 
@@ -7279,28 +7349,17 @@ int PrimaryLogPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	bool truncated = false;
 	bufferlist bl;
 	if (oi.is_omap()) {
-	  ObjectMap::ObjectMapIterator iter = osd->store->get_omap_iterator(
-	    ch, ghobject_t(soid)
-	    );
-          if (!iter) {
-            result = -ENOENT;
+	  // the store hands back the reply payload in one go
+	  int r = osd->store->omap_get_range(
+	    ch, ghobject_t(soid), start_after, filter_prefix, max_return,
+	    cct->_conf->osd_max_omap_bytes_per_request, &bl, &truncated);
+          if (r < 0) {
+            result = r;
             goto fail;
           }
-	  iter->upper_bound(start_after);
-	  if (filter_prefix > start_after) iter->lower_bound(filter_prefix);
-	  for (num = 0;
-	       iter->valid() &&
-		 iter->key().substr(0, filter_prefix.size()) == filter_prefix;
-	       ++num, iter->next(false)) {
-	    dout(20) << "Found key " << iter->key() << dendl;
-	    if (num >= max_return ||
-		bl.length() >= cct->_conf->osd_max_omap_bytes_per_request) {
-	      truncated = true;
-	      break;
-	    }
-	    encode(iter->key(), bl);
-	    encode(iter->value(), bl);
-	  }
+	  num = r;
+	  dout(20) << " got " << num << " keys"
+		   << (truncated ? ", truncated" : "") << dendl;
 	} // else return empty out_set
 	encode(num, osd_op.outdata);
 	osd_op.outdata.claim_append(bl);
@@ -10690,7 +10749,7 @@ void PrimaryLogPG::check_blacklisted_obc_watchers(ObjectContextRef obc)
 void PrimaryLogPG::populate_obc_watchers(ObjectContextRef obc)
 {
   assert(is_active());
-  auto it_objects = pg_log.get_log().objects.find(obc->obs.oi.soid);
+  auto it_objects = pg_log.get_log().objects.find(&obc->obs.oi.soid);
   assert((recovering.count(obc->obs.oi.soid) ||
 	  !is_missing_object(obc->obs.oi.soid)) ||
 	 (it_objects != pg_log.get_log().objects.end() && // or this is a revert... see recover_primary()
@@ -10810,7 +10869,7 @@ ObjectContextRef PrimaryLogPG::get_object_context(
   bool can_create,
   const map<string, bufferlist> *attrs)
 {
-  auto it_objects = pg_log.get_log().objects.find(soid);
+  auto it_objects = pg_log.get_log().objects.find(&soid);
   assert(
     attrs || !pg_log.get_missing().is_missing(soid) ||
     // or this is a revert... see recover_primary()
@@ -10825,47 +10884,52 @@ ObjectContextRef PrimaryLogPG::get_object_context(
 	     << dendl;
   } else {
     dout(10) << __func__ << ": obc NOT found in cache: " << soid << dendl;
-    // check disk
-    bufferlist bv;
-    if (attrs) {
-      auto it_oi = attrs->find(OI_ATTR);
-      assert(it_oi != attrs->end());
-      bv = it_oi->second;
+    object_info_t oi;
+    // attrs come with recovery, which supersedes anything we stashed
+    if (take_cached_object_info(soid, &oi) && !attrs) {
+      dout(10) << __func__ << ": using cached oi for " << soid << dendl;
     } else {
-      int r = pgbackend->objects_get_attr(soid, OI_ATTR, &bv);
-      if (r < 0) {
-	if (!can_create) {
+      // check disk
+      bufferlist bv;
+      if (attrs) {
+	auto it_oi = attrs->find(OI_ATTR);
+	assert(it_oi != attrs->end());
+	bv = it_oi->second;
+      } else {
+	int r = pgbackend->objects_get_attr(soid, OI_ATTR, &bv);
+	if (r < 0) {
+	  if (!can_create) {
+	    dout(10) << __func__ << ": no obc for soid "
+		     << soid << " and !can_create"
+		     << dendl;
+	    return ObjectContextRef();   // -ENOENT!
+	  }
+
 	  dout(10) << __func__ << ": no obc for soid "
-		   << soid << " and !can_create"
+		   << soid << " but can_create"
 		   << dendl;
-	  return ObjectContextRef();   // -ENOENT!
+	  // new object.
+	  object_info_t oi(soid);
+	  SnapSetContext *ssc = get_snapset_context(
+	    soid, true, 0, false);
+	  assert(ssc);
+	  obc = create_object_context(oi, ssc);
+	  dout(10) << __func__ << ": " << obc << " " << soid
+		   << " " << obc->rwstate
+		   << " oi: " << obc->obs.oi
+		   << " ssc: " << obc->ssc
+		   << " snapset: " << obc->ssc->snapset << dendl;
+	  return obc;
 	}
-
-	dout(10) << __func__ << ": no obc for soid "
-		 << soid << " but can_create"
-		 << dendl;
-	// new object.
-	object_info_t oi(soid);
-	SnapSetContext *ssc = get_snapset_context(
-	  soid, true, 0, false);
-        assert(ssc);
-	obc = create_object_context(oi, ssc);
-	dout(10) << __func__ << ": " << obc << " " << soid
-		 << " " << obc->rwstate
-		 << " oi: " << obc->obs.oi
-		 << " ssc: " << obc->ssc
-		 << " snapset: " << obc->ssc->snapset << dendl;
-	return obc;
       }
-    }
 
-    object_info_t oi;
-    try {
-      bufferlist::const_iterator bliter = bv.begin();
-      decode(oi, bliter);
-    } catch (...) {
-      dout(0) << __func__ << ": obc corrupt: " << soid << dendl;
-      return ObjectContextRef();   // -ENOENT!
+      try {
+	bufferlist::const_iterator bliter = bv.begin();
+	decode(oi, bliter);
+      } catch (...) {
+	dout(0) << __func__ << ": obc corrupt: " << soid << dendl;
+	return ObjectContextRef();   // -ENOENT!
+      }
     }
 
     assert(oi.soid.pool == (int64_t)info.pgid.pool());
@@ -11136,12 +11200,56 @@ int PrimaryLogPG::find_object_context(const hobject_t& oid,
   }
 }
 
-void PrimaryLogPG::object_context_destructor_callback(ObjectContext *obc)
+void PrimaryLogPG::object_context_destructor_callback(ObjectContext *obc,
+						      uint64_t cache_tag)
 {
+  if (cache_tag && obc->obs.exists) {
+    hobject_t soid = obc->obs.oi.soid;
+    unsigned evicted = osd->object_info_cache.put(
+      pg_id, soid, cache_tag, std::move(obc->obs.oi));
+    if (evicted)
+      osd->logger->inc(l_osd_object_info_cache_evict, evicted);
+  }
   if (obc->ssc)
     put_snapset_context(obc->ssc);
 }
 
+uint64_t PrimaryLogPG::object_info_cache_tag() const
+{
+  // ec pools also cache the remaining attrs in the obc; leave them be
+  if (!osd->object_info_cache.enabled() || pool.info.is_erasure())
+    return 0;
+  return ((uint64_t)info.history.same_interval_since << 32) |
+    object_info_cache_gen;
+}
+
+bool PrimaryLogPG::take_cached_object_info(const hobject_t& soid,
+					   object_info_t *oi)
+{
+  uint64_t tag = object_info_cache_tag();
+  if (!tag)
+    return false;
+  if (osd->object_info_cache.take(pg_id, soid, tag, oi)) {
+    osd->logger->inc(l_osd_object_info_cache_hit);
+    return true;
+  }
+  osd->logger->inc(l_osd_object_info_cache_miss);
+  return false;
+}
+
+bool PrimaryLogPG::take_cached_snapset(const hobject_t& oid, SnapSet *snapset)
+{
+  uint64_t tag = object_info_cache_tag();
+  if (!tag)
+    return false;
+  if (osd->snapset_cache.take(pg_id, oid, tag, snapset)) {
+    osd->logger->inc(l_osd_object_info_cache_hit);
+    return true;
+  }
+  osd->logger->inc(l_osd_object_info_cache_miss);
+  return false;
+}
+
 void PrimaryLogPG::add_object_context_to_pg_stat(ObjectContextRef obc, pg_stat_t *pgstat)
 {
   object_info_t& oi = obc->obs.oi;
@@ -11224,7 +11332,12 @@ SnapSetContext *PrimaryLogPG::get_snapset_context(
     }
   } else {
     bufferlist bv;
-    if (!attrs) {
+    SnapSet cached;
+    bool have_cached = take_cached_snapset(oid.get_snapdir(), &cached) &&
+      !attrs && !(oid.is_head() && !oid_existed);
+    if (have_cached) {
+      dout(10) << __func__ << " using cached snapset for " << oid << dendl;
+    } else if (!attrs) {
       int r = -ENOENT;
       if (!(oid.is_head() && !oid_existed)) {
 	r = pgbackend->objects_get_attr(oid.get_head(), SS_ATTR, &bv);
@@ -11237,8 +11350,12 @@ SnapSetContext *PrimaryLogPG::get_snapset_context(
       bv = it_ss->second;
     }
     ssc = new SnapSetContext(oid.get_snapdir());
+    ssc->cache_tag = object_info_cache_tag();
     _register_snapset_context(ssc);
-    if (bv.length()) {
+    if (have_cached) {
+      ssc->snapset = std::move(cached);
+      ssc->exists = true;
+    } else if (bv.length()) {
       bufferlist::const_iterator bvp = bv.begin();
       try {
 	ssc->snapset.decode(bvp);
@@ -11261,8 +11378,15 @@ void PrimaryLogPG::put_snapset_context(SnapSetContext *ssc)
   Mutex::Locker l(snapset_contexts_lock);
   --ssc->ref;
   if (ssc->ref == 0) {
-    if (ssc->registered)
+    if (ssc->registered) {
       snapset_contexts.erase(ssc->oid);
+      if (ssc->cache_tag && ssc->exists) {
+	unsigned evicted = osd->snapset_cache.put(
+	  pg_id, ssc->oid, ssc->cache_tag, std::move(ssc->snapset));
+	if (evicted)
+	  osd->logger->inc(l_osd_object_info_cache_evict, evicted);
+      }
+    }
     delete ssc;
   }
 }
@@ -12420,7 +12544,7 @@ uint64_t PrimaryLogPG::recover_primary(uint64_t max, ThreadPool::TPHandle &handl
     hobject_t soid;
     version_t v = p->first;
 
-    auto it_objects = pg_log.get_log().objects.find(p->second);
+    auto it_objects = pg_log.get_log().objects.find(&p->second);
     if (it_objects != pg_log.get_log().objects.end()) {
       latest = it_objects->second;
       assert(latest->is_update() || latest->is_delete());
@@ -14991,8 +15115,10 @@ void PrimaryLogPG::_scrub_finish()
     }
   }
   // Clear object context cache to get repair information
-  if (repair)
+  if (repair) {
     object_contexts.clear();
+    ++object_info_cache_gen;
+  }
 }
 
 bool PrimaryLogPG::check_osdmap_full(const set<pg_shard_t> &missing_on)
@@ -15015,6 +15141,8 @@ int PrimaryLogPG::rep_repair_primary_object(const hobject_t& soid, OpRequestRef
   }
 
   assert(!pg_log.get_missing().is_missing(soid));
+  // the object will be recovered from a replica behind our contexts
+  ++object_info_cache_gen;
   bufferlist bv;
   object_info_t oi;
   eversion_t v;
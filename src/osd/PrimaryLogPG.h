@@ -453,6 +453,7 @@ public:
 
   void schedule_recovery_work(
     GenContext<ThreadPool::TPHandle&> *c) override;
+  void scrub_read_ready() override;
 
   pg_shard_t whoami_shard() const override {
     return pg_whoami;
@@ -960,6 +961,13 @@ protected:
   map<hobject_t, SnapSetContext*> snapset_contexts;
   Mutex snapset_contexts_lock;
 
+  /// bumped when objects may change behind our contexts' backs within
+  /// an interval (repair), so that the shard cache drops what we left
+  uint32_t object_info_cache_gen = 0;
+  uint64_t object_info_cache_tag() const;
+  bool take_cached_object_info(const hobject_t& soid, object_info_t *oi);
+  bool take_cached_snapset(const hobject_t& oid, SnapSet *snapset);
+
   // debug order that client ops are applied
   map<hobject_t, map<client_t, ceph_tid_t>> debug_op_order;
 
@@ -980,7 +988,8 @@ protected:
     );
 
   void context_registry_on_change();
-  void object_context_destructor_callback(ObjectContext *obc);
+  void object_context_destructor_callback(ObjectContext *obc,
+					  uint64_t cache_tag);
   class C_PG_ObjectContext;
 
   int find_object_context(const hobject_t& oid,
@@ -1437,6 +1446,7 @@ public:
   void do_request(
     OpRequestRef& op,
     ThreadPool::TPHandle &handle) override;
+  bool can_run_inline(OpRequestRef& op) override;
   void do_op(OpRequestRef& op);
   void record_write_error(OpRequestRef op, const hobject_t &soid,
 			  MOSDOpReply *orig_reply, int r);
@@ -254,6 +254,68 @@ int ReplicatedBackend::objects_read_sync(
   return store->read(ch, ghobject_t(hoid), off, len, *bl, op_flags);
 }
 
+namespace {
+// the store fills in our own buffers; they are only handed to the caller
+// under the pg lock, once we know the pg has not reset in the meantime
+struct AsyncReadState {
+  list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+	    pair<bufferlist*, Context*> > > to_read;
+  vector<pair<int, bufferlist>> results;
+  Context *on_complete;
+  Context *on_done = nullptr;   ///< blessed, runs finish() below
+  std::atomic<unsigned> pending = {1};
+
+  AsyncReadState(
+    const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
+		    pair<bufferlist*, Context*> > > &to_read,
+    Context *on_complete)
+    : to_read(to_read), results(to_read.size()), on_complete(on_complete) {}
+  ~AsyncReadState() {
+    for (auto& i : to_read) {
+      delete i.second.second;
+    }
+    delete on_complete;
+  }
+
+  void finish() {
+    auto r = results.begin();
+    for (auto& i : to_read) {
+      i.second.first->claim(r->second);
+      if (i.second.second) {
+	i.second.second->complete(r->first);
+	i.second.second = nullptr;
+      }
+      ++r;
+    }
+    on_complete->complete(0);
+    on_complete = nullptr;
+  }
+};
+
+struct C_ReplicatedBackend_ReadsDone : public Context {
+  std::shared_ptr<AsyncReadState> state;
+  explicit C_ReplicatedBackend_ReadsDone(std::shared_ptr<AsyncReadState> s)
+    : state(s) {}
+  void finish(int r) override {
+    state->finish();
+  }
+};
+
+struct C_ReplicatedBackend_ExtentRead : public Context {
+  std::shared_ptr<AsyncReadState> state;
+  unsigned i;
+  C_ReplicatedBackend_ExtentRead(std::shared_ptr<AsyncReadState> s,
+				 unsigned i)
+    : state(s), i(i) {}
+  void finish(int r) override {
+    state->results[i].first = r;
+    if (--state->pending == 0) {
+      state->on_done->complete(0);
+    }
+  }
+};
+}
+
 void ReplicatedBackend::objects_read_async(
   const hobject_t &hoid,
   const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
@@ -261,7 +323,27 @@ void ReplicatedBackend::objects_read_async(
   Context *on_complete,
   bool fast_read)
 {
-  assert(0 == "async read is not used by replica pool");
+  auto state = std::make_shared<AsyncReadState>(to_read, on_complete);
+  state->on_done = get_parent()->bless_context(
+    new C_ReplicatedBackend_ReadsDone(state));
+  unsigned i = 0;
+  for (auto& p : to_read) {
+    ++state->pending;
+    auto c = new C_ReplicatedBackend_ExtentRead(state, i);
+    int r = store->read_async(
+      ch, ghobject_t(hoid), p.first.get<0>(), p.first.get<1>(),
+      state->results[i].second, p.first.get<2>(), c);
+    if (r != -EINPROGRESS) {
+      c->complete(r);
+    }
+    ++i;
+  }
+  dout(20) << __func__ << " " << hoid << " " << to_read.size()
+	   << " extents" << dendl;
+  if (--state->pending == 0) {
+    // everything came from cache; we already hold the pg lock
+    state->on_done->sync_complete(0);
+  }
 }
 
 class C_OSD_OnOpCommit : public Context {
@@ -617,13 +699,13 @@ int ReplicatedBackend::be_deep_scrub(
     }
 
     bufferlist bl;
-    r = store->read(
-      ch,
-      ghobject_t(
-	poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
-      pos.data_pos,
-      cct->_conf->osd_deep_scrub_stride, bl,
-      fadvise_flags);
+    r = be_deep_scrub_read(
+      poid, pos, o.size,
+      cct->_conf->osd_deep_scrub_stride,
+      fadvise_flags, &bl);
+    if (r == -EINPROGRESS) {
+      return r;
+    }
     if (r < 0) {
       dout(20) << __func__ << "  " << poid << " got "
 	       << r << " on read, read_error" << dendl;
@@ -1314,11 +1396,11 @@ void ReplicatedBackend::prepare_pull(
 	     << " at version " << pmissing.get_items().find(soid)->second.have
 	     << " rather than at version " << v << dendl;
     v = pmissing.get_items().find(soid)->second.have;
-    assert(get_parent()->get_log().get_log().objects.count(soid) &&
-	   (get_parent()->get_log().get_log().objects.find(soid)->second->op ==
+    assert(get_parent()->get_log().get_log().objects.count(&soid) &&
+	   (get_parent()->get_log().get_log().objects.find(&soid)->second->op ==
 	    pg_log_entry_t::LOST_REVERT) &&
 	   (get_parent()->get_log().get_log().objects.find(
-	     soid)->second->reverting_to ==
+	     &soid)->second->reverting_to ==
 	    v));
   }
 
@@ -20,6 +20,7 @@ struct SnapSetContext {
   int ref;
   bool registered : 1;
   bool exists : 1;
+  uint64_t cache_tag = 0;  ///< stash snapset in the shard cache on release
 
   explicit SnapSetContext(const hobject_t& o) :
     oid(o), ref(0), registered(false), exists(true) { }
@@ -3858,10 +3858,20 @@ string pg_log_entry_t::get_key_name() const
 void pg_log_entry_t::encode_with_checksum(bufferlist& bl) const
 {
   using ceph::encode;
-  bufferlist ebl(sizeof(*this)*2);
-  this->encode(ebl);
+  // same bytes as encoding a bufferlist holding the entry and then its
+  // crc, but built in place so that many entries can share one buffer
+  ceph_le32 len;
+  len = 0;
+  encode(len, bl);
+  auto len_it = bl.end();
+  len_it.advance(-4);
+  unsigned off = bl.length();
+  this->encode(bl);
+  bufferlist ebl;
+  ebl.substr_of(bl, off, bl.length() - off);
+  len = ebl.length();
+  len_it.copy_in(4, (char *)&len);
   __u32 crc = ebl.crc32c(0);
-  encode(ebl, bl);
   encode(crc, bl);
 }
 
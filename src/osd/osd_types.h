@@ -4988,6 +4988,8 @@ struct ScrubMap {
 WRITE_CLASS_ENCODER(ScrubMap::object)
 WRITE_CLASS_ENCODER(ScrubMap)
 
+struct ScrubReadahead;
+
 struct ScrubMapBuilder {
   bool deep = false;
   vector<hobject_t> ls;
@@ -4998,6 +5000,10 @@ struct ScrubMapBuilder {
   bufferhash data_hash, omap_hash;  ///< accumulatinng hash value
   uint64_t omap_keys = 0;
   uint64_t omap_bytes = 0;
+  /// deep scrub reads in flight past data_pos (see be_deep_scrub_read)
+  std::shared_ptr<ScrubReadahead> readahead;
+  /// a deep scrub read-ahead will requeue the scrub when it completes
+  bool waiting_read = false;
 
   bool empty() {
     return ls.empty();
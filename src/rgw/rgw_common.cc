@@ -163,6 +163,9 @@ int rgw_perf_start(CephContext *cct)
   plb.add_u64_counter(l_rgw_keystone_token_cache_hit, "keystone_token_cache_hit", "Keystone token cache hits");
   plb.add_u64_counter(l_rgw_keystone_token_cache_miss, "keystone_token_cache_miss", "Keystone token cache miss");
 
+  plb.add_u64_counter(l_rgw_compress_attempted_b, "compress_attempted_b", "Bytes of puts handed to the compressor");
+  plb.add_u64_counter(l_rgw_compress_skipped_b, "compress_skipped_b", "Bytes of puts stored uncompressed because they were not expected to compress");
+
   perfcounter = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(perfcounter);
   return 0;
@@ -258,6 +258,9 @@ enum {
   l_rgw_keystone_token_cache_hit,
   l_rgw_keystone_token_cache_miss,
 
+  l_rgw_compress_attempted_b,
+  l_rgw_compress_skipped_b,
+
   l_rgw_last,
 };
 
@@ -8,6 +8,17 @@
 
 //------------RGWPutObj_Compress---------------
 
+bool RGWPutObj_Compress::looks_incompressible(const bufferlist& bl)
+{
+  uint64_t sample = cct->_conf->get_val<uint64_t>("rgw_compression_sample_size");
+  if (!sample) {
+    return false;
+  }
+  double e = Compressor::estimate_entropy(bl, sample);
+  ldout(cct, 20) << "compression sample entropy " << e << dendl;
+  return e > cct->_conf->get_val<double>("rgw_compression_sample_max_entropy");
+}
+
 int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, rgw_raw_obj *pobj, bool *again)
 {
   bufferlist in_bl;
@@ -16,9 +27,17 @@ int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, r
   }
   if (bl.length() > 0) {
     // compression stuff
-    if ((ofs > 0 && compressed) ||                                // if previous part was compressed
-        (ofs == 0)) {                                             // or it's the first part
+    // the first part decides for the whole object: either every part is
+    // compressed or none is
+    if (ofs == 0 && looks_incompressible(bl)) {
+      ldout(cct, 10) << "first part looks incompressible, storing uncompressed" << dendl;
+      compressed = false;
+      if (perfcounter) perfcounter->inc(l_rgw_compress_skipped_b, bl.length());
+      in_bl.claim(bl);
+    } else if ((ofs > 0 && compressed) ||                         // if previous part was compressed
+               (ofs == 0)) {                                      // or it's the first part
       ldout(cct, 10) << "Compression for rgw is enabled, compress part " << bl.length() << dendl;
+      if (perfcounter) perfcounter->inc(l_rgw_compress_attempted_b, bl.length());
       int cr = compressor->compress(bl, in_bl);
       if (cr < 0) {
         if (ofs > 0) {
@@ -30,6 +49,12 @@ int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, r
         ldout(cct, 5) << "Compression failed with exit code " << cr
             << " for first part, storing uncompressed" << dendl;
         in_bl.claim(bl);
+      } else if (ofs == 0 && in_bl.length() >= bl.length()) {
+        compressed = false;
+        ldout(cct, 10) << "first part did not shrink (" << in_bl.length()
+            << " >= " << bl.length() << "), storing uncompressed" << dendl;
+        in_bl.clear();
+        in_bl.claim(bl);
       } else {
         compressed = true;
     
@@ -42,6 +67,7 @@ int RGWPutObj_Compress::handle_data(bufferlist& bl, off_t ofs, void **phandle, r
       }
     } else {
       compressed = false;
+      if (perfcounter) perfcounter->inc(l_rgw_compress_skipped_b, bl.length());
       in_bl.claim(bl);
     }
     // end of compression stuff
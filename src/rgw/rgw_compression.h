@@ -37,6 +37,9 @@ class RGWPutObj_Compress : public RGWPutObj_Filter
   bool compressed{false};
   CompressorRef compressor;
   std::vector<compression_block> blocks;
+
+  /// true if a sample of bl predicts that compressing it would not pay
+  bool looks_incompressible(const bufferlist& bl);
 public:
   RGWPutObj_Compress(CephContext* cct_, CompressorRef compressor,
                      RGWPutObjDataProcessor* next)
@@ -0,0 +1,69 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "acconfig.h"
+#include "common/numa.h"
+#include "gtest/gtest.h"
+
+TEST(numa, node_for_shard)
+{
+  ASSERT_EQ(-1, get_numa_node_for_shard(0, 8, {}));
+  ASSERT_EQ(-1, get_numa_node_for_shard(0, 8, {0}));
+  ASSERT_EQ(-1, get_numa_node_for_shard(3, 0, {0, 1}));
+  // contiguous blocks
+  ASSERT_EQ(0, get_numa_node_for_shard(0, 8, {0, 1}));
+  ASSERT_EQ(0, get_numa_node_for_shard(3, 8, {0, 1}));
+  ASSERT_EQ(1, get_numa_node_for_shard(4, 8, {0, 1}));
+  ASSERT_EQ(1, get_numa_node_for_shard(7, 8, {0, 1}));
+  // more nodes than shards
+  ASSERT_EQ(0, get_numa_node_for_shard(0, 2, {0, 1, 2, 3}));
+  ASSERT_EQ(2, get_numa_node_for_shard(1, 2, {0, 1, 2, 3}));
+  // sparse node ids
+  ASSERT_EQ(0, get_numa_node_for_shard(1, 4, {0, 2}));
+  ASSERT_EQ(2, get_numa_node_for_shard(2, 4, {0, 2}));
+  ASSERT_EQ(2, get_numa_node_for_shard(3, 4, {0, 2}));
+}
+
+TEST(numa, node_count)
+{
+  ASSERT_GE(get_numa_node_count(), 1);
+  auto nodes = get_online_numa_nodes();
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    ASSERT_LT(nodes[i - 1], nodes[i]);
+  }
+}
+
+#ifdef HAVE_SCHED
+TEST(numa, parse_cpu_set_list)
+{
+  cpu_set_t cpu_set;
+  size_t size;
+  ASSERT_EQ(0, parse_cpu_set_list("0-3,8,10-11\n", &size, &cpu_set));
+  ASSERT_EQ(7, CPU_COUNT_S(size, &cpu_set));
+  ASSERT_TRUE(CPU_ISSET_S(0, size, &cpu_set));
+  ASSERT_TRUE(CPU_ISSET_S(3, size, &cpu_set));
+  ASSERT_FALSE(CPU_ISSET_S(4, size, &cpu_set));
+  ASSERT_TRUE(CPU_ISSET_S(8, size, &cpu_set));
+  ASSERT_FALSE(CPU_ISSET_S(9, size, &cpu_set));
+  ASSERT_TRUE(CPU_ISSET_S(11, size, &cpu_set));
+
+  ASSERT_EQ(0, parse_cpu_set_list("5", &size, &cpu_set));
+  ASSERT_EQ(1, CPU_COUNT_S(size, &cpu_set));
+
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("3-1", &size, &cpu_set));
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("a", &size, &cpu_set));
+  ASSERT_EQ(-EINVAL, parse_cpu_set_list("1;2", &size, &cpu_set));
+}
+
+TEST(numa, node0_cpu_set)
+{
+  cpu_set_t cpu_set;
+  size_t size;
+  int r = get_numa_node_cpu_set(0, &size, &cpu_set);
+  if (r == -ENOENT) {
+    return;  // no sysfs numa info here
+  }
+  ASSERT_EQ(0, r);
+  ASSERT_GT(CPU_COUNT_S(size, &cpu_set), 0);
+}
+#endif
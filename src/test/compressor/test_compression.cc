@@ -383,6 +383,35 @@ TEST(ZlibCompressor, zlib_isal_compatibility)
 }
 #endif
 
+TEST(Compressor, estimate_entropy)
+{
+  bufferlist empty;
+  EXPECT_EQ(0.0, Compressor::estimate_entropy(empty, 4096));
+
+  bufferlist zeros;
+  zeros.append_zero(65536);
+  EXPECT_EQ(0.0, Compressor::estimate_entropy(zeros, 4096));
+
+  bufferlist text;
+  while (text.length() < 65536) {
+    text.append("The quick brown fox jumps over the lazy dog. ");
+  }
+  EXPECT_LT(Compressor::estimate_entropy(text, 4096), 0.6);
+
+  bufferlist random;
+  for (unsigned i = 0; i < 65536; ++i) {
+    random.append((char)(rand() & 0xff));
+  }
+  EXPECT_GT(Compressor::estimate_entropy(random, 4096), 0.95);
+
+  // only the sampled prefix counts, across buffer boundaries
+  bufferlist mixed;
+  mixed.append_zero(1000);
+  mixed.append(random);
+  EXPECT_EQ(0.0, Compressor::estimate_entropy(mixed, 1000));
+  EXPECT_GT(Compressor::estimate_entropy(mixed, 1001), 0.0);
+}
+
 TEST(CompressionPlugin, all)
 {
   CompressorRef compressor;
@@ -5,6 +5,7 @@
  * Author: Igor Fedotov, ifedotov@suse.com
  */
 #include <iostream>
+#include <thread>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
 
@@ -14,6 +15,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/MagazineAllocator.h"
 
 #include <boost/random/uniform_int.hpp>
 typedef boost::mt11213b gen_type;
@@ -40,6 +42,8 @@ public:
   }
   void doOverwriteTest(uint64_t capacity, uint64_t prefill,
     uint64_t overwrite);
+  utime_t doContentionTest(uint64_t capacity, unsigned threads,
+    uint64_t ops_per_thread);
 };
 
 const uint64_t _1m = 1024 * 1024;
@@ -329,10 +333,158 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+/*
+ * Age the allocator the way months of RBD overwrites do: fill it up with
+ * mixed size allocations, then keep freeing random pieces and allocating
+ * again.  After every round report how fragmented the free space is and
+ * how many extents a large write gets split into.
+ */
+TEST_P(AllocTest, test_alloc_bench_aging)
+{
+  uint64_t capacity = uint64_t(64) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  uint64_t big_write = 4 * _1m;
+  PExtentVector tmp;
+  AllocTracker at(capacity, alloc_unit);
+
+  init_alloc(capacity, alloc_unit);
+  alloc->init_add_free(0, capacity);
+
+  gen_type rng(time(NULL));
+  boost::uniform_int<> u1(0, 9); // 4K-2M
+  boost::uniform_int<> u2(0, 4); // 4K-64K
+
+  utime_t start = ceph_clock_now();
+  for (uint64_t i = 0; i < capacity / 10 * 8; ) {
+    uint32_t want = alloc_unit << u1(rng);
+    tmp.clear();
+    auto r = alloc->allocate(want, alloc_unit, 0, 0, &tmp);
+    ASSERT_EQ((int64_t)want, r);
+    i += r;
+    for (auto a : tmp) {
+      ASSERT_TRUE(at.push(a.offset, a.length));
+    }
+  }
+
+  for (unsigned round = 0; round < 10; ++round) {
+    // churn 10% of the capacity in small overwrites
+    for (uint64_t i = 0; i < capacity / 10; ) {
+      uint64_t want = alloc_unit << u2(rng);
+      uint64_t released = 0;
+      while (released < want) {
+	uint64_t o = 0;
+	uint32_t l = 0;
+	if (!at.pop_random(rng, &o, &l, want - released)) {
+	  break;
+	}
+	interval_set<uint64_t> release_set;
+	release_set.insert(o, l);
+	alloc->release(release_set);
+	released += l;
+      }
+      tmp.clear();
+      auto r = alloc->allocate(want, alloc_unit, 0, 0, &tmp);
+      ASSERT_EQ((int64_t)want, r);
+      i += r;
+      for (auto a : tmp) {
+	ASSERT_TRUE(at.push(a.offset, a.length));
+      }
+    }
+
+    uint64_t extents = 0;
+    const unsigned probes = 16;
+    for (unsigned p = 0; p < probes; ++p) {
+      tmp.clear();
+      auto r = alloc->allocate(big_write, alloc_unit, 0, 0, &tmp);
+      ASSERT_EQ((int64_t)big_write, r);
+      extents += tmp.size();
+      alloc->release(tmp);
+    }
+    std::cout << "round " << round
+	      << " fragmentation " << alloc->get_fragmentation(alloc_unit)
+	      << " extents per 4M write " << (double)extents / probes
+	      << std::endl;
+  }
+  std::cout << "Executed in " << ceph_clock_now() - start << std::endl;
+  dump_mempools();
+}
+
+/*
+ * Each thread keeps a window of small allocations and, once it is full,
+ * releases a random one for every new one, the way op shards allocate
+ * and the kv thread releases in BlueStore.
+ */
+utime_t AllocTest::doContentionTest(uint64_t capacity, unsigned threads,
+  uint64_t ops_per_thread)
+{
+  uint64_t alloc_unit = 4096;
+  const size_t window = 256;
+  std::vector<std::thread> workers;
+  utime_t start = ceph_clock_now();
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      gen_type rng(time(NULL) + t);
+      boost::uniform_int<> u1(0, 4); // 4K-64K
+      std::vector<PExtentVector> held;
+      for (uint64_t i = 0; i < ops_per_thread; ++i) {
+	if (held.size() == window) {
+	  boost::uniform_int<> u2(0, window - 1);
+	  size_t victim = u2(rng);
+	  alloc->release(held[victim]);
+	  held[victim].swap(held.back());
+	  held.pop_back();
+	}
+	PExtentVector tmp;
+	uint64_t want = alloc_unit << u1(rng);
+	auto r = alloc->allocate(want, alloc_unit, 0, 0, &tmp);
+	ASSERT_EQ((int64_t)want, r);
+	held.push_back(std::move(tmp));
+      }
+      for (auto& e : held) {
+	alloc->release(e);
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  utime_t elapsed = ceph_clock_now() - start;
+  EXPECT_EQ(capacity, alloc->get_free());
+  return elapsed;
+}
+
+TEST_P(AllocTest, test_alloc_bench_contention)
+{
+  uint64_t capacity = uint64_t(64) * 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 4096;
+  uint64_t ops = 1000000;
+  for (unsigned threads : {1, 4, 16}) {
+    init_alloc(capacity, alloc_unit);
+    alloc->init_add_free(0, capacity);
+    utime_t plain = doContentionTest(capacity, threads, ops / threads);
+    alloc->shutdown();
+
+    auto backing = Allocator::create(g_ceph_context, string(GetParam()),
+				     capacity, alloc_unit);
+    auto m = new MagazineAllocator(g_ceph_context, backing, alloc_unit,
+				   threads, 16 * _1m, 16 * alloc_unit);
+    alloc.reset(m);
+    alloc->init_add_free(0, capacity);
+    utime_t cached = doContentionTest(capacity, threads, ops / threads);
+    auto st = m->get_stats();
+    alloc->shutdown();
+    std::cout << threads << " threads: " << ops << " ops in " << plain
+	      << " plain, " << cached << " cached (hits " << st.hits
+	      << " misses " << st.misses << " refills " << st.refills
+	      << " drains " << st.drains << ")" << std::endl;
+  }
+  dump_mempools();
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "avl"));
 
 #else
 
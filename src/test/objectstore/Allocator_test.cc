@@ -14,6 +14,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/MagazineAllocator.h"
 
 #include <boost/random/uniform_int.hpp>
 typedef boost::mt11213b gen_type;
@@ -316,10 +317,112 @@ TEST_P(AllocTest, test_alloc_bug_24598)
   EXPECT_EQ(tmp.size(), 1);
 }
 
+TEST_P(AllocTest, test_alloc_foreach_free)
+{
+  uint64_t block_size = 4096;
+  uint64_t capacity = 1024 * block_size;
+  init_alloc(capacity, block_size);
+  alloc->init_add_free(0, 256 * block_size);
+  alloc->init_add_free(512 * block_size, 512 * block_size);
+  PExtentVector extents;
+  EXPECT_EQ(64 * (int64_t)block_size,
+	    alloc->allocate(64 * block_size, block_size, 0, 0, &extents));
+
+  interval_set<uint64_t> free;
+  alloc->foreach_free([&](uint64_t offset, uint64_t length) {
+      ASSERT_FALSE(free.intersects(offset, length));
+      free.insert(offset, length);
+    });
+  EXPECT_EQ(alloc->get_free(), free.size());
+  for (auto& e : extents) {
+    EXPECT_FALSE(free.intersects(e.offset, e.length));
+  }
+  // what we enumerate is enough to rebuild the allocator
+  init_alloc(capacity, block_size);
+  for (auto p = free.begin(); p != free.end(); ++p) {
+    alloc->init_add_free(p.get_start(), p.get_len());
+  }
+  EXPECT_EQ(free.size(), alloc->get_free());
+  alloc->shutdown();
+}
+
+TEST_P(AllocTest, test_alloc_magazine)
+{
+  uint64_t block_size = 4096;
+  uint64_t capacity = 1024 * block_size;
+  MagazineAllocator *m = new MagazineAllocator(
+    g_ceph_context,
+    Allocator::create(g_ceph_context, string(GetParam()), capacity,
+		      block_size),
+    block_size, 2, 64 * block_size, 16 * block_size);
+  alloc.reset(m);
+  alloc->init_add_free(0, capacity);
+
+  // small allocations come from the magazines and never overlap
+  interval_set<uint64_t> used;
+  for (unsigned i = 0; i < 64; ++i) {
+    PExtentVector extents;
+    uint64_t want = block_size * (1 + i % 16);
+    EXPECT_EQ((int64_t)want, alloc->allocate(want, block_size, 0, 0, &extents));
+    for (auto& e : extents) {
+      ASSERT_FALSE(used.intersects(e.offset, e.length));
+      used.insert(e.offset, e.length);
+    }
+  }
+  auto st = m->get_stats();
+  EXPECT_GT(st.hits, 0u);
+  EXPECT_GT(st.refills, 0u);
+  EXPECT_GT(st.bypass, 0u);
+  EXPECT_EQ(capacity, alloc->get_free() + used.size());
+
+  // a request that is not one size class is not split up by the cache
+  {
+    PExtentVector extents;
+    uint64_t bypass = m->get_stats().bypass;
+    EXPECT_EQ((int64_t)(3 * block_size),
+	      alloc->allocate(3 * block_size, block_size, 0, 0, &extents));
+    EXPECT_EQ(bypass + 1, m->get_stats().bypass);
+    EXPECT_EQ(1u, extents.size());
+    for (auto& e : extents) {
+      ASSERT_FALSE(used.intersects(e.offset, e.length));
+      used.insert(e.offset, e.length);
+    }
+  }
+
+  // freed extents are cached, then reused
+  alloc->release(used);
+  EXPECT_EQ(capacity, alloc->get_free());
+  EXPECT_GT(m->get_stats().cached_bytes, 0u);
+  {
+    PExtentVector extents, again;
+    EXPECT_EQ((int64_t)block_size,
+	      alloc->allocate(block_size, block_size, 0, 0, &extents));
+    alloc->release(extents);
+    uint64_t hits = m->get_stats().hits;
+    EXPECT_EQ((int64_t)block_size,
+	      alloc->allocate(block_size, block_size, 0, 0, &again));
+    EXPECT_EQ(hits + 1, m->get_stats().hits);
+    EXPECT_EQ(extents[0].offset, again[0].offset);
+    alloc->release(again);
+  }
+
+  // a request the backing allocator can only satisfy with the cached space
+  {
+    PExtentVector extents;
+    EXPECT_EQ((int64_t)capacity,
+	      alloc->allocate(capacity, block_size, 0, 0, &extents));
+    EXPECT_EQ(0u, m->get_stats().cached_bytes);
+    EXPECT_EQ(0u, alloc->get_free());
+    alloc->release(extents);
+  }
+  EXPECT_EQ(capacity, alloc->get_free());
+  alloc->shutdown();
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "avl"));
 
 #else
 
@@ -16,6 +16,8 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <atomic>
+#include <new>
 #include <string>
 #include <iostream>
 
@@ -27,6 +29,28 @@ using namespace std;
 #include "global/global_init.h"
 #include "os/ObjectStore.h"
 
+// count every heap allocation so we can report allocations per op
+static std::atomic<uint64_t> allocs = { 0 };
+
+void *operator new(size_t size)
+{
+  allocs++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
 class Transaction {
  private:
   ObjectStore::Transaction t;
@@ -43,44 +67,57 @@ class Transaction {
   };
   static Tick write_ticks, setattr_ticks, omap_setkeys_ticks, omap_rmkeys_ticks;
   static Tick encode_ticks, decode_ticks, iterate_ticks;
+  static uint64_t build_allocs, encode_allocs, decode_allocs;
 
   void write(coll_t cid, const ghobject_t& oid, uint64_t off, uint64_t len,
              const bufferlist& data) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.write(cid, oid, off, len, data);
     write_ticks.add(Cycles::rdtsc() - start_time);
+    build_allocs += allocs - start_allocs;
   }
   void setattr(coll_t cid, const ghobject_t& oid, const string &name,
                bufferlist& val) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.setattr(cid, oid, name, val);
     setattr_ticks.add(Cycles::rdtsc() - start_time);
+    build_allocs += allocs - start_allocs;
   }
   void omap_setkeys(coll_t cid, const ghobject_t &oid,
                     const map<string, bufferlist> &attrset) {
 
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.omap_setkeys(cid, oid, attrset);
     omap_setkeys_ticks.add(Cycles::rdtsc() - start_time);
+    build_allocs += allocs - start_allocs;
   }
   void omap_rmkeys(coll_t cid, const ghobject_t &oid,
                    const set<string> &keys) {
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.omap_rmkeys(cid, oid, keys);
     omap_rmkeys_ticks.add(Cycles::rdtsc() - start_time);
+    build_allocs += allocs - start_allocs;
   }
 
   void apply_encode_decode() {
     bufferlist bl;
     ObjectStore::Transaction d;
+    uint64_t start_allocs = allocs;
     uint64_t start_time = Cycles::rdtsc();
     t.encode(bl);
     encode_ticks.add(Cycles::rdtsc() - start_time);
+    encode_allocs += allocs - start_allocs;
 
     auto bliter = bl.cbegin();
+    start_allocs = allocs;
     start_time = Cycles::rdtsc();
     d.decode(bliter);
     decode_ticks.add(Cycles::rdtsc() - start_time);
+    decode_allocs += allocs - start_allocs;
   }
 
   void apply_iterate() {
@@ -135,6 +172,13 @@ class Transaction {
     cerr << " decode op: " << Cycles::to_microseconds(Transaction::decode_ticks.ticks) << "us count: " << Transaction::decode_ticks.count << std::endl;
     cerr << " iterate op: " << Cycles::to_microseconds(Transaction::iterate_ticks.ticks) << "us count: " << Transaction::iterate_ticks.count << std::endl;
   }
+  static void dump_allocs(uint64_t times) {
+    if (!times)
+      return;
+    cerr << " allocations per rados op: build " << (double)build_allocs / times
+         << " encode " << (double)encode_allocs / times
+         << " decode " << (double)decode_allocs / times << std::endl;
+  }
 };
 
 class PerfCase {
@@ -235,6 +279,7 @@ const ghobject_t PerfCase::pglog_oid(hobject_t(sobject_t(object_t("cid_pglog"),
 const ghobject_t PerfCase::info_oid(hobject_t(sobject_t(object_t("infos"), 0)));
 Transaction::Tick Transaction::write_ticks, Transaction::setattr_ticks, Transaction::omap_setkeys_ticks, Transaction::omap_rmkeys_ticks;
 Transaction::Tick Transaction::encode_ticks, Transaction::decode_ticks, Transaction::iterate_ticks;
+uint64_t Transaction::build_allocs, Transaction::encode_allocs, Transaction::decode_allocs;
 
 void usage(const string &name) {
   cerr << "Usage: " << name << " [times] "
@@ -263,6 +308,7 @@ int main(int argc, char **argv)
   PerfCase c;
   uint64_t ticks = c.rados_write_4k(times);
   Transaction::dump_stat();
+  Transaction::dump_allocs(times);
   cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(ticks) << "us." << std::endl;
 
   return 0;
@@ -1096,6 +1096,30 @@ TEST_P(StoreTest, CompressionTest) {
   doCompressionTest();
 }
 
+TEST_P(StoreTest, CompressionThreadsTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_compression_threads", "4");
+  SetVal(g_conf, "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf, "bluestore_compression_mode", "force");
+  g_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(store->mount(), 0);
+  doCompressionTest();
+
+  // a tiny queue forces most blobs back onto the writing thread
+  SetVal(g_conf, "bluestore_compression_queue_max_bytes", "65536");
+  g_conf->apply_changes(NULL);
+  doCompressionTest();
+
+  SetVal(g_conf, "bluestore_compression_threads", "0");
+  SetVal(g_conf, "bluestore_compression_queue_max_bytes", "67108864");
+  g_conf->apply_changes(NULL);
+  store->umount();
+  ASSERT_EQ(store->mount(), 0);
+}
+
 TEST_P(StoreTest, SimpleObjectTest) {
   int r;
   coll_t cid;
@@ -4378,6 +4402,711 @@ TEST_P(StoreTestSpecificAUSize, ZipperPatternSharded) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, KVSyncPipelines) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_kv_sync_pipelines", "4");
+  StartDeferred(4096);
+
+  int r;
+  const unsigned num_colls = 16;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  bufferlist bl;
+  bl.append(std::string(4096, 'a'));
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    coll_t cid(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD));
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    cids.push_back(cid);
+    chs.push_back(ch);
+  }
+  // interleave writes across collections, and hence pipelines
+  for (unsigned n = 0; n < 32; ++n) {
+    for (unsigned i = 0; i < num_colls; ++i) {
+      ObjectStore::Transaction t;
+      t.write(cids[i], hoid, n * bl.length(), bl.length(), bl);
+      r = queue_transaction(store, chs[i], std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    auto ch = store->open_collection(cids[i]);
+    ASSERT_TRUE(ch);
+    struct stat st;
+    r = store->stat(ch, hoid, &st);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(32u * bl.length(), (uint64_t)st.st_size);
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, AllocatorSnapshot) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_allocator_snapshot", "true");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  map<ghobject_t, string> written;
+  unsigned n = 0;
+  auto write_some = [&](char c) {
+    for (unsigned i = 0; i < 8; ++i, ++n) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n),
+					  CEPH_NOSNAP)));
+      string data(4096 * (1 + n % 16), c);
+      bufferlist bl;
+      bl.append(data);
+      ObjectStore::Transaction t;
+      t.write(cid, hoid, 0, bl.length(), bl);
+      // free some space, too, so the snapshot is not a single extent
+      if (i % 3 == 0 && !written.empty()) {
+	t.remove(cid, written.begin()->first);
+	written.erase(written.begin());
+      }
+      written[hoid] = data;
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  };
+  auto verify = [&]() {
+    for (auto& i : written) {
+      bufferlist in;
+      r = store->read(ch, i.first, 0, i.second.size(), in);
+      ASSERT_EQ((int)i.second.size(), r);
+      ASSERT_EQ(i.second, in.to_str());
+    }
+  };
+
+  auto remount = [&]() {
+    ch.reset();
+    r = store->umount();
+    ASSERT_EQ(0, r);
+    r = store->mount();
+    ASSERT_EQ(0, r);
+    ch = store->open_collection(cid);
+  };
+  auto loaded = [&]() {
+    return store->get_perf_counters()->get(l_bluestore_alloc_snapshot_loaded);
+  };
+  auto rejected = [&]() {
+    return store->get_perf_counters()->get(
+      l_bluestore_alloc_snapshot_rejected);
+  };
+
+  write_some('a');
+  // the snapshot taken with one allocator is loaded into the next; any
+  // space handed out twice would show up as corrupted objects
+  for (const char *type : {"bitmap", "stupid", "avl", "bitmap"}) {
+    uint64_t n_loaded = loaded();
+    SetVal(g_conf, "bluestore_allocator", type);
+    remount();
+    ASSERT_EQ(n_loaded + 1, loaded());
+    verify();
+    write_some(type[0]);
+    verify();
+  }
+  ASSERT_EQ(0u, rejected());
+
+  // a snapshot that does not match the one recorded is not used; the
+  // freelist has changed since it was written
+  uint64_t n_loaded = loaded();
+  static_cast<BlueStore*>(store.get())->inject_alloc_snapshot_seq(1);
+  SetVal(g_conf, "bluestore_allocator_snapshot", "false");
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  SetVal(g_conf, "bluestore_allocator_snapshot", "true");
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  ASSERT_EQ(n_loaded, loaded());
+  ASSERT_EQ(1u, rejected());
+  verify();
+  write_some('s');
+  verify();
+
+  // without a snapshot recorded the freelist is used
+  SetVal(g_conf, "bluestore_allocator_snapshot", "false");
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  SetVal(g_conf, "bluestore_allocator_snapshot", "true");
+  r = store->fsck(false);
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  ASSERT_EQ(n_loaded, loaded());
+  ASSERT_EQ(1u, rejected());
+  verify();
+  {
+    ObjectStore::Transaction t;
+    for (auto& i : written) {
+      t.remove(cid, i.first);
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DeferredCoalesce) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_prefer_deferred_size", "65536");
+  SetVal(g_conf, "bluestore_deferred_batch_ops", "1");
+  SetVal(g_conf, "bluestore_deferred_coalesce", "true");
+  StartDeferred(65536);
+
+  int r;
+  const unsigned num_colls = 4;
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  vector<string> expected;
+  ghobject_t hoid(hobject_t(sobject_t("Object", CEPH_NOSNAP)));
+  for (unsigned i = 0; i < num_colls; ++i) {
+    cids.push_back(coll_t(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD)));
+    chs.push_back(store->create_new_collection(cids[i]));
+    expected.push_back(string(65536, 'a' + i));
+    ObjectStore::Transaction t;
+    t.create_collection(cids[i], 0);
+    bufferlist bl;
+    bl.append(expected[i]);
+    t.write(cids[i], hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t elided = logger->get(l_bluestore_deferred_write_elided_bytes);
+  uint64_t merged = logger->get(l_bluestore_deferred_write_merged_ios);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    // adjacent small overwrites, then one of them again
+    ObjectStore::Transaction t;
+    for (unsigned j = 1; j <= 5; ++j) {
+      unsigned off = j < 5 ? 4096 * j : 4096;
+      string data(4096, j < 5 ? 'A' + j : 'z');
+      expected[i].replace(off, data.size(), data);
+      bufferlist bl;
+      bl.append(data);
+      t.write(cids[i], hoid, off, bl.length(), bl);
+    }
+    r = queue_transaction(store, chs[i], std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_GE(logger->get(l_bluestore_deferred_write_elided_bytes) - elided,
+	    num_colls * 4096);
+  for (unsigned n = 0;
+       n < 100 && logger->get(l_bluestore_deferred_write_merged_ios) == merged;
+       ++n) {
+    usleep(100000);
+  }
+  ASSERT_GT(logger->get(l_bluestore_deferred_write_merged_ios), merged);
+
+  for (unsigned i = 0; i < num_colls; ++i) {
+    bufferlist in;
+    r = store->read(chs[i], hoid, 0, expected[i].size(), in);
+    ASSERT_EQ((int)expected[i].size(), r);
+    ASSERT_EQ(expected[i], in.to_str());
+  }
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned i = 0; i < num_colls; ++i) {
+    auto ch = store->open_collection(cids[i]);
+    bufferlist in;
+    r = store->read(ch, hoid, 0, expected[i].size(), in);
+    ASSERT_EQ((int)expected[i].size(), r);
+    ASSERT_EQ(expected[i], in.to_str());
+    ObjectStore::Transaction t;
+    t.remove(cids[i], hoid);
+    t.remove_collection(cids[i]);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, OnodeL2Cache) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  string l2path = "store_test_onode_l2cache";
+  ::unlink(l2path.c_str());
+  SetVal(g_conf, "bluestore_onode_l2cache_path", l2path.c_str());
+  SetVal(g_conf, "bluestore_onode_l2cache_size", "16777216");
+  StartDeferred(4096);
+
+  int r;
+  const unsigned num_objs = 64;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist bl;
+  bl.append(std::string(8192, 'a'));
+  for (unsigned i = 0; i < num_objs; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // removed objects must not be resurrected from the l2 cache
+    ghobject_t hoid(hobject_t(sobject_t("Object 0", CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t hits = logger->get(l_bluestore_onode_l2_hits);
+  ch = store->open_collection(cid);
+  for (unsigned i = 0; i < num_objs; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					CEPH_NOSNAP)));
+    struct stat st;
+    r = store->stat(ch, hoid, &st);
+    if (i == 0) {
+      ASSERT_EQ(r, -ENOENT);
+      continue;
+    }
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(bl.length(), (uint64_t)st.st_size);
+    bufferlist in;
+    r = store->read(ch, hoid, 0, bl.length(), in);
+    ASSERT_EQ((int)bl.length(), r);
+    ASSERT_TRUE(bl_eq(bl, in));
+  }
+  ASSERT_GE(logger->get(l_bluestore_onode_l2_hits) - hits, num_objs - 1);
+
+  // an offline repair moves the kv epoch forward, which discards the cache
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->fsck(false);
+  ASSERT_EQ(0, r);
+  r = store->repair(false);
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  logger = store->get_perf_counters();
+  hits = logger->get(l_bluestore_onode_l2_hits);
+  uint64_t misses = logger->get(l_bluestore_onode_l2_misses);
+  ch = store->open_collection(cid);
+  {
+    ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+    struct stat st;
+    r = store->stat(ch, hoid, &st);
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_onode_l2_hits), hits);
+  ASSERT_GT(logger->get(l_bluestore_onode_l2_misses), misses);
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 1; i < num_objs; ++i) {
+      t.remove(cid, ghobject_t(hobject_t(sobject_t("Object " + stringify(i),
+						   CEPH_NOSNAP))));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ::unlink(l2path.c_str());
+}
+
+TEST_P(StoreTestSpecificAUSize, OnodeFlatFormat) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_onode_format", "2");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  bufferlist bl, attr;
+  bl.append(std::string(3 * 4096, 'a'));
+  attr.append("value");
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, bl.length(), bl);
+    t.setattr(cid, hoid, "foo", attr);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t materialized = logger->get(l_bluestore_onode_materialize);
+  ch = store->open_collection(cid);
+  {
+    // stat, getattr and an xattr-only update leave the extent map encoded
+    struct stat st;
+    r = store->stat(ch, hoid, &st);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(bl.length(), (uint64_t)st.st_size);
+    bufferptr v;
+    r = store->getattr(ch, hoid, "foo", v);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(attr.length(), v.length());
+    ObjectStore::Transaction t;
+    t.setattr(cid, hoid, "bar", attr);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(materialized, logger->get(l_bluestore_onode_materialize));
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, bl.length(), in);
+    ASSERT_EQ((int)bl.length(), r);
+    ASSERT_TRUE(bl_eq(bl, in));
+  }
+  ASSERT_EQ(materialized + 1, logger->get(l_bluestore_onode_materialize));
+
+  // the passed-through extent map survives a remount
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, bl.length(), in);
+    ASSERT_EQ((int)bl.length(), r);
+    ASSERT_TRUE(bl_eq(bl, in));
+    map<string,bufferptr> aset;
+    r = store->getattrs(ch, hoid, aset);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(2u, aset.size());
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, DataTiering) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  string dbpath = "store_test_tier.db";
+  ::unlink(dbpath.c_str());
+  SetVal(g_conf, "bluestore_block_db_path", dbpath.c_str());
+  SetVal(g_conf, "bluestore_block_db_size", "1073741824");
+  SetVal(g_conf, "bluestore_block_db_create", "true");
+  SetVal(g_conf, "bluestore_bluefs_min_free", "268435456");
+  SetVal(g_conf, "bluestore_tier_fast_size", "67108864");
+  SetVal(g_conf, "bluestore_tier_small_write_size", "16384");
+  SetVal(g_conf, "bluestore_tier_agent_interval", ".1");
+  StartDeferred(4096);
+
+  int r;
+  const unsigned num_objs = 32;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  const PerfCounters* logger = store->get_perf_counters();
+  bufferlist small, big;
+  small.append(std::string(8192, 's'));
+  big.append(std::string(1048576, 'b'));
+  for (unsigned i = 0; i < num_objs; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    bufferlist& bl = i % 2 ? big : small;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // only the small writes land on the fast tier
+  ASSERT_EQ(logger->get(l_bluestore_tier_fast_write_bytes),
+	    small.length() * num_objs / 2);
+
+  auto verify = [&]() {
+    for (unsigned i = 0; i < num_objs; ++i) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					  CEPH_NOSNAP)));
+      bufferlist& bl = i % 2 ? big : small;
+      bufferlist in;
+      r = store->read(ch, hoid, 0, bl.length(), in);
+      ASSERT_EQ((int)bl.length(), r);
+      ASSERT_TRUE(bl_eq(bl, in));
+    }
+  };
+  verify();
+
+  // the reservation survives a remount and fsck accounts for it
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->fsck(false);
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  verify();
+
+  // unread data is cold; demote everything and wait for the agent
+  SetVal(g_conf, "bluestore_tier_demote_ratio", "0");
+  SetVal(g_conf, "bluestore_tier_min_read_recency_for_promote", "100");
+  g_conf->apply_changes(NULL);
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  logger = store->get_perf_counters();
+  for (unsigned i = 0; i < 100; ++i) {
+    if (logger->get(l_bluestore_tier_demote_bytes) >=
+	small.length() * num_objs / 2) {
+      break;
+    }
+    usleep(100000);
+  }
+  ASSERT_EQ(logger->get(l_bluestore_tier_demote_bytes),
+	    small.length() * num_objs / 2);
+  verify();
+
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->fsck(true);
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    for (unsigned i = 0; i < num_objs; ++i) {
+      t.remove(cid, ghobject_t(hobject_t(sobject_t("Object " + stringify(i),
+						   CEPH_NOSNAP))));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ::unlink(dbpath.c_str());
+}
+
+TEST_P(StoreTestSpecificAUSize, CompressionSkip) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_compression_mode", "aggressive");
+  SetVal(g_conf, "bluestore_compression_sample_size", "4096");
+  SetVal(g_conf, "bluestore_compression_history_misses", "4");
+  StartDeferred(4096);
+
+  int r;
+  const uint64_t len = 0x10000;
+  coll_t cid;
+  ghobject_t a(hobject_t(sobject_t("Object a", CEPH_NOSNAP)));
+  ghobject_t b(hobject_t(sobject_t("Object b", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist random, text;
+  {
+    gen_type rng(0);
+    bufferptr bp(len);
+    for (unsigned i = 0; i < len; ++i) {
+      bp[i] = rng();
+    }
+    random.append(bp);
+    while (text.length() < len) {
+      text.append("the quick brown fox jumps over the lazy dog ");
+    }
+    text.splice(len, text.length() - len);
+  }
+
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t attempted = logger->get(l_bluestore_compress_attempted_bytes);
+  uint64_t skipped = logger->get(l_bluestore_compress_skipped_bytes);
+  uint64_t woff[2] = {0, 0};
+  // write bl to the next blob of o, then check what the compressor saw
+  // and how much of the store ended up compressed
+  auto write = [&](const ghobject_t& o, bufferlist& bl,
+		   uint64_t expect_attempted, uint64_t expect_original) {
+    uint64_t& off = woff[o == b];
+    ObjectStore::Transaction t;
+    t.write(cid, o, off, bl.length(), bl);
+    off += bl.length();
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    uint64_t now_attempted = logger->get(l_bluestore_compress_attempted_bytes);
+    uint64_t now_skipped = logger->get(l_bluestore_compress_skipped_bytes);
+    ASSERT_EQ(expect_attempted, now_attempted - attempted);
+    ASSERT_EQ(len - expect_attempted, now_skipped - skipped);
+    attempted = now_attempted;
+    skipped = now_skipped;
+    struct store_statfs_t statfs;
+    r = store->statfs(&statfs);
+    ASSERT_EQ(r, 0);
+    ASSERT_EQ(expect_original, (uint64_t)statfs.compressed_original);
+  };
+
+  // random data is caught by the entropy sample, and each skip counts
+  // as a miss for the object and the collection
+  for (unsigned i = 0; i < 5; ++i) {
+    write(a, random, 0, 0);
+  }
+  // the collection's history (5 misses) keeps a new object from trying
+  write(b, text, 0, 0);
+  // a's own history says skip, until every 4th miss retries
+  write(a, text, 0, 0);
+  write(a, text, 0, 0);
+  write(a, text, len, len);
+  // the hit reset the history for both
+  write(a, text, len, 2 * len);
+  write(b, text, len, 3 * len);
+
+  // nothing we skipped was lost
+  {
+    bufferlist in, expected;
+    r = store->read(ch, a, 0, woff[0], in);
+    ASSERT_EQ((int)woff[0], r);
+    for (unsigned i = 0; i < 5; ++i) {
+      expected.append(random);
+    }
+    for (unsigned i = 0; i < 4; ++i) {
+      expected.append(text);
+    }
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, a);
+    t.remove(cid, b);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, KVSyncPipelinesNidMax) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf, "bluestore_kv_sync_pipelines", "4");
+  SetVal(g_conf, "bluestore_sync_submit_transaction", "true");
+  SetVal(g_conf, "bluestore_nid_prealloc", "16");
+  SetVal(g_conf, "bluestore_blobid_prealloc", "16");
+  StartDeferred(4096);
+
+  int r;
+  const unsigned num_objs = 256;
+  bufferlist bl;
+  bl.append(std::string(4096, 'a'));
+  // collections that hash to the non-primary pipelines only; their
+  // objects take nids (and blobids) far past the preallocated limits
+  vector<coll_t> cids;
+  vector<ObjectStore::CollectionHandle> chs;
+  for (unsigned i = 0; cids.size() < 3; ++i) {
+    coll_t cid(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD));
+    if (cid.hash_to_shard(4) == 0)
+      continue;
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    cids.push_back(cid);
+    chs.push_back(ch);
+  }
+  for (unsigned n = 0; n < num_objs; ++n) {
+    for (unsigned i = 0; i < cids.size(); ++i) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n),
+					  CEPH_NOSNAP)));
+      ghobject_t clone = hoid;
+      clone.hobj.snap = 1;
+      map<string, bufferlist> keys = {{"key", bl}};
+      ObjectStore::Transaction t;
+      t.write(cids[i], hoid, 0, bl.length(), bl);
+      t.omap_setkeys(cids[i], hoid, keys);
+      // sharing the blob gives it a blobid
+      t.clone(cids[i], hoid, clone);
+      r = queue_transaction(store, chs[i], std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  chs.clear();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  // fsck checks every nid and shared blob id against the nid_max and
+  // blobid_max persisted on disk, which is what a restart would use
+  r = store->fsck(false);
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  for (unsigned i = 0; i < cids.size(); ++i) {
+    auto ch = store->open_collection(cids[i]);
+    ASSERT_TRUE(ch);
+    ObjectStore::Transaction t;
+    for (unsigned n = 0; n < num_objs; ++n) {
+      ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(n),
+					  CEPH_NOSNAP)));
+      ghobject_t clone = hoid;
+      clone.hobj.snap = 1;
+      t.remove(cids[i], hoid);
+      t.remove(cids[i], clone);
+    }
+    t.remove_collection(cids[i]);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, SyntheticMatrixCsumAlgorithm) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -4708,6 +5437,169 @@ TEST_P(StoreTest, ScrubTest) {
 }
 
 
+TEST_P(StoreTest, ReadvTest) {
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  const unsigned num_objects = 16;
+  vector<ghobject_t> oids;
+  vector<bufferlist> datas;
+  for (unsigned i = 0; i < num_objects; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "readv_%u", i);
+    oids.emplace_back(hobject_t(name, "", CEPH_NOSNAP, i, 0, ""));
+    bufferlist bl;
+    // mix of sizes, some spanning several blobs
+    bl.append(string(4096 * (1 + i % 5) + i * 17, 'a' + i));
+    datas.push_back(bl);
+
+    ObjectStore::Transaction t;
+    t.write(cid, oids.back(), 0, bl.length(), bl);
+    map<string, bufferlist> omap;
+    omap["k1"].append(string("v1_") + name);
+    omap["k2"].append(string("v2_") + name);
+    t.omap_setkeys(cid, oids.back(), omap);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ch.reset();
+  EXPECT_EQ(store->umount(), 0);
+  EXPECT_EQ(store->mount(), 0);
+  ch = store->open_collection(cid);
+
+  vector<ObjectStore::ReadvOp> ops;
+  for (unsigned i = 0; i < num_objects; ++i) {
+    ops.emplace_back(oids[i], i * 100, 5000);
+    ops.back().omap_keys = {"k1", "k2", "missing"};
+  }
+  // whole object, past eof, omap only and a missing object
+  ops.emplace_back(oids[0], 0, 0);
+  ops.emplace_back(oids[1], 1 << 20, 100);
+  ops.emplace_back(oids[2], 0, 0);
+  ops.back().want_data = false;
+  ops.back().omap_keys = {"k2"};
+  ops.emplace_back(
+    ghobject_t(hobject_t("nonexistent", "", CEPH_NOSNAP, 0, 0, "")), 0, 100);
+  ops.back().omap_keys = {"k1"};
+
+  r = store->readv(ch, ops);
+  ASSERT_EQ(r, 0);
+  for (unsigned i = 0; i < num_objects; ++i) {
+    auto& op = ops[i];
+    bufferlist expected;
+    uint64_t len = std::min<uint64_t>(
+      5000, datas[i].length() - std::min<uint64_t>(i * 100,
+						   datas[i].length()));
+    expected.substr_of(datas[i], i * 100, len);
+    ASSERT_EQ((int)len, op.r);
+    ASSERT_TRUE(bl_eq(expected, op.bl));
+    ASSERT_EQ(0, op.omap_r);
+    ASSERT_EQ(2u, op.omap.size());
+    ASSERT_EQ(string("v1_") + oids[i].hobj.oid.name, op.omap["k1"].to_str());
+    ASSERT_EQ(string("v2_") + oids[i].hobj.oid.name, op.omap["k2"].to_str());
+  }
+  auto p = ops.begin() + num_objects;
+  ASSERT_EQ((int)datas[0].length(), p->r);
+  ASSERT_TRUE(bl_eq(datas[0], p->bl));
+  ++p;
+  ASSERT_EQ(0, p->r);
+  ASSERT_EQ(0u, p->bl.length());
+  ++p;
+  ASSERT_EQ(0, p->r);
+  ASSERT_EQ(0u, p->bl.length());
+  ASSERT_EQ(1u, p->omap.size());
+  ASSERT_EQ(string("v2_") + oids[2].hobj.oid.name, p->omap["k2"].to_str());
+  ++p;
+  ASSERT_EQ(-ENOENT, p->r);
+  ASSERT_EQ(-ENOENT, p->omap_r);
+
+  // the batch must agree with plain reads
+  for (unsigned i = 0; i < num_objects; ++i) {
+    bufferlist bl;
+    r = store->read(ch, oids[i], ops[i].offset, ops[i].length, bl);
+    ASSERT_EQ(ops[i].r, r);
+    ASSERT_TRUE(bl_eq(ops[i].bl, bl));
+  }
+
+  {
+    ObjectStore::Transaction t;
+    for (auto& oid : oids) {
+      t.remove(cid, oid);
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, ReadAsyncTest) {
+  coll_t cid;
+  ghobject_t hoid(hobject_t("read_async", "", CEPH_NOSNAP, 0, 0, ""));
+  auto ch = store->create_new_collection(cid);
+  int r;
+  bufferlist data;
+  for (unsigned i = 0; i < 64; ++i) {
+    data.append(string(4096, 'a' + i % 26));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.write(cid, hoid, 0, data.length(), data);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  for (unsigned pass = 0; pass < 2; ++pass) {
+    // cold, then possibly cached
+    if (pass == 0) {
+      ch.reset();
+      EXPECT_EQ(store->umount(), 0);
+      EXPECT_EQ(store->mount(), 0);
+      ch = store->open_collection(cid);
+    }
+    for (auto& e : vector<pair<uint64_t, uint64_t>>{
+	{0, 0}, {0, 4096}, {1000, 70000}, {250000, 100000}, {1 << 20, 10}}) {
+      bufferlist bl;
+      C_SaferCond c;
+      int ar = store->read_async(ch, hoid, e.first, e.second, bl, 0, &c);
+      if (ar == -EINPROGRESS) {
+	ar = c.wait();
+      }
+      bufferlist expected;
+      r = store->read(ch, hoid, e.first, e.second, expected);
+      ASSERT_EQ(r, ar);
+      ASSERT_EQ(r, (int)bl.length());
+      ASSERT_TRUE(bl_eq(expected, bl));
+    }
+  }
+
+  {
+    bufferlist bl;
+    C_SaferCond c;
+    ghobject_t missing(hobject_t("nonexistent", "", CEPH_NOSNAP, 0, 0, ""));
+    r = store->read_async(ch, missing, 0, 100, bl, 0, &c);
+    if (r == -EINPROGRESS) {
+      r = c.wait();
+    }
+    ASSERT_EQ(-ENOENT, r);
+  }
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, OMapTest) {
   coll_t cid;
   ghobject_t hoid(hobject_t("tesomap", "", CEPH_NOSNAP, 0, 0, ""));
@@ -4986,6 +5878,108 @@ TEST_P(StoreTest, OMapIterator) {
   }
 }
 
+TEST_P(StoreTest, OMapGetRangeTest) {
+  coll_t cid;
+  ghobject_t hoid(hobject_t("tesomaprange", "", CEPH_NOSNAP, 0, 0, ""));
+  auto ch = store->create_new_collection(cid);
+  int r;
+  map<string, bufferlist> attrs;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    t.touch(cid, hoid);
+    for (unsigned i = 0; i < 300; ++i) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%s-%04u", (i % 3) ? "a" : "b", i);
+      bufferlist bl;
+      bl.append(string(buf) + "-value");
+      attrs[buf] = bl;
+    }
+    t.omap_setkeys(cid, hoid, attrs);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  auto decode_range = [](bufferlist& bl, map<string, bufferlist> *out) {
+    auto p = bl.cbegin();
+    while (!p.end()) {
+      string k;
+      bufferlist v;
+      decode(k, p);
+      decode(v, p);
+      (*out)[k] = v;
+    }
+  };
+
+  // walk everything in small batches
+  {
+    map<string, bufferlist> got;
+    string start_after;
+    bool more = true;
+    while (more) {
+      bufferlist bl;
+      r = store->omap_get_range(ch, hoid, start_after, "", 64, 1 << 20,
+				&bl, &more);
+      ASSERT_GE(r, 0);
+      ASSERT_LE(r, 64);
+      map<string, bufferlist> batch;
+      decode_range(bl, &batch);
+      ASSERT_EQ((int)batch.size(), r);
+      if (batch.empty()) {
+	break;
+      }
+      start_after = batch.rbegin()->first;
+      got.insert(batch.begin(), batch.end());
+    }
+    ASSERT_EQ(attrs.size(), got.size());
+    for (auto& i : attrs) {
+      ASSERT_TRUE(got.count(i.first));
+      ASSERT_TRUE(bl_eq(i.second, got[i.first]));
+    }
+  }
+
+  // prefix filter
+  {
+    bufferlist bl;
+    bool more;
+    r = store->omap_get_range(ch, hoid, "", "b-", 1000, 1 << 20, &bl, &more);
+    ASSERT_EQ(100, r);
+    ASSERT_FALSE(more);
+    map<string, bufferlist> got;
+    decode_range(bl, &got);
+    for (auto& i : got) {
+      ASSERT_EQ(0u, i.first.find("b-"));
+    }
+  }
+
+  // byte limit truncates
+  {
+    bufferlist bl;
+    bool more;
+    r = store->omap_get_range(ch, hoid, "", "", 1000, 100, &bl, &more);
+    ASSERT_GT(r, 0);
+    ASSERT_LT(r, 300);
+    ASSERT_TRUE(more);
+  }
+
+  // missing object
+  {
+    ghobject_t missing(hobject_t("nosuchobj", "", CEPH_NOSNAP, 0, 0, ""));
+    bufferlist bl;
+    bool more;
+    r = store->omap_get_range(ch, missing, "", "", 10, 1 << 20, &bl, &more);
+    ASSERT_EQ(-ENOENT, r);
+  }
+
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTest, XattrTest) {
   coll_t cid;
   ghobject_t hoid(hobject_t("tesomap", "", CEPH_NOSNAP, 0, 0, ""));
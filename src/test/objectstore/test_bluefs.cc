@@ -13,6 +13,7 @@
 #include "include/stringify.h"
 #include "include/scope_guard.h"
 #include "common/errno.h"
+#include "common/ceph_json.h"
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
@@ -567,6 +568,73 @@ TEST(BlueFS, test_replay) {
   rm_temp_bdev(fn);
 }
 
+static uint64_t get_log_compactions(BlueFS& fs)
+{
+  JSONFormatter f;
+  fs.dump_perf_counters(&f);
+  stringstream ss;
+  f.flush(ss);
+  JSONParser parser;
+  assert(parser.parse(ss.str().c_str(), ss.str().length()));
+  JSONObj *o = parser.find_obj("bluefs_perf_counters");
+  assert(o);
+  o = o->find_obj("bluefs");
+  assert(o);
+  o = o->find_obj("log_compactions");
+  assert(o);
+  return std::stoull(o->get_data());
+}
+
+TEST(BlueFS, test_background_compaction) {
+  uint64_t size = 1048576 * 128;
+  string fn = get_temp_bdev(size);
+  g_ceph_context->_conf->set_val("bluefs_compact_log_sync", "false");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_size", "65536");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_ratio", "1");
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn, false));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.mkdir("dir"));
+  {
+    // keep appending to the log while sync_metadata hands compaction to
+    // the background thread
+    int n = 0;
+    for (int i = 0; i < 3000 && (i < 200 || get_log_compactions(fs) < 2);
+	 ++i) {
+      string file = "file." + to_string(n++);
+      BlueFS::FileWriter *h;
+      ASSERT_EQ(0, fs.open_for_write("dir", file, &h, false));
+      ASSERT_NE(nullptr, h);
+      auto sg = make_scope_guard([&fs, h] { fs.close_writer(h); });
+      std::unique_ptr<char[]> buf = gen_buffer(4096);
+      h->append(buf.get(), 4096);
+      fs.fsync(h);
+      if (i % 2) {
+	ASSERT_EQ(0, fs.unlink("dir", "file." + to_string(n - 2)));
+      }
+      fs.sync_metadata();
+    }
+    ASSERT_LE(2u, get_log_compactions(fs));
+  }
+  vector<string> ls;
+  ASSERT_EQ(0, fs.readdir("dir", &ls));
+  fs.umount();
+
+  // the switched log must replay to the same namespace
+  ASSERT_EQ(0, fs.mount());
+  vector<string> ls2;
+  ASSERT_EQ(0, fs.readdir("dir", &ls2));
+  ASSERT_EQ(ls, ls2);
+  fs.umount();
+  rm_temp_bdev(fn);
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_size", "16777216");
+  g_ceph_context->_conf->set_val("bluefs_log_compact_min_ratio", "5");
+}
+
 int main(int argc, char **argv) {
   vector<const char*> args;
   argv_to_vec(argc, (const char **)argv, args);
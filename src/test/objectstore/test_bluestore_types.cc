@@ -332,6 +332,115 @@ TEST(bluestore_blob_t, csum_bench)
   }
 }
 
+TEST(bluestore_blob_t, verify_batch)
+{
+  // several regions per blob, one of them split across buffers, one corrupt
+  bufferptr bp(0x10000);
+  for (unsigned i = 0; i < bp.length(); ++i)
+    bp.c_str()[i] = (i * 7) ^ (i >> 8);
+  bufferlist whole;
+  whole.append(bp);
+
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	 << std::endl;
+    bluestore_blob_t b;
+    b.init_csum(csum_type, 12, whole.length());
+    b.calc_csum(0, whole);
+
+    vector<bufferlist> bls(6);
+    for (unsigned i = 0; i < bls.size(); ++i) {
+      bls[i].substr_of(whole, i * 0x2000, 0x2000);
+    }
+    // 0x1000 + 0x800 + 0x800: the second block spans two buffers
+    bls[2].clear();
+    bls[2].append(bufferptr(bp, 0x4000, 0x1800));
+    bls[2].append(bufferptr(bp, 0x5800, 0x800));
+    // flip a bit in the second block of region 4
+    bls[4].clear();
+    bls[4].append(bp.c_str() + 0x8000, 0x2000);
+    bls[4].c_str()[0x1010] ^= 1;
+
+    vector<Checksummer::verify_item_t> items;
+    for (unsigned i = 0; i < bls.size(); ++i) {
+      items.emplace_back(b.csum_type, b.get_csum_chunk_size(), i * 0x2000,
+			 &bls[i], &b.csum_data);
+    }
+    ASSERT_EQ(1, Checksummer::verify_batch(items));
+    for (unsigned i = 0; i < items.size(); ++i) {
+      int bad_off;
+      uint64_t bad_csum = 0;
+      b.verify_csum(i * 0x2000, bls[i], &bad_off, &bad_csum);
+      ASSERT_EQ(bad_off, items[i].bad_off);
+      if (bad_off >= 0) {
+	ASSERT_EQ(0x9000, bad_off);
+	ASSERT_EQ(bad_csum, items[i].bad_csum);
+      }
+    }
+  }
+
+  vector<Checksummer::verify_item_t> items;
+  bluestore_blob_t b;
+  items.emplace_back(Checksummer::CSUM_MAX, 4096, 0, &whole, &b.csum_data);
+  ASSERT_EQ(-EOPNOTSUPP, Checksummer::verify_batch(items));
+}
+
+TEST(bluestore_blob_t, verify_batch_bench)
+{
+  cout << "batch crc32c lanes: " << Checksummer::have_batch_crc32c()
+       << std::endl;
+  const uint64_t total = 256ull << 20;
+  bufferptr bp(4 << 20);
+  for (char *a = bp.c_str(); a < bp.c_str() + bp.length(); ++a)
+    *a = (unsigned long)a & 0xff;
+  for (unsigned csum_type = Checksummer::CSUM_NONE + 1;
+       csum_type < Checksummer::CSUM_MAX;
+       ++csum_type) {
+    bluestore_blob_t b;
+    b.init_csum(csum_type, 12, bp.length());
+    bufferlist whole;
+    whole.append(bp);
+    b.calc_csum(0, whole);
+    for (unsigned region : { 4096u, 65536u, 4u << 20 }) {
+      // a read returning bp.length() bytes as region sized pieces
+      vector<bufferlist> bls(bp.length() / region);
+      vector<Checksummer::verify_item_t> items;
+      for (unsigned i = 0; i < bls.size(); ++i) {
+	bls[i].append(bp.c_str() + i * region, region);
+	items.emplace_back(b.csum_type, b.get_csum_chunk_size(), i * region,
+			   &bls[i], &b.csum_data);
+      }
+      unsigned count = total / bp.length();
+
+      int bad_off;
+      uint64_t bad_csum;
+      auto start = ceph::mono_clock::now();
+      for (unsigned n = 0; n < count; ++n) {
+	for (unsigned i = 0; i < bls.size(); ++i) {
+	  b.verify_csum(i * region, bls[i], &bad_off, &bad_csum);
+	  ASSERT_EQ(-1, bad_off);
+	}
+      }
+      auto mid = ceph::mono_clock::now();
+      for (unsigned n = 0; n < count; ++n) {
+	ASSERT_EQ(0, Checksummer::verify_batch(items));
+      }
+      auto end = ceph::mono_clock::now();
+
+      auto mbsec = [&](ceph::timespan dur) {
+	return (double)total / 1000000.0 /
+	  std::chrono::duration<double>(dur).count();
+      };
+      cout << "csum_type " << Checksummer::get_csum_type_string(csum_type)
+	   << ", region 0x" << std::hex << region << std::dec
+	   << ": scalar " << mbsec(mid - start) << " MB/sec"
+	   << ", batch " << mbsec(end - mid) << " MB/sec" << std::endl;
+    }
+  }
+}
+
 TEST(Blob, put_ref)
 {
   {
@@ -1179,6 +1288,200 @@ TEST(ExtentMap, compress_extent_map)
   ASSERT_EQ(6u, em.extent_map.size());
 }
 
+TEST(bluestore_onode_t, flat_encode_decode)
+{
+  bluestore_onode_t o;
+  o.nid = 1234;
+  o.size = 0x123456;
+  o.set_omap_flag();
+  o.expected_object_size = 0x400000;
+  o.expected_write_size = 0x1000;
+  o.alloc_hint_flags = 3;
+  o.attrs["_"] = bufferptr("object_info", 11);
+  o.attrs["snapset"] = bufferptr("ss", 2);
+  o.extent_map_shards.resize(2);
+  o.extent_map_shards[1].offset = 0x10000;
+  o.extent_map_shards[1].bytes = 321;
+
+  bufferlist spanning, extents, bl;
+  spanning.append("spanning");
+  extents.append("extents!");
+  o.encode_flat(spanning, extents, bl);
+  ASSERT_TRUE(bluestore_onode_t::is_flat(bl));
+
+  auto h = bluestore_onode_t::get_flat_header(bl);
+  ASSERT_TRUE(h);
+  ASSERT_EQ(1234u, (uint64_t)h->nid);
+  ASSERT_EQ(0x123456u, (uint64_t)h->size);
+  ASSERT_EQ(2u, (uint32_t)h->num_shards);
+
+  bluestore_onode_t d;
+  bufferlist s2, e2;
+  d.decode_flat(bl, &s2, &e2);
+  ASSERT_EQ(o.nid, d.nid);
+  ASSERT_EQ(o.size, d.size);
+  ASSERT_EQ(o.flags, d.flags);
+  ASSERT_EQ(o.expected_object_size, d.expected_object_size);
+  ASSERT_EQ(o.expected_write_size, d.expected_write_size);
+  ASSERT_EQ(o.alloc_hint_flags, d.alloc_hint_flags);
+  ASSERT_EQ(2u, d.attrs.size());
+  ASSERT_EQ(11u, d.attrs["_"].length());
+  ASSERT_EQ(2u, d.extent_map_shards.size());
+  ASSERT_EQ(0x10000u, d.extent_map_shards[1].offset);
+  ASSERT_EQ(321u, d.extent_map_shards[1].bytes);
+  ASSERT_TRUE(s2.contents_equal(spanning));
+  ASSERT_TRUE(e2.contents_equal(extents));
+
+  // legacy values are never mistaken for flat ones
+  bufferlist legacy;
+  encode(o, legacy);
+  ASSERT_FALSE(bluestore_onode_t::is_flat(legacy));
+
+  // truncated values are rejected
+  bufferlist t;
+  t.substr_of(bl, 0, bl.length() - 1);
+  ASSERT_EQ(nullptr, bluestore_onode_t::get_flat_header(t));
+}
+
+static void populate_extent_map(BlueStore::Collection *coll,
+				BlueStore::ExtentMap& em,
+				unsigned num)
+{
+  for (unsigned i = 0; i < num; ++i) {
+    BlueStore::BlobRef b(new BlueStore::Blob);
+    b->shared_blob = new BlueStore::SharedBlob(coll);
+    b->dirty_blob().allocated_test(
+      bluestore_pextent_t(0x1000000 + i * 0x10000, 0x10000));
+    b->dirty_blob().init_csum(Checksummer::CSUM_CRC32C, 12, 0x10000);
+    em.extent_map.insert(*new BlueStore::Extent(i * 0x10000, 0, 0x10000, b));
+  }
+}
+
+static void encode_extent_map_sections(BlueStore::ExtentMap& em,
+				       bufferlist *spanning,
+				       bufferlist *extents)
+{
+  size_t bound = 0;
+  em.bound_encode_spanning_blobs(bound);
+  {
+    auto p = spanning->get_contiguous_appender(bound, true);
+    em.encode_spanning_blobs(p);
+  }
+  unsigned n;
+  ASSERT_FALSE(em.encode_some(0, 0xffffffff, *extents, &n));
+}
+
+TEST(ExtentMap, flat_onode_materialize)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::LRUCache cache(g_ceph_context);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+  populate_extent_map(coll.get(), onode.extent_map, 16);
+  bufferlist spanning, extents, bl;
+  encode_extent_map_sections(onode.extent_map, &spanning, &extents);
+  onode.onode.encode_flat(spanning, extents, bl);
+
+  BlueStore::Onode on(coll.get(), ghobject_t(), "");
+  auto& em = on.extent_map;
+  on.onode.decode_flat(bl, &em.lazy_spanning, &em.lazy_extents);
+  em.lazy = true;
+  ASSERT_EQ(0u, em.extent_map.size());
+  em.materialize();
+  ASSERT_FALSE(em.lazy);
+  ASSERT_EQ(16u, em.extent_map.size());
+  ASSERT_TRUE(em.inline_bl.contents_equal(extents));
+  em.materialize();
+  ASSERT_EQ(16u, em.extent_map.size());
+}
+
+TEST(bluestore_onode_t, decode_bench)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::LRUCache cache(g_ceph_context);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  BlueStore::Onode onode(coll.get(), ghobject_t(), "");
+  onode.onode.nid = 1;
+  onode.onode.size = 0x400000;
+  onode.onode.attrs["_"] = buffer::create(250);
+  onode.onode.attrs["snapset"] = buffer::create(31);
+  populate_extent_map(coll.get(), onode.extent_map, 64);
+  bufferlist spanning, extents;
+  encode_extent_map_sections(onode.extent_map, &spanning, &extents);
+
+  // legacy layout, as written by _record_onode
+  bufferlist legacy;
+  {
+    size_t bound = 0;
+    denc(onode.onode, bound);
+    bound += spanning.length();
+    denc(extents, bound);
+    auto p = legacy.get_contiguous_appender(bound, true);
+    denc(onode.onode, p);
+    p.append(spanning.c_str(), spanning.length());
+    denc(extents, p);
+  }
+  legacy.rebuild();
+  bufferlist flat;
+  onode.onode.encode_flat(spanning, extents, flat);
+  flat.rebuild();
+  cout << "onode value: legacy " << legacy.length() << " bytes, flat "
+       << flat.length() << " bytes" << std::endl;
+
+  const int count = 20000;
+  uint64_t sum = 0;
+  auto report = [&](const char *what, ceph::mono_clock::time_point start) {
+    auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      ceph::mono_clock::now() - start);
+    cout << what << ": " << (double)dur.count() / count << " ns/onode"
+	 << std::endl;
+  };
+
+  // what every onode load pays today
+  auto start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    BlueStore::Onode on(coll.get(), ghobject_t(), "");
+    auto p = legacy.front().begin_deep();
+    on.onode.decode(p);
+    on.extent_map.decode_spanning_blobs(p);
+    denc(on.extent_map.inline_bl, p);
+    on.extent_map.decode_some(on.extent_map.inline_bl);
+    sum += on.onode.size;
+  }
+  report("legacy full decode", start);
+
+  // stat/getattr on a flat onode: the extent map stays encoded
+  start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    BlueStore::Onode on(coll.get(), ghobject_t(), "");
+    auto& em = on.extent_map;
+    on.onode.decode_flat(flat, &em.lazy_spanning, &em.lazy_extents);
+    em.lazy = true;
+    sum += on.onode.size;
+  }
+  report("flat lazy decode", start);
+
+  // flat onode whose extent map is then needed (e.g., a read)
+  start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    BlueStore::Onode on(coll.get(), ghobject_t(), "");
+    auto& em = on.extent_map;
+    on.onode.decode_flat(flat, &em.lazy_spanning, &em.lazy_extents);
+    em.lazy = true;
+    em.materialize();
+    sum += on.onode.size;
+  }
+  report("flat decode + materialize", start);
+
+  // scalar fields only, read in place
+  start = ceph::mono_clock::now();
+  for (int i = 0; i < count; ++i) {
+    sum += bluestore_onode_t::get_flat_header(flat)->size;
+  }
+  report("flat header in place", start);
+  ASSERT_EQ((uint64_t)count * 4 * 0x400000, sum);
+}
+
 TEST(GarbageCollector, BasicTest)
 {
   BlueStore::LRUCache cache(g_ceph_context);
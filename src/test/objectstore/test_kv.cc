@@ -119,6 +119,27 @@ TEST_P(KVTest, OpenWriteRead) {
   fini();
 }
 
+TEST_P(KVTest, GetKeys) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < 10; ++i) {
+      bufferlist value;
+      value.append("value" + stringify(i));
+      t->set("prefix", "key" + stringify(i), value);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  std::set<string> keys = {"key1", "key3", "key33", "key9", "nokey"};
+  std::map<string, bufferlist> out;
+  ASSERT_EQ(0, db->get("prefix", keys, &out));
+  ASSERT_EQ(3u, out.size());
+  ASSERT_EQ("value1", _bl_to_str(out["key1"]));
+  ASSERT_EQ("value3", _bl_to_str(out["key3"]));
+  ASSERT_EQ("value9", _bl_to_str(out["key9"]));
+  fini();
+}
+
 TEST_P(KVTest, PutReopen) {
   ASSERT_EQ(0, db->create_and_open(cout));
   {
@@ -467,6 +488,168 @@ TEST_P(KVTest, RocksDBCFMerge) {
   fini();
 }
 
+TEST_P(KVTest, RocksDBShardingTest) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  std::vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families("A(3) B(2,0-1) C", &cfs));
+  ASSERT_EQ(3u, cfs.size());
+  ASSERT_EQ("A(3) B(2,0-1) C", KeyValueDB::dump_column_families(cfs));
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  cout << "creating sharded column families and opening them" << std::endl;
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist value;
+    value.append("value");
+    for (unsigned i = 0; i < 100; ++i) {
+      t->set("A", stringify(1000 + i), value);
+      t->set("B", stringify(1000 + i), value);
+      t->set("Z", stringify(1000 + i), value);
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  auto check = [&](const string& prefix) {
+    KeyValueDB::Iterator iter = db->get_iterator(prefix);
+    unsigned n = 0;
+    for (iter->seek_to_first(); iter->valid(); iter->next(), ++n) {
+      ASSERT_EQ(stringify(1000 + n), iter->key());
+    }
+    ASSERT_EQ(100u, n);
+    for (iter->seek_to_last(); iter->valid(); iter->prev()) {
+      ASSERT_EQ(stringify(1000 + --n), iter->key());
+    }
+    ASSERT_EQ(0u, n);
+    iter->lower_bound("1050");
+    ASSERT_TRUE(iter->valid());
+    ASSERT_EQ("1050", iter->key());
+    iter->prev();
+    ASSERT_EQ("1049", iter->key());
+    iter->next();
+    iter->next();
+    ASSERT_EQ("1051", iter->key());
+    bufferlist v;
+    ASSERT_EQ(0, db->get(prefix, "1077", &v));
+    ASSERT_EQ("value", _bl_to_str(v));
+  };
+  check("A");
+  check("B");
+  check("Z");
+  {
+    cout << "whole space iteration covers every column family" << std::endl;
+    KeyValueDB::WholeSpaceIterator iter = db->get_wholespace_iterator();
+    unsigned n = 0;
+    string last;
+    for (iter->seek_to_first(); iter->valid(); iter->next(), ++n) {
+      auto k = iter->raw_key();
+      string combined = k.first + '\0' + k.second;
+      ASSERT_LT(last, combined);
+      last = combined;
+    }
+    ASSERT_EQ(300u, n);
+  }
+  fini();
+
+  cout << "resharding" << std::endl;
+  init();
+  ASSERT_EQ(0, db->open(cout));
+  std::vector<KeyValueDB::ColumnFamily> new_cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families("A B(4) Z(2)", &new_cfs));
+  ASSERT_EQ(0, db->reshard(new_cfs, cout));
+  fini();
+
+  init();
+  ASSERT_EQ(0, db->open(cout));
+  check("A");
+  check("B");
+  check("Z");
+  fini();
+}
+
+TEST_P(KVTest, RocksDBShardedGetRange) {
+  if(string(GetParam()) != "rocksdb")
+    return;
+
+  std::vector<KeyValueDB::ColumnFamily> cfs;
+  ASSERT_EQ(0, KeyValueDB::parse_column_families("B(4,0-2)", &cfs));
+  ASSERT_EQ(0, db->init(g_conf->bluestore_rocksdb_options));
+  ASSERT_EQ(0, db->create_and_open(cout, cfs));
+  // keys of one "object" share their first two bytes, as omap keys
+  // share the onode id, so each object's keys sit in a single shard
+  const std::vector<string> objs = {"aa", "ab", "ba", "zz"};
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (auto& o : objs) {
+      for (unsigned i = 0; i < 100; ++i) {
+	bufferlist value;
+	value.append(o + stringify(i));
+	t->set("B", o + stringify(1000 + i), value);
+      }
+    }
+    ASSERT_EQ(0, db->submit_transaction_sync(t));
+  }
+  auto decode_range = [](bufferlist& bl) {
+    std::map<string, bufferlist> m;
+    bufferlist::const_iterator p = bl.begin();
+    while (!p.end()) {
+      string k;
+      bufferlist v;
+      decode(k, p);
+      decode(v, p);
+      m[k] = v;
+    }
+    return m;
+  };
+  for (auto& o : objs) {
+    bufferlist bl;
+    bool more;
+    // within one object: the single column family path
+    int r = db->get_range("B", o + "1010", true, o + "1050", o.size(),
+			  1000, 1 << 20, &bl, &more);
+    ASSERT_EQ(39, r);
+    ASSERT_FALSE(more);
+    auto m = decode_range(bl);
+    ASSERT_EQ(39u, m.size());
+    unsigned i = 11;
+    for (auto& p : m) {
+      ASSERT_EQ(stringify(1000 + i), p.first);
+      ASSERT_EQ(o + stringify(i), _bl_to_str(p.second));
+      ++i;
+    }
+
+    bl.clear();
+    r = db->get_range("B", o, false, o + "~", o.size(), 10, 1 << 20,
+		      &bl, &more);
+    ASSERT_EQ(10, r);
+    ASSERT_TRUE(more);
+    ASSERT_EQ(stringify(1000), decode_range(bl).begin()->first);
+  }
+  {
+    // a multi-key get spread over the shards
+    std::set<string> keys = {"aa1001", "ab1002", "ba1003", "zz1004", "zz2000"};
+    std::map<string, bufferlist> m;
+    ASSERT_EQ(0, db->get("B", keys, &m));
+    ASSERT_EQ(4u, m.size());
+    ASSERT_EQ("ab2", _bl_to_str(m["ab1002"]));
+    ASSERT_EQ("zz4", _bl_to_str(m["zz1004"]));
+  }
+  {
+    // across objects, and so across shards, the keys stay in order
+    bufferlist bl;
+    bool more;
+    int r = db->get_range("B", "aa1050", false, "", 0, 1000, 1 << 20,
+			  &bl, &more);
+    ASSERT_EQ(350, r);
+    ASSERT_FALSE(more);
+    auto m = decode_range(bl);
+    ASSERT_EQ(350u, m.size());
+    ASSERT_EQ("aa1050", m.begin()->first);
+    ASSERT_EQ("zz1099", m.rbegin()->first);
+  }
+  fini();
+}
+
 INSTANTIATE_TEST_CASE_P(
   KeyValueDB,
   KVTest,
@@ -137,6 +137,68 @@ TEST(Transaction, MoveRangesDelSrcObj)
   t.write(c, o2, 1, bl.length(), bl);
 }
 
+TEST(Transaction, EncodeIndexes)
+{
+  auto a = ObjectStore::Transaction{};
+  coll_t c1(spg_t(pg_t(4,5), shard_id_t::NO_SHARD));
+  coll_t c2(spg_t(pg_t(1,2), shard_id_t::NO_SHARD));
+  ghobject_t o1(hobject_t("obj3", "", 123, 456, -1, ""));
+  ghobject_t o2(hobject_t("obj1", "", 123, 789, -1, ""));
+  ghobject_t o3(hobject_t("obj2", "", 123, 123, -1, ""));
+
+  a.touch(c1, o1);
+  a.touch(c2, o2);
+  a.touch(c1, o3);
+  a.touch(c2, o1);
+  a.collection_move_rename(c1, o3, c2, o2);
+
+  auto i = a.begin();
+  ASSERT_EQ(2u, i.colls.size());
+  ASSERT_EQ(3u, i.objects.size());
+
+  bufferlist bl;
+  encode(a, bl);
+
+  // the indexes must still be encoded as map<key, __le32>
+  auto p = bl.cbegin();
+  __u8 struct_v, struct_compat;
+  __u32 struct_len;
+  bufferlist data_bl, op_bl;
+  map<coll_t, __le32> cm;
+  map<ghobject_t, __le32> om;
+  decode(struct_v, p);
+  decode(struct_compat, p);
+  decode(struct_len, p);
+  decode(data_bl, p);
+  decode(op_bl, p);
+  decode(cm, p);
+  decode(om, p);
+  ASSERT_EQ(i.colls.size(), cm.size());
+  ASSERT_EQ(i.objects.size(), om.size());
+  for (auto& q : cm) {
+    ASSERT_EQ(i.get_cid(q.second), q.first);
+  }
+  for (auto& q : om) {
+    ASSERT_EQ(i.get_oid(q.second), q.first);
+  }
+
+  auto b = ObjectStore::Transaction{};
+  auto bp = bl.cbegin();
+  decode(b, bp);
+  ASSERT_EQ(a.get_num_ops(), b.get_num_ops());
+  auto ia = a.begin();
+  auto ib = b.begin();
+  while (ia.have_op()) {
+    ASSERT_TRUE(ib.have_op());
+    auto opa = ia.decode_op();
+    auto opb = ib.decode_op();
+    ASSERT_EQ(opa->op, opb->op);
+    ASSERT_EQ(ia.get_cid(opa->cid), ib.get_cid(opb->cid));
+    ASSERT_EQ(ia.get_oid(opa->oid), ib.get_oid(opb->oid));
+  }
+  ASSERT_FALSE(ib.have_op());
+}
+
 TEST(Transaction, GetNumBytes)
 {
   auto a = ObjectStore::Transaction{};
@@ -57,6 +57,14 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--test") == 0) {
+	if (strcmp("read", args[i+1]) == 0) {
+	  test = &OmapBench::test_read_objects;
+	} else if (strcmp("write", args[i+1]) == 0) {
+	  test = &OmapBench::test_write_objects_in_parallel;
+	}
+      } else if (strcmp(args[i], "--readbatch") == 0) {
+	read_batch = atoi(args[i+1]);
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: ostorebench [options]\n"
@@ -87,6 +95,11 @@ int OmapBench::setup(int argc, const char** argv) {
            << "                        (default uniform)\n";
       cout << "	--name          the rados id to use (default "<< rados_id
            << ")\n";
+      cout << "	--test          write, or read to write the objects and then\n"
+           << "                        list them back reporting keys/s"
+           << " (default write)\n";
+      cout << "	--readbatch     keys per omap_get_vals2 call in the read "
+           << "test (default " << read_batch << ")\n";
       exit(1);
     }
   }
@@ -275,6 +288,15 @@ void OmapBench::print_results() {
   cout << " and " <<data.mode.first * increment + increment;
   cout << "ms\nTotal latency:\t\t" << data.total_latency;
   cout << "ms"<<std::endl;
+  if (data.keys_read) {
+    cout << std::endl;
+    cout << "Keys read:\t\t" << data.keys_read;
+    cout << "\nKeys per read op:\t" << read_batch;
+    cout << "\nRead time:\t\t" << data.read_time;
+    cout << "ms\nKeys/s:\t\t\t"
+	 << (data.read_time > 0 ? data.keys_read * 1000 / data.read_time : 0);
+    cout << std::endl;
+  }
   cout << std::endl;
   cout << "Histogram:" << std::endl;
   for(int i = floor(data.min_latency / increment); i <
@@ -407,6 +429,40 @@ int OmapBench::test_write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+int OmapBench::test_read_objects(omap_generator_t omap_gen) {
+  int err = test_write_objects_in_parallel(omap_gen);
+  if (err < 0) {
+    return err;
+  }
+
+  utime_t start = ceph_clock_now();
+  for (int i = 1; i <= objects; i++) {
+    std::stringstream objstrm;
+    objstrm << prefix << i;
+    string start_after;
+    bool more = true;
+    while (more) {
+      librados::ObjectReadOperation read;
+      map<string, bufferlist> out_vals;
+      int rval = 0;
+      read.omap_get_vals2(start_after, read_batch, &out_vals, &more, &rval);
+      err = io_ctx.operate(objstrm.str(), &read, NULL);
+      if (err < 0 || rval < 0) {
+	cout << "error " << (err < 0 ? err : rval);
+	cout << " listing omap of " << objstrm.str() << std::endl;
+	return err < 0 ? err : rval;
+      }
+      if (out_vals.empty()) {
+	break;
+      }
+      data.keys_read += out_vals.size();
+      start_after = out_vals.rbegin()->first;
+    }
+  }
+  data.read_time = (ceph_clock_now() - start) * 1000;
+  return 0;
+}
+
 /**
  * runs the specified test with the specified parameters and generates
  * a histogram of latencies
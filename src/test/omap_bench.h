@@ -32,10 +32,13 @@ struct o_bench_data {
   int completed_ops;
   std::map<int,int> freq_map;
   pair<int,int> mode;
+  uint64_t keys_read;
+  double read_time;
   o_bench_data()
   : avg_latency(0.0), min_latency(DBL_MAX), max_latency(0.0),
     total_latency(0.0),
-    started_ops(0), completed_ops(0)
+    started_ops(0), completed_ops(0),
+    keys_read(0), read_time(0.0)
   {}
 };
 
@@ -103,6 +106,7 @@ protected:
   int key_size;
   int value_size;
   double increment;
+  int read_batch;
 
   friend class Writer;
   friend class AioWriter;
@@ -119,7 +123,7 @@ public:
       rados_id("admin"),
       prefix(rados_id+".obj."),
       threads(3), objects(100), entries_per_omap(10), key_size(10),
-      value_size(100), increment(10)
+      value_size(100), increment(10), read_batch(512)
   {}
   /**
    * Parses command line args, initializes rados and ioctx
@@ -200,6 +204,15 @@ public:
    */
   int test_write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /*
+   * Writes the objects as test_write_objects_in_parallel does, then lists
+   * every omap back with omap_get_vals2 in batches of READ_BATCH keys and
+   * records the listing rate in keys/s.
+   *
+   * @param omap_gen the method used to generate the omaps.
+   */
+  int test_read_objects(omap_generator_t omap_gen);
+
 };
 
 
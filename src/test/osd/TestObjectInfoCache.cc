@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "osd/ObjectInfoCache.h"
+#include "gtest/gtest.h"
+
+static hobject_t mk_obj(unsigned id) {
+  hobject_t hoid;
+  stringstream ss;
+  ss << "obj_" << id;
+  hoid.oid = ss.str();
+  hoid.set_hash(id);
+  hoid.pool = 1;
+  return hoid;
+}
+
+static object_info_t mk_oi(unsigned id, version_t v) {
+  object_info_t oi(mk_obj(id));
+  oi.version = eversion_t(1, v);
+  oi.size = v * 10;
+  return oi;
+}
+
+TEST(ObjectInfoCache, Disabled)
+{
+  ObjectInfoCache<object_info_t> cache;
+  cache.init(4, 0);
+  ASSERT_FALSE(cache.enabled());
+  spg_t pgid(pg_t(0, 1));
+  EXPECT_EQ(0u, cache.put(pgid, mk_obj(1), 1, mk_oi(1, 1)));
+  object_info_t oi;
+  EXPECT_FALSE(cache.take(pgid, mk_obj(1), 1, &oi));
+}
+
+TEST(ObjectInfoCache, TakeRemoves)
+{
+  ObjectInfoCache<object_info_t> cache;
+  cache.init(4, 64);
+  spg_t pgid(pg_t(0, 1));
+  EXPECT_EQ(0u, cache.put(pgid, mk_obj(1), 7, mk_oi(1, 3)));
+
+  object_info_t oi;
+  ASSERT_TRUE(cache.take(pgid, mk_obj(1), 7, &oi));
+  EXPECT_EQ(mk_obj(1), oi.soid);
+  EXPECT_EQ(eversion_t(1, 3), oi.version);
+  EXPECT_EQ(30u, oi.size);
+  // taken, so the cache no longer has it
+  EXPECT_FALSE(cache.take(pgid, mk_obj(1), 7, &oi));
+}
+
+TEST(ObjectInfoCache, StaleTagDropped)
+{
+  ObjectInfoCache<object_info_t> cache;
+  cache.init(4, 64);
+  spg_t pgid(pg_t(0, 1));
+  cache.put(pgid, mk_obj(1), 7, mk_oi(1, 3));
+
+  object_info_t oi;
+  EXPECT_FALSE(cache.take(pgid, mk_obj(1), 8, &oi));
+  // a mismatched take drops the stale entry as well
+  EXPECT_FALSE(cache.take(pgid, mk_obj(1), 7, &oi));
+
+  // re-stashing replaces the value and the tag
+  cache.put(pgid, mk_obj(2), 7, mk_oi(2, 3));
+  cache.put(pgid, mk_obj(2), 8, mk_oi(2, 4));
+  ASSERT_TRUE(cache.take(pgid, mk_obj(2), 8, &oi));
+  EXPECT_EQ(eversion_t(1, 4), oi.version);
+}
+
+TEST(ObjectInfoCache, Evict)
+{
+  ObjectInfoCache<object_info_t> cache;
+  cache.init(1, 4);
+  spg_t pgid(pg_t(0, 1));
+  for (unsigned i = 0; i < 4; ++i) {
+    EXPECT_EQ(0u, cache.put(pgid, mk_obj(i), 1, mk_oi(i, 1)));
+  }
+  EXPECT_EQ(1u, cache.put(pgid, mk_obj(4), 1, mk_oi(4, 1)));
+
+  object_info_t oi;
+  // the least recently stashed entry went first
+  EXPECT_FALSE(cache.take(pgid, mk_obj(0), 1, &oi));
+  for (unsigned i = 1; i < 5; ++i) {
+    EXPECT_TRUE(cache.take(pgid, mk_obj(i), 1, &oi));
+  }
+}
@@ -429,9 +429,9 @@ TEST_F(PGLogTest, rewind_divergent_log) {
     rewind_divergent_log(newhead, info, &h,
 			 dirty_info, dirty_big_info);
 
-    EXPECT_TRUE(log.objects.count(divergent));
+    EXPECT_TRUE(log.objects.count(&divergent));
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.objects.count(&divergent_object));
     EXPECT_EQ(2U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(newhead, info.last_update);
@@ -495,7 +495,7 @@ TEST_F(PGLogTest, rewind_divergent_log) {
 			 dirty_info, dirty_big_info);
 
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(0U, log.objects.count(divergent_object));
+    EXPECT_EQ(0U, log.objects.count(&divergent_object));
     EXPECT_TRUE(log.empty());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_TRUE(is_dirty());
@@ -1144,7 +1144,7 @@ TEST_F(PGLogTest, merge_log) {
     }
 
     EXPECT_FALSE(missing.have_missing());
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.objects.count(&divergent_object));
     EXPECT_EQ(3U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(log.head, info.last_update);
@@ -1163,7 +1163,7 @@ TEST_F(PGLogTest, merge_log) {
        to be divergent.
     */
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.objects.count(&divergent_object));
     EXPECT_EQ(4U, log.log.size());
     /* DELETE entries from olog that are appended to the hed of the
        log, and the divergent version of the object is removed (added
@@ -1262,7 +1262,7 @@ TEST_F(PGLogTest, merge_log) {
     }
 
     EXPECT_FALSE(missing.have_missing());
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.objects.count(&divergent_object));
     EXPECT_EQ(3U, log.log.size());
     EXPECT_TRUE(remove_snap.empty());
     EXPECT_EQ(log.head, info.last_update);
@@ -1282,7 +1282,7 @@ TEST_F(PGLogTest, merge_log) {
        to be divergent.
     */
     EXPECT_TRUE(missing.is_missing(divergent_object));
-    EXPECT_EQ(1U, log.objects.count(divergent_object));
+    EXPECT_EQ(1U, log.objects.count(&divergent_object));
     EXPECT_EQ(4U, log.log.size());
     /* DELETE entries from olog that are appended to the hed of the
        log, and the divergent version of the object is removed (added
@@ -2232,7 +2232,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
   log.add(modify);
 
   EXPECT_TRUE(log.logged_object(oid));
-  pg_log_entry_t *entry = log.objects[oid];
+  pg_log_entry_t *entry = log.objects.find(&oid)->second;
   EXPECT_EQ(modify.op, entry->op);
   EXPECT_EQ(modify.version, entry->version);
   EXPECT_EQ(modify.prior_version, entry->prior_version);
@@ -2246,7 +2246,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
   log.add(del);
 
   EXPECT_TRUE(log.logged_object(oid));
-  entry = log.objects[oid];
+  entry = log.objects.find(&oid)->second;
   EXPECT_EQ(del.op, entry->op);
   EXPECT_EQ(del.version, entry->version);
   EXPECT_EQ(del.prior_version, entry->prior_version);
@@ -2259,7 +2259,7 @@ TEST_F(PGLogTest, ErrorNotIndexedByObject) {
 		   utime_t(20,1), -ENOENT));
 
   EXPECT_TRUE(log.logged_object(oid));
-  entry = log.objects[oid];
+  entry = log.objects.find(&oid)->second;
   EXPECT_EQ(del.op, entry->op);
   EXPECT_EQ(del.version, entry->version);
   EXPECT_EQ(del.prior_version, entry->prior_version);
@@ -2451,9 +2451,10 @@ public:
   }
 
   void check_index() {
-    EXPECT_EQ(log.dups.size(), log.dup_index.size());
     for (auto& i : log.dups) {
-      EXPECT_EQ(1u, log.dup_index.count(i.reqid));
+      auto d = log.get_dup(i.reqid);
+      ASSERT_NE(nullptr, d);
+      EXPECT_EQ(i.version, d->version);
     }
   }
 
@@ -2672,6 +2673,39 @@ TEST_F(PGLogMergeDupsTest, Superset) {
 }
 
 
+TEST_F(PGLogMergeDupsTest, ManyBuckets) {
+  // enough dups on either side to span several dup filter buckets
+  const unsigned n = 600;
+  std::vector<pg_log_dup_t> older, mine, newer;
+  for (unsigned i = 1; i <= n; ++i) {
+    older.push_back(create_dup_entry(10, i));
+    mine.push_back(create_dup_entry(20, i));
+    newer.push_back(create_dup_entry(30, i));
+  }
+  log.tail = eversion_t(30, n / 2);
+
+  IndexedLog olog;
+
+  add_dups(mine);
+  index();
+  add_dups(olog, older);
+  add_dups(olog, mine);
+  add_dups(olog, newer);
+
+  bool changed = merge_log_dups(olog);
+
+  // the newer dups at or past the log tail are dropped again
+  EXPECT_TRUE(changed);
+  EXPECT_EQ(2 * n + n / 2 - 1, log.dups.size());
+
+  check_order();
+  check_index();
+  for (unsigned i = n / 2; i <= n; ++i) {
+    EXPECT_EQ(nullptr, log.get_dup(newer[i - 1].reqid));
+  }
+}
+
+
 struct PGLogTrimTest :
   public ::testing::Test,
   public PGLogTestBase,
@@ -2751,6 +2785,36 @@ TEST_F(PGLogTrimTest, TestPartialTrim)
 }
 
 
+TEST_F(PGLogTrimTest, TestObjectIndexAfterTrim)
+{
+  SetUp(1, 2, 20);
+  PGLog::IndexedLog log;
+  log.head = mk_evt(24, 0);
+  log.skip_can_rollback_to_to_head();
+  log.head = mk_evt(9, 0);
+
+  hobject_t oid1 = mk_obj(1);
+  hobject_t oid2 = mk_obj(2);
+  log.add(mk_ple_mod(oid1, mk_evt(10, 100), mk_evt(8, 70)));
+  log.add(mk_ple_mod(oid2, mk_evt(10, 101), mk_evt(8, 71)));
+  log.index();
+  log.add(mk_ple_mod(oid1, mk_evt(10, 102), mk_evt(10, 100)));
+
+  std::set<eversion_t> trimmed;
+  std::set<std::string> trimmed_dups;
+  eversion_t write_from_dups = eversion_t::max();
+
+  log.trim(cct, mk_evt(10, 101), &trimmed, &trimmed_dups, &write_from_dups);
+
+  EXPECT_EQ(1u, log.log.size());
+  EXPECT_EQ(0u, log.objects.count(&oid2));
+  // the slot must be keyed on the surviving entry, not the trimmed one
+  auto p = log.objects.find(&oid1);
+  ASSERT_NE(log.objects.end(), p);
+  EXPECT_EQ(&p->second->soid, p->first);
+  EXPECT_EQ(mk_evt(10, 102), p->second->version);
+}
+
 TEST_F(PGLogTrimTest, TestTrimNoTrimmed) {
   SetUp(1, 2, 20);
   PGLog::IndexedLog log;
@@ -2912,6 +2976,50 @@ TEST_F(PGLogTrimTest, TestGetRequest) {
   EXPECT_FALSE(result);
 }
 
+TEST_F(PGLogTrimTest, TestGetRequestManyDups) {
+  SetUp(1, 2, 1000);
+  PGLog::IndexedLog log;
+  log.head = mk_evt(20, 0);
+  log.skip_can_rollback_to_to_head();
+  log.head = mk_evt(9, 0);
+
+  entity_name_t client = entity_name_t::CLIENT(777);
+  const unsigned n = 800;
+  for (unsigned i = 1; i <= n; ++i) {
+    log.add(mk_ple_mod(mk_obj(i % 7), mk_evt(10, i), mk_evt(10, i - 1),
+		       osd_reqid_t(client, 8, i)));
+  }
+
+  eversion_t write_from_dups = eversion_t::max();
+  log.trim(cct, mk_evt(10, n - 2), nullptr, nullptr, &write_from_dups);
+  EXPECT_EQ(2u, log.log.size());
+  EXPECT_EQ(n - 2, log.dups.size());
+
+  eversion_t version;
+  version_t user_version;
+  int return_code;
+
+  // every tracked dup is found, spread over several filter buckets
+  for (unsigned i = 1; i <= n; ++i) {
+    ASSERT_TRUE(log.get_request(osd_reqid_t(client, 8, i),
+				&version, &user_version, &return_code));
+    EXPECT_EQ(mk_evt(10, i), version);
+  }
+
+  // dropping dups from the front must not lose the ones that remain,
+  // and the dropped ones must not be reported even if the filter hits
+  SetUp(1, 2, 300);
+  log.trim(cct, mk_evt(10, n - 1), nullptr, nullptr, &write_from_dups);
+  EXPECT_EQ(300u, log.dups.size());
+  for (unsigned i = 1; i <= n; ++i) {
+    bool result = log.get_request(osd_reqid_t(client, 8, i),
+				  &version, &user_version, &return_code);
+    EXPECT_EQ(i >= n - 300, result) << i;
+  }
+  EXPECT_FALSE(log.get_request(osd_reqid_t(client, 8, n + 1),
+			       &version, &user_version, &return_code));
+}
+
 TEST_F(PGLogTest, _merge_object_divergent_entries) {
   {
     // Test for issue 20843
@@ -125,6 +125,7 @@ TEST(Compress, LimitedChunkSize)
   for (size_t s = 100 ; s < 10000000 ; s = s*5/4)
   {
     bufferptr bp(s);
+    bp.zero();
     bufferlist bl;
     bl.append(bp);
 
@@ -169,6 +170,7 @@ TEST(Compress, BillionZeros)
 
   constexpr size_t size = 1000000;
   bufferptr bp(size);
+  bp.zero();
   bufferlist bl;
   bl.append(bp);
 
@@ -199,3 +201,30 @@ TEST(Compress, BillionZeros)
 
   ASSERT_EQ(d_sink.get_sink().length() , size*1000);
 }
+
+TEST(Compress, IncompressibleStoredRaw)
+{
+  CompressorRef plugin;
+  ut_put_sink c_sink;
+  plugin = Compressor::create(g_ceph_context, Compressor::COMP_ALG_ZLIB);
+  ASSERT_NE(plugin.get(), nullptr);
+  RGWPutObj_Compress compressor(g_ceph_context, plugin, &c_sink);
+
+  constexpr size_t size = 1000000;
+  bufferlist bl;
+  for (size_t i = 0; i < size; i++) {
+    bl.append((char)(rand() & 0xff));
+  }
+  bufferlist orig = bl;
+
+  void* handle;
+  rgw_raw_obj obj;
+  bool again = false;
+  compressor.handle_data(bl, 0, &handle, &obj, &again);
+  bufferlist empty;
+  compressor.handle_data(empty, size, &handle, &obj, &again);
+
+  ASSERT_FALSE(compressor.is_compressed());
+  ASSERT_TRUE(compressor.get_compression_blocks().empty());
+  ASSERT_TRUE(c_sink.get_sink().contents_equal(orig));
+}
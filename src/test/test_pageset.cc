@@ -1,5 +1,7 @@
 // -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
 // vim: ts=8 sw=2 smarttab
+#include <thread>
+
 #include "gtest/gtest.h"
 
 #include "os/memstore/PageSet.h"
@@ -281,3 +283,84 @@ TEST(PageSet, FreeHoles)
   pages.get_range(0, 8, range);
   ASSERT_EQ(0u, range.size());
 }
+
+TEST(PageSet, ShareCopyOnWrite)
+{
+  PageSet src(2), dst(2);
+  PageSet::page_vector range;
+
+  // pages at offsets 0 and 4, hole at 2
+  src.alloc_range(0, 2, range);
+  range[0]->data[0] = 'a';
+  src.alloc_range(4, 2, range);
+  range[0]->data[0] = 'b';
+  range.clear();
+
+  // dst has a page where src has the hole
+  dst.alloc_range(2, 2, range);
+  range.clear();
+
+  dst.share_range(src, 0, 6);
+  dst.get_range(0, 6, range);
+  ASSERT_EQ(2u, range.size());
+  ASSERT_EQ(0u, range[0]->offset);
+  ASSERT_EQ(4u, range[1]->offset);
+  src.get_range(0, 2, range);
+  ASSERT_EQ(range[0].get(), range[2].get());
+  range.clear();
+
+  // writing to dst copies the shared page and leaves src alone
+  dst.alloc_range(0, 1, range);
+  ASSERT_EQ('a', range[0]->data[0]);
+  range[0]->data[0] = 'c';
+  range.clear();
+  src.get_range(0, 2, range);
+  ASSERT_EQ('a', range[0]->data[0]);
+  range.clear();
+
+  // a page nobody else refers to is written in place
+  dst.get_range(0, 1, range);
+  Page *p = range[0].get();
+  range.clear();
+  dst.alloc_range(0, 1, range);
+  ASSERT_EQ(p, range[0].get());
+  ASSERT_EQ('c', range[0]->data[0]);
+}
+
+TEST(PageSet, ConcurrentReadWrite)
+{
+  PageSet pages(16);
+  std::atomic<bool> done = {false};
+
+  // the writer keeps growing the set, rehashing the index, and rewrites
+  // (and so copies) every page a reader may be holding
+  std::thread writer([&] {
+    PageSet::page_vector range;
+    for (unsigned n = 1; n <= 200; ++n) {
+      pages.alloc_range(0, n * 16, range);
+      for (auto& p : range) {
+	std::fill(p->data, p->data + 16, (char)n);
+      }
+      range.clear();
+    }
+    done = true;
+  });
+
+  // readers always see a consistent prefix of the pages
+  PageSet::page_vector range;
+  while (!done) {
+    pages.get_range(0, 200 * 16, range);
+    ASSERT_LE(range.size(), 200u);
+    for (size_t i = 0; i < range.size(); ++i) {
+      ASSERT_EQ(i * 16, range[i]->offset);
+    }
+    range.clear();
+  }
+  writer.join();
+
+  pages.get_range(0, 200 * 16, range);
+  ASSERT_EQ(200u, range.size());
+  for (auto& p : range) {
+    ASSERT_EQ((char)200, p->data[15]);
+  }
+}